@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2013 strongSwan Project
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include <library.h>
+#include <bus/bus.h>
+#include <threading/thread.h>
+
+static void usage()
+{
+	printf("usage: bus_speed listeners events max-threads\n");
+	exit(1);
+}
+
+/**
+ * Bus to dispatch events to
+ */
+static bus_t *bus;
+
+/**
+ * Number of events each thread dispatches
+ */
+static int events;
+
+METHOD(listener_t, ike_state_change, bool,
+	listener_t *this, ike_sa_t *ike_sa, ike_sa_state_t state)
+{
+	return TRUE;
+}
+
+METHOD(listener_t, child_state_change, bool,
+	listener_t *this, ike_sa_t *ike_sa, child_sa_t *child_sa,
+	child_sa_state_t state)
+{
+	return TRUE;
+}
+
+static void *dispatch(void *arg)
+{
+	int i;
+
+	for (i = 0; i < events; i++)
+	{
+		if (i % 2)
+		{
+			bus->ike_state_change(bus, NULL, IKE_ESTABLISHED);
+		}
+		else
+		{
+			bus->child_state_change(bus, NULL, CHILD_INSTALLED);
+		}
+	}
+	return NULL;
+}
+
+static void start_timing(struct timespec *start)
+{
+	clock_gettime(CLOCK_MONOTONIC, start);
+}
+
+static double end_timing(struct timespec *start)
+{
+	struct timespec end;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_nsec - start->tv_nsec) / 1000000000.0 +
+			(end.tv_sec - start->tv_sec) * 1.0;
+}
+
+static void run_test(int count)
+{
+	thread_t *threads[count];
+	struct timespec timing;
+	double elapsed;
+	int i;
+
+	start_timing(&timing);
+	for (i = 0; i < count; i++)
+	{
+		threads[i] = thread_create(dispatch, NULL);
+	}
+	for (i = 0; i < count; i++)
+	{
+		threads[i]->join(threads[i]);
+	}
+	elapsed = end_timing(&timing);
+	printf("%3d threads: %12.1f events/s\n", count,
+		   count * events / elapsed);
+}
+
+int main(int argc, char *argv[])
+{
+	listener_t *listeners;
+	int count, threads, i;
+
+	if (argc < 4)
+	{
+		usage();
+	}
+
+	library_init(NULL);
+	atexit(library_deinit);
+
+	count = atoi(argv[1]);
+	events = atoi(argv[2]);
+	threads = atoi(argv[3]);
+
+	bus = bus_create();
+	listeners = calloc(count, sizeof(listener_t));
+	for (i = 0; i < count; i++)
+	{
+		listeners[i].ike_state_change = _ike_state_change;
+		listeners[i].child_state_change = _child_state_change;
+		bus->add_listener(bus, &listeners[i]);
+	}
+
+	for (i = 1; i <= threads; i *= 2)
+	{
+		run_test(i);
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		bus->remove_listener(bus, &listeners[i]);
+	}
+	bus->destroy(bus);
+	free(listeners);
+	return 0;
+}
@@ -0,0 +1,239 @@
+/*
+ * Copyright (C) 2013 strongSwan Project
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+
+#include <library.h>
+#include <ipsec.h>
+#include <threading/mutex.h>
+#include <threading/condvar.h>
+
+static void usage()
+{
+	printf("usage: esp_speed sas packets workers [size]\n");
+	exit(1);
+}
+
+/**
+ * Outer addresses of the SAs, packets are looped back to the inbound SAs
+ */
+static host_t *local, *remote, *loop;
+
+/**
+ * Number of packets delivered by the inbound SAs
+ */
+static u_int delivered = 0;
+
+/**
+ * Lock and condvar to wait for delivered packets
+ */
+static mutex_t *mutex;
+static condvar_t *condvar;
+
+/**
+ * Send outbound ESP packets back to the inbound SA with the same SPI
+ */
+static void outbound_cb(void *data, esp_packet_t *packet)
+{
+	packet->packet.set_destination(&packet->packet, loop->clone(loop));
+	ipsec->processor->queue_inbound(ipsec->processor, packet);
+}
+
+/**
+ * Count decrypted packets
+ */
+static void inbound_cb(void *data, ip_packet_t *packet)
+{
+	packet->destroy(packet);
+	mutex->lock(mutex);
+	delivered++;
+	condvar->signal(condvar);
+	mutex->unlock(mutex);
+}
+
+/**
+ * Install an outbound SA and its looped inbound SA, with policies
+ */
+static bool install(u_int i)
+{
+	traffic_selector_t *src_ts, *dst_ts;
+	lifetime_cfg_t lifetime = {
+		.time = {
+			.life = 3600,
+		},
+	};
+	ipsec_sa_cfg_t sa = {
+		.mode = MODE_TUNNEL,
+		.reqid = i + 1,
+		.esp = {
+			.use = TRUE,
+			.spi = htonl(0x1000 + i),
+		},
+	};
+	mark_t mark = {};
+	char enc[16], integ[20], inner[32];
+	bool success;
+
+	memset(enc, 0x12, sizeof(enc));
+	memset(integ, 0x34, sizeof(integ));
+	snprintf(inner, sizeof(inner), "10.1.%u.%u/32", (i >> 8) & 0xff, i & 0xff);
+	src_ts = traffic_selector_create_from_cidr("10.0.0.1/32", 0, 0, 65535);
+	dst_ts = traffic_selector_create_from_cidr(inner, 0, 0, 65535);
+
+	success =
+		ipsec->sas->add_sa(ipsec->sas, local, remote, sa.esp.spi,
+				IPPROTO_ESP, sa.reqid, mark, 0, &lifetime, ENCR_AES_CBC,
+				chunk_from_thing(enc), AUTH_HMAC_SHA1_96,
+				chunk_from_thing(integ), MODE_TUNNEL, IPCOMP_NONE, 0, TRUE,
+				FALSE, FALSE, src_ts, dst_ts) == SUCCESS &&
+		ipsec->sas->add_sa(ipsec->sas, local, loop, sa.esp.spi,
+				IPPROTO_ESP, sa.reqid, mark, 0, &lifetime, ENCR_AES_CBC,
+				chunk_from_thing(enc), AUTH_HMAC_SHA1_96,
+				chunk_from_thing(integ), MODE_TUNNEL, IPCOMP_NONE, 0, TRUE,
+				FALSE, TRUE, src_ts, dst_ts) == SUCCESS &&
+		ipsec->policies->add_policy(ipsec->policies, local, remote, src_ts,
+				dst_ts, POLICY_OUT, POLICY_IPSEC, &sa, mark,
+				POLICY_PRIORITY_DEFAULT) == SUCCESS &&
+		ipsec->policies->add_policy(ipsec->policies, local, loop, src_ts,
+				dst_ts, POLICY_IN, POLICY_IPSEC, &sa, mark,
+				POLICY_PRIORITY_DEFAULT) == SUCCESS;
+
+	src_ts->destroy(src_ts);
+	dst_ts->destroy(dst_ts);
+	return success;
+}
+
+/**
+ * Create a plaintext packet for the SA with the given index
+ */
+static ip_packet_t *create_packet(u_int i, u_int size)
+{
+	struct ip ip = {
+		.ip_v = 4,
+		.ip_hl = sizeof(struct ip) / 4,
+		.ip_len = htons(size),
+		.ip_ttl = 64,
+		.ip_p = 253,
+		.ip_src.s_addr = htonl(0x0a000001),
+		.ip_dst.s_addr = htonl(0x0a010000 | (i & 0xffff)),
+	};
+	chunk_t data;
+
+	/* reserve room for in-place encapsulation, as the TUN readers do */
+	data = chunk_alloc(ESP_PACKET_HEADROOM + size + ESP_PACKET_TAILROOM);
+	memset(data.ptr, 0x56, data.len);
+	memcpy(data.ptr + ESP_PACKET_HEADROOM, &ip, sizeof(ip));
+	return ip_packet_create_from_buffer(data, ESP_PACKET_HEADROOM, size);
+}
+
+static void start_timing(struct timespec *start)
+{
+	clock_gettime(CLOCK_MONOTONIC, start);
+}
+
+static double end_timing(struct timespec *start)
+{
+	struct timespec end;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_nsec - start->tv_nsec) / 1000000000.0 +
+			(end.tv_sec - start->tv_sec) * 1.0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct timespec timing;
+	u_int sas, packets, workers, size = 1400, i, last = 0;
+	double time;
+
+	if (argc < 4)
+	{
+		usage();
+	}
+	sas = atoi(argv[1]);
+	packets = atoi(argv[2]);
+	workers = atoi(argv[3]);
+	if (argc > 4)
+	{
+		size = atoi(argv[4]);
+	}
+	if (!sas || sas > 65536 || !workers || size < sizeof(struct ip))
+	{
+		usage();
+	}
+
+	library_init(NULL);
+	atexit(library_deinit);
+	lib->plugins->load(lib->plugins, NULL, PLUGINS);
+	lib->settings->set_int(lib->settings, "libipsec.workers", workers);
+	if (!libipsec_init())
+	{
+		fprintf(stderr, "initializing libipsec failed!\n");
+		return 1;
+	}
+
+	mutex = mutex_create(MUTEX_TYPE_DEFAULT);
+	condvar = condvar_create(CONDVAR_TYPE_DEFAULT);
+	local = host_create_from_string("192.0.2.1", 4500);
+	remote = host_create_from_string("192.0.2.2", 4500);
+	loop = host_create_from_string("192.0.2.3", 4500);
+
+	for (i = 0; i < sas; i++)
+	{
+		if (!install(i))
+		{
+			fprintf(stderr, "installing SA %u failed!\n", i);
+			return 1;
+		}
+	}
+	ipsec->processor->register_outbound(ipsec->processor, outbound_cb, NULL);
+	ipsec->processor->register_inbound(ipsec->processor, inbound_cb, NULL);
+	/* a thread for each worker per direction, the event relay and scheduler */
+	lib->processor->set_threads(lib->processor, workers * 2 + 2);
+
+	start_timing(&timing);
+	for (i = 0; i < packets; i++)
+	{
+		ipsec->processor->queue_outbound(ipsec->processor,
+										 create_packet(i % sas, size));
+	}
+	mutex->lock(mutex);
+	while (delivered < packets)
+	{
+		if (condvar->timed_wait(condvar, mutex, 1000) && delivered == last)
+		{	/* no progress, packets got lost */
+			break;
+		}
+		last = delivered;
+	}
+	mutex->unlock(mutex);
+	time = end_timing(&timing);
+
+	printf("%u/%u packets of %u bytes over %u SAs with %u workers: "
+		   "%.3fs, %.0f packets/s, %.1f Mbit/s\n", delivered, packets, size,
+		   sas, workers, time, delivered / time,
+		   delivered * size * 8 / time / 1000000.0);
+
+	lib->processor->cancel(lib->processor);
+	libipsec_deinit();
+	local->destroy(local);
+	remote->destroy(remote);
+	loop->destroy(loop);
+	condvar->destroy(condvar);
+	mutex->destroy(mutex);
+	return 0;
+}
@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2013 strongSwan Project
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include <library.h>
+#include <threading/thread.h>
+
+static void usage()
+{
+	printf("usage: rng_speed plugins weak|strong rounds threads [bytes]\n");
+	exit(1);
+}
+
+/**
+ * Quality of the RNG to test
+ */
+static rng_quality_t quality;
+
+/**
+ * Number of get_bytes() calls per thread, and bytes per call
+ */
+static u_int rounds, bytes;
+
+static void start_timing(struct timespec *start)
+{
+	clock_gettime(CLOCK_MONOTONIC, start);
+}
+
+static double end_timing(struct timespec *start)
+{
+	struct timespec end;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_nsec - start->tv_nsec) / 1000000000.0 +
+			(end.tv_sec - start->tv_sec) * 1.0;
+}
+
+/**
+ * Request random bytes from a thread specific RNG instance
+ */
+static void *run_test(void *arg)
+{
+	u_int8_t buf[bytes];
+	rng_t *rng;
+	u_int i;
+
+	rng = lib->crypto->create_rng(lib->crypto, quality);
+	if (!rng)
+	{
+		return (void*)FALSE;
+	}
+	for (i = 0; i < rounds; i++)
+	{
+		if (!rng->get_bytes(rng, sizeof(buf), buf))
+		{
+			rng->destroy(rng);
+			return (void*)FALSE;
+		}
+	}
+	rng->destroy(rng);
+	return (void*)TRUE;
+}
+
+int main(int argc, char *argv[])
+{
+	struct timespec timing;
+	u_int count, i;
+	bool success = TRUE;
+	double time;
+
+	if (argc < 5)
+	{
+		usage();
+	}
+	if (streq(argv[2], "weak"))
+	{
+		quality = RNG_WEAK;
+	}
+	else if (streq(argv[2], "strong"))
+	{
+		quality = RNG_STRONG;
+	}
+	else
+	{
+		usage();
+	}
+	rounds = atoi(argv[3]);
+	count = atoi(argv[4]);
+	bytes = argc > 5 ? atoi(argv[5]) : 16;
+	if (!rounds || !count || !bytes)
+	{
+		usage();
+	}
+
+	library_init(NULL);
+	lib->plugins->load(lib->plugins, NULL, argv[1]);
+	atexit(library_deinit);
+
+	{
+		thread_t *threads[count];
+
+		start_timing(&timing);
+		for (i = 0; i < count; i++)
+		{
+			threads[i] = thread_create(run_test, NULL);
+		}
+		for (i = 0; i < count; i++)
+		{
+			success = threads[i]->join(threads[i]) && success;
+		}
+		time = end_timing(&timing);
+	}
+	if (!success)
+	{
+		printf("%N RNG failed\n", rng_quality_names, quality);
+		return 1;
+	}
+	printf("%N RNG, %u threads, %u bytes: %.0f ops/s\n", rng_quality_names,
+		   quality, count, bytes, rounds * count / time);
+	return 0;
+}
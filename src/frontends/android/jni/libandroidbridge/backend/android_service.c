@@ -179,17 +179,18 @@ static job_requeue_t handle_plain(private_android_service_t *this)
 		return JOB_REQUEUE_DIRECT;
 	}
 
-	raw = chunk_alloc(TUN_DEFAULT_MTU);
-	len = read(tunfd, raw.ptr, raw.len);
+	/* reserve room so libipsec can encapsulate the packet in place */
+	raw = chunk_alloc(ESP_PACKET_HEADROOM + TUN_DEFAULT_MTU +
+					  ESP_PACKET_TAILROOM);
+	len = read(tunfd, raw.ptr + ESP_PACKET_HEADROOM, TUN_DEFAULT_MTU);
 	if (len < 0)
 	{
 		DBG1(DBG_DMN, "reading from TUN device failed: %s", strerror(errno));
 		chunk_free(&raw);
 		return JOB_REQUEUE_FAIR;
 	}
-	raw.len = len;
 
-	packet = ip_packet_create(raw);
+	packet = ip_packet_create_from_buffer(raw, ESP_PACKET_HEADROOM, len);
 	if (packet)
 	{
 		ipsec->processor->queue_outbound(ipsec->processor, packet);
@@ -12,6 +12,7 @@ config/backend_manager.c config/backend_manager.h config/backend.h \
 config/child_cfg.c config/child_cfg.h \
 config/ike_cfg.c config/ike_cfg.h \
 config/peer_cfg.c config/peer_cfg.h \
+config/peer_cfg_index.c config/peer_cfg_index.h \
 config/proposal.c config/proposal.h \
 control/controller.c control/controller.h \
 daemon.c daemon.h \
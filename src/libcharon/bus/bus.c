@@ -21,9 +21,17 @@
 #include <threading/thread.h>
 #include <threading/thread_value.h>
 #include <threading/mutex.h>
+#include <threading/condvar.h>
 #include <threading/rwlock.h>
 
+/**
+ * Interval in ms to recheck for threads calling a listener while unregistering
+ * it, in case we missed a signal
+ */
+#define REMOVE_RECHECK_INTERVAL 10
+
 typedef struct private_bus_t private_bus_t;
+typedef struct listeners_t listeners_t;
 
 /**
  * Private data of a bus_t object.
@@ -35,9 +43,9 @@ struct private_bus_t {
 	bus_t public;
 
 	/**
-	 * List of registered listeners as entry_t.
+	 * Current snapshot of registered listeners.
 	 */
-	linked_list_t *listeners;
+	listeners_t *volatile listeners;
 
 	/**
 	 * List of registered loggers for each log group as log_entry_t.
@@ -58,10 +66,30 @@ struct private_bus_t {
 	level_t max_vlevel[DBG_MAX + 1];
 
 	/**
-	 * Mutex for the list of listeners, recursively.
+	 * Mutex to replace the snapshot of listeners and for the list of threads
 	 */
 	mutex_t *mutex;
 
+	/**
+	 * Condvar to wait for threads calling an unregistered listener
+	 */
+	condvar_t *condvar;
+
+	/**
+	 * Number of threads waiting in remove_listener()
+	 */
+	volatile u_int waiting;
+
+	/**
+	 * States of all threads that dispatched events, as thread_state_t
+	 */
+	linked_list_t *threads;
+
+	/**
+	 * Thread local storage of the dispatching state, as thread_state_t
+	 */
+	thread_value_t *thread_state;
+
 	/**
 	 * Read-write lock for the list of loggers.
 	 */
@@ -86,10 +114,81 @@ struct entry_t {
 	listener_t *listener;
 
 	/**
-	 * are we currently calling this listener
+	 * has the listener been unregistered
+	 */
+	volatile bool removed;
+
+	/**
+	 * number of snapshots referencing this entry
+	 */
+	refcount_t refs;
+
+	/**
+	 * number of threads currently calling the listener
+	 */
+	refcount_t calls;
+};
+
+/**
+ * An immutable snapshot of registered listeners.
+ *
+ * Event hooks use the snapshot without holding any locks, registering and
+ * unregistering listeners replaces the snapshot.
+ */
+struct listeners_t {
+
+	/**
+	 * number of threads and the bus referencing this snapshot
 	 */
-	int calling;
+	refcount_t refs;
 
+	/**
+	 * number of entries
+	 */
+	int count;
+
+	/**
+	 * registered listener entries, in order of registration
+	 */
+	entry_t *entries[];
+};
+
+typedef struct thread_state_t thread_state_t;
+
+/**
+ * Per-thread state of event dispatching
+ */
+struct thread_state_t {
+
+	/**
+	 * bus this state belongs to
+	 */
+	private_bus_t *bus;
+
+	/**
+	 * snapshot of listeners used by this thread
+	 */
+	listeners_t *listeners;
+
+	/**
+	 * nesting level of events currently dispatched by this thread
+	 */
+	u_int depth;
+
+	/**
+	 * entries this thread currently calls, to prevent recursive invocations
+	 */
+	entry_t **calling;
+
+	/**
+	 * number of entries in calling
+	 */
+	u_int calls;
+
+	/**
+	 * allocated size of calling
+	 */
+	u_int size;
 };
 
 typedef struct log_entry_t log_entry_t;
@@ -111,6 +210,213 @@ struct log_entry_t {
 
 };
 
+/**
+ * Release a reference to a snapshot of listeners
+ */
+static void listeners_release(listeners_t *this)
+{
+	int i;
+
+	if (ref_put(&this->refs))
+	{
+		for (i = 0; i < this->count; i++)
+		{
+			if (ref_put(&this->entries[i]->refs))
+			{
+				free(this->entries[i]);
+			}
+		}
+		free(this);
+	}
+}
+
+/**
+ * Create a new snapshot based on an existing one, adding and/or removing a
+ * single entry
+ */
+static listeners_t *listeners_create(listeners_t *old, entry_t *add,
+									 entry_t *remove)
+{
+	listeners_t *this;
+	int i;
+
+	this = malloc(sizeof(listeners_t) +
+				  sizeof(entry_t*) * (old->count + (add ? 1 : 0)));
+	this->refs = 1;
+	this->count = 0;
+	for (i = 0; i < old->count; i++)
+	{
+		if (old->entries[i] != remove)
+		{
+			this->entries[this->count++] = old->entries[i];
+			ref_get(&old->entries[i]->refs);
+		}
+	}
+	if (add)
+	{
+		this->entries[this->count++] = add;
+		ref_get(&add->refs);
+	}
+	return this;
+}
+
+/**
+ * Replace the current snapshot of listeners, this->mutex must be held
+ */
+static void replace_listeners(private_bus_t *this, entry_t *add,
+							  entry_t *remove)
+{
+	listeners_t *old;
+
+	old = this->listeners;
+	this->listeners = listeners_create(old, add, remove);
+	listeners_release(old);
+}
+
+/**
+ * Destroy the dispatching state of a thread, this->mutex must be held
+ */
+static void thread_state_destroy(thread_state_t *state)
+{
+	if (state->listeners)
+	{
+		listeners_release(state->listeners);
+	}
+	free(state->calling);
+	free(state);
+}
+
+/**
+ * Cleanup function for the dispatching state of terminating threads
+ */
+static void thread_state_cleanup(thread_state_t *state)
+{
+	private_bus_t *this = state->bus;
+
+	this->mutex->lock(this->mutex);
+	this->threads->remove(this->threads, state, NULL);
+	thread_state_destroy(state);
+	this->mutex->unlock(this->mutex);
+}
+
+/**
+ * Start dispatching an event in the calling thread.
+ *
+ * For the outermost event the thread switches to the current snapshot of
+ * listeners, nested events reuse the snapshot of the outer event.
+ */
+static thread_state_t *dispatch_start(private_bus_t *this)
+{
+	thread_state_t *state;
+
+	state = this->thread_state->get(this->thread_state);
+	if (!state)
+	{
+		INIT(state,
+			.bus = this,
+		);
+		this->thread_state->set(this->thread_state, state);
+		this->mutex->lock(this->mutex);
+		this->threads->insert_last(this->threads, state);
+		this->mutex->unlock(this->mutex);
+	}
+	if (state->depth++ == 0)
+	{
+		if (state->listeners != this->listeners)
+		{
+			this->mutex->lock(this->mutex);
+			if (state->listeners)
+			{
+				listeners_release(state->listeners);
+			}
+			state->listeners = this->listeners;
+			ref_get(&state->listeners->refs);
+			this->mutex->unlock(this->mutex);
+		}
+	}
+	return state;
+}
+
+/**
+ * Finish dispatching an event in the calling thread
+ */
+static void dispatch_end(private_bus_t *this, thread_state_t *state)
+{
+	state->depth--;
+}
+
+/**
+ * Mark an entry as being called by this thread, if the listener may be
+ * invoked, i.e. it is still registered and not already called by this thread
+ */
+static bool call_start(thread_state_t *state, entry_t *entry)
+{
+	u_int i;
+
+	for (i = 0; i < state->calls; i++)
+	{
+		if (state->calling[i] == entry)
+		{
+			return FALSE;
+		}
+	}
+	ref_get(&entry->calls);
+	/* make our call visible before we check the removal flag, pairs with the
+	 * barrier in remove_listener() */
+	memory_barrier();
+	if (entry->removed)
+	{
+		ignore_result(ref_put(&entry->calls));
+		return FALSE;
+	}
+	if (state->calls == state->size)
+	{
+		state->size = max(4, state->size * 2);
+		state->calling = realloc(state->calling,
+								 sizeof(entry_t*) * state->size);
+	}
+	state->calling[state->calls++] = entry;
+	return TRUE;
+}
+
+/**
+ * Remove the mark of the entry called last by this thread
+ */
+static void call_end(thread_state_t *state, entry_t *entry)
+{
+	private_bus_t *this = state->bus;
+
+	state->calls--;
+	if (ref_put(&entry->calls) && entry->removed && this->waiting)
+	{	/* wake up threads waiting in remove_listener() */
+		this->mutex->lock(this->mutex);
+		this->condvar->broadcast(this->condvar);
+		this->mutex->unlock(this->mutex);
+	}
+}
+
+/**
+ * Wait until no other thread calls the listener of an unregistered entry,
+ * this->mutex must be held
+ */
+static void wait_for_calls(private_bus_t *this, entry_t *entry)
+{
+	bool old;
+
+	old = thread_cancelability(FALSE);
+	this->waiting++;
+	/* make the removal flag visible before we read the number of calls,
+	 * pairs with the barrier in call_start() */
+	memory_barrier();
+	while (entry->calls)
+	{
+		this->condvar->timed_wait(this->condvar, this->mutex,
+								  REMOVE_RECHECK_INTERVAL);
+	}
+	this->waiting--;
+	thread_cancelability(old);
+}
+
 METHOD(bus_t, add_listener, void,
 	private_bus_t *this, listener_t *listener)
 {
@@ -121,28 +427,44 @@ METHOD(bus_t, add_listener, void,
 	);
 
 	this->mutex->lock(this->mutex);
-	this->listeners->insert_last(this->listeners, entry);
+	replace_listeners(this, entry, NULL);
 	this->mutex->unlock(this->mutex);
 }
 
 METHOD(bus_t, remove_listener, void,
 	private_bus_t *this, listener_t *listener)
 {
-	enumerator_t *enumerator;
+	thread_state_t *state;
 	entry_t *entry;
+	int i;
+
+	state = this->thread_state->get(this->thread_state);
 
 	this->mutex->lock(this->mutex);
-	enumerator = this->listeners->create_enumerator(this->listeners);
-	while (enumerator->enumerate(enumerator, &entry))
+	for (i = 0; i < this->listeners->count; i++)
 	{
+		entry = this->listeners->entries[i];
 		if (entry->listener == listener)
 		{
-			this->listeners->remove_at(this->listeners, enumerator);
-			free(entry);
+			entry->removed = TRUE;
+			ref_get(&entry->refs);
+			replace_listeners(this, NULL, entry);
+			/* threads using an older snapshot might still call the listener,
+			 * wait until they are done. We don't wait if we are dispatching an
+			 * event ourselves, i.e. the listener gets unregistered from within
+			 * a listener callback, as the threads calling it might wait for
+			 * resources we hold (or for ourselves removing a listener) */
+			if (!state || !state->depth)
+			{
+				wait_for_calls(this, entry);
+			}
+			if (ref_put(&entry->refs))
+			{
+				free(entry);
+			}
 			break;
 		}
 	}
-	enumerator->destroy(enumerator);
 	this->mutex->unlock(this->mutex);
 }
 
@@ -386,133 +708,133 @@ METHOD(bus_t, log_, void,
 /**
  * unregister a listener
  */
-static inline void unregister_listener(private_bus_t *this, entry_t *entry,
-									   enumerator_t *enumerator)
+static inline void unregister_listener(private_bus_t *this, entry_t *entry)
 {
-	this->listeners->remove_at(this->listeners, enumerator);
-	free(entry);
+	this->mutex->lock(this->mutex);
+	if (!entry->removed)
+	{
+		entry->removed = TRUE;
+		replace_listeners(this, NULL, entry);
+	}
+	this->mutex->unlock(this->mutex);
 }
 
 METHOD(bus_t, alert, void,
 	private_bus_t *this, alert_t alert, ...)
 {
-	enumerator_t *enumerator;
+	thread_state_t *dispatch;
 	ike_sa_t *ike_sa;
 	entry_t *entry;
 	va_list args;
 	bool keep;
+	int i;
 
 	ike_sa = this->thread_sa->get(this->thread_sa);
 
-	this->mutex->lock(this->mutex);
-	enumerator = this->listeners->create_enumerator(this->listeners);
-	while (enumerator->enumerate(enumerator, &entry))
+	dispatch = dispatch_start(this);
+	for (i = 0; i < dispatch->listeners->count; i++)
 	{
-		if (entry->calling || !entry->listener->alert)
+		entry = dispatch->listeners->entries[i];
+		if (!entry->listener->alert || !call_start(dispatch, entry))
 		{
 			continue;
 		}
-		entry->calling++;
 		va_start(args, alert);
 		keep = entry->listener->alert(entry->listener, ike_sa, alert, args);
 		va_end(args);
-		entry->calling--;
+		call_end(dispatch, entry);
 		if (!keep)
 		{
-			unregister_listener(this, entry, enumerator);
+			unregister_listener(this, entry);
 		}
 	}
-	enumerator->destroy(enumerator);
-	this->mutex->unlock(this->mutex);
+	dispatch_end(this, dispatch);
 }
 
 METHOD(bus_t, ike_state_change, void,
 	private_bus_t *this, ike_sa_t *ike_sa, ike_sa_state_t state)
 {
-	enumerator_t *enumerator;
+	thread_state_t *dispatch;
 	entry_t *entry;
 	bool keep;
+	int i;
 
-	this->mutex->lock(this->mutex);
-	enumerator = this->listeners->create_enumerator(this->listeners);
-	while (enumerator->enumerate(enumerator, &entry))
+	dispatch = dispatch_start(this);
+	for (i = 0; i < dispatch->listeners->count; i++)
 	{
-		if (entry->calling || !entry->listener->ike_state_change)
+		entry = dispatch->listeners->entries[i];
+		if (!entry->listener->ike_state_change || !call_start(dispatch, entry))
 		{
 			continue;
 		}
-		entry->calling++;
 		keep = entry->listener->ike_state_change(entry->listener, ike_sa, state);
-		entry->calling--;
+		call_end(dispatch, entry);
 		if (!keep)
 		{
-			unregister_listener(this, entry, enumerator);
+			unregister_listener(this, entry);
 		}
 	}
-	enumerator->destroy(enumerator);
-	this->mutex->unlock(this->mutex);
+	dispatch_end(this, dispatch);
 }
 
 METHOD(bus_t, child_state_change, void,
 	private_bus_t *this, child_sa_t *child_sa, child_sa_state_t state)
 {
-	enumerator_t *enumerator;
+	thread_state_t *dispatch;
 	ike_sa_t *ike_sa;
 	entry_t *entry;
 	bool keep;
+	int i;
 
 	ike_sa = this->thread_sa->get(this->thread_sa);
 
-	this->mutex->lock(this->mutex);
-	enumerator = this->listeners->create_enumerator(this->listeners);
-	while (enumerator->enumerate(enumerator, &entry))
+	dispatch = dispatch_start(this);
+	for (i = 0; i < dispatch->listeners->count; i++)
 	{
-		if (entry->calling || !entry->listener->child_state_change)
+		entry = dispatch->listeners->entries[i];
+		if (!entry->listener->child_state_change || !call_start(dispatch, entry))
 		{
 			continue;
 		}
-		entry->calling++;
 		keep = entry->listener->child_state_change(entry->listener, ike_sa,
 												   child_sa, state);
-		entry->calling--;
+		call_end(dispatch, entry);
 		if (!keep)
 		{
-			unregister_listener(this, entry, enumerator);
+			unregister_listener(this, entry);
 		}
 	}
-	enumerator->destroy(enumerator);
-	this->mutex->unlock(this->mutex);
+	dispatch_end(this, dispatch);
 }
 
 METHOD(bus_t, message, void,
 	private_bus_t *this, message_t *message, bool incoming, bool plain)
 {
-	enumerator_t *enumerator;
+	thread_state_t *dispatch;
 	ike_sa_t *ike_sa;
 	entry_t *entry;
 	bool keep;
+	int i;
 
 	ike_sa = this->thread_sa->get(this->thread_sa);
 
-	this->mutex->lock(this->mutex);
-	enumerator = this->listeners->create_enumerator(this->listeners);
-	while (enumerator->enumerate(enumerator, &entry))
+	dispatch = dispatch_start(this);
+	for (i = 0; i < dispatch->listeners->count; i++)
 	{
-		if (entry->calling || !entry->listener->message)
+		entry = dispatch->listeners->entries[i];
+		if (!entry->listener->message || !call_start(dispatch, entry))
 		{
 			continue;
 		}
-		entry->calling++;
 		keep = entry->listener->message(entry->listener, ike_sa,
 										message, incoming, plain);
-		entry->calling--;
+		call_end(dispatch, entry);
 		if (!keep)
 		{
-			unregister_listener(this, entry, enumerator);
+			unregister_listener(this, entry);
 		}
 	}
-	enumerator->destroy(enumerator);
-	this->mutex->unlock(this->mutex);
+	dispatch_end(this, dispatch);
 }
 
 METHOD(bus_t, ike_keys, void,
@@ -520,150 +842,145 @@ METHOD(bus_t, ike_keys, void,
 	chunk_t dh_other, chunk_t nonce_i, chunk_t nonce_r,
 	ike_sa_t *rekey, shared_key_t *shared)
 {
-	enumerator_t *enumerator;
+	thread_state_t *dispatch;
 	entry_t *entry;
 	bool keep;
+	int i;
 
-	this->mutex->lock(this->mutex);
-	enumerator = this->listeners->create_enumerator(this->listeners);
-	while (enumerator->enumerate(enumerator, &entry))
+	dispatch = dispatch_start(this);
+	for (i = 0; i < dispatch->listeners->count; i++)
 	{
-		if (entry->calling || !entry->listener->ike_keys)
+		entry = dispatch->listeners->entries[i];
+		if (!entry->listener->ike_keys || !call_start(dispatch, entry))
 		{
 			continue;
 		}
-		entry->calling++;
 		keep = entry->listener->ike_keys(entry->listener, ike_sa, dh, dh_other,
 										 nonce_i, nonce_r, rekey, shared);
-		entry->calling--;
+		call_end(dispatch, entry);
 		if (!keep)
 		{
-			unregister_listener(this, entry, enumerator);
+			unregister_listener(this, entry);
 		}
 	}
-	enumerator->destroy(enumerator);
-	this->mutex->unlock(this->mutex);
+	dispatch_end(this, dispatch);
 }
 
 METHOD(bus_t, child_keys, void,
 	private_bus_t *this, child_sa_t *child_sa, bool initiator,
 	diffie_hellman_t *dh, chunk_t nonce_i, chunk_t nonce_r)
 {
-	enumerator_t *enumerator;
+	thread_state_t *dispatch;
 	ike_sa_t *ike_sa;
 	entry_t *entry;
 	bool keep;
+	int i;
 
 	ike_sa = this->thread_sa->get(this->thread_sa);
 
-	this->mutex->lock(this->mutex);
-	enumerator = this->listeners->create_enumerator(this->listeners);
-	while (enumerator->enumerate(enumerator, &entry))
+	dispatch = dispatch_start(this);
+	for (i = 0; i < dispatch->listeners->count; i++)
 	{
-		if (entry->calling || !entry->listener->child_keys)
+		entry = dispatch->listeners->entries[i];
+		if (!entry->listener->child_keys || !call_start(dispatch, entry))
 		{
 			continue;
 		}
-		entry->calling++;
 		keep = entry->listener->child_keys(entry->listener, ike_sa,
 								child_sa, initiator, dh, nonce_i, nonce_r);
-		entry->calling--;
+		call_end(dispatch, entry);
 		if (!keep)
 		{
-			unregister_listener(this, entry, enumerator);
+			unregister_listener(this, entry);
 		}
 	}
-	enumerator->destroy(enumerator);
-	this->mutex->unlock(this->mutex);
+	dispatch_end(this, dispatch);
 }
 
 METHOD(bus_t, child_updown, void,
 	private_bus_t *this, child_sa_t *child_sa, bool up)
 {
-	enumerator_t *enumerator;
+	thread_state_t *dispatch;
 	ike_sa_t *ike_sa;
 	entry_t *entry;
 	bool keep;
+	int i;
 
 	ike_sa = this->thread_sa->get(this->thread_sa);
 
-	this->mutex->lock(this->mutex);
-	enumerator = this->listeners->create_enumerator(this->listeners);
-	while (enumerator->enumerate(enumerator, &entry))
+	dispatch = dispatch_start(this);
+	for (i = 0; i < dispatch->listeners->count; i++)
 	{
-		if (entry->calling || !entry->listener->child_updown)
+		entry = dispatch->listeners->entries[i];
+		if (!entry->listener->child_updown || !call_start(dispatch, entry))
 		{
 			continue;
 		}
-		entry->calling++;
 		keep = entry->listener->child_updown(entry->listener,
 											 ike_sa, child_sa, up);
-		entry->calling--;
+		call_end(dispatch, entry);
 		if (!keep)
 		{
-			unregister_listener(this, entry, enumerator);
+			unregister_listener(this, entry);
 		}
 	}
-	enumerator->destroy(enumerator);
-	this->mutex->unlock(this->mutex);
+	dispatch_end(this, dispatch);
 }
 
 METHOD(bus_t, child_rekey, void,
 	private_bus_t *this, child_sa_t *old, child_sa_t *new)
 {
-	enumerator_t *enumerator;
+	thread_state_t *dispatch;
 	ike_sa_t *ike_sa;
 	entry_t *entry;
 	bool keep;
+	int i;
 
 	ike_sa = this->thread_sa->get(this->thread_sa);
 
-	this->mutex->lock(this->mutex);
-	enumerator = this->listeners->create_enumerator(this->listeners);
-	while (enumerator->enumerate(enumerator, &entry))
+	dispatch = dispatch_start(this);
+	for (i = 0; i < dispatch->listeners->count; i++)
 	{
-		if (entry->calling || !entry->listener->child_rekey)
+		entry = dispatch->listeners->entries[i];
+		if (!entry->listener->child_rekey || !call_start(dispatch, entry))
 		{
 			continue;
 		}
-		entry->calling++;
 		keep = entry->listener->child_rekey(entry->listener, ike_sa,
 											old, new);
-		entry->calling--;
+		call_end(dispatch, entry);
 		if (!keep)
 		{
-			unregister_listener(this, entry, enumerator);
+			unregister_listener(this, entry);
 		}
 	}
-	enumerator->destroy(enumerator);
-	this->mutex->unlock(this->mutex);
+	dispatch_end(this, dispatch);
 }
 
 METHOD(bus_t, ike_updown, void,
 	private_bus_t *this, ike_sa_t *ike_sa, bool up)
 {
-	enumerator_t *enumerator;
+	thread_state_t *dispatch;
 	entry_t *entry;
 	bool keep;
+	int i;
 
-	this->mutex->lock(this->mutex);
-	enumerator = this->listeners->create_enumerator(this->listeners);
-	while (enumerator->enumerate(enumerator, &entry))
+	dispatch = dispatch_start(this);
+	for (i = 0; i < dispatch->listeners->count; i++)
 	{
-		if (entry->calling || !entry->listener->ike_updown)
+		entry = dispatch->listeners->entries[i];
+		if (!entry->listener->ike_updown || !call_start(dispatch, entry))
 		{
 			continue;
 		}
-		entry->calling++;
 		keep = entry->listener->ike_updown(entry->listener, ike_sa, up);
-		entry->calling--;
+		call_end(dispatch, entry);
 		if (!keep)
 		{
-			unregister_listener(this, entry, enumerator);
+			unregister_listener(this, entry);
 		}
 	}
-	enumerator->destroy(enumerator);
-	this->mutex->unlock(this->mutex);
+	dispatch_end(this, dispatch);
 
 	/* a down event for IKE_SA implicitly downs all CHILD_SAs */
 	if (!up)
@@ -683,90 +1000,87 @@ METHOD(bus_t, ike_updown, void,
 METHOD(bus_t, ike_rekey, void,
 	private_bus_t *this, ike_sa_t *old, ike_sa_t *new)
 {
-	enumerator_t *enumerator;
+	thread_state_t *dispatch;
 	entry_t *entry;
 	bool keep;
+	int i;
 
-	this->mutex->lock(this->mutex);
-	enumerator = this->listeners->create_enumerator(this->listeners);
-	while (enumerator->enumerate(enumerator, &entry))
+	dispatch = dispatch_start(this);
+	for (i = 0; i < dispatch->listeners->count; i++)
 	{
-		if (entry->calling || !entry->listener->ike_rekey)
+		entry = dispatch->listeners->entries[i];
+		if (!entry->listener->ike_rekey || !call_start(dispatch, entry))
 		{
 			continue;
 		}
-		entry->calling++;
 		keep = entry->listener->ike_rekey(entry->listener, old, new);
-		entry->calling--;
+		call_end(dispatch, entry);
 		if (!keep)
 		{
-			unregister_listener(this, entry, enumerator);
+			unregister_listener(this, entry);
 		}
 	}
-	enumerator->destroy(enumerator);
-	this->mutex->unlock(this->mutex);
+	dispatch_end(this, dispatch);
 }
 
 METHOD(bus_t, ike_reestablish, void,
 	private_bus_t *this, ike_sa_t *old, ike_sa_t *new)
 {
-	enumerator_t *enumerator;
+	thread_state_t *dispatch;
 	entry_t *entry;
 	bool keep;
+	int i;
 
-	this->mutex->lock(this->mutex);
-	enumerator = this->listeners->create_enumerator(this->listeners);
-	while (enumerator->enumerate(enumerator, &entry))
+	dispatch = dispatch_start(this);
+	for (i = 0; i < dispatch->listeners->count; i++)
 	{
-		if (entry->calling || !entry->listener->ike_reestablish)
+		entry = dispatch->listeners->entries[i];
+		if (!entry->listener->ike_reestablish || !call_start(dispatch, entry))
 		{
 			continue;
 		}
-		entry->calling++;
 		keep = entry->listener->ike_reestablish(entry->listener, old, new);
-		entry->calling--;
+		call_end(dispatch, entry);
 		if (!keep)
 		{
-			unregister_listener(this, entry, enumerator);
+			unregister_listener(this, entry);
 		}
 	}
-	enumerator->destroy(enumerator);
-	this->mutex->unlock(this->mutex);
+	dispatch_end(this, dispatch);
 }
 
 METHOD(bus_t, authorize, bool,
 	private_bus_t *this, bool final)
 {
-	enumerator_t *enumerator;
+	thread_state_t *dispatch;
 	ike_sa_t *ike_sa;
 	entry_t *entry;
 	bool keep, success = TRUE;
+	int i;
 
 	ike_sa = this->thread_sa->get(this->thread_sa);
 
-	this->mutex->lock(this->mutex);
-	enumerator = this->listeners->create_enumerator(this->listeners);
-	while (enumerator->enumerate(enumerator, &entry))
+	dispatch = dispatch_start(this);
+	for (i = 0; i < dispatch->listeners->count; i++)
 	{
-		if (entry->calling || !entry->listener->authorize)
+		entry = dispatch->listeners->entries[i];
+		if (!entry->listener->authorize || !call_start(dispatch, entry))
 		{
 			continue;
 		}
-		entry->calling++;
 		keep = entry->listener->authorize(entry->listener, ike_sa,
 										  final, &success);
-		entry->calling--;
+		call_end(dispatch, entry);
 		if (!keep)
 		{
-			unregister_listener(this, entry, enumerator);
+			unregister_listener(this, entry);
 		}
 		if (!success)
 		{
 			break;
 		}
 	}
-	enumerator->destroy(enumerator);
-	this->mutex->unlock(this->mutex);
+	dispatch_end(this, dispatch);
 	if (!success)
 	{
 		alert(this, ALERT_AUTHORIZATION_FAILED);
@@ -778,59 +1092,57 @@ METHOD(bus_t, narrow, void,
 	private_bus_t *this, child_sa_t *child_sa, narrow_hook_t type,
 	linked_list_t *local, linked_list_t *remote)
 {
-	enumerator_t *enumerator;
+	thread_state_t *dispatch;
 	ike_sa_t *ike_sa;
 	entry_t *entry;
 	bool keep;
+	int i;
 
 	ike_sa = this->thread_sa->get(this->thread_sa);
 
-	this->mutex->lock(this->mutex);
-	enumerator = this->listeners->create_enumerator(this->listeners);
-	while (enumerator->enumerate(enumerator, &entry))
+	dispatch = dispatch_start(this);
+	for (i = 0; i < dispatch->listeners->count; i++)
 	{
-		if (entry->calling || !entry->listener->narrow)
+		entry = dispatch->listeners->entries[i];
+		if (!entry->listener->narrow || !call_start(dispatch, entry))
 		{
 			continue;
 		}
-		entry->calling++;
 		keep = entry->listener->narrow(entry->listener, ike_sa, child_sa,
 									   type, local, remote);
-		entry->calling--;
+		call_end(dispatch, entry);
 		if (!keep)
 		{
-			unregister_listener(this, entry, enumerator);
+			unregister_listener(this, entry);
 		}
 	}
-	enumerator->destroy(enumerator);
-	this->mutex->unlock(this->mutex);
+	dispatch_end(this, dispatch);
 }
 
 METHOD(bus_t, assign_vips, void,
 	private_bus_t *this, ike_sa_t *ike_sa, bool assign)
 {
-	enumerator_t *enumerator;
+	thread_state_t *dispatch;
 	entry_t *entry;
 	bool keep;
+	int i;
 
-	this->mutex->lock(this->mutex);
-	enumerator = this->listeners->create_enumerator(this->listeners);
-	while (enumerator->enumerate(enumerator, &entry))
+	dispatch = dispatch_start(this);
+	for (i = 0; i < dispatch->listeners->count; i++)
 	{
-		if (entry->calling || !entry->listener->assign_vips)
+		entry = dispatch->listeners->entries[i];
+		if (!entry->listener->assign_vips || !call_start(dispatch, entry))
 		{
 			continue;
 		}
-		entry->calling++;
 		keep = entry->listener->assign_vips(entry->listener, ike_sa, assign);
-		entry->calling--;
+		call_end(dispatch, entry);
 		if (!keep)
 		{
-			unregister_listener(this, entry, enumerator);
+			unregister_listener(this, entry);
 		}
 	}
-	enumerator->destroy(enumerator);
-	this->mutex->unlock(this->mutex);
+	dispatch_end(this, dispatch);
 }
 
 METHOD(bus_t, destroy, void,
@@ -843,9 +1155,14 @@ METHOD(bus_t, destroy, void,
 	}
 	this->loggers[DBG_MAX]->destroy_function(this->loggers[DBG_MAX],
 											 (void*)free);
-	this->listeners->destroy_function(this->listeners, (void*)free);
+	/* pthread_key_delete() does not invoke cleanup functions for other threads,
+	 * so destroy the states of threads still alive explicitly */
+	this->thread_state->destroy(this->thread_state);
+	this->threads->destroy_function(this->threads, (void*)thread_state_destroy);
+	listeners_release(this->listeners);
 	this->thread_sa->destroy(this->thread_sa);
 	this->log_lock->destroy(this->log_lock);
+	this->condvar->destroy(this->condvar);
 	this->mutex->destroy(this->mutex);
 	free(this);
 }
@@ -884,12 +1201,18 @@ bus_t *bus_create()
 			.assign_vips = _assign_vips,
 			.destroy = _destroy,
 		},
-		.listeners = linked_list_create(),
-		.mutex = mutex_create(MUTEX_TYPE_RECURSIVE),
+		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
+		.condvar = condvar_create(CONDVAR_TYPE_DEFAULT),
+		.threads = linked_list_create(),
+		.thread_state = thread_value_create((void*)thread_state_cleanup),
 		.log_lock = rwlock_create(RWLOCK_TYPE_DEFAULT),
 		.thread_sa = thread_value_create(NULL),
 	);
 
+	INIT(this->listeners,
+		.refs = 1,
+	);
+
 	for (group = 0; group <= DBG_MAX; group++)
 	{
 		this->loggers[group] = linked_list_create();
@@ -173,7 +173,10 @@ struct bus_t {
 	 *
 	 * A registered listener receives all events which are sent to the bus.
 	 * The listener is passive; the thread which emitted the event
-	 * processes the listener routine.
+	 * processes the listener routine.  Events are dispatched without holding
+	 * a lock, so the listener routines may be called concurrently by multiple
+	 * threads.  Recursive calls of a listener by the same thread are
+	 * prevented.
 	 *
 	 * @param listener	listener to register.
 	 */
@@ -182,6 +185,12 @@ struct bus_t {
 	/**
 	 * Unregister a listener from the bus.
 	 *
+	 * Waits until other threads currently calling the listener returned from
+	 * it, so the listener is not called anymore after this call returns.
+	 * If the listener is unregistered from within a listener callback, i.e.
+	 * while the calling thread dispatches an event, this does not wait, and
+	 * other threads might still be executing the listener.
+	 *
 	 * @param listener	listener to unregister.
 	 */
 	void (*remove_listener) (bus_t *this, listener_t *listener);
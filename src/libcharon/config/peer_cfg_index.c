@@ -0,0 +1,511 @@
+/*
+ * Copyright (C) 2013 strongSwan Project
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include "peer_cfg_index.h"
+
+#include <collections/hashtable.h>
+#include <collections/linked_list.h>
+
+typedef struct private_peer_cfg_index_t private_peer_cfg_index_t;
+typedef struct index_t index_t;
+typedef struct entry_t entry_t;
+
+/**
+ * Properties we index
+ */
+enum {
+	INDEX_LOCAL_ID,
+	INDEX_REMOTE_ID,
+	INDEX_LOCAL_HOST,
+	INDEX_REMOTE_HOST,
+	INDEX_MAX,
+};
+
+/**
+ * Index over one property of the peer configs
+ */
+struct index_t {
+
+	/**
+	 * Lists of entry_t in insertion order, by hash of the property
+	 */
+	hashtable_t *buckets;
+
+	/**
+	 * Entries matching any value of the property, in insertion order
+	 */
+	linked_list_t *wildcards;
+};
+
+/**
+ * An indexed peer config
+ */
+struct entry_t {
+
+	/**
+	 * The peer config
+	 */
+	peer_cfg_t *cfg;
+
+	/**
+	 * Insertion sequence number
+	 */
+	u_int seq;
+
+	/**
+	 * Hashes of local/remote identity and address, if not a wildcard
+	 */
+	u_int32_t hash[INDEX_MAX];
+
+	/**
+	 * Which of the hashes are wildcards
+	 */
+	bool wildcard[INDEX_MAX];
+};
+
+/**
+ * Private data of an peer_cfg_index_t object.
+ */
+struct private_peer_cfg_index_t {
+
+	/**
+	 * Public peer_cfg_index_t interface.
+	 */
+	peer_cfg_index_t public;
+
+	/**
+	 * All entries, in insertion order
+	 */
+	linked_list_t *entries;
+
+	/**
+	 * Indices, by property
+	 */
+	index_t index[INDEX_MAX];
+
+	/**
+	 * Next insertion sequence number
+	 */
+	u_int seq;
+};
+
+/**
+ * Hashtable hash function, the key is the hash itself
+ */
+static u_int hash_key(void *key)
+{
+	return (uintptr_t)key;
+}
+
+/**
+ * Hashtable equals function
+ */
+static bool equals_key(void *a, void *b)
+{
+	return a == b;
+}
+
+/**
+ * Get the hash of the identity of the first auth config, FALSE if wildcard
+ */
+static bool hash_cfg_id(peer_cfg_t *cfg, bool local, u_int32_t *hash)
+{
+	enumerator_t *enumerator;
+	identification_t *id = NULL;
+	auth_cfg_t *auth;
+
+	enumerator = cfg->create_auth_cfg_enumerator(cfg, local);
+	if (enumerator->enumerate(enumerator, &auth))
+	{
+		id = auth->get(auth, AUTH_RULE_IDENTITY);
+	}
+	enumerator->destroy(enumerator);
+
+	if (!id || id->contains_wildcards(id))
+	{
+		return FALSE;
+	}
+	*hash = id->hash(id, 0);
+	return TRUE;
+}
+
+/**
+ * Get the hash of an ike_cfg address, FALSE if it matches any host
+ */
+static bool hash_cfg_host(ike_cfg_t *ike_cfg, bool local, u_int32_t *hash)
+{
+	host_t *host;
+	bool allow_any;
+	char *addr;
+
+	if (local)
+	{
+		addr = ike_cfg->get_my_addr(ike_cfg, &allow_any);
+	}
+	else
+	{
+		addr = ike_cfg->get_other_addr(ike_cfg, &allow_any);
+	}
+	if (allow_any)
+	{
+		return FALSE;
+	}
+	/* DNS names get resolved during matching, we can't index them */
+	host = host_create_from_string(addr, 0);
+	if (!host)
+	{
+		return FALSE;
+	}
+	if (host->is_anyaddr(host))
+	{
+		host->destroy(host);
+		return FALSE;
+	}
+	*hash = chunk_hash(host->get_address(host));
+	host->destroy(host);
+	return TRUE;
+}
+
+/**
+ * Add an entry to an index
+ */
+static void index_add(index_t *index, entry_t *entry, int i)
+{
+	linked_list_t *list;
+	void *key;
+
+	if (entry->wildcard[i])
+	{
+		index->wildcards->insert_last(index->wildcards, entry);
+		return;
+	}
+	key = (void*)(uintptr_t)entry->hash[i];
+	list = index->buckets->get(index->buckets, key);
+	if (!list)
+	{
+		list = linked_list_create();
+		index->buckets->put(index->buckets, key, list);
+	}
+	list->insert_last(list, entry);
+}
+
+/**
+ * Remove an entry from an index
+ */
+static void index_remove(index_t *index, entry_t *entry, int i)
+{
+	linked_list_t *list;
+	void *key;
+
+	if (entry->wildcard[i])
+	{
+		index->wildcards->remove(index->wildcards, entry, NULL);
+		return;
+	}
+	key = (void*)(uintptr_t)entry->hash[i];
+	list = index->buckets->get(index->buckets, key);
+	if (list)
+	{
+		list->remove(list, entry, NULL);
+		if (list->get_count(list) == 0)
+		{
+			index->buckets->remove(index->buckets, key);
+			list->destroy(list);
+		}
+	}
+}
+
+/**
+ * Get the bucket for a hash and the number of candidates in an index
+ */
+static u_int index_lookup(index_t *index, u_int32_t hash, linked_list_t **list)
+{
+	u_int count;
+
+	count = index->wildcards->get_count(index->wildcards);
+	*list = index->buckets->get(index->buckets, (void*)(uintptr_t)hash);
+	if (*list)
+	{
+		count += (*list)->get_count(*list);
+	}
+	return count;
+}
+
+METHOD(peer_cfg_index_t, add, void,
+	private_peer_cfg_index_t *this, peer_cfg_t *cfg)
+{
+	entry_t *entry;
+	ike_cfg_t *ike_cfg;
+	int i;
+
+	ike_cfg = cfg->get_ike_cfg(cfg);
+	INIT(entry,
+		.cfg = cfg->get_ref(cfg),
+		.seq = this->seq++,
+	);
+	entry->wildcard[INDEX_LOCAL_ID] = !hash_cfg_id(cfg, TRUE,
+										&entry->hash[INDEX_LOCAL_ID]);
+	entry->wildcard[INDEX_REMOTE_ID] = !hash_cfg_id(cfg, FALSE,
+										&entry->hash[INDEX_REMOTE_ID]);
+	entry->wildcard[INDEX_LOCAL_HOST] = !hash_cfg_host(ike_cfg, TRUE,
+										&entry->hash[INDEX_LOCAL_HOST]);
+	entry->wildcard[INDEX_REMOTE_HOST] = !hash_cfg_host(ike_cfg, FALSE,
+										&entry->hash[INDEX_REMOTE_HOST]);
+
+	this->entries->insert_last(this->entries, entry);
+	for (i = 0; i < INDEX_MAX; i++)
+	{
+		index_add(&this->index[i], entry, i);
+	}
+}
+
+METHOD(peer_cfg_index_t, remove_, bool,
+	private_peer_cfg_index_t *this, peer_cfg_t *cfg)
+{
+	enumerator_t *enumerator;
+	entry_t *entry, *found = NULL;
+	int i;
+
+	enumerator = this->entries->create_enumerator(this->entries);
+	while (enumerator->enumerate(enumerator, &entry))
+	{
+		if (entry->cfg == cfg)
+		{
+			this->entries->remove_at(this->entries, enumerator);
+			found = entry;
+			break;
+		}
+	}
+	enumerator->destroy(enumerator);
+
+	if (!found)
+	{
+		return FALSE;
+	}
+	for (i = 0; i < INDEX_MAX; i++)
+	{
+		index_remove(&this->index[i], found, i);
+	}
+	found->cfg->destroy(found->cfg);
+	free(found);
+	return TRUE;
+}
+
+/**
+ * Enumerator merging a bucket and the wildcards of an index
+ */
+typedef struct {
+	/** implements enumerator_t */
+	enumerator_t public;
+	/** enumerator over bucket, if any */
+	enumerator_t *bucket;
+	/** enumerator over wildcards, or all entries */
+	enumerator_t *wildcards;
+	/** next entry of bucket */
+	entry_t *next_bucket;
+	/** next entry of wildcards */
+	entry_t *next_wildcard;
+} merge_enumerator_t;
+
+/**
+ * Fetch the next entry of an inner enumerator, if any
+ */
+static entry_t* fetch(enumerator_t *enumerator)
+{
+	entry_t *entry;
+
+	if (enumerator && enumerator->enumerate(enumerator, &entry))
+	{
+		return entry;
+	}
+	return NULL;
+}
+
+METHOD(enumerator_t, merge_enumerate, bool,
+	merge_enumerator_t *this, peer_cfg_t **cfg)
+{
+	entry_t *entry;
+
+	if (this->next_bucket && (!this->next_wildcard ||
+		this->next_bucket->seq < this->next_wildcard->seq))
+	{
+		entry = this->next_bucket;
+		this->next_bucket = fetch(this->bucket);
+	}
+	else if (this->next_wildcard)
+	{
+		entry = this->next_wildcard;
+		this->next_wildcard = fetch(this->wildcards);
+	}
+	else
+	{
+		return FALSE;
+	}
+	*cfg = entry->cfg;
+	return TRUE;
+}
+
+METHOD(enumerator_t, merge_destroy, void,
+	merge_enumerator_t *this)
+{
+	DESTROY_IF(this->bucket);
+	this->wildcards->destroy(this->wildcards);
+	free(this);
+}
+
+/**
+ * Create an enumerator merging a bucket with wildcards, in insertion order
+ */
+static enumerator_t* create_merge_enumerator(linked_list_t *bucket,
+											 linked_list_t *wildcards)
+{
+	merge_enumerator_t *this;
+
+	INIT(this,
+		.public = {
+			.enumerate = (void*)_merge_enumerate,
+			.destroy = _merge_destroy,
+		},
+		.wildcards = wildcards->create_enumerator(wildcards),
+	);
+	if (bucket)
+	{
+		this->bucket = bucket->create_enumerator(bucket);
+	}
+	this->next_bucket = fetch(this->bucket);
+	this->next_wildcard = fetch(this->wildcards);
+	return &this->public;
+}
+
+/**
+ * Create an enumerator over the smaller candidate set of two indices
+ */
+static enumerator_t* create_enumerator(private_peer_cfg_index_t *this,
+									   int local, bool use_local,
+									   u_int32_t local_hash, int remote,
+									   bool use_remote, u_int32_t remote_hash)
+{
+	linked_list_t *local_list = NULL, *remote_list = NULL;
+	u_int local_count = 0, remote_count = 0;
+
+	if (use_local)
+	{
+		local_count = index_lookup(&this->index[local], local_hash,
+								   &local_list);
+	}
+	if (use_remote)
+	{
+		remote_count = index_lookup(&this->index[remote], remote_hash,
+									&remote_list);
+	}
+	if (use_remote && (!use_local || remote_count <= local_count))
+	{
+		return create_merge_enumerator(remote_list,
+									   this->index[remote].wildcards);
+	}
+	if (use_local)
+	{
+		return create_merge_enumerator(local_list,
+									   this->index[local].wildcards);
+	}
+	/* nothing to look up, use the list of all entries */
+	return create_merge_enumerator(NULL, this->entries);
+}
+
+METHOD(peer_cfg_index_t, create_id_enumerator, enumerator_t*,
+	private_peer_cfg_index_t *this, identification_t *me,
+	identification_t *other)
+{
+	bool use_me, use_other;
+
+	/* identities with wildcards might match any config */
+	use_me = me && !me->contains_wildcards(me);
+	use_other = other && !other->contains_wildcards(other);
+
+	return create_enumerator(this,
+						INDEX_LOCAL_ID, use_me, use_me ? me->hash(me, 0) : 0,
+						INDEX_REMOTE_ID, use_other, use_other ? other->hash(other, 0) : 0);
+}
+
+METHOD(peer_cfg_index_t, create_host_enumerator, enumerator_t*,
+	private_peer_cfg_index_t *this, host_t *me, host_t *other)
+{
+	bool use_me, use_other;
+
+	use_me = me && !me->is_anyaddr(me);
+	use_other = other && !other->is_anyaddr(other);
+
+	return create_enumerator(this,
+			INDEX_LOCAL_HOST, use_me,
+			use_me ? chunk_hash(me->get_address(me)) : 0,
+			INDEX_REMOTE_HOST, use_other,
+			use_other ? chunk_hash(other->get_address(other)) : 0);
+}
+
+METHOD(peer_cfg_index_t, destroy, void,
+	private_peer_cfg_index_t *this)
+{
+	enumerator_t *enumerator;
+	linked_list_t *list;
+	entry_t *entry;
+	void *key;
+	int i;
+
+	for (i = 0; i < INDEX_MAX; i++)
+	{
+		enumerator = this->index[i].buckets->create_enumerator(
+													this->index[i].buckets);
+		while (enumerator->enumerate(enumerator, &key, &list))
+		{
+			list->destroy(list);
+		}
+		enumerator->destroy(enumerator);
+		this->index[i].buckets->destroy(this->index[i].buckets);
+		this->index[i].wildcards->destroy(this->index[i].wildcards);
+	}
+	while (this->entries->remove_last(this->entries, (void**)&entry) == SUCCESS)
+	{
+		entry->cfg->destroy(entry->cfg);
+		free(entry);
+	}
+	this->entries->destroy(this->entries);
+	free(this);
+}
+
+/**
+ * See header
+ */
+peer_cfg_index_t *peer_cfg_index_create()
+{
+	private_peer_cfg_index_t *this;
+	int i;
+
+	INIT(this,
+		.public = {
+			.add = _add,
+			.remove = _remove_,
+			.create_id_enumerator = _create_id_enumerator,
+			.create_host_enumerator = _create_host_enumerator,
+			.destroy = _destroy,
+		},
+		.entries = linked_list_create(),
+	);
+
+	for (i = 0; i < INDEX_MAX; i++)
+	{
+		this->index[i].buckets = hashtable_create(hash_key, equals_key, 32);
+		this->index[i].wildcards = linked_list_create();
+	}
+	return &this->public;
+}
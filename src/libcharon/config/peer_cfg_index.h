@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2013 strongSwan Project
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/**
+ * @defgroup peer_cfg_index peer_cfg_index
+ * @{ @ingroup config
+ */
+
+#ifndef PEER_CFG_INDEX_H_
+#define PEER_CFG_INDEX_H_
+
+typedef struct peer_cfg_index_t peer_cfg_index_t;
+
+#include <config/peer_cfg.h>
+
+/**
+ * Index over peer configs, usable by backends holding many of them.
+ *
+ * Peer configs are indexed by the identities of their first local and remote
+ * auth_cfg, and by the addresses of their ike_cfg. Configs using wildcard
+ * identities, %any or DNS names for addresses are kept in a separate wildcard
+ * bucket and returned for every lookup. Lookups return a superset of the
+ * configs the backend_manager_t would consider a match, in the order they
+ * have been added, so its match-quality ordering is preserved.
+ *
+ * The index is not thread safe, the backend has to lock it while adding,
+ * removing or enumerating configs.
+ */
+struct peer_cfg_index_t {
+
+	/**
+	 * Add a peer config to the index.
+	 *
+	 * @param cfg		peer config to add, gets referenced
+	 */
+	void (*add)(peer_cfg_index_t *this, peer_cfg_t *cfg);
+
+	/**
+	 * Remove a peer config from the index.
+	 *
+	 * @param cfg		peer config to remove, gets released
+	 * @return			TRUE if config was found and removed
+	 */
+	bool (*remove)(peer_cfg_index_t *this, peer_cfg_t *cfg);
+
+	/**
+	 * Create an enumerator over peer configs possibly matching identities.
+	 *
+	 * Identities may be NULL to match any.
+	 *
+	 * @param me		identity of ourself
+	 * @param other		identity of remote host
+	 * @return			enumerator over peer_cfg_t
+	 */
+	enumerator_t* (*create_id_enumerator)(peer_cfg_index_t *this,
+								identification_t *me, identification_t *other);
+
+	/**
+	 * Create an enumerator over peer configs with an ike_cfg possibly
+	 * matching two hosts.
+	 *
+	 * Hosts may be NULL to match any.
+	 *
+	 * @param me		address of local host
+	 * @param other		address of remote host
+	 * @return			enumerator over peer_cfg_t
+	 */
+	enumerator_t* (*create_host_enumerator)(peer_cfg_index_t *this,
+											host_t *me, host_t *other);
+
+	/**
+	 * Destroy a peer_cfg_index_t, releasing all configs.
+	 */
+	void (*destroy)(peer_cfg_index_t *this);
+};
+
+/**
+ * Create a peer_cfg_index instance.
+ *
+ * @return			peer config index
+ */
+peer_cfg_index_t *peer_cfg_index_create();
+
+#endif /** PEER_CFG_INDEX_H_ @}*/
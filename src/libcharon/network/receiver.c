@@ -69,6 +69,11 @@ struct private_receiver_t {
 	 */
 	mutex_t *esp_cb_mutex;
 
+	/**
+	 * Mutex for cookie secrets and hasher, as we receive in multiple threads
+	 */
+	mutex_t *cookie_mutex;
+
 	/**
 	 * current secret to use for cookie calculation
 	 */
@@ -334,6 +339,7 @@ static bool drop_ike_sa_init(private_receiver_t *this, message_t *message)
 										charon->ike_sa_manager, NULL);
 
 	/* check for cookies in IKEv2 */
+	this->cookie_mutex->lock(this->cookie_mutex);
 	if (message->get_major_version(message) == IKEV2_MAJOR_VERSION &&
 		cookie_required(this, half_open, now) && !check_cookie(this, message))
 	{
@@ -345,6 +351,7 @@ static bool drop_ike_sa_init(private_receiver_t *this, message_t *message)
 		if (!cookie_build(this, message, now - this->secret_offset,
 						  chunk_from_thing(this->secret), &cookie))
 		{
+			this->cookie_mutex->unlock(this->cookie_mutex);
 			return TRUE;
 		}
 		DBG2(DBG_NET, "sending COOKIE notify to %H",
@@ -370,8 +377,10 @@ static bool drop_ike_sa_init(private_receiver_t *this, message_t *message)
 				DBG1(DBG_NET, "failed to allocated cookie secret, keeping old");
 			}
 		}
+		this->cookie_mutex->unlock(this->cookie_mutex);
 		return TRUE;
 	}
+	this->cookie_mutex->unlock(this->cookie_mutex);
 
 	/* check if peer has too many IKE_SAs half open */
 	if (this->block_threshold &&
@@ -614,6 +623,7 @@ METHOD(receiver_t, destroy, void,
 	this->rng->destroy(this->rng);
 	this->hasher->destroy(this->hasher);
 	this->esp_cb_mutex->destroy(this->esp_cb_mutex);
+	this->cookie_mutex->destroy(this->cookie_mutex);
 	free(this);
 }
 
@@ -624,6 +634,7 @@ receiver_t *receiver_create()
 {
 	private_receiver_t *this;
 	u_int32_t now = time_monotonic(NULL);
+	int threads;
 
 	INIT(this,
 		.public = {
@@ -632,6 +643,7 @@ receiver_t *receiver_create()
 			.destroy = _destroy,
 		},
 		.esp_cb_mutex = mutex_create(MUTEX_TYPE_DEFAULT),
+		.cookie_mutex = mutex_create(MUTEX_TYPE_DEFAULT),
 		.secret_switch = now,
 		.secret_offset = random() % now,
 	);
@@ -682,9 +694,15 @@ receiver_t *receiver_create()
 	}
 	memcpy(this->secret_old, this->secret, SECRET_LENGTH);
 
-	lib->processor->queue_job(lib->processor,
-		(job_t*)callback_job_create_with_prio((callback_job_cb_t)receive_packets,
-			this, NULL, (callback_job_cancel_t)return_false, JOB_PRIO_CRITICAL));
+	threads = max(1, lib->settings->get_int(lib->settings,
+				"%s.receive_threads", 1, charon->name));
+	while (threads--)
+	{
+		lib->processor->queue_job(lib->processor,
+			(job_t*)callback_job_create_with_prio(
+				(callback_job_cb_t)receive_packets, this, NULL,
+				(callback_job_cancel_t)return_false, JOB_PRIO_CRITICAL));
+	}
 
 	return &this->public;
 }
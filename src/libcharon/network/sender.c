@@ -27,6 +27,8 @@
 #include <threading/condvar.h>
 #include <threading/mutex.h>
 
+/** maximum number of packets to pass to the socket at once */
+#define MAX_BATCH 32
 
 typedef struct private_sender_t private_sender_t;
 
@@ -59,6 +61,26 @@ struct private_sender_t {
 	 */
 	condvar_t *sent;
 
+	/**
+	 * Largest number of packets queued so far
+	 */
+	u_int max_queued;
+
+	/**
+	 * Number of packets sent
+	 */
+	u_int64_t packets;
+
+	/**
+	 * Number of batches these packets were sent in
+	 */
+	u_int64_t batches;
+
+	/**
+	 * Largest batch sent so far
+	 */
+	u_int max_batch;
+
 	/**
 	 * Delay for sending outgoing packets, to simulate larger RTT
 	 */
@@ -85,6 +107,8 @@ METHOD(sender_t, send_no_marker, void,
 {
 	this->mutex->lock(this->mutex);
 	this->list->insert_last(this->list, packet);
+	this->max_queued = max(this->max_queued,
+						   this->list->get_count(this->list));
 	this->got->signal(this->got);
 	this->mutex->unlock(this->mutex);
 }
@@ -139,8 +163,9 @@ METHOD(sender_t, send_, void,
  */
 static job_requeue_t send_packets(private_sender_t *this)
 {
-	packet_t *packet;
+	packet_t *packets[MAX_BATCH];
 	bool oldstate;
+	int count = 0, i;
 
 	this->mutex->lock(this->mutex);
 	while (this->list->get_count(this->list) == 0)
@@ -154,15 +179,50 @@ static job_requeue_t send_packets(private_sender_t *this)
 		thread_cancelability(oldstate);
 		thread_cleanup_pop(FALSE);
 	}
-	this->list->remove_first(this->list, (void**)&packet);
+	/* drain as many queued packets as possible, to send them together */
+	while (count < MAX_BATCH &&
+		   this->list->remove_first(this->list,
+									(void**)&packets[count]) == SUCCESS)
+	{
+		count++;
+	}
+	this->packets += count;
+	this->batches++;
+	this->max_batch = max(this->max_batch, count);
 	this->sent->signal(this->sent);
 	this->mutex->unlock(this->mutex);
 
-	charon->socket->send(charon->socket, packet);
-	packet->destroy(packet);
+	charon->socket->send_batch(charon->socket, packets, count);
+	for (i = 0; i < count; i++)
+	{
+		packets[i]->destroy(packets[i]);
+	}
 	return JOB_REQUEUE_DIRECT;
 }
 
+METHOD(sender_t, get_queue_length, u_int,
+	private_sender_t *this)
+{
+	u_int count;
+
+	this->mutex->lock(this->mutex);
+	count = this->list->get_count(this->list);
+	this->mutex->unlock(this->mutex);
+	return count;
+}
+
+METHOD(sender_t, get_stats, void,
+	private_sender_t *this, u_int *max_queued, u_int64_t *packets,
+	u_int64_t *batches, u_int *max_batch)
+{
+	this->mutex->lock(this->mutex);
+	*max_queued = this->max_queued;
+	*packets = this->packets;
+	*batches = this->batches;
+	*max_batch = this->max_batch;
+	this->mutex->unlock(this->mutex);
+}
+
 METHOD(sender_t, flush, void,
 	private_sender_t *this)
 {
@@ -197,6 +257,8 @@ sender_t * sender_create()
 			.send = _send_,
 			.send_no_marker = _send_no_marker,
 			.flush = _flush,
+			.get_queue_length = _get_queue_length,
+			.get_stats = _get_stats,
 			.destroy = _destroy,
 		},
 		.list = linked_list_create(),
@@ -58,6 +58,27 @@ struct sender_t {
 	 */
 	void (*flush)(sender_t *this);
 
+	/**
+	 * Get the number of packets currently waiting to be sent.
+	 *
+	 * @return			number of queued packets
+	 */
+	u_int (*get_queue_length)(sender_t *this);
+
+	/**
+	 * Get statistics about the packets sent so far.
+	 *
+	 * Queued packets are passed to the socket in batches, to reduce the
+	 * number of system calls if the socket supports it.
+	 *
+	 * @param max_queued	largest number of packets queued at once
+	 * @param packets		total number of packets sent
+	 * @param batches		number of batches these packets were sent in
+	 * @param max_batch		largest batch sent
+	 */
+	void (*get_stats)(sender_t *this, u_int *max_queued, u_int64_t *packets,
+					  u_int64_t *batches, u_int *max_batch);
+
 	/**
 	 * Destroys a sender object.
 	 */
@@ -67,6 +67,21 @@ struct socket_t {
 	 */
 	status_t (*send) (socket_t *this, packet_t *packet);
 
+	/**
+	 * Send multiple packets at once.
+	 *
+	 * This method is optional and may be NULL. Packets are sent in order,
+	 * but packets sent over different underlying sockets may get reordered.
+	 *
+	 * @param packets		array of packet_t to send
+	 * @param count			number of packets in array
+	 * @return
+	 *						- SUCCESS when at least one packet sent, packets
+	 *						  that fail individually are skipped
+	 *						- FAILED when unable to send any of the packets
+	 */
+	status_t (*send_batch) (socket_t *this, packet_t **packets, int count);
+
 	/**
 	 * Get the port this socket is listening on.
 	 *
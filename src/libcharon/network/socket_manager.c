@@ -89,6 +89,41 @@ METHOD(socket_manager_t, sender, status_t,
 	return status;
 }
 
+METHOD(socket_manager_t, send_batch, status_t,
+	private_socket_manager_t *this, packet_t **packets, int count)
+{
+	status_t status = SUCCESS;
+	int i, sent = 0;
+
+	this->lock->read_lock(this->lock);
+	if (!this->socket)
+	{
+		DBG1(DBG_NET, "no socket implementation registered, sending failed");
+		this->lock->unlock(this->lock);
+		return NOT_SUPPORTED;
+	}
+	if (this->socket->send_batch)
+	{
+		status = this->socket->send_batch(this->socket, packets, count);
+	}
+	else
+	{
+		for (i = 0; i < count; i++)
+		{
+			if (this->socket->send(this->socket, packets[i]) == SUCCESS)
+			{
+				sent++;
+			}
+		}
+		if (count && !sent)
+		{
+			status = FAILED;
+		}
+	}
+	this->lock->unlock(this->lock);
+	return status;
+}
+
 METHOD(socket_manager_t, get_port, u_int16_t,
 	private_socket_manager_t *this, bool nat_t)
 {
@@ -165,6 +200,7 @@ socket_manager_t *socket_manager_create()
 	INIT(this,
 		.public = {
 			.send = _sender,
+			.send_batch = _send_batch,
 			.receive = _receiver,
 			.get_port = _get_port,
 			.add_socket = _add_socket,
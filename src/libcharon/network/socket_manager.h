@@ -52,6 +52,22 @@ struct socket_manager_t {
 	 */
 	status_t (*send) (socket_manager_t *this, packet_t *packet);
 
+	/**
+	 * Send multiple packets at once using the registered socket.
+	 *
+	 * Falls back to send() for each packet if the socket does not support
+	 * sending batches of packets.
+	 *
+	 * @param packets		array of packets to send out
+	 * @param count			number of packets in array
+	 * @return
+	 *						- SUCCESS when at least one packet sent, packets
+	 *						  that fail individually are skipped
+	 *						- FAILED when unable to send any of the packets
+	 */
+	status_t (*send_batch) (socket_manager_t *this, packet_t **packets,
+							int count);
+
 	/**
 	 * Get the port the registered socket is listening on.
 	 *
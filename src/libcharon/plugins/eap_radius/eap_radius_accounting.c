@@ -179,27 +179,63 @@ static void update_usage(private_eap_radius_accounting_t *this,
 }
 
 /**
- * Send a RADIUS message, wait for response
+ * Data for an accounting request in flight
  */
-static bool send_message(private_eap_radius_accounting_t *this,
-						 radius_message_t *request)
-{
-	radius_message_t *response;
+typedef struct {
+	/** client the request has been sent over */
 	radius_client_t *client;
+	/** IKE_SA to delete on timeout, NULL for none */
+	ike_sa_id_t *id;
+} request_data_t;
+
+/**
+ * Handle the completion of an accounting request
+ */
+static void request_done(request_data_t *data, radius_message_t *request,
+						 radius_message_t *response)
+{
 	bool ack = FALSE;
 
+	if (response)
+	{
+		ack = response->get_code(response) == RMC_ACCOUNTING_RESPONSE;
+		response->destroy(response);
+	}
+	if (!ack)
+	{
+		eap_radius_handle_timeout(data->id);
+	}
+	data->client->destroy(data->client);
+	DESTROY_IF(data->id);
+	free(data);
+}
+
+/**
+ * Send a RADIUS message without waiting for the response, the message gets
+ * owned. If the server does not respond, the given IKE_SA gets deleted.
+ */
+static void send_message(private_eap_radius_accounting_t *this,
+						 radius_message_t *request, ike_sa_id_t *id)
+{
+	request_data_t *data;
+	radius_client_t *client;
+
 	client = eap_radius_create_client();
-	if (client)
+	if (!client)
 	{
-		response = client->request(client, request);
-		if (response)
-		{
-			ack = response->get_code(response) == RMC_ACCOUNTING_RESPONSE;
-			response->destroy(response);
-		}
-		client->destroy(client);
+		request->destroy(request);
+		eap_radius_handle_timeout(id);
+		return;
+	}
+	INIT(data,
+		.client = client,
+		.id = id ? id->clone(id) : NULL,
+	);
+	if (!client->request_async(client, request,
+							   (radius_client_cb_t)request_done, data))
+	{
+		request_done(data, NULL, NULL);
 	}
-	return ack;
 }
 
 /**
@@ -408,11 +444,7 @@ static job_requeue_t send_interim(interim_data_t *data)
 
 	if (message)
 	{
-		if (!send_message(this, message))
-		{
-			eap_radius_handle_timeout(data->id);
-		}
-		message->destroy(message);
+		send_message(this, message, data->id);
 	}
 	return JOB_REQUEUE_NONE;
 }
@@ -487,11 +519,7 @@ static void send_start(private_eap_radius_accounting_t *this, ike_sa_t *ike_sa)
 	this->mutex->unlock(this->mutex);
 
 	add_ike_sa_parameters(this, message, ike_sa);
-	if (!send_message(this, message))
-	{
-		eap_radius_handle_timeout(ike_sa->get_id(ike_sa));
-	}
-	message->destroy(message);
+	send_message(this, message, ike_sa->get_id(ike_sa));
 }
 
 /**
@@ -549,11 +577,7 @@ static void send_stop(private_eap_radius_accounting_t *this, ike_sa_t *ike_sa)
 		value = htonl(entry->cause);
 		message->add(message, RAT_ACCT_TERMINATE_CAUSE, chunk_from_thing(value));
 
-		if (!send_message(this, message))
-		{
-			eap_radius_handle_timeout(NULL);
-		}
-		message->destroy(message);
+		send_message(this, message, NULL);
 		destroy_entry(entry);
 	}
 }
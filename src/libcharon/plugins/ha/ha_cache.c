@@ -56,6 +56,11 @@ struct private_ha_cache_t {
 	 * Mutex to lock cache
 	 */
 	mutex_t *mutex;
+
+	/**
+	 * Sequence number assigned to the next cached IKE_SA
+	 */
+	u_int32_t seq;
 };
 
 /**
@@ -80,6 +85,8 @@ static bool equals(void *a, void *b)
 typedef struct {
 	/* segment this entry is associate to */
 	u_int segment;
+	/* sequence number of this entry */
+	u_int32_t seq;
 	/* ADD message */
 	ha_message_t *add;
 	/* list of updates UPDATE message */
@@ -130,6 +137,7 @@ METHOD(ha_cache_t, cache, void,
 	{
 		case HA_IKE_ADD:
 			entry = entry_create(message);
+			entry->seq = ++this->seq;
 			entry = this->cache->put(this->cache, ike_sa, entry);
 			if (entry)
 			{
@@ -334,6 +342,207 @@ METHOD(ha_cache_t, resync, void,
 	rekey_segment(this, segment);
 }
 
+METHOD(ha_cache_t, rekey, void,
+	private_ha_cache_t *this, u_int segment)
+{
+	rekey_segment(this, segment);
+}
+
+/**
+ * Position of a cached IKE_SA in a stream
+ */
+typedef struct {
+	/* IKE_SA the entry is cached for */
+	ike_sa_t *ike_sa;
+	/* sequence number of the entry */
+	u_int32_t seq;
+} position_t;
+
+/**
+ * Sort positions by sequence number
+ */
+static int position_cmp(const void *a, const void *b)
+{
+	const position_t *pa = a, *pb = b;
+
+	if (pa->seq == pb->seq)
+	{
+		return 0;
+	}
+	return pa->seq < pb->seq ? -1 : 1;
+}
+
+/**
+ * Enumerator over the cached messages of a segment
+ */
+typedef struct {
+	/* implements enumerator_t */
+	enumerator_t public;
+	/* cache we enumerate */
+	private_ha_cache_t *this;
+	/* positions of the IKE_SAs to enumerate, sorted */
+	position_t *positions;
+	/* number of positions */
+	int count;
+	/* current position */
+	int current;
+	/* encodings of the current entry, as chunk_t* */
+	linked_list_t *encodings;
+	/* currently enumerated encoding */
+	chunk_t *encoding;
+} stream_enumerator_t;
+
+/**
+ * Clone the encoding of a message to a list
+ */
+static void add_encoding(linked_list_t *list, ha_message_t *message)
+{
+	chunk_t *encoding;
+
+	encoding = malloc_thing(chunk_t);
+	*encoding = chunk_clone(message->get_encoding(message));
+	list->insert_last(list, encoding);
+}
+
+/**
+ * Clone the encodings of the next entry still cached, FALSE if none left
+ */
+static bool next_entry(stream_enumerator_t *this)
+{
+	enumerator_t *enumerator;
+	ha_message_t *message;
+	entry_t *entry;
+
+	while (this->current < this->count)
+	{
+		this->this->mutex->lock(this->this->mutex);
+		entry = this->this->cache->get(this->this->cache,
+									   this->positions[this->current].ike_sa);
+		if (entry && entry->seq == this->positions[this->current].seq)
+		{
+			add_encoding(this->encodings, entry->add);
+			enumerator = entry->updates->create_enumerator(entry->updates);
+			while (enumerator->enumerate(enumerator, &message))
+			{
+				add_encoding(this->encodings, message);
+			}
+			enumerator->destroy(enumerator);
+			if (entry->midi)
+			{
+				add_encoding(this->encodings, entry->midi);
+			}
+			if (entry->midr)
+			{
+				add_encoding(this->encodings, entry->midr);
+			}
+			if (entry->iv)
+			{
+				add_encoding(this->encodings, entry->iv);
+			}
+		}
+		this->this->mutex->unlock(this->this->mutex);
+		if (this->encodings->get_count(this->encodings))
+		{
+			return TRUE;
+		}
+		this->current++;
+	}
+	return FALSE;
+}
+
+METHOD(enumerator_t, stream_enumerate, bool,
+	stream_enumerator_t *this, u_int32_t *seq, chunk_t *encoding)
+{
+	if (this->encoding)
+	{
+		chunk_free(this->encoding);
+		free(this->encoding);
+		this->encoding = NULL;
+		if (!this->encodings->get_count(this->encodings))
+		{
+			this->current++;
+		}
+	}
+	if (!this->encodings->get_count(this->encodings) && !next_entry(this))
+	{
+		return FALSE;
+	}
+	this->encodings->remove_first(this->encodings, (void**)&this->encoding);
+	*seq = this->positions[this->current].seq;
+	*encoding = *this->encoding;
+	return TRUE;
+}
+
+METHOD(enumerator_t, stream_destroy, void,
+	stream_enumerator_t *this)
+{
+	chunk_t *encoding;
+
+	if (this->encoding)
+	{
+		chunk_free(this->encoding);
+		free(this->encoding);
+	}
+	while (this->encodings->remove_last(this->encodings,
+										(void**)&encoding) == SUCCESS)
+	{
+		chunk_free(encoding);
+		free(encoding);
+	}
+	this->encodings->destroy(this->encodings);
+	free(this->positions);
+	free(this);
+}
+
+METHOD(ha_cache_t, create_stream_enumerator, enumerator_t*,
+	private_ha_cache_t *this, u_int segment, u_int32_t after)
+{
+	stream_enumerator_t *enumerator;
+	enumerator_t *entries;
+	ike_sa_t *ike_sa;
+	entry_t *entry;
+	int size = 0;
+
+	INIT(enumerator,
+		.public = {
+			.enumerate = (void*)_stream_enumerate,
+			.destroy = _stream_destroy,
+		},
+		.this = this,
+		.encodings = linked_list_create(),
+	);
+
+	/* entries are copied one by one during enumeration, we only remember
+	 * the IKE_SAs and their order to avoid blocking the cache */
+	this->mutex->lock(this->mutex);
+	entries = this->cache->create_enumerator(this->cache);
+	while (entries->enumerate(entries, &ike_sa, &entry))
+	{
+		if (entry->segment == segment && entry->seq > after)
+		{
+			if (enumerator->count == size)
+			{
+				size = max(32, size * 2);
+				enumerator->positions = realloc(enumerator->positions,
+												size * sizeof(position_t));
+			}
+			enumerator->positions[enumerator->count++] = (position_t){
+				.ike_sa = ike_sa,
+				.seq = entry->seq,
+			};
+		}
+	}
+	entries->destroy(entries);
+	this->mutex->unlock(this->mutex);
+
+	if (enumerator->count)
+	{
+		qsort(enumerator->positions, enumerator->count, sizeof(position_t),
+			  position_cmp);
+	}
+	return &enumerator->public;
+}
+
 /**
  * Request a resync of all segments
  */
@@ -375,6 +584,8 @@ ha_cache_t *ha_cache_create(ha_kernel_t *kernel, ha_socket_t *socket,
 			.cache = _cache,
 			.delete = _delete_,
 			.resync = _resync,
+			.create_stream_enumerator = _create_stream_enumerator,
+			.rekey = _rekey,
 			.destroy = _destroy,
 		},
 		.count = count,
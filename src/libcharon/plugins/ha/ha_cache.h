@@ -58,6 +58,28 @@ struct ha_cache_t {
 	 */
 	void (*resync)(ha_cache_t *this, u_int segment);
 
+	/**
+	 * Create an enumerator over the cached messages of a segment.
+	 *
+	 * Messages are enumerated grouped by IKE_SA, ordered by a sequence
+	 * number assigned when caching the IKE_SA. Enumerating only IKE_SAs
+	 * with a sequence number larger than a previous one allows resuming an
+	 * interrupted resync.
+	 *
+	 * @param segment		segment to enumerate messages of
+	 * @param after			only enumerate IKE_SAs with a larger sequence
+	 * @return				enumerator over (u_int32_t seq, chunk_t encoding)
+	 */
+	enumerator_t* (*create_stream_enumerator)(ha_cache_t *this, u_int segment,
+											  u_int32_t after);
+
+	/**
+	 * Trigger rekeying of the CHILD_SAs in a resynced segment.
+	 *
+	 * @param segment		segment to rekey CHILD_SAs in
+	 */
+	void (*rekey)(ha_cache_t *this, u_int segment);
+
 	/**
 	 * Destroy a ha_cache_t.
 	 */
@@ -48,8 +48,38 @@ struct private_ha_ctl_t {
 	 * Resynchronization message cache
 	 */
 	ha_cache_t *cache;
+
+	/**
+	 * Resynchronization stream, if enabled
+	 */
+	ha_stream_t *stream;
 };
 
+/**
+ * Log the resync progress of all segments
+ */
+static void log_progress(private_ha_ctl_t *this)
+{
+	ha_stream_progress_t progress;
+	u_int segment;
+
+	if (!this->stream)
+	{
+		DBG1(DBG_CFG, "HA resync stream disabled");
+		return;
+	}
+	for (segment = 1;
+		 this->stream->get_progress(this->stream, segment, &progress);
+		 segment++)
+	{
+		DBG1(DBG_CFG, "HA segment %d resync %N: received %u IKE_SAs "
+			 "(%llu bytes, cursor %u), sent %u IKE_SAs (%llu bytes)", segment,
+			 ha_stream_state_names, progress.state, progress.received,
+			 progress.bytes_in, progress.cursor, progress.sent,
+			 progress.bytes_out);
+	}
+}
+
 /**
  * FIFO dispatching function
  */
@@ -73,6 +103,10 @@ static job_requeue_t dispatch_fifo(private_ha_ctl_t *this)
 	memset(buf, 0, sizeof(buf));
 	if (read(fifo, buf, sizeof(buf)-1) > 1)
 	{
+		if (buf[0] == '?')
+		{
+			log_progress(this);
+		}
 		segment = atoi(&buf[1]);
 		if (segment)
 		{
@@ -85,7 +119,14 @@ static job_requeue_t dispatch_fifo(private_ha_ctl_t *this)
 					this->segments->deactivate(this->segments, segment, TRUE);
 					break;
 				case '*':
-					this->cache->resync(this->cache, segment);
+					if (this->stream)
+					{
+						this->stream->push(this->stream, segment);
+					}
+					else
+					{
+						this->cache->resync(this->cache, segment);
+					}
 					break;
 				default:
 					break;
@@ -106,7 +147,8 @@ METHOD(ha_ctl_t, destroy, void,
 /**
  * See header
  */
-ha_ctl_t *ha_ctl_create(ha_segments_t *segments, ha_cache_t *cache)
+ha_ctl_t *ha_ctl_create(ha_segments_t *segments, ha_cache_t *cache,
+						ha_stream_t *stream)
 {
 	private_ha_ctl_t *this;
 	mode_t old;
@@ -117,6 +159,7 @@ ha_ctl_t *ha_ctl_create(ha_segments_t *segments, ha_cache_t *cache)
 		},
 		.segments = segments,
 		.cache = cache,
+		.stream = stream,
 	);
 
 	if (access(HA_FIFO, R_OK|W_OK) != 0)
@@ -23,6 +23,7 @@
 
 #include "ha_segments.h"
 #include "ha_cache.h"
+#include "ha_stream.h"
 
 typedef struct ha_ctl_t ha_ctl_t;
 
@@ -42,8 +43,10 @@ struct ha_ctl_t {
  *
  * @param segments	segments to control
  * @param cache		message cache for resynchronization
+ * @param stream	resync stream, NULL if disabled
  * @return			HA control interface
  */
-ha_ctl_t *ha_ctl_create(ha_segments_t *segments, ha_cache_t *cache);
+ha_ctl_t *ha_ctl_create(ha_segments_t *segments, ha_cache_t *cache,
+						ha_stream_t *stream);
 
 #endif /** HA_CTL_ @}*/
@@ -16,6 +16,7 @@
 #include "ha_dispatcher.h"
 
 #include <daemon.h>
+#include <threading/mutex.h>
 #include <sa/ikev2/keymat_v2.h>
 #include <sa/ikev1/keymat_v1.h>
 #include <processing/jobs/callback_job.h>
@@ -58,6 +59,21 @@ struct private_ha_dispatcher_t {
 	 * HA enabled pool
 	 */
 	ha_attribute_t *attr;
+
+	/**
+	 * Number of hold() requests currently active
+	 */
+	u_int held;
+
+	/**
+	 * State messages received from the socket while held, as ha_message_t
+	 */
+	linked_list_t *queue;
+
+	/**
+	 * Serializes processing of socket messages and replaying the queue
+	 */
+	mutex_t *mutex;
 };
 
 /**
@@ -981,15 +997,41 @@ static void process_resync(private_ha_dispatcher_t *this,
 }
 
 /**
- * Dispatcher job function
+ * Check if a message carries IKE/CHILD_SA state, rather than controlling
+ * segments
  */
-static job_requeue_t dispatch(private_ha_dispatcher_t *this)
+static bool is_state(ha_message_type_t type)
+{
+	switch (type)
+	{
+		case HA_IKE_ADD:
+		case HA_IKE_UPDATE:
+		case HA_IKE_MID_INITIATOR:
+		case HA_IKE_MID_RESPONDER:
+		case HA_IKE_IV:
+		case HA_IKE_DELETE:
+		case HA_CHILD_ADD:
+		case HA_CHILD_DELETE:
+			return TRUE;
+		default:
+			return FALSE;
+	}
+}
+
+/**
+ * Process a single received message, live if received from the socket
+ */
+static void process_message(private_ha_dispatcher_t *this,
+							ha_message_t *message, bool live)
 {
-	ha_message_t *message;
 	ha_message_type_t type;
 
-	message = this->socket->pull(this->socket);
 	type = message->get_type(message);
+	if (live && this->held && is_state(type))
+	{	/* a stream is receiving, apply live updates after its snapshot */
+		this->queue->insert_last(this->queue, message);
+		return;
+	}
 	if (type != HA_STATUS)
 	{
 		DBG2(DBG_CFG, "received HA %N message", ha_message_type_names,
@@ -1038,12 +1080,112 @@ static job_requeue_t dispatch(private_ha_dispatcher_t *this)
 			message->destroy(message);
 			break;
 	}
+}
+
+/**
+ * Process messages of type BATCH, in the order they have been batched
+ */
+static void process_batch(private_ha_dispatcher_t *this, ha_message_t *batch,
+						  bool live)
+{
+	ha_message_attribute_t attribute;
+	ha_message_value_t value;
+	enumerator_t *enumerator;
+	ha_message_t *message;
+
+	enumerator = batch->create_attribute_enumerator(batch);
+	while (enumerator->enumerate(enumerator, &attribute, &value))
+	{
+		if (attribute != HA_MESSAGE)
+		{
+			continue;
+		}
+		message = ha_message_parse(value.chunk);
+		if (!message)
+		{
+			continue;
+		}
+		if (message->get_type(message) == HA_BATCH)
+		{
+			DBG1(DBG_CFG, "ignoring nested HA %N message",
+				 ha_message_type_names, HA_BATCH);
+			message->destroy(message);
+			continue;
+		}
+		process_message(this, message, live);
+	}
+	enumerator->destroy(enumerator);
+	batch->destroy(batch);
+}
+
+/**
+ * Process a message or a batch of messages
+ */
+static void process_any(private_ha_dispatcher_t *this, ha_message_t *message,
+						bool live)
+{
+	if (message->get_type(message) == HA_BATCH)
+	{
+		process_batch(this, message, live);
+	}
+	else
+	{
+		process_message(this, message, live);
+	}
+}
+
+METHOD(ha_dispatcher_t, process, void,
+	private_ha_dispatcher_t *this, ha_message_t *message)
+{
+	process_any(this, message, FALSE);
+}
+
+METHOD(ha_dispatcher_t, hold, void,
+	private_ha_dispatcher_t *this, bool hold)
+{
+	ha_message_t *message;
+
+	this->mutex->lock(this->mutex);
+	if (hold)
+	{
+		this->held++;
+	}
+	else if (--this->held == 0)
+	{
+		if (this->queue->get_count(this->queue))
+		{
+			DBG1(DBG_CFG, "applying %d HA messages received during resync",
+				 this->queue->get_count(this->queue));
+		}
+		while (this->queue->remove_first(this->queue,
+										 (void**)&message) == SUCCESS)
+		{
+			process_message(this, message, FALSE);
+		}
+	}
+	this->mutex->unlock(this->mutex);
+}
+
+/**
+ * Dispatcher job function
+ */
+static job_requeue_t dispatch(private_ha_dispatcher_t *this)
+{
+	ha_message_t *message;
+
+	message = this->socket->pull(this->socket);
+	this->mutex->lock(this->mutex);
+	process_any(this, message, TRUE);
+	this->mutex->unlock(this->mutex);
 	return JOB_REQUEUE_DIRECT;
 }
 
 METHOD(ha_dispatcher_t, destroy, void,
 	private_ha_dispatcher_t *this)
 {
+	this->queue->destroy_offset(this->queue,
+								offsetof(ha_message_t, destroy));
+	this->mutex->destroy(this->mutex);
 	free(this);
 }
 
@@ -1059,6 +1201,8 @@ ha_dispatcher_t *ha_dispatcher_create(ha_socket_t *socket,
 
 	INIT(this,
 		.public = {
+			.process = _process,
+			.hold = _hold,
 			.destroy = _destroy,
 		},
 		.socket = socket,
@@ -1066,6 +1210,8 @@ ha_dispatcher_t *ha_dispatcher_create(ha_socket_t *socket,
 		.cache = cache,
 		.kernel = kernel,
 		.attr = attr,
+		.queue = linked_list_create(),
+		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
 	);
 	lib->processor->queue_job(lib->processor,
 		(job_t*)callback_job_create_with_prio((callback_job_cb_t)dispatch, this,
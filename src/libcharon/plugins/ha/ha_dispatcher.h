@@ -34,6 +34,26 @@ typedef struct ha_dispatcher_t ha_dispatcher_t;
  */
 struct ha_dispatcher_t {
 
+	/**
+	 * Process a message received by other means than the HA socket.
+	 *
+	 * @param message		message to process, gets owned
+	 */
+	void (*process)(ha_dispatcher_t *this, ha_message_t *message);
+
+	/**
+	 * Hold back IKE/CHILD_SA state received over the HA socket.
+	 *
+	 * While a resync stream is receiving, live updates received over the
+	 * socket are queued, and applied in order once no hold is active
+	 * anymore. This prevents older state from the stream from overwriting
+	 * newer live updates. Messages controlling segments are processed
+	 * immediately. Calls may be nested.
+	 *
+	 * @param hold			TRUE to start holding, FALSE to release a hold
+	 */
+	void (*hold)(ha_dispatcher_t *this, bool hold);
+
 	/**
 	 * Destroy a ha_dispatcher_t.
 	 */
@@ -46,7 +46,7 @@ struct private_ha_message_t {
 	chunk_t buf;
 };
 
-ENUM(ha_message_type_names, HA_IKE_ADD, HA_IKE_IV,
+ENUM(ha_message_type_names, HA_IKE_ADD, HA_RESYNC_MARK,
 	"IKE_ADD",
 	"IKE_UPDATE",
 	"IKE_MID_INITIATOR",
@@ -59,6 +59,8 @@ ENUM(ha_message_type_names, HA_IKE_ADD, HA_IKE_IV,
 	"STATUS",
 	"RESYNC",
 	"IKE_IV",
+	"BATCH",
+	"RESYNC_MARK",
 );
 
 typedef struct ike_sa_id_encoding_t ike_sa_id_encoding_t;
@@ -254,6 +256,7 @@ METHOD(ha_message_t, add_attribute, void,
 		case HA_INBOUND_SPI:
 		case HA_OUTBOUND_SPI:
 		case HA_MID:
+		case HA_SEQUENCE:
 		{
 			u_int32_t val;
 
@@ -272,6 +275,7 @@ METHOD(ha_message_t, add_attribute, void,
 		case HA_PSK:
 		case HA_IV:
 		case HA_OLD_SKD:
+		case HA_MESSAGE:
 		{
 			chunk_t chunk;
 
@@ -475,6 +479,7 @@ METHOD(enumerator_t, attribute_enumerate, bool,
 		case HA_INBOUND_SPI:
 		case HA_OUTBOUND_SPI:
 		case HA_MID:
+		case HA_SEQUENCE:
 		{
 			if (this->buf.len < sizeof(u_int32_t))
 			{
@@ -494,6 +499,7 @@ METHOD(enumerator_t, attribute_enumerate, bool,
 		case HA_PSK:
 		case HA_IV:
 		case HA_OLD_SKD:
+		case HA_MESSAGE:
 		{
 			size_t len;
 
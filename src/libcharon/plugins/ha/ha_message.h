@@ -65,6 +65,10 @@ enum ha_message_type_t {
 	HA_RESYNC,
 	/** IV synchronization for IKEv1 Main/Aggressive mode */
 	HA_IKE_IV,
+	/** multiple messages sent in a single datagram */
+	HA_BATCH,
+	/** progress of a resync stream, segment complete if without sequence */
+	HA_RESYNC_MARK,
 };
 
 /**
@@ -154,6 +158,10 @@ enum ha_message_attribute_t {
 	HA_PSK,
 	/** chunk_t, IV for next IKEv1 message */
 	HA_IV,
+	/** chunk_t, encoded message contained in a HA_BATCH */
+	HA_MESSAGE,
+	/** u_int32_t, sequence number of a cached IKE_SA in a resync stream */
+	HA_SEQUENCE,
 };
 
 /**
@@ -22,6 +22,7 @@
 #include "ha_segments.h"
 #include "ha_ctl.h"
 #include "ha_cache.h"
+#include "ha_stream.h"
 #include "ha_attribute.h"
 
 #include <daemon.h>
@@ -89,6 +90,11 @@ struct private_ha_plugin_t {
 	 * Attribute provider
 	 */
 	ha_attribute_t *attr;
+
+	/**
+	 * Bulk resynchronization stream
+	 */
+	ha_stream_t *stream;
 };
 
 METHOD(plugin_t, get_name, char*,
@@ -101,6 +107,7 @@ METHOD(plugin_t, destroy, void,
 	private_ha_plugin_t *this)
 {
 	DESTROY_IF(this->ctl);
+	DESTROY_IF(this->stream);
 	hydra->attributes->remove_provider(hydra->attributes, &this->attr->provider);
 	charon->bus->remove_listener(charon->bus, &this->segments->listener);
 	charon->bus->remove_listener(charon->bus, &this->ike->listener);
@@ -125,7 +132,7 @@ plugin_t *ha_plugin_create()
 	private_ha_plugin_t *this;
 	char *local, *remote, *secret;
 	u_int count;
-	bool fifo, monitor, resync;
+	bool fifo, monitor, resync, stream;
 
 	local = lib->settings->get_str(lib->settings,
 							"%s.plugins.ha.local", NULL, charon->name);
@@ -139,6 +146,8 @@ plugin_t *ha_plugin_create()
 							"%s.plugins.ha.monitor", TRUE, charon->name);
 	resync = lib->settings->get_bool(lib->settings,
 							"%s.plugins.ha.resync", TRUE, charon->name);
+	stream = lib->settings->get_bool(lib->settings,
+							"%s.plugins.ha.resync_stream", FALSE, charon->name);
 	count = min(SEGMENTS_MAX, lib->settings->get_int(lib->settings,
 							"%s.plugins.ha.segment_count", 1, charon->name));
 	if (!local || !remote)
@@ -159,7 +168,7 @@ plugin_t *ha_plugin_create()
 
 	if (secret)
 	{
-		this->tunnel = ha_tunnel_create(local, remote, secret);
+		this->tunnel = ha_tunnel_create(local, remote, secret, stream);
 	}
 	this->socket = ha_socket_create(local, remote);
 	if (!this->socket)
@@ -171,14 +180,20 @@ plugin_t *ha_plugin_create()
 	this->kernel = ha_kernel_create(count);
 	this->segments = ha_segments_create(this->socket, this->kernel, this->tunnel,
 							count, strcmp(local, remote) > 0, monitor);
-	this->cache = ha_cache_create(this->kernel, this->socket, resync, count);
-	if (fifo)
-	{
-		this->ctl = ha_ctl_create(this->segments, this->cache);
-	}
+	this->cache = ha_cache_create(this->kernel, this->socket,
+								  resync && !stream, count);
 	this->attr = ha_attribute_create(this->kernel, this->segments);
 	this->dispatcher = ha_dispatcher_create(this->socket, this->segments,
 										this->cache, this->kernel, this->attr);
+	if (stream)
+	{
+		this->stream = ha_stream_create(local, remote, this->socket,
+							this->cache, this->dispatcher, resync, count);
+	}
+	if (fifo)
+	{
+		this->ctl = ha_ctl_create(this->segments, this->cache, this->stream);
+	}
 	this->ike = ha_ike_create(this->socket, this->tunnel, this->cache);
 	this->child = ha_child_create(this->socket, this->tunnel, this->segments,
 								  this->kernel);
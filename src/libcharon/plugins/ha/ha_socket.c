@@ -24,8 +24,30 @@
 #include <daemon.h>
 #include <networking/host.h>
 #include <threading/thread.h>
+#include <threading/mutex.h>
+#include <collections/linked_list.h>
 #include <processing/jobs/callback_job.h>
 
+/**
+ * Default delay in ms to wait for more messages before sending a batch
+ */
+#define DEFAULT_BATCH_DELAY 5
+
+/**
+ * Size of the HA_BATCH message header
+ */
+#define BATCH_HEADER_LEN 2
+
+/**
+ * Size of the HA_MESSAGE attribute header of each batched message
+ */
+#define BATCH_ENTRY_LEN 3
+
+/**
+ * Maximum size of a received datagram
+ */
+#define MAX_PACKET 65536
+
 typedef struct private_ha_socket_t private_ha_socket_t;
 
 /**
@@ -52,8 +74,65 @@ struct private_ha_socket_t {
 	 * remote host to receive/send to
 	 */
 	host_t *remote;
+
+	/**
+	 * Maximum size of a batch datagram, 0 to send each message on its own
+	 */
+	u_int batch_size;
+
+	/**
+	 * Delay in ms before a batch gets sent
+	 */
+	u_int batch_delay;
+
+	/**
+	 * Messages waiting to get sent in a batch, as batched_t
+	 */
+	linked_list_t *batch;
+
+	/**
+	 * Encoded size of the pending batch
+	 */
+	size_t batch_len;
+
+	/**
+	 * TRUE if a job to send the pending batch is scheduled
+	 */
+	bool scheduled;
+
+	/**
+	 * Lock for batch
+	 */
+	mutex_t *mutex;
+
+	/**
+	 * Buffer to receive datagrams
+	 */
+	char *buf;
 };
 
+/**
+ * A message waiting in a batch
+ */
+typedef struct {
+	/** message type */
+	ha_message_type_t type;
+	/** IKE_SA the message updates, if a newer one supersedes it */
+	ike_sa_id_t *id;
+	/** message encoding */
+	chunk_t encoding;
+} batched_t;
+
+/**
+ * Destroy a batched message
+ */
+static void batched_destroy(batched_t *this)
+{
+	DESTROY_IF(this->id);
+	free(this->encoding.ptr);
+	free(this);
+}
+
 /**
  * Data to pass to the send_message() callback job
  */
@@ -83,13 +162,12 @@ static job_requeue_t send_message(job_data_t *data)
 	return JOB_REQUEUE_NONE;
 }
 
-METHOD(ha_socket_t, push, void,
-	private_ha_socket_t *this, ha_message_t *message)
+/**
+ * Send an encoded message or batch, without blocking
+ */
+static void send_chunk(private_ha_socket_t *this, chunk_t chunk)
 {
-	chunk_t chunk;
-
 	/* Try to send synchronously, but non-blocking. */
-	chunk = message->get_encoding(message);
 	if (send(this->fd, chunk.ptr, chunk.len, MSG_DONTWAIT) < chunk.len)
 	{
 		if (errno == EAGAIN)
@@ -114,18 +192,165 @@ METHOD(ha_socket_t, push, void,
 	}
 }
 
+/**
+ * Send the pending batch, mutex must be held
+ */
+static void flush(private_ha_socket_t *this)
+{
+	ha_message_t *message;
+	batched_t *batched;
+
+	switch (this->batch->get_count(this->batch))
+	{
+		case 0:
+			return;
+		case 1:
+			/* a single message does not need a batch */
+			this->batch->remove_first(this->batch, (void**)&batched);
+			send_chunk(this, batched->encoding);
+			batched_destroy(batched);
+			break;
+		default:
+			message = ha_message_create(HA_BATCH);
+			while (this->batch->remove_first(this->batch,
+											 (void**)&batched) == SUCCESS)
+			{
+				message->add_attribute(message, HA_MESSAGE, batched->encoding);
+				batched_destroy(batched);
+			}
+			send_chunk(this, message->get_encoding(message));
+			message->destroy(message);
+			break;
+	}
+	this->batch_len = BATCH_HEADER_LEN;
+}
+
+/**
+ * Send the pending batch after the batch delay
+ */
+static job_requeue_t flush_job(private_ha_socket_t *this)
+{
+	this->mutex->lock(this->mutex);
+	this->scheduled = FALSE;
+	flush(this);
+	this->mutex->unlock(this->mutex);
+	return JOB_REQUEUE_NONE;
+}
+
+/**
+ * Get the IKE_SA a message updates, if newer messages of the same type
+ * supersede it
+ */
+static ike_sa_id_t *get_superseded_id(ha_message_t *message)
+{
+	ha_message_attribute_t attribute;
+	ha_message_value_t value;
+	enumerator_t *enumerator;
+	ike_sa_id_t *id = NULL;
+
+	switch (message->get_type(message))
+	{
+		case HA_IKE_MID_INITIATOR:
+		case HA_IKE_MID_RESPONDER:
+		case HA_IKE_IV:
+			break;
+		default:
+			return NULL;
+	}
+	enumerator = message->create_attribute_enumerator(message);
+	while (enumerator->enumerate(enumerator, &attribute, &value))
+	{
+		if (attribute == HA_IKE_ID)
+		{
+			id = value.ike_sa_id->clone(value.ike_sa_id);
+			break;
+		}
+	}
+	enumerator->destroy(enumerator);
+	return id;
+}
+
+/**
+ * Remove a pending message superseded by a new one, mutex must be held
+ */
+static void coalesce(private_ha_socket_t *this, batched_t *new)
+{
+	enumerator_t *enumerator;
+	batched_t *batched;
+
+	enumerator = this->batch->create_enumerator(this->batch);
+	while (enumerator->enumerate(enumerator, &batched))
+	{
+		if (batched->id && batched->type == new->type &&
+			batched->id->equals(batched->id, new->id))
+		{
+			this->batch->remove_at(this->batch, enumerator);
+			this->batch_len -= BATCH_ENTRY_LEN + batched->encoding.len;
+			batched_destroy(batched);
+			break;
+		}
+	}
+	enumerator->destroy(enumerator);
+}
+
+METHOD(ha_socket_t, push, void,
+	private_ha_socket_t *this, ha_message_t *message)
+{
+	batched_t *batched;
+	chunk_t chunk;
+
+	chunk = message->get_encoding(message);
+	if (!this->batch_size)
+	{
+		send_chunk(this, chunk);
+		return;
+	}
+
+	this->mutex->lock(this->mutex);
+	if (BATCH_HEADER_LEN + BATCH_ENTRY_LEN + chunk.len > this->batch_size)
+	{	/* too large for a batch, send it directly but keep the order */
+		flush(this);
+		send_chunk(this, chunk);
+		this->mutex->unlock(this->mutex);
+		return;
+	}
+	INIT(batched,
+		.type = message->get_type(message),
+		.id = get_superseded_id(message),
+		.encoding = chunk_clone(chunk),
+	);
+	if (batched->id)
+	{
+		coalesce(this, batched);
+	}
+	if (this->batch_len + BATCH_ENTRY_LEN + chunk.len > this->batch_size)
+	{
+		flush(this);
+	}
+	this->batch->insert_last(this->batch, batched);
+	this->batch_len += BATCH_ENTRY_LEN + chunk.len;
+	if (!this->scheduled)
+	{
+		this->scheduled = TRUE;
+		lib->scheduler->schedule_job_ms(lib->scheduler, (job_t*)
+			callback_job_create_with_prio((callback_job_cb_t)flush_job, this,
+				NULL, (callback_job_cancel_t)return_false, JOB_PRIO_CRITICAL),
+			this->batch_delay);
+	}
+	this->mutex->unlock(this->mutex);
+}
+
 METHOD(ha_socket_t, pull, ha_message_t*,
 	private_ha_socket_t *this)
 {
 	while (TRUE)
 	{
 		ha_message_t *message;
-		char buf[1024];
 		bool oldstate;
 		ssize_t len;
 
 		oldstate = thread_cancelability(TRUE);
-		len = recv(this->fd, buf, sizeof(buf), 0);
+		len = recv(this->fd, this->buf, MAX_PACKET, 0);
 		thread_cancelability(oldstate);
 		if (len <= 0)
 		{
@@ -141,7 +366,7 @@ METHOD(ha_socket_t, pull, ha_message_t*,
 					continue;
 			}
 		}
-		message = ha_message_parse(chunk_create(buf, len));
+		message = ha_message_parse(chunk_create(this->buf, len));
 		if (message)
 		{
 			return message;
@@ -186,8 +411,14 @@ METHOD(ha_socket_t, destroy, void,
 {
 	if (this->fd != -1)
 	{
+		this->mutex->lock(this->mutex);
+		flush(this);
+		this->mutex->unlock(this->mutex);
 		close(this->fd);
 	}
+	this->batch->destroy_function(this->batch, (void*)batched_destroy);
+	this->mutex->destroy(this->mutex);
+	free(this->buf);
 	DESTROY_IF(this->local);
 	DESTROY_IF(this->remote);
 	free(this);
@@ -209,6 +440,14 @@ ha_socket_t *ha_socket_create(char *local, char *remote)
 		.local = host_create_from_dns(local, 0, HA_PORT),
 		.remote = host_create_from_dns(remote, 0, HA_PORT),
 		.fd = -1,
+		.batch_size = min(lib->settings->get_int(lib->settings,
+				"%s.plugins.ha.batch_size", 0, charon->name), MAX_PACKET - 1),
+		.batch_delay = lib->settings->get_int(lib->settings,
+				"%s.plugins.ha.batch_delay", DEFAULT_BATCH_DELAY, charon->name),
+		.batch = linked_list_create(),
+		.batch_len = BATCH_HEADER_LEN,
+		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
+		.buf = malloc(MAX_PACKET),
 	);
 
 	if (!this->local || !this->remote)
@@ -0,0 +1,1045 @@
+/*
+ * Copyright (C) 2013 strongSwan Project
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include "ha_stream.h"
+#include "ha_plugin.h"
+#include "ha_segments.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <daemon.h>
+#include <threading/thread.h>
+#include <threading/mutex.h>
+#include <processing/jobs/callback_job.h>
+
+/**
+ * Timeout in s for blocking stream operations
+ */
+#define STREAM_TIMEOUT 30
+
+/**
+ * Interval in s to retry an interrupted resync
+ */
+#define STREAM_RETRY_INTERVAL 5
+
+/**
+ * Number of retries before falling back to a datagram based resync
+ */
+#define STREAM_RETRY_MAX 10
+
+/**
+ * Size of the send and receive buffers of a stream connection
+ */
+#define BUFFER_SIZE 65536
+
+/**
+ * Size of the length prefix of a record
+ */
+#define RECORD_HEADER_LEN 2
+
+ENUM(ha_stream_state_names, HA_STREAM_IDLE, HA_STREAM_COMPLETE,
+	"IDLE",
+	"RUNNING",
+	"INTERRUPTED",
+	"COMPLETE",
+);
+
+typedef struct private_ha_stream_t private_ha_stream_t;
+
+/**
+ * Private data of an ha_stream_t object.
+ */
+struct private_ha_stream_t {
+
+	/**
+	 * Public ha_stream_t interface.
+	 */
+	ha_stream_t public;
+
+	/**
+	 * Local address, with HA_PORT
+	 */
+	host_t *local;
+
+	/**
+	 * Remote address, with HA_PORT
+	 */
+	host_t *remote;
+
+	/**
+	 * Listening socket
+	 */
+	int fd;
+
+	/**
+	 * Socket to fall back to for resync requests
+	 */
+	ha_socket_t *socket;
+
+	/**
+	 * Message cache to stream segments from
+	 */
+	ha_cache_t *cache;
+
+	/**
+	 * Dispatcher to process received messages
+	 */
+	ha_dispatcher_t *dispatcher;
+
+	/**
+	 * Total number of segments
+	 */
+	u_int count;
+
+	/**
+	 * Maximum number of IKE_SAs sent per second, 0 for no limit
+	 */
+	u_int rate;
+
+	/**
+	 * Number of failed attempts to pull a resync
+	 */
+	u_int attempts;
+
+	/**
+	 * Progress counters, indexed by segment - 1
+	 */
+	ha_stream_progress_t progress[SEGMENTS_MAX];
+
+	/**
+	 * Mutex to lock progress counters
+	 */
+	mutex_t *mutex;
+};
+
+/**
+ * A buffered stream connection to the other node
+ */
+typedef struct {
+	/** connected socket */
+	int fd;
+	/** number of bytes in send buffer */
+	size_t out_len;
+	/** offset of unread data in receive buffer */
+	size_t in_pos;
+	/** number of bytes in receive buffer */
+	size_t in_len;
+	/** send buffer */
+	u_char out[BUFFER_SIZE];
+	/** receive buffer */
+	u_char in[BUFFER_SIZE];
+	/** buffer for a received record */
+	u_char record[0xFFFF];
+} conn_t;
+
+/**
+ * Segment to push asynchronously
+ */
+typedef struct {
+	/** stream instance */
+	private_ha_stream_t *this;
+	/** segment to push */
+	u_int segment;
+} push_data_t;
+
+/**
+ * Create a connection, apply timeouts to the socket
+ */
+static conn_t *conn_create(int fd)
+{
+	struct timeval tv = {
+		.tv_sec = STREAM_TIMEOUT,
+	};
+	conn_t *conn;
+
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == -1 ||
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) == -1)
+	{
+		DBG1(DBG_CFG, "setting HA stream timeouts failed: %s",
+			 strerror(errno));
+	}
+	conn = malloc_thing(conn_t);
+	conn->fd = fd;
+	conn->out_len = conn->in_pos = conn->in_len = 0;
+	return conn;
+}
+
+/**
+ * Close and destroy a connection
+ */
+static void conn_destroy(conn_t *conn)
+{
+	close(conn->fd);
+	free(conn);
+}
+
+/**
+ * Send all buffered data
+ */
+static bool conn_flush(conn_t *conn)
+{
+	size_t done = 0;
+	ssize_t len;
+	bool oldstate;
+
+	while (done < conn->out_len)
+	{
+		oldstate = thread_cancelability(TRUE);
+		len = send(conn->fd, conn->out + done, conn->out_len - done,
+				   MSG_NOSIGNAL);
+		thread_cancelability(oldstate);
+		if (len <= 0)
+		{
+			if (len == -1 && errno == EINTR)
+			{
+				continue;
+			}
+			DBG1(DBG_CFG, "sending to HA stream failed: %s",
+				 len ? strerror(errno) : "connection closed");
+			return FALSE;
+		}
+		done += len;
+	}
+	conn->out_len = 0;
+	return TRUE;
+}
+
+/**
+ * Buffer an encoded message, prefixed by its length
+ */
+static bool conn_send(conn_t *conn, chunk_t data)
+{
+	if (data.len > 0xFFFF)
+	{
+		DBG1(DBG_CFG, "HA message too large for stream, dropped");
+		return TRUE;
+	}
+	if (conn->out_len + RECORD_HEADER_LEN + data.len > BUFFER_SIZE &&
+		!conn_flush(conn))
+	{
+		return FALSE;
+	}
+	htoun16(conn->out + conn->out_len, data.len);
+	memcpy(conn->out + conn->out_len + RECORD_HEADER_LEN, data.ptr, data.len);
+	conn->out_len += RECORD_HEADER_LEN + data.len;
+	return TRUE;
+}
+
+/**
+ * Read a number of bytes from a connection
+ */
+static bool conn_read(conn_t *conn, u_char *buf, size_t len)
+{
+	ssize_t got;
+	size_t copy;
+	bool oldstate;
+
+	while (len)
+	{
+		if (conn->in_pos == conn->in_len)
+		{
+			oldstate = thread_cancelability(TRUE);
+			got = recv(conn->fd, conn->in, sizeof(conn->in), 0);
+			thread_cancelability(oldstate);
+			if (got <= 0)
+			{
+				if (got == -1 && errno == EINTR)
+				{
+					continue;
+				}
+				if (got == -1)
+				{
+					DBG1(DBG_CFG, "receiving from HA stream failed: %s",
+						 strerror(errno));
+				}
+				return FALSE;
+			}
+			conn->in_pos = 0;
+			conn->in_len = got;
+		}
+		copy = min(len, conn->in_len - conn->in_pos);
+		memcpy(buf, conn->in + conn->in_pos, copy);
+		conn->in_pos += copy;
+		buf += copy;
+		len -= copy;
+	}
+	return TRUE;
+}
+
+/**
+ * Receive the next message of a connection, NULL if closed or invalid
+ */
+static ha_message_t *conn_receive(conn_t *conn, size_t *bytes)
+{
+	u_int16_t len;
+
+	if (!conn_read(conn, (u_char*)&len, sizeof(len)))
+	{
+		return NULL;
+	}
+	len = ntohs(len);
+	if (!conn_read(conn, conn->record, len))
+	{
+		return NULL;
+	}
+	*bytes = RECORD_HEADER_LEN + len;
+	return ha_message_parse(chunk_create(conn->record, len));
+}
+
+/**
+ * Send a mark for a segment, with the sequence of the last IKE_SA sent or
+ * without sequence if the segment is complete
+ */
+static bool send_mark(conn_t *conn, u_int segment, u_int32_t seq)
+{
+	ha_message_t *message;
+	bool success;
+
+	message = ha_message_create(HA_RESYNC_MARK);
+	message->add_attribute(message, HA_SEGMENT, segment);
+	if (seq)
+	{
+		message->add_attribute(message, HA_SEQUENCE, seq);
+	}
+	success = conn_send(conn, message->get_encoding(message));
+	message->destroy(message);
+	return success;
+}
+
+/**
+ * Delay sending to stay within the configured rate
+ */
+static bool pace(private_ha_stream_t *this, conn_t *conn, timeval_t *start,
+				 u_int sent)
+{
+	timeval_t now;
+	u_int64_t due, elapsed;
+	bool oldstate;
+
+	time_monotonic(&now);
+	timersub(&now, start, &now);
+	elapsed = now.tv_sec * 1000000ULL + now.tv_usec;
+	due = sent * 1000000ULL / this->rate;
+	if (due > elapsed)
+	{
+		if (!conn_flush(conn))
+		{
+			return FALSE;
+		}
+		oldstate = thread_cancelability(TRUE);
+		usleep(due - elapsed);
+		thread_cancelability(oldstate);
+	}
+	return TRUE;
+}
+
+/**
+ * Stream the cached IKE_SAs of a segment following a sequence number
+ */
+static bool send_segment(private_ha_stream_t *this, conn_t *conn,
+						 u_int segment, u_int32_t after)
+{
+	ha_stream_progress_t *progress;
+	enumerator_t *enumerator;
+	timeval_t start;
+	chunk_t encoding;
+	u_int32_t seq, last = 0;
+	u_int sent = 0;
+	bool success = TRUE;
+
+	DBG1(DBG_CFG, "streaming HA segment %d to %H", segment, this->remote);
+
+	progress = &this->progress[segment - 1];
+	if (!after)
+	{
+		this->mutex->lock(this->mutex);
+		progress->sent = 0;
+		progress->bytes_out = 0;
+		this->mutex->unlock(this->mutex);
+	}
+	time_monotonic(&start);
+
+	enumerator = this->cache->create_stream_enumerator(this->cache, segment,
+													   after);
+	thread_cleanup_push((thread_cleanup_t)enumerator->destroy, enumerator);
+	while (enumerator->enumerate(enumerator, &seq, &encoding))
+	{
+		if (seq != last && last)
+		{
+			if (!send_mark(conn, segment, last))
+			{
+				success = FALSE;
+				break;
+			}
+			this->mutex->lock(this->mutex);
+			progress->sent++;
+			this->mutex->unlock(this->mutex);
+			if (this->rate && !pace(this, conn, &start, ++sent))
+			{
+				success = FALSE;
+				break;
+			}
+		}
+		last = seq;
+		if (!conn_send(conn, encoding))
+		{
+			success = FALSE;
+			break;
+		}
+		this->mutex->lock(this->mutex);
+		progress->bytes_out += RECORD_HEADER_LEN + encoding.len;
+		this->mutex->unlock(this->mutex);
+	}
+	thread_cleanup_pop(TRUE);
+
+	if (success && last)
+	{
+		success = send_mark(conn, segment, last);
+		if (success)
+		{
+			this->mutex->lock(this->mutex);
+			progress->sent++;
+			this->mutex->unlock(this->mutex);
+		}
+	}
+	success = success && send_mark(conn, segment, 0) && conn_flush(conn);
+	if (success)
+	{
+		DBG1(DBG_CFG, "streamed HA segment %d, %u IKE_SAs", segment,
+			 progress->sent);
+	}
+	else
+	{
+		DBG1(DBG_CFG, "streaming HA segment %d interrupted", segment);
+	}
+	return success;
+}
+
+/**
+ * Stream the segments requested by a HA_RESYNC message
+ */
+static segment_mask_t serve(private_ha_stream_t *this, conn_t *conn,
+							ha_message_t *message)
+{
+	ha_message_attribute_t attribute;
+	ha_message_value_t value;
+	enumerator_t *enumerator;
+	u_int32_t after[SEGMENTS_MAX] = {};
+	segment_mask_t requested = 0, done = 0;
+	u_int segment = 0;
+
+	enumerator = message->create_attribute_enumerator(message);
+	while (enumerator->enumerate(enumerator, &attribute, &value))
+	{
+		switch (attribute)
+		{
+			case HA_SEGMENT:
+				segment = value.u16;
+				if (segment < 1 || segment > this->count)
+				{
+					segment = 0;
+					break;
+				}
+				requested |= SEGMENTS_BIT(segment);
+				break;
+			case HA_SEQUENCE:
+				/* resume cursor of the preceding segment */
+				if (segment)
+				{
+					after[segment - 1] = value.u32;
+				}
+				break;
+			default:
+				break;
+		}
+	}
+	enumerator->destroy(enumerator);
+	message->destroy(message);
+
+	for (segment = 1; segment <= this->count; segment++)
+	{
+		if (requested & SEGMENTS_BIT(segment))
+		{
+			if (!send_segment(this, conn, segment, after[segment - 1]))
+			{
+				break;
+			}
+			done |= SEGMENTS_BIT(segment);
+		}
+	}
+	return done;
+}
+
+/**
+ * Process a resync mark, returns the sequence of the completed IKE_SA, 0 if
+ * the segment is complete or the mark invalid
+ */
+static u_int32_t process_mark(private_ha_stream_t *this, ha_message_t *message,
+							  size_t bytes)
+{
+	ha_message_attribute_t attribute;
+	ha_message_value_t value;
+	enumerator_t *enumerator;
+	ha_stream_progress_t *progress;
+	u_int segment = 0;
+	u_int32_t seq = 0;
+
+	enumerator = message->create_attribute_enumerator(message);
+	while (enumerator->enumerate(enumerator, &attribute, &value))
+	{
+		switch (attribute)
+		{
+			case HA_SEGMENT:
+				segment = value.u16;
+				break;
+			case HA_SEQUENCE:
+				seq = value.u32;
+				break;
+			default:
+				break;
+		}
+	}
+	enumerator->destroy(enumerator);
+	message->destroy(message);
+
+	if (segment < 1 || segment > this->count)
+	{
+		DBG1(DBG_CFG, "received HA resync mark for invalid segment %d",
+			 segment);
+		return 0;
+	}
+	progress = &this->progress[segment - 1];
+
+	this->mutex->lock(this->mutex);
+	progress->bytes_in += bytes;
+	if (seq)
+	{
+		if (progress->state != HA_STREAM_RUNNING)
+		{
+			if (progress->state == HA_STREAM_COMPLETE)
+			{	/* resync pushed by the other node */
+				progress->received = 0;
+				progress->bytes_in = bytes;
+			}
+			progress->state = HA_STREAM_RUNNING;
+		}
+		progress->cursor = seq;
+		progress->received++;
+	}
+	else
+	{
+		progress->state = HA_STREAM_COMPLETE;
+		progress->cursor = 0;
+		DBG1(DBG_CFG, "resynced HA segment %d, %u IKE_SAs", segment,
+			 progress->received);
+	}
+	this->mutex->unlock(this->mutex);
+	return seq;
+}
+
+/**
+ * Destroy the buffered messages of an incompletely received IKE_SA
+ */
+static void destroy_buffered(linked_list_t *buffered)
+{
+	buffered->destroy_offset(buffered, offsetof(ha_message_t, destroy));
+}
+
+/**
+ * Release the hold on live updates of the dispatcher
+ */
+static void release_hold(private_ha_stream_t *this)
+{
+	this->dispatcher->hold(this->dispatcher, FALSE);
+}
+
+/**
+ * Process the messages received on a connection until it gets closed.
+ *
+ * The messages of an IKE_SA are buffered until its mark arrives, so an
+ * interrupted transfer resumed after the last mark does not process any of
+ * them twice. Live updates received over the HA socket are held back until
+ * the stream ends, so they get applied over the streamed state.
+ */
+static void receive(private_ha_stream_t *this, conn_t *conn,
+					ha_message_t *message, size_t bytes)
+{
+	linked_list_t *buffered;
+	size_t pending = 0;
+	int i;
+
+	buffered = linked_list_create();
+	this->dispatcher->hold(this->dispatcher, TRUE);
+	thread_cleanup_push((thread_cleanup_t)release_hold, this);
+	thread_cleanup_push((thread_cleanup_t)destroy_buffered, buffered);
+	while (message)
+	{
+		pending += bytes;
+		if (message->get_type(message) == HA_RESYNC_MARK)
+		{
+			if (process_mark(this, message, pending))
+			{
+				while (buffered->remove_first(buffered,
+											  (void**)&message) == SUCCESS)
+				{
+					this->dispatcher->process(this->dispatcher, message);
+				}
+			}
+			else
+			{	/* end of segment, no IKE_SA pending */
+				while (buffered->remove_first(buffered,
+											  (void**)&message) == SUCCESS)
+				{
+					message->destroy(message);
+				}
+			}
+			pending = 0;
+		}
+		else
+		{
+			buffered->insert_last(buffered, message);
+		}
+		message = conn_receive(conn, &bytes);
+	}
+	if (buffered->get_count(buffered))
+	{
+		DBG1(DBG_CFG, "discarding %d HA messages of incompletely received "
+			 "IKE_SA", buffered->get_count(buffered));
+	}
+	thread_cleanup_pop(TRUE);
+	thread_cleanup_pop(TRUE);
+
+	this->mutex->lock(this->mutex);
+	for (i = 0; i < this->count; i++)
+	{
+		if (this->progress[i].state == HA_STREAM_RUNNING)
+		{
+			DBG1(DBG_CFG, "resyncing HA segment %d interrupted after %u "
+				 "IKE_SAs", i + 1, this->progress[i].received);
+			this->progress[i].state = HA_STREAM_INTERRUPTED;
+		}
+	}
+	this->mutex->unlock(this->mutex);
+}
+
+/**
+ * Rekey the CHILD_SAs of streamed segments
+ */
+static void rekey(private_ha_stream_t *this, segment_mask_t segments)
+{
+	u_int segment;
+
+	for (segment = 1; segment <= this->count; segment++)
+	{
+		if (segments & SEGMENTS_BIT(segment))
+		{
+			this->cache->rekey(this->cache, segment);
+		}
+	}
+}
+
+/**
+ * Open a stream connection to the other node, -1 on failure
+ */
+static int connect_stream(private_ha_stream_t *this)
+{
+	host_t *local;
+	bool oldstate;
+	int fd, err;
+
+	fd = socket(this->remote->get_family(this->remote), SOCK_STREAM, 0);
+	if (fd == -1)
+	{
+		DBG1(DBG_CFG, "opening HA stream socket failed: %s", strerror(errno));
+		return -1;
+	}
+	/* connect from our HA address, as the other node accepts no other */
+	local = this->local->clone(this->local);
+	local->set_port(local, 0);
+	if (bind(fd, local->get_sockaddr(local),
+			 *local->get_sockaddr_len(local)) == -1)
+	{
+		err = errno;
+		DBG1(DBG_CFG, "binding HA stream socket failed: %s", strerror(err));
+		local->destroy(local);
+		close(fd);
+		errno = err;
+		return -1;
+	}
+	local->destroy(local);
+
+	oldstate = thread_cancelability(TRUE);
+	err = connect(fd, this->remote->get_sockaddr(this->remote),
+				  *this->remote->get_sockaddr_len(this->remote));
+	thread_cancelability(oldstate);
+	if (err == -1)
+	{
+		err = errno;
+		DBG1(DBG_CFG, "connecting HA stream to %H failed: %s",
+			 this->remote, strerror(err));
+		close(fd);
+		errno = err;
+		return -1;
+	}
+	return fd;
+}
+
+/**
+ * Request a datagram based resync for all incomplete segments
+ */
+static void fallback(private_ha_stream_t *this)
+{
+	ha_message_t *message;
+	int i;
+
+	DBG1(DBG_CFG, "requesting HA resynchronization without stream");
+
+	message = ha_message_create(HA_RESYNC);
+	this->mutex->lock(this->mutex);
+	for (i = 0; i < this->count; i++)
+	{
+		if (this->progress[i].state != HA_STREAM_COMPLETE)
+		{
+			this->progress[i].state = HA_STREAM_IDLE;
+			message->add_attribute(message, HA_SEGMENT, i + 1);
+		}
+	}
+	this->mutex->unlock(this->mutex);
+	this->socket->push(this->socket, message);
+	message->destroy(message);
+}
+
+static job_requeue_t pull(private_ha_stream_t *this);
+
+/**
+ * Schedule a job pulling a resync from the other node
+ */
+static void schedule_pull(private_ha_stream_t *this, u_int delay)
+{
+	lib->scheduler->schedule_job(lib->scheduler, (job_t*)
+			callback_job_create_with_prio((callback_job_cb_t)pull, this,
+				NULL, (callback_job_cancel_t)return_false, JOB_PRIO_CRITICAL),
+			delay);
+}
+
+/**
+ * Request the incomplete segments from the other node and receive them
+ */
+static job_requeue_t pull(private_ha_stream_t *this)
+{
+	ha_message_t *message;
+	conn_t *conn;
+	size_t bytes = 0;
+	bool complete = TRUE;
+	int i, fd;
+
+	message = ha_message_create(HA_RESYNC);
+	this->mutex->lock(this->mutex);
+	for (i = 0; i < this->count; i++)
+	{
+		if (this->progress[i].state != HA_STREAM_COMPLETE)
+		{
+			message->add_attribute(message, HA_SEGMENT, i + 1);
+			if (this->progress[i].cursor)
+			{
+				message->add_attribute(message, HA_SEQUENCE,
+									   this->progress[i].cursor);
+			}
+			else
+			{
+				this->progress[i].received = 0;
+				this->progress[i].bytes_in = 0;
+			}
+			this->progress[i].state = HA_STREAM_RUNNING;
+			complete = FALSE;
+		}
+	}
+	this->mutex->unlock(this->mutex);
+	if (complete)
+	{
+		message->destroy(message);
+		return JOB_REQUEUE_NONE;
+	}
+
+	DBG1(DBG_CFG, "requesting HA resynchronization stream");
+
+	fd = connect_stream(this);
+	if (fd == -1)
+	{
+		message->destroy(message);
+		if (errno == ECONNREFUSED || ++this->attempts > STREAM_RETRY_MAX)
+		{	/* other node does not stream or is unreachable */
+			fallback(this);
+		}
+		else
+		{
+			schedule_pull(this, STREAM_RETRY_INTERVAL);
+		}
+		return JOB_REQUEUE_NONE;
+	}
+
+	conn = conn_create(fd);
+	thread_cleanup_push((thread_cleanup_t)conn_destroy, conn);
+	if (conn_send(conn, message->get_encoding(message)) && conn_flush(conn))
+	{
+		message->destroy(message);
+		message = conn_receive(conn, &bytes);
+	}
+	else
+	{
+		message->destroy(message);
+		message = NULL;
+	}
+	receive(this, conn, message, bytes);
+	thread_cleanup_pop(TRUE);
+
+	complete = TRUE;
+	this->mutex->lock(this->mutex);
+	for (i = 0; i < this->count; i++)
+	{
+		if (this->progress[i].state != HA_STREAM_COMPLETE)
+		{
+			this->progress[i].state = HA_STREAM_INTERRUPTED;
+			complete = FALSE;
+		}
+	}
+	this->mutex->unlock(this->mutex);
+
+	if (!complete)
+	{
+		if (++this->attempts > STREAM_RETRY_MAX)
+		{
+			fallback(this);
+		}
+		else
+		{
+			schedule_pull(this, STREAM_RETRY_INTERVAL);
+		}
+	}
+	return JOB_REQUEUE_NONE;
+}
+
+/**
+ * Accept and handle a stream connection from the other node
+ */
+static job_requeue_t accept_stream(private_ha_stream_t *this)
+{
+	union {
+		struct sockaddr_storage ss;
+		sockaddr_t sa;
+	} addr;
+	socklen_t addrlen = sizeof(addr);
+	ha_message_t *message;
+	segment_mask_t done = 0;
+	conn_t *conn;
+	host_t *host;
+	size_t bytes;
+	bool oldstate;
+	int fd;
+
+	oldstate = thread_cancelability(TRUE);
+	fd = accept(this->fd, &addr.sa, &addrlen);
+	thread_cancelability(oldstate);
+	if (fd == -1)
+	{
+		DBG1(DBG_CFG, "accepting HA stream failed: %s", strerror(errno));
+		sleep(1);
+		return JOB_REQUEUE_FAIR;
+	}
+	host = host_create_from_sockaddr(&addr.sa);
+	if (!host || !host->ip_equals(host, this->remote))
+	{
+		DBG1(DBG_CFG, "rejecting HA stream from %H", host);
+		DESTROY_IF(host);
+		close(fd);
+		return JOB_REQUEUE_FAIR;
+	}
+	host->destroy(host);
+
+	conn = conn_create(fd);
+	thread_cleanup_push((thread_cleanup_t)conn_destroy, conn);
+	message = conn_receive(conn, &bytes);
+	if (message)
+	{
+		if (message->get_type(message) == HA_RESYNC)
+		{
+			done = serve(this, conn, message);
+		}
+		else
+		{
+			receive(this, conn, message, bytes);
+		}
+	}
+	thread_cleanup_pop(TRUE);
+
+	/* the kernel state of CHILD_SAs is not cached, rekey them */
+	rekey(this, done);
+	return JOB_REQUEUE_FAIR;
+}
+
+/**
+ * Push a segment to the other node
+ */
+static job_requeue_t push_segment(push_data_t *data)
+{
+	private_ha_stream_t *this = data->this;
+	segment_mask_t done = 0;
+	conn_t *conn;
+	int fd;
+
+	fd = connect_stream(this);
+	if (fd == -1)
+	{
+		return JOB_REQUEUE_NONE;
+	}
+	conn = conn_create(fd);
+	thread_cleanup_push((thread_cleanup_t)conn_destroy, conn);
+	if (send_segment(this, conn, data->segment, 0))
+	{
+		done = SEGMENTS_BIT(data->segment);
+	}
+	thread_cleanup_pop(TRUE);
+
+	rekey(this, done);
+	return JOB_REQUEUE_NONE;
+}
+
+METHOD(ha_stream_t, push, void,
+	private_ha_stream_t *this, u_int segment)
+{
+	push_data_t *data;
+
+	if (segment < 1 || segment > this->count)
+	{
+		return;
+	}
+	INIT(data,
+		.this = this,
+		.segment = segment,
+	);
+	lib->processor->queue_job(lib->processor,
+		(job_t*)callback_job_create_with_prio((callback_job_cb_t)push_segment,
+			data, free, (callback_job_cancel_t)return_false,
+			JOB_PRIO_CRITICAL));
+}
+
+METHOD(ha_stream_t, get_progress, bool,
+	private_ha_stream_t *this, u_int segment, ha_stream_progress_t *progress)
+{
+	if (segment < 1 || segment > this->count)
+	{
+		return FALSE;
+	}
+	this->mutex->lock(this->mutex);
+	*progress = this->progress[segment - 1];
+	this->mutex->unlock(this->mutex);
+	return TRUE;
+}
+
+METHOD(ha_stream_t, destroy, void,
+	private_ha_stream_t *this)
+{
+	if (this->fd != -1)
+	{
+		close(this->fd);
+	}
+	DESTROY_IF(this->local);
+	DESTROY_IF(this->remote);
+	this->mutex->destroy(this->mutex);
+	free(this);
+}
+
+/**
+ * Open the listening socket
+ */
+static bool open_socket(private_ha_stream_t *this)
+{
+	int on = TRUE;
+
+	this->fd = socket(this->local->get_family(this->local), SOCK_STREAM, 0);
+	if (this->fd == -1)
+	{
+		DBG1(DBG_CFG, "opening HA stream socket failed: %s", strerror(errno));
+		return FALSE;
+	}
+	if (setsockopt(this->fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) == -1)
+	{
+		DBG1(DBG_CFG, "setting SO_REUSEADDR on HA stream socket failed: %s",
+			 strerror(errno));
+	}
+	if (bind(this->fd, this->local->get_sockaddr(this->local),
+			 *this->local->get_sockaddr_len(this->local)) == -1 ||
+		listen(this->fd, 1) == -1)
+	{
+		DBG1(DBG_CFG, "binding HA stream socket failed: %s", strerror(errno));
+		close(this->fd);
+		this->fd = -1;
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+ * See header
+ */
+ha_stream_t *ha_stream_create(char *local, char *remote, ha_socket_t *socket,
+							  ha_cache_t *cache, ha_dispatcher_t *dispatcher,
+							  bool resync, u_int count)
+{
+	private_ha_stream_t *this;
+
+	INIT(this,
+		.public = {
+			.push = _push,
+			.get_progress = _get_progress,
+			.destroy = _destroy,
+		},
+		.local = host_create_from_dns(local, 0, HA_PORT),
+		.remote = host_create_from_dns(remote, 0, HA_PORT),
+		.fd = -1,
+		.socket = socket,
+		.cache = cache,
+		.dispatcher = dispatcher,
+		.count = count,
+		.rate = lib->settings->get_int(lib->settings,
+						"%s.plugins.ha.resync_rate", 0, charon->name),
+		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
+	);
+
+	if (!this->local || !this->remote)
+	{
+		DBG1(DBG_CFG, "invalid local/remote HA address");
+		destroy(this);
+		return NULL;
+	}
+	/* without listening we still can pull a resync from the other node */
+	if (open_socket(this))
+	{
+		lib->processor->queue_job(lib->processor,
+			(job_t*)callback_job_create_with_prio(
+				(callback_job_cb_t)accept_stream, this, NULL,
+				(callback_job_cancel_t)return_false, JOB_PRIO_CRITICAL));
+	}
+
+	if (resync)
+	{
+		/* request a resync as soon as we are up */
+		schedule_pull(this, 1);
+	}
+	return &this->public;
+}
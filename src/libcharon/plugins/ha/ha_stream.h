@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2013 strongSwan Project
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/**
+ * @defgroup ha_stream ha_stream
+ * @{ @ingroup ha
+ */
+
+#ifndef HA_STREAM_H_
+#define HA_STREAM_H_
+
+#include "ha_socket.h"
+#include "ha_cache.h"
+#include "ha_dispatcher.h"
+
+typedef struct ha_stream_t ha_stream_t;
+typedef struct ha_stream_progress_t ha_stream_progress_t;
+typedef enum ha_stream_state_t ha_stream_state_t;
+
+/**
+ * State of a segment resync received over a stream
+ */
+enum ha_stream_state_t {
+	/** no resync of this segment received */
+	HA_STREAM_IDLE,
+	/** segment is currently being received */
+	HA_STREAM_RUNNING,
+	/** transfer got interrupted, resumed at the cursor */
+	HA_STREAM_INTERRUPTED,
+	/** all cached IKE_SAs of the segment received */
+	HA_STREAM_COMPLETE,
+};
+
+/**
+ * Enum names for ha_stream_state_t
+ */
+extern enum_name_t *ha_stream_state_names;
+
+/**
+ * Resync progress counters of a segment
+ */
+struct ha_stream_progress_t {
+	/** state of the resync we receive */
+	ha_stream_state_t state;
+	/** sequence number of the last IKE_SA received, resume cursor */
+	u_int32_t cursor;
+	/** number of IKE_SAs received */
+	u_int received;
+	/** number of bytes received */
+	u_int64_t bytes_in;
+	/** number of IKE_SAs sent to the other node */
+	u_int sent;
+	/** number of bytes sent to the other node */
+	u_int64_t bytes_out;
+};
+
+/**
+ * Bulk resynchronization of segments over a TCP stream.
+ *
+ * Instead of replaying cached messages as individual datagrams, the node
+ * to resync connects to the other node, which streams the cached messages
+ * of the requested segments. Marks in the stream let the receiver resume an
+ * interrupted transfer after the last completely received IKE_SA.
+ */
+struct ha_stream_t {
+
+	/**
+	 * Stream the cached state of a segment to the other node.
+	 *
+	 * The transfer is done asynchronously.
+	 *
+	 * @param segment		segment to resync
+	 */
+	void (*push)(ha_stream_t *this, u_int segment);
+
+	/**
+	 * Get the resync progress counters of a segment.
+	 *
+	 * @param segment		segment to get counters for
+	 * @param progress		receives progress counters
+	 * @return				TRUE if segment valid
+	 */
+	bool (*get_progress)(ha_stream_t *this, u_int segment,
+						 ha_stream_progress_t *progress);
+
+	/**
+	 * Destroy a ha_stream_t.
+	 */
+	void (*destroy)(ha_stream_t *this);
+};
+
+/**
+ * Create a ha_stream instance.
+ *
+ * @param local			local address of HA stream
+ * @param remote		remote address of HA stream
+ * @param socket		socket to request a resync if the stream fails
+ * @param cache			message cache to stream segments from
+ * @param dispatcher	dispatcher to process received messages
+ * @param resync		request a resync during startup?
+ * @param count			total number of segments
+ * @return				HA stream instance, NULL on failure
+ */
+ha_stream_t *ha_stream_create(char *local, char *remote, ha_socket_t *socket,
+							  ha_cache_t *cache, ha_dispatcher_t *dispatcher,
+							  bool resync, u_int count);
+
+#endif /** HA_STREAM_H_ @}*/
@@ -81,6 +81,11 @@ struct private_ha_tunnel_t {
 	 */
 	u_int32_t trap;
 
+	/**
+	 * Reqids of installed traps for outgoing/incoming stream connections
+	 */
+	u_int32_t stream_traps[2];
+
 	/**
 	 * backend for HA SA
 	 */
@@ -172,17 +177,41 @@ METHOD(backend_t, create_ike_cfg_enumerator, enumerator_t*,
 	return enumerator_create_single(this->cfg->get_ike_cfg(this->cfg), NULL);
 }
 
+/**
+ * Create a CHILD_SA config for HA stream connections in one direction
+ */
+static child_cfg_t *create_stream_cfg(lifetime_cfg_t *lifetime, bool outgoing)
+{
+	child_cfg_t *child_cfg;
+	traffic_selector_t *ts;
+
+	child_cfg = child_cfg_create(outgoing ? "ha-stream-out" : "ha-stream-in",
+								 lifetime, NULL, TRUE, MODE_TRANSPORT,
+								 ACTION_NONE, ACTION_NONE, ACTION_NONE, FALSE,
+								 0, 0, NULL, NULL, 0);
+	/* the connecting node uses an ephemeral port, the other one HA_PORT */
+	ts = traffic_selector_create_dynamic(IPPROTO_TCP, outgoing ? 0 : HA_PORT,
+										 outgoing ? 65535 : HA_PORT);
+	child_cfg->add_traffic_selector(child_cfg, TRUE, ts);
+	ts = traffic_selector_create_dynamic(IPPROTO_TCP, outgoing ? HA_PORT : 0,
+										 outgoing ? HA_PORT : 65535);
+	child_cfg->add_traffic_selector(child_cfg, FALSE, ts);
+	child_cfg->add_proposal(child_cfg, proposal_create_default(PROTO_ESP));
+	return child_cfg;
+}
+
 /**
  * Install configs and a a trap for secured HA message exchange
  */
 static void setup_tunnel(private_ha_tunnel_t *this,
-						 char *local, char *remote, char *secret)
+						 char *local, char *remote, char *secret, bool stream)
 {
 	peer_cfg_t *peer_cfg;
 	ike_cfg_t *ike_cfg;
 	auth_cfg_t *auth_cfg;
-	child_cfg_t *child_cfg;
+	child_cfg_t *child_cfg, *stream_cfgs[2] = {};
 	traffic_selector_t *ts;
+	int i;
 	lifetime_cfg_t lifetime = {
 		.time = {
 			.life = 21600, .rekey = 20400, .jitter = 400,
@@ -236,6 +265,15 @@ static void setup_tunnel(private_ha_tunnel_t *this,
 	child_cfg->add_traffic_selector(child_cfg, FALSE, ts);
 	child_cfg->add_proposal(child_cfg, proposal_create_default(PROTO_ESP));
 	peer_cfg->add_child_cfg(peer_cfg, child_cfg);
+	if (stream)
+	{	/* either node connects to HA_PORT of the other, as the traffic
+		 * selectors of a CHILD_SA combine, use one for each direction */
+		for (i = 0; i < countof(stream_cfgs); i++)
+		{
+			stream_cfgs[i] = create_stream_cfg(&lifetime, i == 0);
+			peer_cfg->add_child_cfg(peer_cfg, stream_cfgs[i]);
+		}
+	}
 
 	this->backend.cfg = peer_cfg;
 	this->backend.public.create_peer_cfg_enumerator = (void*)_create_peer_cfg_enumerator;
@@ -246,11 +284,21 @@ static void setup_tunnel(private_ha_tunnel_t *this,
 
 	/* install an acquiring trap */
 	this->trap = charon->traps->install(charon->traps, peer_cfg, child_cfg);
+	for (i = 0; i < countof(stream_cfgs); i++)
+	{
+		if (stream_cfgs[i])
+		{
+			this->stream_traps[i] = charon->traps->install(charon->traps,
+												peer_cfg, stream_cfgs[i]);
+		}
+	}
 }
 
 METHOD(ha_tunnel_t, destroy, void,
 	private_ha_tunnel_t *this)
 {
+	int i;
+
 	if (this->backend.cfg)
 	{
 		charon->backends->remove_backend(charon->backends, &this->backend.public);
@@ -267,13 +315,21 @@ METHOD(ha_tunnel_t, destroy, void,
 	{
 		charon->traps->uninstall(charon->traps, this->trap);
 	}
+	for (i = 0; i < countof(this->stream_traps); i++)
+	{
+		if (this->stream_traps[i])
+		{
+			charon->traps->uninstall(charon->traps, this->stream_traps[i]);
+		}
+	}
 	free(this);
 }
 
 /**
  * See header
  */
-ha_tunnel_t *ha_tunnel_create(char *local, char *remote, char *secret)
+ha_tunnel_t *ha_tunnel_create(char *local, char *remote, char *secret,
+							  bool stream)
 {
 	private_ha_tunnel_t *this;
 
@@ -284,7 +340,7 @@ ha_tunnel_t *ha_tunnel_create(char *local, char *remote, char *secret)
 		},
 	);
 
-	setup_tunnel(this, local, remote, secret);
+	setup_tunnel(this, local, remote, secret, stream);
 
 	return &this->public;
 }
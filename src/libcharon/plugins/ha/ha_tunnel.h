@@ -50,8 +50,10 @@ struct ha_tunnel_t {
  * @param local		local address of HA tunnel
  * @param remote	remote address of HA tunnel
  * @param secret	PSK tunnel authentication secret
+ * @param stream	also protect TCP resync streams
  * @return			HA tunnel instance
  */
-ha_tunnel_t *ha_tunnel_create(char *local, char *remote, char *secret);
+ha_tunnel_t *ha_tunnel_create(char *local, char *remote, char *secret,
+							  bool stream);
 
 #endif /** HA_TUNNEL_H_ @}*/
@@ -19,6 +19,7 @@
 
 #include <daemon.h>
 #include <processing/jobs/delete_ike_sa_job.h>
+#include <threading/mutex.h>
 
 typedef struct private_load_tester_listener_t private_load_tester_listener_t;
 
@@ -55,6 +56,11 @@ struct private_load_tester_listener_t {
 	 * Configuration backend
 	 */
 	load_tester_config_t *config;
+
+	/**
+	 * Mutex to update counters, hooks get invoked concurrently
+	 */
+	mutex_t *mutex;
 };
 
 METHOD(listener_t, ike_updown, bool,
@@ -63,8 +69,11 @@ METHOD(listener_t, ike_updown, bool,
 	if (up)
 	{
 		ike_sa_id_t *id = ike_sa->get_id(ike_sa);
+		u_int established;
 
-		this->established++;
+		this->mutex->lock(this->mutex);
+		established = ++this->established;
+		this->mutex->unlock(this->mutex);
 
 		if (this->delete_after_established)
 		{
@@ -74,7 +83,7 @@ METHOD(listener_t, ike_updown, bool,
 
 		if (id->is_initiator(id))
 		{
-			if (this->shutdown_on == this->established)
+			if (this->shutdown_on == established)
 			{
 				DBG1(DBG_CFG, "load-test complete, raising SIGTERM");
 				kill(0, SIGTERM);
@@ -83,7 +92,9 @@ METHOD(listener_t, ike_updown, bool,
 	}
 	else
 	{
+		this->mutex->lock(this->mutex);
 		this->terminated++;
+		this->mutex->unlock(this->mutex);
 	}
 	return TRUE;
 }
@@ -101,12 +112,18 @@ METHOD(listener_t, ike_state_change, bool,
 METHOD(load_tester_listener_t, get_established, u_int,
 	private_load_tester_listener_t *this)
 {
-	return this->established - this->terminated;
+	u_int established;
+
+	this->mutex->lock(this->mutex);
+	established = this->established - this->terminated;
+	this->mutex->unlock(this->mutex);
+	return established;
 }
 
 METHOD(load_tester_listener_t, destroy, void,
 	private_load_tester_listener_t *this)
 {
+	this->mutex->destroy(this->mutex);
 	free(this);
 }
 
@@ -129,6 +146,7 @@ load_tester_listener_t *load_tester_listener_create(u_int shutdown_on,
 					charon->name),
 		.shutdown_on = shutdown_on,
 		.config = config,
+		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
 	);
 
 	return &this->public;
@@ -44,10 +44,19 @@
 #include <hydra.h>
 #include <daemon.h>
 #include <threading/thread.h>
+#include <threading/thread_value.h>
+#include <threading/mutex.h>
+#include <collections/linked_list.h>
 
 /* Maximum size of a packet */
 #define MAX_PACKET 10000
 
+/* Maximum number of packets read with a single system call */
+#define RECEIVE_BATCH 16
+
+/* Maximum number of packets sent with a single system call */
+#define SEND_BATCH 32
+
 /* these are not defined on some platforms */
 #ifndef SOL_IP
 #define SOL_IP IPPROTO_IP
@@ -73,8 +82,101 @@
 static const struct in6_addr in6addr_any = IN6ADDR_ANY_INIT;
 #endif
 
+#if defined(HAVE_RECVMMSG) || defined(HAVE_SENDMMSG)
+typedef struct mmsghdr mmsg_t;
+#else /* !HAVE_RECVMMSG && !HAVE_SENDMMSG */
+typedef struct {
+	struct msghdr msg_hdr;
+	unsigned int msg_len;
+} mmsg_t;
+#endif /* HAVE_RECVMMSG || HAVE_SENDMMSG */
+
+/**
+ * Buffer for ancillary data to set the source address of sent packets
+ */
+typedef union {
+	struct cmsghdr align;
+#ifdef IP_PKTINFO
+	char v4[CMSG_SPACE(sizeof(struct in_pktinfo))];
+#elif defined(IP_SENDSRCADDR)
+	char v4[CMSG_SPACE(sizeof(struct in_addr))];
+#endif
+#ifdef HAVE_IN6_PKTINFO
+	char v6[CMSG_SPACE(sizeof(struct in6_pktinfo))];
+#endif
+} source_cmsg_t;
+
 typedef struct private_socket_default_socket_t private_socket_default_socket_t;
 
+/**
+ * Sockets bound to the IKE ports, for all address families
+ */
+typedef struct {
+
+	/**
+	 * IPv4 socket (500 or port)
+	 */
+	int ipv4;
+
+	/**
+	 * IPv4 socket for NAT-T (4500 or natt)
+	 */
+	int ipv4_natt;
+
+	/**
+	 * IPv6 socket (500 or port)
+	 */
+	int ipv6;
+
+	/**
+	 * IPv6 socket for NAT-T (4500 or natt)
+	 */
+	int ipv6_natt;
+
+	/**
+	 * Number of threads receiving from this set
+	 */
+	int users;
+
+} socket_set_t;
+
+/**
+ * Receive state of a single thread
+ */
+typedef struct {
+
+	/**
+	 * Socket instance
+	 */
+	private_socket_default_socket_t *socket;
+
+	/**
+	 * Socket set this thread receives from
+	 */
+	socket_set_t *set;
+
+	/**
+	 * Packets received in a batch, but not yet returned
+	 */
+	packet_t *packets[RECEIVE_BATCH];
+
+	/**
+	 * Number of packets in batch
+	 */
+	int count;
+
+	/**
+	 * Index of the next packet to return
+	 */
+	int pos;
+
+	/**
+	 * Receive buffer, RECEIVE_BATCH * max_packet bytes
+	 */
+	char *buffer;
+
+} receive_state_t;
+
 /**
  * Private data of an socket_t object
  */
@@ -96,24 +198,29 @@ struct private_socket_default_socket_t {
 	u_int16_t natt;
 
 	/**
-	 * IPv4 socket (500 or port)
+	 * Socket sets, one per receiving thread, the first is used for sending
 	 */
-	int ipv4;
+	socket_set_t *sets;
 
 	/**
-	 * IPv4 socket for NAT-T (4500 or natt)
+	 * Number of socket sets
 	 */
-	int ipv4_natt;
+	int count;
 
 	/**
-	 * IPv6 socket (500 or port)
+	 * Per-thread receive state, receive_state_t
 	 */
-	int ipv6;
+	thread_value_t *state;
 
 	/**
-	 * IPv6 socket for NAT-T (4500 or natt)
+	 * All receive states currently allocated, receive_state_t
 	 */
-	int ipv6_natt;
+	linked_list_t *states;
+
+	/**
+	 * Mutex to assign socket sets to receiving threads
+	 */
+	mutex_t *mutex;
 
 	/**
 	 * DSCP value set on IPv4 socket
@@ -146,205 +253,307 @@ struct private_socket_default_socket_t {
 	bool set_source;
 };
 
-METHOD(socket_t, receiver, status_t,
-	private_socket_default_socket_t *this, packet_t **packet)
+/**
+ * Create a packet from a received message, NULL on error
+ */
+static packet_t *build_packet(struct msghdr *msg, int len, u_int16_t port)
 {
-	char buffer[this->max_packet];
-	chunk_t data;
+	struct cmsghdr *cmsgptr;
+	host_t *source, *dest = NULL;
 	packet_t *pkt;
-	host_t *source = NULL, *dest = NULL;
-	int bytes_read = 0;
-	bool oldstate;
-
-	fd_set rfds;
-	int max_fd = 0, selected = 0;
-	u_int16_t port = 0;
-
-	FD_ZERO(&rfds);
+	chunk_t data;
 
-	if (this->ipv4 != -1)
+	if (msg->msg_flags & MSG_TRUNC)
 	{
-		FD_SET(this->ipv4, &rfds);
-		max_fd = max(max_fd, this->ipv4);
+		DBG1(DBG_NET, "receive buffer too small, packet discarded");
+		return NULL;
 	}
-	if (this->ipv4_natt != -1)
+	data = chunk_create(msg->msg_iov->iov_base, len);
+	DBG3(DBG_NET, "received packet %B", &data);
+
+	/* read ancillary data to get destination address */
+	for (cmsgptr = CMSG_FIRSTHDR(msg); cmsgptr != NULL;
+		 cmsgptr = CMSG_NXTHDR(msg, cmsgptr))
 	{
-		FD_SET(this->ipv4_natt, &rfds);
-		max_fd = max(max_fd, this->ipv4_natt);
+		if (cmsgptr->cmsg_len == 0)
+		{
+			DBG1(DBG_NET, "error reading ancillary data");
+			return NULL;
+		}
+
+#ifdef HAVE_IN6_PKTINFO
+		if (cmsgptr->cmsg_level == SOL_IPV6 &&
+			cmsgptr->cmsg_type == IPV6_PKTINFO)
+		{
+			struct in6_pktinfo *pktinfo;
+			pktinfo = (struct in6_pktinfo*)CMSG_DATA(cmsgptr);
+			struct sockaddr_in6 dst;
+
+			memset(&dst, 0, sizeof(dst));
+			memcpy(&dst.sin6_addr, &pktinfo->ipi6_addr, sizeof(dst.sin6_addr));
+			dst.sin6_family = AF_INET6;
+			dst.sin6_port = htons(port);
+			dest = host_create_from_sockaddr((sockaddr_t*)&dst);
+		}
+#endif /* HAVE_IN6_PKTINFO */
+		if (cmsgptr->cmsg_level == SOL_IP &&
+#ifdef IP_PKTINFO
+			cmsgptr->cmsg_type == IP_PKTINFO
+#elif defined(IP_RECVDSTADDR)
+			cmsgptr->cmsg_type == IP_RECVDSTADDR
+#else
+			FALSE
+#endif
+			)
+		{
+			struct in_addr *addr;
+			struct sockaddr_in dst;
+
+#ifdef IP_PKTINFO
+			struct in_pktinfo *pktinfo;
+			pktinfo = (struct in_pktinfo*)CMSG_DATA(cmsgptr);
+			addr = &pktinfo->ipi_addr;
+#elif defined(IP_RECVDSTADDR)
+			addr = (struct in_addr*)CMSG_DATA(cmsgptr);
+#endif
+			memset(&dst, 0, sizeof(dst));
+			memcpy(&dst.sin_addr, addr, sizeof(dst.sin_addr));
+
+			dst.sin_family = AF_INET;
+			dst.sin_port = htons(port);
+			dest = host_create_from_sockaddr((sockaddr_t*)&dst);
+		}
+		if (dest)
+		{
+			break;
+		}
 	}
-	if (this->ipv6 != -1)
+	if (dest == NULL)
 	{
-		FD_SET(this->ipv6, &rfds);
-		max_fd = max(max_fd, this->ipv6);
+		DBG1(DBG_NET, "error reading IP header");
+		return NULL;
 	}
-	if (this->ipv6_natt != -1)
+	source = host_create_from_sockaddr((sockaddr_t*)msg->msg_name);
+
+	pkt = packet_create();
+	pkt->set_source(pkt, source);
+	pkt->set_destination(pkt, dest);
+	DBG2(DBG_NET, "received packet: from %#H to %#H", source, dest);
+	pkt->set_data(pkt, chunk_clone(data));
+	return pkt;
+}
+
+/**
+ * Read as many pending packets from a socket as fit into the batch
+ */
+static bool receive_batch(private_socket_default_socket_t *this,
+						  receive_state_t *state, int skt, u_int16_t port)
+{
+	union {
+		struct sockaddr_in in4;
+		struct sockaddr_in6 in6;
+	} src[RECEIVE_BATCH];
+	char ancillary[RECEIVE_BATCH][64];
+	struct iovec iov[RECEIVE_BATCH];
+	mmsg_t msgs[RECEIVE_BATCH];
+	packet_t *pkt;
+	int i, slots, received;
+
+	slots = RECEIVE_BATCH - state->count;
+	memset(msgs, 0, sizeof(mmsg_t) * slots);
+	for (i = 0; i < slots; i++)
 	{
-		FD_SET(this->ipv6_natt, &rfds);
-		max_fd = max(max_fd, this->ipv6_natt);
+		iov[i].iov_base = state->buffer + i * this->max_packet;
+		iov[i].iov_len = this->max_packet;
+		msgs[i].msg_hdr.msg_name = &src[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof(src[i]);
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_control = ancillary[i];
+		msgs[i].msg_hdr.msg_controllen = sizeof(ancillary[i]);
 	}
 
-	DBG2(DBG_NET, "waiting for data on sockets");
-	oldstate = thread_cancelability(TRUE);
-	if (select(max_fd + 1, &rfds, NULL, NULL, NULL) <= 0)
+	/* the socket might get drained by another thread sharing the same
+	 * socket set, so don't block */
+#ifdef HAVE_RECVMMSG
+	received = recvmmsg(skt, msgs, slots, MSG_DONTWAIT, NULL);
+#else /* !HAVE_RECVMMSG */
+	received = recvmsg(skt, &msgs[0].msg_hdr, MSG_DONTWAIT);
+	if (received >= 0)
 	{
-		thread_cancelability(oldstate);
-		return FAILED;
+		msgs[0].msg_len = received;
+		received = 1;
 	}
-	thread_cancelability(oldstate);
-
-	if (FD_ISSET(this->ipv4, &rfds))
+#endif /* HAVE_RECVMMSG */
+	if (received < 0)
 	{
-		port = this->port;
-		selected = this->ipv4;
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+		{
+			return TRUE;
+		}
+		DBG1(DBG_NET, "error reading socket: %s", strerror(errno));
+		return FALSE;
 	}
-	if (FD_ISSET(this->ipv4_natt, &rfds))
+	for (i = 0; i < received; i++)
 	{
-		port = this->natt;
-		selected = this->ipv4_natt;
+		pkt = build_packet(&msgs[i].msg_hdr, msgs[i].msg_len, port);
+		if (pkt)
+		{
+			state->packets[state->count++] = pkt;
+		}
 	}
-	if (FD_ISSET(this->ipv6, &rfds))
+	return TRUE;
+}
+
+/**
+ * Clean up a receive state
+ */
+static void state_destroy(receive_state_t *state)
+{
+	while (state->pos < state->count)
 	{
-		port = this->port;
-		selected = this->ipv6;
+		state->packets[state->pos]->destroy(state->packets[state->pos]);
+		state->pos++;
 	}
-	if (FD_ISSET(this->ipv6_natt, &rfds))
+	free(state->buffer);
+	free(state);
+}
+
+/**
+ * Clean up the receive state of a terminating thread
+ */
+static void state_cleanup(receive_state_t *state)
+{
+	private_socket_default_socket_t *this = state->socket;
+
+	this->mutex->lock(this->mutex);
+	state->set->users--;
+	this->states->remove(this->states, state, NULL);
+	this->mutex->unlock(this->mutex);
+	state_destroy(state);
+}
+
+/**
+ * Get the receive state of the calling thread, assign it the socket set with
+ * the least number of receiving threads if it has none yet
+ */
+static receive_state_t *get_state(private_socket_default_socket_t *this)
+{
+	receive_state_t *state;
+	int i;
+
+	state = this->state->get(this->state);
+	if (!state)
 	{
-		port = this->natt;
-		selected = this->ipv6_natt;
+		INIT(state,
+			.socket = this,
+			.set = &this->sets[0],
+			.buffer = malloc(RECEIVE_BATCH * this->max_packet),
+		);
+		this->mutex->lock(this->mutex);
+		for (i = 1; i < this->count; i++)
+		{
+			if (this->sets[i].users < state->set->users)
+			{
+				state->set = &this->sets[i];
+			}
+		}
+		state->set->users++;
+		this->states->insert_last(this->states, state);
+		this->mutex->unlock(this->mutex);
+		this->state->set(this->state, state);
 	}
-	if (selected)
+	return state;
+}
+
+/**
+ * Add a socket to an fd_set
+ */
+static void add_fd(fd_set *fds, int skt, int *max_fd)
+{
+	if (skt != -1)
 	{
-		struct msghdr msg;
-		struct cmsghdr *cmsgptr;
-		struct iovec iov;
-		char ancillary[64];
-		union {
-			struct sockaddr_in in4;
-			struct sockaddr_in6 in6;
-		} src;
+		FD_SET(skt, fds);
+		*max_fd = max(*max_fd, skt);
+	}
+}
+
+/**
+ * Check if a socket is ready for reading
+ */
+static bool is_ready(fd_set *fds, int skt)
+{
+	return skt != -1 && FD_ISSET(skt, fds);
+}
+
+METHOD(socket_t, receiver, status_t,
+	private_socket_default_socket_t *this, packet_t **packet)
+{
+	receive_state_t *state;
+	socket_set_t *set;
+	fd_set rfds;
+	int max_fd;
+	bool oldstate, success;
 
-		msg.msg_name = &src;
-		msg.msg_namelen = sizeof(src);
-		iov.iov_base = buffer;
-		iov.iov_len = this->max_packet;
-		msg.msg_iov = &iov;
-		msg.msg_iovlen = 1;
-		msg.msg_control = ancillary;
-		msg.msg_controllen = sizeof(ancillary);
-		msg.msg_flags = 0;
-		bytes_read = recvmsg(selected, &msg, 0);
-		if (bytes_read < 0)
+	state = get_state(this);
+	set = state->set;
+
+	while (state->pos == state->count)
+	{
+		state->pos = state->count = 0;
+		max_fd = 0;
+		FD_ZERO(&rfds);
+		add_fd(&rfds, set->ipv4, &max_fd);
+		add_fd(&rfds, set->ipv4_natt, &max_fd);
+		add_fd(&rfds, set->ipv6, &max_fd);
+		add_fd(&rfds, set->ipv6_natt, &max_fd);
+
+		DBG2(DBG_NET, "waiting for data on sockets");
+		oldstate = thread_cancelability(TRUE);
+		if (select(max_fd + 1, &rfds, NULL, NULL, NULL) <= 0)
 		{
-			DBG1(DBG_NET, "error reading socket: %s", strerror(errno));
+			thread_cancelability(oldstate);
 			return FAILED;
 		}
-		if (msg.msg_flags & MSG_TRUNC)
+		thread_cancelability(oldstate);
+
+		success = TRUE;
+		if (is_ready(&rfds, set->ipv4))
 		{
-			DBG1(DBG_NET, "receive buffer too small, packet discarded");
-			return FAILED;
+			success &= receive_batch(this, state, set->ipv4, this->port);
 		}
-		DBG3(DBG_NET, "received packet %b", buffer, bytes_read);
-
-		/* read ancillary data to get destination address */
-		for (cmsgptr = CMSG_FIRSTHDR(&msg); cmsgptr != NULL;
-			 cmsgptr = CMSG_NXTHDR(&msg, cmsgptr))
+		if (is_ready(&rfds, set->ipv4_natt))
 		{
-			if (cmsgptr->cmsg_len == 0)
-			{
-				DBG1(DBG_NET, "error reading ancillary data");
-				return FAILED;
-			}
-
-#ifdef HAVE_IN6_PKTINFO
-			if (cmsgptr->cmsg_level == SOL_IPV6 &&
-				cmsgptr->cmsg_type == IPV6_PKTINFO)
-			{
-				struct in6_pktinfo *pktinfo;
-				pktinfo = (struct in6_pktinfo*)CMSG_DATA(cmsgptr);
-				struct sockaddr_in6 dst;
-
-				memset(&dst, 0, sizeof(dst));
-				memcpy(&dst.sin6_addr, &pktinfo->ipi6_addr, sizeof(dst.sin6_addr));
-				dst.sin6_family = AF_INET6;
-				dst.sin6_port = htons(port);
-				dest = host_create_from_sockaddr((sockaddr_t*)&dst);
-			}
-#endif /* HAVE_IN6_PKTINFO */
-			if (cmsgptr->cmsg_level == SOL_IP &&
-#ifdef IP_PKTINFO
-				cmsgptr->cmsg_type == IP_PKTINFO
-#elif defined(IP_RECVDSTADDR)
-				cmsgptr->cmsg_type == IP_RECVDSTADDR
-#else
-				FALSE
-#endif
-				)
-			{
-				struct in_addr *addr;
-				struct sockaddr_in dst;
-
-#ifdef IP_PKTINFO
-				struct in_pktinfo *pktinfo;
-				pktinfo = (struct in_pktinfo*)CMSG_DATA(cmsgptr);
-				addr = &pktinfo->ipi_addr;
-#elif defined(IP_RECVDSTADDR)
-				addr = (struct in_addr*)CMSG_DATA(cmsgptr);
-#endif
-				memset(&dst, 0, sizeof(dst));
-				memcpy(&dst.sin_addr, addr, sizeof(dst.sin_addr));
-
-				dst.sin_family = AF_INET;
-				dst.sin_port = htons(port);
-				dest = host_create_from_sockaddr((sockaddr_t*)&dst);
-			}
-			if (dest)
-			{
-				break;
-			}
+			success &= receive_batch(this, state, set->ipv4_natt, this->natt);
+		}
+		if (is_ready(&rfds, set->ipv6))
+		{
+			success &= receive_batch(this, state, set->ipv6, this->port);
+		}
+		if (is_ready(&rfds, set->ipv6_natt))
+		{
+			success &= receive_batch(this, state, set->ipv6_natt, this->natt);
 		}
-		if (dest == NULL)
+		if (!success && !state->count)
 		{
-			DBG1(DBG_NET, "error reading IP header");
 			return FAILED;
 		}
-		source = host_create_from_sockaddr((sockaddr_t*)&src);
-
-		pkt = packet_create();
-		pkt->set_source(pkt, source);
-		pkt->set_destination(pkt, dest);
-		DBG2(DBG_NET, "received packet: from %#H to %#H", source, dest);
-		data = chunk_create(buffer, bytes_read);
-		pkt->set_data(pkt, chunk_clone(data));
-	}
-	else
-	{
-		/* oops, shouldn't happen */
-		return FAILED;
 	}
-	/* return packet */
-	*packet = pkt;
+	*packet = state->packets[state->pos++];
 	return SUCCESS;
 }
 
-METHOD(socket_t, sender, status_t,
-	private_socket_default_socket_t *this, packet_t *packet)
+/**
+ * Find the socket to send a packet over, -1 if none found
+ */
+static int find_socket(private_socket_default_socket_t *this, packet_t *packet,
+					   u_int8_t **dscp)
 {
 	int sport, skt = -1, family;
-	ssize_t bytes_sent;
-	chunk_t data;
 	host_t *src, *dst;
-	struct msghdr msg;
-	struct cmsghdr *cmsg;
-	struct iovec iov;
-	u_int8_t *dscp;
 
 	src = packet->get_source(packet);
 	dst = packet->get_destination(packet);
-	data = packet->get_data(packet);
-
-	DBG2(DBG_NET, "sending packet: from %#H to %#H", src, dst);
-
-	/* send data */
 	sport = src->get_port(src);
 	family = dst->get_family(dst);
 	if (sport == 0 || sport == this->port)
@@ -352,15 +561,15 @@ METHOD(socket_t, sender, status_t,
 		switch (family)
 		{
 			case AF_INET:
-				skt = this->ipv4;
-				dscp = &this->dscp4;
+				skt = this->sets[0].ipv4;
+				*dscp = &this->dscp4;
 				break;
 			case AF_INET6:
-				skt = this->ipv6;
-				dscp = &this->dscp6;
+				skt = this->sets[0].ipv6;
+				*dscp = &this->dscp6;
 				break;
 			default:
-				return FAILED;
+				return -1;
 		}
 	}
 	else if (sport == this->natt)
@@ -368,30 +577,39 @@ METHOD(socket_t, sender, status_t,
 		switch (family)
 		{
 			case AF_INET:
-				skt = this->ipv4_natt;
-				dscp = &this->dscp4_natt;
+				skt = this->sets[0].ipv4_natt;
+				*dscp = &this->dscp4_natt;
 				break;
 			case AF_INET6:
-				skt = this->ipv6_natt;
-				dscp = &this->dscp6_natt;
+				skt = this->sets[0].ipv6_natt;
+				*dscp = &this->dscp6_natt;
 				break;
 			default:
-				return FAILED;
+				return -1;
 		}
 	}
 	if (skt == -1)
 	{
 		DBG1(DBG_NET, "no socket found to send IPv%d packet from port %d",
 			 family == AF_INET ? 4 : 6, sport);
-		return FAILED;
 	}
+	return skt;
+}
+
+/**
+ * Set the DSCP value of a packet on the socket, if it changed
+ */
+static void set_dscp(int skt, u_int8_t *dscp, packet_t *packet)
+{
+	host_t *dst;
 
 	/* setting DSCP values per-packet in a cmsg seems not to be supported
 	 * on Linux. We instead setsockopt() before sending it, this should be
 	 * safe as only a single thread calls send(). */
 	if (*dscp != packet->get_dscp(packet))
 	{
-		if (family == AF_INET)
+		dst = packet->get_destination(packet);
+		if (dst->get_family(dst) == AF_INET)
 		{
 			u_int8_t ds4;
 
@@ -422,32 +640,46 @@ METHOD(socket_t, sender, status_t,
 			}
 		}
 	}
+}
+
+/**
+ * Prepare the message header to send a packet
+ */
+static void build_msg(private_socket_default_socket_t *this, packet_t *packet,
+					  struct msghdr *msg, struct iovec *iov, source_cmsg_t *buf)
+{
+	struct cmsghdr *cmsg;
+	host_t *src, *dst;
+	chunk_t data;
+
+	src = packet->get_source(packet);
+	dst = packet->get_destination(packet);
+	data = packet->get_data(packet);
+
+	DBG2(DBG_NET, "sending packet: from %#H to %#H", src, dst);
 
-	memset(&msg, 0, sizeof(struct msghdr));
-	msg.msg_name = dst->get_sockaddr(dst);;
-	msg.msg_namelen = *dst->get_sockaddr_len(dst);
-	iov.iov_base = data.ptr;
-	iov.iov_len = data.len;
-	msg.msg_iov = &iov;
-	msg.msg_iovlen = 1;
-	msg.msg_flags = 0;
+	memset(msg, 0, sizeof(struct msghdr));
+	msg->msg_name = dst->get_sockaddr(dst);
+	msg->msg_namelen = *dst->get_sockaddr_len(dst);
+	iov->iov_base = data.ptr;
+	iov->iov_len = data.len;
+	msg->msg_iov = iov;
+	msg->msg_iovlen = 1;
+	msg->msg_flags = 0;
 
 	if (this->set_source && !src->is_anyaddr(src))
 	{
-		if (family == AF_INET)
+		if (dst->get_family(dst) == AF_INET)
 		{
 #if defined(IP_PKTINFO) || defined(IP_SENDSRCADDR)
 			struct in_addr *addr;
 			struct sockaddr_in *sin;
 #ifdef IP_PKTINFO
-			char buf[CMSG_SPACE(sizeof(struct in_pktinfo))];
 			struct in_pktinfo *pktinfo;
-#elif defined(IP_SENDSRCADDR)
-			char buf[CMSG_SPACE(sizeof(struct in_addr))];
 #endif
-			msg.msg_control = buf;
-			msg.msg_controllen = sizeof(buf);
-			cmsg = CMSG_FIRSTHDR(&msg);
+			msg->msg_control = buf->v4;
+			msg->msg_controllen = sizeof(buf->v4);
+			cmsg = CMSG_FIRSTHDR(msg);
 			cmsg->cmsg_level = SOL_IP;
 #ifdef IP_PKTINFO
 			cmsg->cmsg_type = IP_PKTINFO;
@@ -467,13 +699,12 @@ METHOD(socket_t, sender, status_t,
 #ifdef HAVE_IN6_PKTINFO
 		else
 		{
-			char buf[CMSG_SPACE(sizeof(struct in6_pktinfo))];
 			struct in6_pktinfo *pktinfo;
 			struct sockaddr_in6 *sin;
 
-			msg.msg_control = buf;
-			msg.msg_controllen = sizeof(buf);
-			cmsg = CMSG_FIRSTHDR(&msg);
+			msg->msg_control = buf->v6;
+			msg->msg_controllen = sizeof(buf->v6);
+			cmsg = CMSG_FIRSTHDR(msg);
 			cmsg->cmsg_level = SOL_IPV6;
 			cmsg->cmsg_type = IPV6_PKTINFO;
 			cmsg->cmsg_len = CMSG_LEN(sizeof(struct in6_pktinfo));
@@ -484,10 +715,28 @@ METHOD(socket_t, sender, status_t,
 		}
 #endif /* HAVE_IN6_PKTINFO */
 	}
+}
 
-	bytes_sent = sendmsg(skt, &msg, 0);
+METHOD(socket_t, sender, status_t,
+	private_socket_default_socket_t *this, packet_t *packet)
+{
+	source_cmsg_t buf;
+	struct msghdr msg;
+	struct iovec iov;
+	ssize_t bytes_sent;
+	u_int8_t *dscp;
+	int skt;
 
-	if (bytes_sent != data.len)
+	skt = find_socket(this, packet, &dscp);
+	if (skt == -1)
+	{
+		return FAILED;
+	}
+	set_dscp(skt, dscp, packet);
+	build_msg(this, packet, &msg, &iov, &buf);
+
+	bytes_sent = sendmsg(skt, &msg, 0);
+	if (bytes_sent != iov.iov_len)
 	{
 		DBG1(DBG_NET, "error writing to socket: %s", strerror(errno));
 		return FAILED;
@@ -495,6 +744,86 @@ METHOD(socket_t, sender, status_t,
 	return SUCCESS;
 }
 
+/**
+ * Send prepared messages over a socket, using as few system calls as possible,
+ * returns the number of messages successfully sent
+ */
+static int send_msgs(int skt, mmsg_t *msgs, int count)
+{
+	int i = 0, sent = 0;
+
+	while (i < count)
+	{
+#ifdef HAVE_SENDMMSG
+		int done;
+
+		done = sendmmsg(skt, &msgs[i], count - i, 0);
+		if (done > 0)
+		{
+			i += done;
+			sent += done;
+			continue;
+		}
+#else /* !HAVE_SENDMMSG */
+		if (sendmsg(skt, &msgs[i].msg_hdr, 0) ==
+								msgs[i].msg_hdr.msg_iov->iov_len)
+		{
+			i++;
+			sent++;
+			continue;
+		}
+#endif /* HAVE_SENDMMSG */
+		/* skip the message that failed and continue with the rest */
+		DBG1(DBG_NET, "error writing to socket: %s", strerror(errno));
+		i++;
+	}
+	return sent;
+}
+
+METHOD(socket_t, send_batch, status_t,
+	private_socket_default_socket_t *this, packet_t **packets, int count)
+{
+	mmsg_t msgs[SEND_BATCH];
+	struct iovec iov[SEND_BATCH];
+	source_cmsg_t bufs[SEND_BATCH];
+	u_int8_t *dscp, dscp_value = 0;
+	int i, n = 0, skt = -1, current, sent = 0;
+
+	/* batch runs of consecutive packets sent over the same socket with the
+	 * same DSCP value, so the order of the packets is retained */
+	for (i = 0; i < count; i++)
+	{
+		current = find_socket(this, packets[i], &dscp);
+		if (n && (current != skt ||
+				  packets[i]->get_dscp(packets[i]) != dscp_value))
+		{
+			sent += send_msgs(skt, msgs, n);
+			n = 0;
+		}
+		if (current == -1)
+		{
+			continue;
+		}
+		if (!n)
+		{
+			skt = current;
+			dscp_value = packets[i]->get_dscp(packets[i]);
+			set_dscp(skt, dscp, packets[i]);
+		}
+		build_msg(this, packets[i], &msgs[n].msg_hdr, &iov[n], &bufs[n]);
+		if (++n == SEND_BATCH)
+		{
+			sent += send_msgs(skt, msgs, n);
+			n = 0;
+		}
+	}
+	if (n)
+	{
+		sent += send_msgs(skt, msgs, n);
+	}
+	return (sent || !count) ? SUCCESS : FAILED;
+}
+
 METHOD(socket_t, get_port, u_int16_t,
 	private_socket_default_socket_t *this, bool nat_t)
 {
@@ -556,6 +885,16 @@ static int open_socket(private_socket_default_socket_t *this,
 		close(skt);
 		return -1;
 	}
+#ifdef SO_REUSEPORT
+	/* let the kernel distribute packets to the sockets of all sets */
+	if (this->count > 1 &&
+		setsockopt(skt, SOL_SOCKET, SO_REUSEPORT, (void*)&on, sizeof(on)) < 0)
+	{
+		DBG1(DBG_NET, "unable to set SO_REUSEPORT on socket: %s", strerror(errno));
+		close(skt);
+		return -1;
+	}
+#endif /* SO_REUSEPORT */
 
 	/* bind the socket */
 	if (bind(skt, &addr.sockaddr, addrlen) < 0)
@@ -635,25 +974,62 @@ static void open_socketpair(private_socket_default_socket_t *this, int family,
 	}
 }
 
-METHOD(socket_t, destroy, void,
-	private_socket_default_socket_t *this)
+/**
+ * Open all sockets of a socket set
+ */
+static void open_socketset(private_socket_default_socket_t *this,
+						   socket_set_t *set)
+{
+	set->ipv4 = set->ipv4_natt = set->ipv6 = set->ipv6_natt = -1;
+
+	/* we allocate IPv6 sockets first as that will reserve randomly allocated
+	 * ports also for IPv4. On OS X, we have to do it the other way round
+	 * for the same effect. */
+#ifdef __APPLE__
+	open_socketpair(this, AF_INET, &set->ipv4, &set->ipv4_natt, "IPv4");
+	open_socketpair(this, AF_INET6, &set->ipv6, &set->ipv6_natt, "IPv6");
+#else /* !__APPLE__ */
+	open_socketpair(this, AF_INET6, &set->ipv6, &set->ipv6_natt, "IPv6");
+	open_socketpair(this, AF_INET, &set->ipv4, &set->ipv4_natt, "IPv4");
+#endif /* __APPLE__ */
+}
+
+/**
+ * Close all sockets of a socket set
+ */
+static void close_socketset(socket_set_t *set)
 {
-	if (this->ipv4 != -1)
+	if (set->ipv4 != -1)
+	{
+		close(set->ipv4);
+	}
+	if (set->ipv4_natt != -1)
 	{
-		close(this->ipv4);
+		close(set->ipv4_natt);
 	}
-	if (this->ipv4_natt != -1)
+	if (set->ipv6 != -1)
 	{
-		close(this->ipv4_natt);
+		close(set->ipv6);
 	}
-	if (this->ipv6 != -1)
+	if (set->ipv6_natt != -1)
 	{
-		close(this->ipv6);
+		close(set->ipv6_natt);
 	}
-	if (this->ipv6_natt != -1)
+}
+
+METHOD(socket_t, destroy, void,
+	private_socket_default_socket_t *this)
+{
+	int i;
+
+	this->state->destroy(this->state);
+	this->states->destroy_function(this->states, (void*)state_destroy);
+	for (i = 0; i < this->count; i++)
 	{
-		close(this->ipv6_natt);
+		close_socketset(&this->sets[i]);
 	}
+	this->mutex->destroy(this->mutex);
+	free(this->sets);
 	free(this);
 }
 
@@ -663,11 +1039,13 @@ METHOD(socket_t, destroy, void,
 socket_default_socket_t *socket_default_socket_create()
 {
 	private_socket_default_socket_t *this;
+	int i;
 
 	INIT(this,
 		.public = {
 			.socket = {
 				.send = _sender,
+				.send_batch = _send_batch,
 				.receive = _receiver,
 				.get_port = _get_port,
 				.destroy = _destroy,
@@ -682,8 +1060,24 @@ socket_default_socket_t *socket_default_socket_create()
 		.set_source = lib->settings->get_bool(lib->settings,
 							"%s.plugins.socket-default.set_source", TRUE,
 							charon->name),
+		.count = lib->settings->get_int(lib->settings,
+							"%s.receive_threads", 1, charon->name),
+		.state = thread_value_create((thread_cleanup_t)state_cleanup),
+		.states = linked_list_create(),
+		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
 	);
 
+#ifndef SO_REUSEPORT
+	if (this->count > 1)
+	{
+		DBG1(DBG_NET, "SO_REUSEPORT not supported, receiving threads share "
+			 "a single socket set");
+		this->count = 1;
+	}
+#endif /* SO_REUSEPORT */
+	this->count = max(this->count, 1);
+	this->sets = calloc(this->count, sizeof(socket_set_t));
+
 	if (this->port && this->port == this->natt)
 	{
 		DBG1(DBG_NET, "IKE ports can't be equal, will allocate NAT-T "
@@ -691,23 +1085,27 @@ socket_default_socket_t *socket_default_socket_create()
 		this->natt = 0;
 	}
 
-	/* we allocate IPv6 sockets first as that will reserve randomly allocated
-	 * ports also for IPv4. On OS X, we have to do it the other way round
-	 * for the same effect. */
-#ifdef __APPLE__
-	open_socketpair(this, AF_INET, &this->ipv4, &this->ipv4_natt, "IPv4");
-	open_socketpair(this, AF_INET6, &this->ipv6, &this->ipv6_natt, "IPv6");
-#else /* !__APPLE__ */
-	open_socketpair(this, AF_INET6, &this->ipv6, &this->ipv6_natt, "IPv6");
-	open_socketpair(this, AF_INET, &this->ipv4, &this->ipv4_natt, "IPv4");
-#endif /* __APPLE__ */
-
-	if (this->ipv4 == -1 && this->ipv6 == -1)
+	for (i = 0; i < this->count; i++)
 	{
-		DBG1(DBG_NET, "could not create any sockets");
-		destroy(this);
-		return NULL;
+		open_socketset(this, &this->sets[i]);
+		if (this->sets[i].ipv4 == -1 && this->sets[i].ipv6 == -1)
+		{
+			if (i == 0)
+			{
+				DBG1(DBG_NET, "could not create any sockets");
+				this->count = 1;
+				destroy(this);
+				return NULL;
+			}
+			DBG1(DBG_NET, "could only open %d of %d socket sets, sharing "
+				 "them among receiving threads", i, this->count);
+			this->count = i;
+		}
+	}
+	if (this->count > 1)
+	{
+		DBG2(DBG_NET, "opened %d socket sets for parallel receiving",
+			 this->count);
 	}
-
 	return &this->public;
 }
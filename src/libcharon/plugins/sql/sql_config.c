@@ -19,6 +19,9 @@
 #include "sql_config.h"
 
 #include <daemon.h>
+#include <config/peer_cfg_index.h>
+#include <threading/rwlock.h>
+#include <threading/mutex.h>
 
 typedef struct private_sql_config_t private_sql_config_t;
 
@@ -36,6 +39,52 @@ struct private_sql_config_t {
 	 * database connection
 	 */
 	database_t *db;
+
+	/**
+	 * lifetime of cached configs in seconds, 0 to disable caching
+	 */
+	u_int lifetime;
+
+	/**
+	 * time the cached configs expire
+	 */
+	time_t expires;
+
+	/**
+	 * cached peer configs, indexed by identities and hosts
+	 */
+	peer_cfg_index_t *index;
+
+	/**
+	 * cached peer configs in database order, peer_cfg_t
+	 */
+	linked_list_t *peer_cfgs;
+
+	/**
+	 * cached IKE configs, ike_cfg_t
+	 */
+	linked_list_t *ike_cfgs;
+
+	/**
+	 * lock for the cached configs
+	 */
+	rwlock_t *lock;
+
+	/**
+	 * mutex serializing reloads of the cache
+	 */
+	mutex_t *mutex;
+
+	/**
+	 * number of lookups served from the cache, informational only, may lose
+	 * concurrent increments as it is updated under the read lock
+	 */
+	u_int hits;
+
+	/**
+	 * number of lookups that required a reload of the cache
+	 */
+	u_int misses;
 };
 
 /**
@@ -419,8 +468,11 @@ static peer_cfg_t *build_peer_cfg(private_sql_config_t *this, enumerator_t *e,
 	return NULL;
 }
 
-METHOD(backend_t, get_peer_cfg_by_name, peer_cfg_t*,
-	private_sql_config_t *this, char *name)
+/**
+ * Query a peer config by its name
+ */
+static peer_cfg_t *query_peer_cfg_by_name(private_sql_config_t *this,
+										  char *name)
 {
 	enumerator_t *e;
 	peer_cfg_t *peer_cfg = NULL;
@@ -490,8 +542,11 @@ static void ike_enumerator_destroy(ike_enumerator_t *this)
 	free(this);
 }
 
-METHOD(backend_t, create_ike_cfg_enumerator, enumerator_t*,
-	private_sql_config_t *this, host_t *me, host_t *other)
+/**
+ * Query all IKE configs
+ */
+static enumerator_t *query_ike_cfgs(private_sql_config_t *this,
+									host_t *me, host_t *other)
 {
 	ike_enumerator_t *e = malloc_thing(ike_enumerator_t);
 
@@ -555,8 +610,12 @@ static void peer_enumerator_destroy(peer_enumerator_t *this)
 	free(this);
 }
 
-METHOD(backend_t, create_peer_cfg_enumerator, enumerator_t*,
-	private_sql_config_t *this, identification_t *me, identification_t *other)
+/**
+ * Query peer configs matching the given identities
+ */
+static enumerator_t *query_peer_cfgs(private_sql_config_t *this,
+									 identification_t *me,
+									 identification_t *other)
 {
 	peer_enumerator_t *e = malloc_thing(peer_enumerator_t);
 
@@ -593,9 +652,163 @@ METHOD(backend_t, create_peer_cfg_enumerator, enumerator_t*,
 	return &e->public;
 }
 
+/**
+ * Load all configs from the database into a fresh cache
+ */
+static bool reload(private_sql_config_t *this, time_t now)
+{
+	linked_list_t *peer_cfgs, *ike_cfgs, *old_peer_cfgs, *old_ike_cfgs;
+	peer_cfg_index_t *index, *old_index;
+	enumerator_t *peers, *ikes;
+	peer_cfg_t *peer_cfg;
+	ike_cfg_t *ike_cfg;
+
+	peers = query_peer_cfgs(this, NULL, NULL);
+	ikes = query_ike_cfgs(this, NULL, NULL);
+	if (!peers || !ikes)
+	{
+		DESTROY_IF(peers);
+		DESTROY_IF(ikes);
+		return FALSE;
+	}
+	index = peer_cfg_index_create();
+	peer_cfgs = linked_list_create();
+	while (peers->enumerate(peers, &peer_cfg))
+	{
+		peer_cfg = peer_cfg->get_ref(peer_cfg);
+		peer_cfgs->insert_last(peer_cfgs, peer_cfg);
+		index->add(index, peer_cfg);
+	}
+	peers->destroy(peers);
+	ike_cfgs = linked_list_create();
+	while (ikes->enumerate(ikes, &ike_cfg))
+	{
+		ike_cfgs->insert_last(ike_cfgs, ike_cfg->get_ref(ike_cfg));
+	}
+	ikes->destroy(ikes);
+
+	this->lock->write_lock(this->lock);
+	old_index = this->index;
+	old_peer_cfgs = this->peer_cfgs;
+	old_ike_cfgs = this->ike_cfgs;
+	this->index = index;
+	this->peer_cfgs = peer_cfgs;
+	this->ike_cfgs = ike_cfgs;
+	this->expires = now + this->lifetime;
+	this->lock->unlock(this->lock);
+
+	old_index->destroy(old_index);
+	old_peer_cfgs->destroy_offset(old_peer_cfgs, offsetof(peer_cfg_t, destroy));
+	old_ike_cfgs->destroy_offset(old_ike_cfgs, offsetof(ike_cfg_t, destroy));
+	return TRUE;
+}
+
+/**
+ * Reload the cache if it expired, returns with the read lock held
+ */
+static void cache_acquire(private_sql_config_t *this)
+{
+	time_t now;
+
+	now = time_monotonic(NULL);
+	this->lock->read_lock(this->lock);
+	if (now < this->expires)
+	{
+		this->hits++;
+		return;
+	}
+	this->lock->unlock(this->lock);
+
+	this->mutex->lock(this->mutex);
+	if (now < this->expires)
+	{	/* reloaded by another thread meanwhile */
+		this->hits++;
+	}
+	else
+	{
+		this->misses++;
+		if (reload(this, now))
+		{
+			DBG2(DBG_CFG, "loaded %d peer configs from database, %u cache "
+				 "hits, %u misses", this->peer_cfgs->get_count(this->peer_cfgs),
+				 this->hits, this->misses);
+		}
+		else
+		{
+			DBG1(DBG_CFG, "loading configs from database failed, using "
+				 "cached configs");
+		}
+	}
+	this->mutex->unlock(this->mutex);
+	this->lock->read_lock(this->lock);
+}
+
+METHOD(backend_t, get_peer_cfg_by_name, peer_cfg_t*,
+	private_sql_config_t *this, char *name)
+{
+	enumerator_t *enumerator;
+	peer_cfg_t *current, *found = NULL;
+
+	if (!this->lifetime)
+	{
+		return query_peer_cfg_by_name(this, name);
+	}
+	cache_acquire(this);
+	enumerator = this->peer_cfgs->create_enumerator(this->peer_cfgs);
+	while (enumerator->enumerate(enumerator, &current))
+	{
+		if (streq(current->get_name(current), name))
+		{
+			found = current->get_ref(current);
+			break;
+		}
+	}
+	enumerator->destroy(enumerator);
+	this->lock->unlock(this->lock);
+	return found;
+}
+
+METHOD(backend_t, create_ike_cfg_enumerator, enumerator_t*,
+	private_sql_config_t *this, host_t *me, host_t *other)
+{
+	if (!this->lifetime)
+	{
+		return query_ike_cfgs(this, me, other);
+	}
+	cache_acquire(this);
+	return enumerator_create_cleaner(
+						this->ike_cfgs->create_enumerator(this->ike_cfgs),
+						(void*)this->lock->unlock, this->lock);
+}
+
+METHOD(backend_t, create_peer_cfg_enumerator, enumerator_t*,
+	private_sql_config_t *this, identification_t *me, identification_t *other)
+{
+	if (!this->lifetime)
+	{
+		return query_peer_cfgs(this, me, other);
+	}
+	cache_acquire(this);
+	return enumerator_create_cleaner(
+						this->index->create_id_enumerator(this->index, me, other),
+						(void*)this->lock->unlock, this->lock);
+}
+
 METHOD(sql_config_t, destroy, void,
 	private_sql_config_t *this)
 {
+	if (this->lifetime)
+	{
+		DBG1(DBG_CFG, "sql config cache: %u hits, %u misses",
+			 this->hits, this->misses);
+	}
+	this->index->destroy(this->index);
+	this->peer_cfgs->destroy_offset(this->peer_cfgs,
+									offsetof(peer_cfg_t, destroy));
+	this->ike_cfgs->destroy_offset(this->ike_cfgs,
+								   offsetof(ike_cfg_t, destroy));
+	this->lock->destroy(this->lock);
+	this->mutex->destroy(this->mutex);
 	free(this);
 }
 
@@ -615,7 +828,14 @@ sql_config_t *sql_config_create(database_t *db)
 			},
 			.destroy = _destroy,
 		},
-		.db = db
+		.db = db,
+		.lifetime = lib->settings->get_int(lib->settings,
+							"%s.plugins.sql.cache_lifetime", 0, charon->name),
+		.index = peer_cfg_index_create(),
+		.peer_cfgs = linked_list_create(),
+		.ike_cfgs = linked_list_create(),
+		.lock = rwlock_create(RWLOCK_TYPE_DEFAULT),
+		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
 	);
 
 	return &this->public;
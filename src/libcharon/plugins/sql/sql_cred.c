@@ -19,6 +19,8 @@
 #include "sql_cred.h"
 
 #include <daemon.h>
+#include <collections/hashtable.h>
+#include <threading/rwlock.h>
 
 typedef struct private_sql_cred_t private_sql_cred_t;
 
@@ -36,8 +38,335 @@ struct private_sql_cred_t {
 	 * database connection
 	 */
 	database_t *db;
+
+	/**
+	 * lifetime of cached lookups in seconds, 0 to disable caching
+	 */
+	u_int lifetime;
+
+	/**
+	 * time the cached lookups expire
+	 */
+	time_t expires;
+
+	/**
+	 * cached lookups, lookup_entry_t
+	 */
+	hashtable_t *cache;
+
+	/**
+	 * lock for cache
+	 */
+	rwlock_t *lock;
+
+	/**
+	 * maximum number of cached lookups that returned no credentials
+	 */
+	u_int max_negative;
+
+	/**
+	 * number of cached lookups that returned no credentials
+	 */
+	u_int negative;
+
+	/**
+	 * number of lookups served from the cache, informational only, may lose
+	 * concurrent increments as it is updated under the read lock
+	 */
+	u_int hits;
+
+	/**
+	 * number of lookups that queried the database
+	 */
+	u_int misses;
 };
 
+/**
+ * Kind of a cached credential lookup
+ */
+typedef enum {
+	LOOKUP_PRIVATE,
+	LOOKUP_CERT,
+	LOOKUP_SHARED,
+	LOOKUP_CDP,
+} lookup_t;
+
+/**
+ * Cached results of a credential lookup, key and value in cache
+ */
+typedef struct {
+	/** kind of lookup */
+	lookup_t kind;
+	/** key, certificate, shared key or CDP type looked up */
+	int type;
+	/** key type looked up for certificates */
+	int subtype;
+	/** identity looked up, NULL for any */
+	identification_t *id;
+	/** other identity looked up for shared keys, NULL for any */
+	identification_t *other;
+	/** private_key_t, certificate_t, shared_key_t or char* URIs found */
+	linked_list_t *items;
+	/** references to this entry */
+	refcount_t refs;
+} lookup_entry_t;
+
+/**
+ * Get a reference to a cached item
+ */
+static void *item_get_ref(lookup_t kind, void *item)
+{
+	switch (kind)
+	{
+		case LOOKUP_PRIVATE:
+			return ((private_key_t*)item)->get_ref(item);
+		case LOOKUP_CERT:
+			return ((certificate_t*)item)->get_ref(item);
+		case LOOKUP_SHARED:
+			return ((shared_key_t*)item)->get_ref(item);
+		case LOOKUP_CDP:
+		default:
+			return strdup(item);
+	}
+}
+
+/**
+ * Release a reference to a lookup entry
+ */
+static void lookup_entry_destroy(lookup_entry_t *this)
+{
+	if (ref_put(&this->refs))
+	{
+		switch (this->kind)
+		{
+			case LOOKUP_PRIVATE:
+				this->items->destroy_offset(this->items,
+											offsetof(private_key_t, destroy));
+				break;
+			case LOOKUP_CERT:
+				this->items->destroy_offset(this->items,
+											offsetof(certificate_t, destroy));
+				break;
+			case LOOKUP_SHARED:
+				this->items->destroy_offset(this->items,
+											offsetof(shared_key_t, destroy));
+				break;
+			case LOOKUP_CDP:
+				this->items->destroy_function(this->items, free);
+				break;
+		}
+		DESTROY_IF(this->id);
+		DESTROY_IF(this->other);
+		free(this);
+	}
+}
+
+/**
+ * Hashtable hash function
+ */
+static u_int lookup_hash(lookup_entry_t *key)
+{
+	u_int hash;
+
+	hash = chunk_hash(chunk_from_thing(key->kind));
+	hash = chunk_hash_inc(chunk_from_thing(key->type), hash);
+	hash = chunk_hash_inc(chunk_from_thing(key->subtype), hash);
+	if (key->id)
+	{
+		hash = key->id->hash(key->id, hash);
+	}
+	if (key->other)
+	{
+		hash = key->other->hash(key->other, hash);
+	}
+	return hash;
+}
+
+/**
+ * Compare two optional identities
+ */
+static bool id_equals(identification_t *a, identification_t *b)
+{
+	if (a && b)
+	{
+		return a->equals(a, b);
+	}
+	return a == b;
+}
+
+/**
+ * Hashtable equals function
+ */
+static bool lookup_equals(lookup_entry_t *a, lookup_entry_t *b)
+{
+	return a->kind == b->kind && a->type == b->type &&
+		   a->subtype == b->subtype && id_equals(a->id, b->id) &&
+		   id_equals(a->other, b->other);
+}
+
+/**
+ * Flush all cached lookups
+ */
+static void flush_cache(private_sql_cred_t *this)
+{
+	enumerator_t *enumerator;
+	lookup_entry_t *entry;
+
+	enumerator = this->cache->create_enumerator(this->cache);
+	while (enumerator->enumerate(enumerator, NULL, &entry))
+	{
+		this->cache->remove_at(this->cache, enumerator);
+		lookup_entry_destroy(entry);
+	}
+	enumerator->destroy(enumerator);
+	this->negative = 0;
+}
+
+/**
+ * Find a cached lookup, flushing the cache if it expired
+ */
+static lookup_entry_t *cache_get(private_sql_cred_t *this, lookup_entry_t *key)
+{
+	lookup_entry_t *entry;
+	time_t now;
+
+	now = time_monotonic(NULL);
+	this->lock->read_lock(this->lock);
+	if (now >= this->expires)
+	{
+		this->lock->unlock(this->lock);
+		this->lock->write_lock(this->lock);
+		if (now >= this->expires)
+		{
+			DBG2(DBG_CFG, "flushing %u cached credential lookups, %u cache "
+				 "hits, %u misses", this->cache->get_count(this->cache),
+				 this->hits, this->misses);
+			flush_cache(this);
+			this->expires = now + this->lifetime;
+		}
+	}
+	entry = this->cache->get(this->cache, key);
+	if (entry)
+	{
+		ref_get(&entry->refs);
+		this->hits++;
+	}
+	this->lock->unlock(this->lock);
+	return entry;
+}
+
+/**
+ * Cache the results of a database lookup, destroys the inner enumerator.
+ *
+ * Lookups that return no credentials are cached up to max_negative times, as
+ * arbitrary peer identities could fill the cache otherwise.
+ */
+static lookup_entry_t *cache_put(private_sql_cred_t *this, lookup_entry_t *key,
+								 enumerator_t *inner)
+{
+	lookup_entry_t *entry, *existing;
+	void *item;
+
+	INIT(entry,
+		.kind = key->kind,
+		.type = key->type,
+		.subtype = key->subtype,
+		.id = key->id ? key->id->clone(key->id) : NULL,
+		.other = key->other ? key->other->clone(key->other) : NULL,
+		.items = linked_list_create(),
+		.refs = 2,
+	);
+	while (inner->enumerate(inner, &item, NULL, NULL))
+	{
+		entry->items->insert_last(entry->items, item_get_ref(key->kind, item));
+	}
+	inner->destroy(inner);
+
+	this->lock->write_lock(this->lock);
+	this->misses++;
+	existing = this->cache->get(this->cache, entry);
+	if (existing)
+	{	/* another thread was faster, use its entry */
+		ref_get(&existing->refs);
+		this->lock->unlock(this->lock);
+		entry->refs = 1;
+		lookup_entry_destroy(entry);
+		return existing;
+	}
+	if (!entry->items->get_count(entry->items))
+	{
+		if (this->negative >= this->max_negative)
+		{	/* serve the empty result without caching it */
+			this->lock->unlock(this->lock);
+			entry->refs = 1;
+			return entry;
+		}
+		this->negative++;
+	}
+	this->cache->put(this->cache, entry, entry);
+	this->lock->unlock(this->lock);
+	return entry;
+}
+
+/**
+ * enumerator over the results of a cached lookup
+ */
+typedef struct {
+	/** implements enumerator */
+	enumerator_t public;
+	/** inner enumerator over items */
+	enumerator_t *inner;
+	/** referenced lookup entry */
+	lookup_entry_t *entry;
+} cache_enumerator_t;
+
+METHOD(enumerator_t, cache_enumerator_enumerate, bool,
+	   cache_enumerator_t *this, void **item, id_match_t *me, id_match_t *other)
+{
+	if (this->inner->enumerate(this->inner, item))
+	{
+		if (this->entry->kind == LOOKUP_SHARED)
+		{
+			if (me)
+			{
+				*me = this->entry->id ? ID_MATCH_PERFECT : ID_MATCH_ANY;
+			}
+			if (other)
+			{
+				*other = this->entry->other ? ID_MATCH_PERFECT : ID_MATCH_ANY;
+			}
+		}
+		return TRUE;
+	}
+	return FALSE;
+}
+
+METHOD(enumerator_t, cache_enumerator_destroy, void,
+	   cache_enumerator_t *this)
+{
+	this->inner->destroy(this->inner);
+	lookup_entry_destroy(this->entry);
+	free(this);
+}
+
+/**
+ * Create an enumerator over a cached lookup, releases the entry when done
+ */
+static enumerator_t *create_cache_enumerator(lookup_entry_t *entry)
+{
+	cache_enumerator_t *e;
+
+	INIT(e,
+		.public = {
+			.enumerate = (void*)_cache_enumerator_enumerate,
+			.destroy = _cache_enumerator_destroy,
+		},
+		.inner = entry->items->create_enumerator(entry->items),
+		.entry = entry,
+	);
+	return &e->public;
+}
+
 
 /**
  * enumerator over private keys
@@ -81,8 +410,11 @@ METHOD(enumerator_t, private_enumerator_destroy, void,
 	free(this);
 }
 
-METHOD(credential_set_t, create_private_enumerator, enumerator_t*,
-	   private_sql_cred_t *this, key_type_t type, identification_t *id)
+/**
+ * Query private keys from the database
+ */
+static enumerator_t *query_private(private_sql_cred_t *this, key_type_t type,
+								   identification_t *id)
 {
 	private_enumerator_t *e;
 
@@ -161,9 +493,12 @@ METHOD(enumerator_t, cert_enumerator_destroy, void,
 	free(this);
 }
 
-METHOD(credential_set_t, create_cert_enumerator, enumerator_t*,
-	   private_sql_cred_t *this, certificate_type_t cert, key_type_t key,
-	   identification_t *id, bool trusted)
+/**
+ * Query certificates from the database
+ */
+static enumerator_t *query_cert(private_sql_cred_t *this,
+								certificate_type_t cert, key_type_t key,
+								identification_t *id)
 {
 	cert_enumerator_t *e;
 
@@ -257,9 +592,12 @@ METHOD(enumerator_t, shared_enumerator_destroy, void,
 	free(this);
 }
 
-METHOD(credential_set_t, create_shared_enumerator, enumerator_t*,
-	   private_sql_cred_t *this, shared_key_type_t type,
-	   identification_t *me, identification_t *other)
+/**
+ * Query shared keys from the database
+ */
+static enumerator_t *query_shared(private_sql_cred_t *this,
+								  shared_key_type_t type,
+								  identification_t *me, identification_t *other)
 {
 	shared_enumerator_t *e;
 
@@ -362,26 +700,14 @@ METHOD(enumerator_t, cdp_enumerator_destroy, void,
 	free(this);
 }
 
-METHOD(credential_set_t, create_cdp_enumerator, enumerator_t*,
-	   private_sql_cred_t *this, certificate_type_t type, identification_t *id)
+/**
+ * Query CDPs from the database
+ */
+static enumerator_t *query_cdp(private_sql_cred_t *this, cdp_type_t cdp_type,
+							   identification_t *id)
 {
 	cdp_enumerator_t *e;
-	cdp_type_t cdp_type;
 
-	switch (type)
-	{	/* we serve CRLs and OCSP responders */
-		case CERT_X509_CRL:
-			cdp_type = CDP_TYPE_CRL;
-			break;
-		case CERT_X509_OCSP_RESPONSE:
-			cdp_type = CDP_TYPE_OCSP;
-			break;
-		case CERT_ANY:
-			cdp_type = CDP_TYPE_ANY;
-			break;
-		default:
-			return NULL;
-	}
 	INIT(e,
 		.public = {
 			.enumerate = (void*)_cdp_enumerator_enumerate,
@@ -417,6 +743,132 @@ METHOD(credential_set_t, create_cdp_enumerator, enumerator_t*,
 	return &e->public;
 }
 
+/**
+ * Serve a lookup from the cache, if enabled and cached
+ */
+static enumerator_t *cache_lookup(private_sql_cred_t *this, lookup_entry_t *key)
+{
+	lookup_entry_t *entry;
+
+	if (!this->lifetime)
+	{
+		return NULL;
+	}
+	if (key->id && key->id->get_type(key->id) == ID_ANY &&
+		key->kind != LOOKUP_SHARED)
+	{
+		key->id = NULL;
+	}
+	entry = cache_get(this, key);
+	if (entry)
+	{
+		return create_cache_enumerator(entry);
+	}
+	return NULL;
+}
+
+/**
+ * Cache the results of a database query, if enabled
+ */
+static enumerator_t *cache_results(private_sql_cred_t *this,
+								   lookup_entry_t *key, enumerator_t *inner)
+{
+	if (!this->lifetime || !inner)
+	{
+		return inner;
+	}
+	return create_cache_enumerator(cache_put(this, key, inner));
+}
+
+METHOD(credential_set_t, create_private_enumerator, enumerator_t*,
+	   private_sql_cred_t *this, key_type_t type, identification_t *id)
+{
+	lookup_entry_t key = {
+		.kind = LOOKUP_PRIVATE,
+		.type = type,
+		.id = id,
+	};
+	enumerator_t *e;
+
+	e = cache_lookup(this, &key);
+	if (!e)
+	{
+		e = cache_results(this, &key, query_private(this, type, id));
+	}
+	return e;
+}
+
+METHOD(credential_set_t, create_cert_enumerator, enumerator_t*,
+	   private_sql_cred_t *this, certificate_type_t cert, key_type_t key,
+	   identification_t *id, bool trusted)
+{
+	lookup_entry_t lookup = {
+		.kind = LOOKUP_CERT,
+		.type = cert,
+		.subtype = key,
+		.id = id,
+	};
+	enumerator_t *e;
+
+	e = cache_lookup(this, &lookup);
+	if (!e)
+	{
+		e = cache_results(this, &lookup, query_cert(this, cert, key, id));
+	}
+	return e;
+}
+
+METHOD(credential_set_t, create_shared_enumerator, enumerator_t*,
+	   private_sql_cred_t *this, shared_key_type_t type,
+	   identification_t *me, identification_t *other)
+{
+	lookup_entry_t key = {
+		.kind = LOOKUP_SHARED,
+		.type = type,
+		.id = me,
+		.other = other,
+	};
+	enumerator_t *e;
+
+	e = cache_lookup(this, &key);
+	if (!e)
+	{
+		e = cache_results(this, &key, query_shared(this, type, me, other));
+	}
+	return e;
+}
+
+METHOD(credential_set_t, create_cdp_enumerator, enumerator_t*,
+	   private_sql_cred_t *this, certificate_type_t type, identification_t *id)
+{
+	lookup_entry_t key = {
+		.kind = LOOKUP_CDP,
+		.id = id,
+	};
+	enumerator_t *e;
+
+	switch (type)
+	{	/* we serve CRLs and OCSP responders */
+		case CERT_X509_CRL:
+			key.type = CDP_TYPE_CRL;
+			break;
+		case CERT_X509_OCSP_RESPONSE:
+			key.type = CDP_TYPE_OCSP;
+			break;
+		case CERT_ANY:
+			key.type = CDP_TYPE_ANY;
+			break;
+		default:
+			return NULL;
+	}
+	e = cache_lookup(this, &key);
+	if (!e)
+	{
+		e = cache_results(this, &key, query_cdp(this, key.type, id));
+	}
+	return e;
+}
+
 METHOD(credential_set_t, cache_cert, void,
 	   private_sql_cred_t *this, certificate_t *cert)
 {
@@ -426,6 +878,14 @@ METHOD(credential_set_t, cache_cert, void,
 METHOD(sql_cred_t, destroy, void,
 	   private_sql_cred_t *this)
 {
+	if (this->lifetime)
+	{
+		DBG1(DBG_CFG, "sql credential cache: %u hits, %u misses",
+			 this->hits, this->misses);
+	}
+	flush_cache(this);
+	this->cache->destroy(this->cache);
+	this->lock->destroy(this->lock);
 	free(this);
 }
 
@@ -448,6 +908,13 @@ sql_cred_t *sql_cred_create(database_t *db)
 			.destroy = _destroy,
 		},
 		.db = db,
+		.lifetime = lib->settings->get_int(lib->settings,
+							"%s.plugins.sql.cache_lifetime", 0, charon->name),
+		.max_negative = lib->settings->get_int(lib->settings,
+							"%s.plugins.sql.cache_negative", 1024, charon->name),
+		.cache = hashtable_create((hashtable_hash_t)lookup_hash,
+								  (hashtable_equals_t)lookup_equals, 32),
+		.lock = rwlock_create(RWLOCK_TYPE_DEFAULT),
 	);
 
 	return &this->public;
@@ -18,6 +18,7 @@
 
 #include <hydra.h>
 #include <daemon.h>
+#include <config/peer_cfg_index.h>
 #include <threading/mutex.h>
 #include <utils/lexparser.h>
 
@@ -38,6 +39,11 @@ struct private_stroke_config_t {
 	 */
 	linked_list_t *list;
 
+	/**
+	 * index over peer_cfg_t in list, for lookups by identity and address
+	 */
+	peer_cfg_index_t *index;
+
 	/**
 	 * mutex to lock config list
 	 */
@@ -63,8 +69,9 @@ METHOD(backend_t, create_peer_cfg_enumerator, enumerator_t*,
 	private_stroke_config_t *this, identification_t *me, identification_t *other)
 {
 	this->mutex->lock(this->mutex);
-	return enumerator_create_cleaner(this->list->create_enumerator(this->list),
-									 (void*)this->mutex->unlock, this->mutex);
+	return enumerator_create_cleaner(
+						this->index->create_id_enumerator(this->index, me, other),
+						(void*)this->mutex->unlock, this->mutex);
 }
 
 /**
@@ -80,9 +87,10 @@ METHOD(backend_t, create_ike_cfg_enumerator, enumerator_t*,
 	private_stroke_config_t *this, host_t *me, host_t *other)
 {
 	this->mutex->lock(this->mutex);
-	return enumerator_create_filter(this->list->create_enumerator(this->list),
-									(void*)ike_filter, this->mutex,
-									(void*)this->mutex->unlock);
+	return enumerator_create_filter(
+						this->index->create_host_enumerator(this->index, me, other),
+						(void*)ike_filter, this->mutex,
+						(void*)this->mutex->unlock);
 }
 
 METHOD(backend_t, get_peer_cfg_by_name, peer_cfg_t*,
@@ -1057,6 +1065,7 @@ METHOD(stroke_config_t, add, void,
 		DBG1(DBG_CFG, "added configuration '%s'", msg->add_conn.name);
 		this->mutex->lock(this->mutex);
 		this->list->insert_last(this->list, peer_cfg);
+		this->index->add(this->index, peer_cfg);
 		this->mutex->unlock(this->mutex);
 	}
 }
@@ -1096,6 +1105,7 @@ METHOD(stroke_config_t, del, void,
 		if (!keep || streq(peer->get_name(peer), msg->del_conn.name))
 		{
 			this->list->remove_at(this->list, enumerator);
+			this->index->remove(this->index, peer);
 			peer->destroy(peer);
 			deleted = TRUE;
 		}
@@ -1295,6 +1305,7 @@ METHOD(stroke_config_t, destroy, void,
 	private_stroke_config_t *this)
 {
 	this->list->destroy_offset(this->list, offsetof(peer_cfg_t, destroy));
+	this->index->destroy(this->index);
 	this->mutex->destroy(this->mutex);
 	free(this);
 }
@@ -1320,6 +1331,7 @@ stroke_config_t *stroke_config_create(stroke_ca_t *ca, stroke_cred_t *cred,
 			.destroy = _destroy,
 		},
 		.list = linked_list_create(),
+		.index = peer_cfg_index_create(),
 		.mutex = mutex_create(MUTEX_TYPE_RECURSIVE),
 		.ca = ca,
 		.cred = cred,
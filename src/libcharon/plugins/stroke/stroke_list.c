@@ -202,7 +202,8 @@ static void log_ike_sa(FILE *out, ike_sa_t *ike_sa, bool all)
 /**
  * log an CHILD_SA to out
  */
-static void log_child_sa(FILE *out, child_sa_t *child_sa, bool all)
+static void log_child_sa(FILE *out, child_sa_t *child_sa, bool all,
+						 kernel_stats_t *stats)
 {
 	time_t use_in, use_out, rekey, now;
 	u_int64_t bytes_in, bytes_out, packets_in, packets_out;
@@ -273,8 +274,8 @@ static void log_child_sa(FILE *out, child_sa_t *child_sa, bool all)
 				}
 			}
 
-			child_sa->get_usestats(child_sa, TRUE,
-								   &use_in, &bytes_in, &packets_in);
+			child_sa->get_usestats_snapshot(child_sa, stats, TRUE,
+											&use_in, &bytes_in, &packets_in);
 			fprintf(out, ", %" PRIu64 " bytes_i", bytes_in);
 			if (use_in)
 			{
@@ -283,8 +284,8 @@ static void log_child_sa(FILE *out, child_sa_t *child_sa, bool all)
 						(u_int64_t)(now - use_in));
 			}
 
-			child_sa->get_usestats(child_sa, FALSE,
-								   &use_out, &bytes_out, &packets_out);
+			child_sa->get_usestats_snapshot(child_sa, stats, FALSE,
+											&use_out, &bytes_out, &packets_out);
 			fprintf(out, ", %" PRIu64 " bytes_o", bytes_out);
 			if (use_out)
 			{
@@ -451,6 +452,7 @@ METHOD(stroke_list_t, status, void,
 	child_cfg_t *child_cfg;
 	child_sa_t *child_sa;
 	ike_sa_t *ike_sa;
+	kernel_stats_t *stats = NULL;
 	linked_list_t *my_ts, *other_ts;
 	bool first, found = FALSE;
 	char *name = msg->status.name;
@@ -464,7 +466,8 @@ METHOD(stroke_list_t, status, void,
 		host_t *host;
 		u_int32_t dpd;
 		time_t since, now;
-		u_int size, online, offline, i;
+		u_int size, online, offline, i, max_queued, max_batch;
+		u_int64_t packets, batches;
 		struct utsname utsname;
 
 		now = time_monotonic(NULL);
@@ -502,6 +505,12 @@ METHOD(stroke_list_t, status, void,
 		}
 		fprintf(out, ", scheduled: %d\n",
 				lib->scheduler->get_job_load(lib->scheduler));
+		charon->sender->get_stats(charon->sender, &max_queued, &packets,
+								  &batches, &max_batch);
+		fprintf(out, "  sender: %u packets queued (max %u), %" PRIu64 " sent "
+				"in %" PRIu64 " batches (max %u)\n",
+				charon->sender->get_queue_length(charon->sender), max_queued,
+				packets, batches, max_batch);
 		fprintf(out, "  loaded plugins: %s\n",
 				lib->plugins->loaded_plugins(lib->plugins));
 
@@ -615,6 +624,13 @@ METHOD(stroke_list_t, status, void,
 	}
 	enumerator->destroy(enumerator);
 
+	if (all && !name)
+	{	/* look up the usage statistics of all CHILD_SAs in one snapshot */
+		stats = hydra->kernel_interface->get_stats(hydra->kernel_interface,
+						lib->settings->get_int(lib->settings,
+							"%s.kernel_stats_max_age", 0, charon->name));
+	}
+
 	/* Enumerate traps */
 	first = TRUE;
 	enumerator = charon->traps->create_enumerator(charon->traps);
@@ -629,7 +645,7 @@ METHOD(stroke_list_t, status, void,
 			fprintf(out, "Routed Connections:\n");
 			first = FALSE;
 		}
-		log_child_sa(out, child_sa, all);
+		log_child_sa(out, child_sa, all, stats);
 	}
 	enumerator->destroy(enumerator);
 
@@ -662,13 +678,15 @@ METHOD(stroke_list_t, status, void,
 					found = TRUE;
 					ike_printed = TRUE;
 				}
-				log_child_sa(out, child_sa, all);
+				log_child_sa(out, child_sa, all, stats);
 			}
 		}
 		children->destroy(children);
 	}
 	enumerator->destroy(enumerator);
 
+	DESTROY_IF(stats);
+
 	if (!found)
 	{
 		if (name)
@@ -1245,6 +1263,7 @@ static void list_algs(FILE *out)
 	diffie_hellman_group_t group;
 	rng_quality_t quality;
 	const char *plugin_name;
+	u_int fill, size, hits, misses;
 	int len;
 
 	fprintf(out, "\n");
@@ -1297,6 +1316,14 @@ static void list_algs(FILE *out)
 		print_alg(out, &len, diffie_hellman_group_names, group, plugin_name);
 	}
 	enumerator->destroy(enumerator);
+	enumerator = lib->crypto->create_dh_pool_enumerator(lib->crypto);
+	while (enumerator->enumerate(enumerator, &group, &fill, &size, &hits,
+								 &misses))
+	{
+		fprintf(out, "\n  dh-pool:    %N %u/%u, %u hits, %u misses",
+				diffie_hellman_group_names, group, fill, size, hits, misses);
+	}
+	enumerator->destroy(enumerator);
 	fprintf(out, "\n  random-gen:");
 	len = 13;
 	enumerator = lib->crypto->create_rng_enumerator(lib->crypto);
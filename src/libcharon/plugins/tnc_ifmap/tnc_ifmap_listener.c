@@ -20,6 +20,7 @@
 #include <daemon.h>
 #include <hydra.h>
 #include <utils/debug.h>
+#include <threading/mutex.h>
 
 #define IFMAP_RENEW_SESSION_INTERVAL	150
 
@@ -40,6 +41,11 @@ struct private_tnc_ifmap_listener_t {
 	 */
 	tnc_ifmap_soap_t *ifmap;
 
+	/**
+	 * Serializes SOAP requests of concurrently invoked listener hooks
+	 */
+	mutex_t *mutex;
+
 };
 
 /**
@@ -100,7 +106,9 @@ METHOD(listener_t, ike_updown, bool,
 {
 	if (ike_sa->get_state(ike_sa) != IKE_CONNECTING)
 	{
+		this->mutex->lock(this->mutex);
 		this->ifmap->publish_ike_sa(this->ifmap, ike_sa, up);
+		this->mutex->unlock(this->mutex);
 	}
 	return TRUE;
 }
@@ -108,7 +116,9 @@ METHOD(listener_t, ike_updown, bool,
 METHOD(listener_t, assign_vips, bool,
 	private_tnc_ifmap_listener_t *this, ike_sa_t *ike_sa, bool assign)
 {
+	this->mutex->lock(this->mutex);
 	this->ifmap->publish_virtual_ips(this->ifmap, ike_sa, assign);
+	this->mutex->unlock(this->mutex);
 	return TRUE;
 }
 
@@ -118,9 +128,11 @@ METHOD(listener_t, alert, bool,
 {
 	if (alert == ALERT_PEER_AUTH_FAILED)
 	{
+		this->mutex->lock(this->mutex);
 		this->ifmap->publish_enforcement_report(this->ifmap,
 							ike_sa->get_other_host(ike_sa),
 							"block", "authentication failed");
+		this->mutex->unlock(this->mutex);
 	}
 	return TRUE;
 }
@@ -136,6 +148,7 @@ METHOD(tnc_ifmap_listener_t, destroy, void,
 		}
 		this->ifmap->destroy(this->ifmap);
 	}
+	this->mutex->destroy(this->mutex);
 	free(this);
 }
 
@@ -158,6 +171,7 @@ tnc_ifmap_listener_t *tnc_ifmap_listener_create(bool reload)
 			.destroy = _destroy,
 		},
 		.ifmap = tnc_ifmap_soap_create(),
+		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
 	);
 
 	if (!this->ifmap)
@@ -16,6 +16,7 @@
 #include <library.h>
 #include <daemon.h>
 #include <credentials/certificates/x509.h>
+#include <credentials/sets/mem_cred.h>
 
 /*******************************************************************************
  * X509 certificate generation and parsing
@@ -106,3 +107,152 @@ bool test_cert_x509()
 }
 
 
+
+/**
+ * Look up the public key of id as done during IKE_AUTH, with the certificates
+ * received from the peer in helper, check that im is part of the trust chain
+ */
+static bool lookup_chain(credential_manager_t *mgr, identification_t *id,
+						 auth_cfg_t *helper, certificate_t *im)
+{
+	enumerator_t *enumerator;
+	public_key_t *public;
+	certificate_t *cert;
+	auth_cfg_t *auth;
+	bool found = FALSE;
+
+	enumerator = mgr->create_public_enumerator(mgr, KEY_RSA, id, helper);
+	while (enumerator->enumerate(enumerator, &public, &auth))
+	{
+		cert = auth->get(auth, AUTH_RULE_IM_CERT);
+		if (cert && cert->equals(cert, im))
+		{
+			found = TRUE;
+			break;
+		}
+	}
+	enumerator->destroy(enumerator);
+	return found;
+}
+
+/**
+ * Create a certificate for a new RSA key, self-signed if no issuer is given
+ */
+static certificate_t *create_cert(char *dn, private_key_t **key,
+								  private_key_t *issuer_key,
+								  certificate_t *issuer, x509_flag_t flags)
+{
+	certificate_t *cert;
+	identification_t *subject;
+	public_key_t *public;
+
+	*key = lib->creds->create(lib->creds, CRED_PRIVATE_KEY, KEY_RSA,
+						BUILD_KEY_SIZE, 1024, BUILD_END);
+	if (!*key)
+	{
+		return NULL;
+	}
+	subject = identification_create_from_string(dn);
+	public = (*key)->get_public_key(*key);
+	cert = lib->creds->create(lib->creds, CRED_CERTIFICATE, CERT_X509,
+						BUILD_SIGNING_KEY, issuer_key ?: *key,
+						BUILD_SIGNING_CERT, issuer,
+						BUILD_PUBLIC_KEY, public,
+						BUILD_SUBJECT, subject,
+						BUILD_X509_FLAG, flags,
+						BUILD_END);
+	public->destroy(public);
+	subject->destroy(subject);
+	return cert;
+}
+
+/*******************************************************************************
+ * Cached trust chains during IKE_AUTH
+ ******************************************************************************/
+bool test_cert_chain_cache()
+{
+	private_key_t *ca_key = NULL, *im_key = NULL, *peer_key = NULL;
+	certificate_t *ca_cert, *im_cert = NULL, *peer_cert = NULL;
+	credential_manager_t *mgr;
+	auth_cfg_t *full, *partial;
+	mem_cred_t *trusted;
+	bool cert_cache, success = TRUE;
+	int lifetime;
+
+	ca_cert = create_cert("CN=CA, OU=Test, O=strongSwan", &ca_key,
+						  NULL, NULL, X509_CA);
+	if (ca_cert)
+	{
+		im_cert = create_cert("CN=IM, OU=Test, O=strongSwan", &im_key,
+							  ca_key, ca_cert, X509_CA);
+	}
+	if (im_cert)
+	{
+		peer_cert = create_cert("CN=Peer, OU=Test, O=strongSwan", &peer_key,
+								im_key, im_cert, X509_NONE);
+	}
+	DESTROY_IF(ca_key);
+	DESTROY_IF(im_key);
+	DESTROY_IF(peer_key);
+	if (!peer_cert)
+	{
+		DESTROY_IF(ca_cert);
+		DESTROY_IF(im_cert);
+		return FALSE;
+	}
+
+	/* disable the relation cache, as it would serve the intermediate CA */
+	lifetime = lib->settings->get_int(lib->settings,
+							"libstrongswan.cert_cache_chain_lifetime", 0);
+	cert_cache = lib->settings->get_bool(lib->settings,
+							"libstrongswan.cert_cache", TRUE);
+	lib->settings->set_int(lib->settings,
+							"libstrongswan.cert_cache_chain_lifetime", 60);
+	lib->settings->set_bool(lib->settings, "libstrongswan.cert_cache", FALSE);
+	mgr = credential_manager_create();
+	lib->settings->set_int(lib->settings,
+							"libstrongswan.cert_cache_chain_lifetime", lifetime);
+	lib->settings->set_bool(lib->settings, "libstrongswan.cert_cache",
+							cert_cache);
+
+	trusted = mem_cred_create();
+	trusted->add_cert(trusted, TRUE, ca_cert->get_ref(ca_cert));
+	full = auth_cfg_create();
+	full->add(full, AUTH_HELPER_IM_CERT, im_cert->get_ref(im_cert));
+	full->add(full, AUTH_HELPER_SUBJECT_CERT, peer_cert->get_ref(peer_cert));
+	partial = auth_cfg_create();
+	partial->add(partial, AUTH_HELPER_SUBJECT_CERT,
+				 peer_cert->get_ref(peer_cert));
+
+	/* the peer omits the intermediate CA it has sent before, which we only
+	 * have in the cached trust chain */
+	mgr->add_set(mgr, &trusted->set);
+	if (!lookup_chain(mgr, peer_cert->get_subject(peer_cert), full, im_cert) ||
+		!lookup_chain(mgr, peer_cert->get_subject(peer_cert), partial, im_cert))
+	{
+		success = FALSE;
+	}
+	mgr->remove_set(mgr, &trusted->set);
+
+	/* a trust chain built on an anchor from a thread-local set must not be
+	 * used after that set is gone */
+	mgr->add_local_set(mgr, &trusted->set, FALSE);
+	if (!lookup_chain(mgr, peer_cert->get_subject(peer_cert), full, im_cert))
+	{
+		success = FALSE;
+	}
+	mgr->remove_local_set(mgr, &trusted->set);
+	if (lookup_chain(mgr, peer_cert->get_subject(peer_cert), full, im_cert))
+	{
+		success = FALSE;
+	}
+
+	mgr->destroy(mgr);
+	trusted->destroy(trusted);
+	full->destroy(full);
+	partial->destroy(partial);
+	ca_cert->destroy(ca_cert);
+	im_cert->destroy(im_cert);
+	peer_cert->destroy(peer_cert);
+	return success;
+}
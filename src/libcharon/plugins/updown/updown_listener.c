@@ -21,6 +21,7 @@
 #include <hydra.h>
 #include <daemon.h>
 #include <config/child_cfg.h>
+#include <threading/mutex.h>
 
 typedef struct private_updown_listener_t private_updown_listener_t;
 
@@ -39,6 +40,11 @@ struct private_updown_listener_t {
 	 */
 	linked_list_t *iface_cache;
 
+	/**
+	 * Mutex to lock the interface name cache
+	 */
+	mutex_t *mutex;
+
 	/**
 	 * DNS attribute handler
 	 */
@@ -68,7 +74,9 @@ static void cache_iface(private_updown_listener_t *this, u_int32_t reqid,
 	entry->reqid = reqid;
 	entry->iface = strdup(iface);
 
+	this->mutex->lock(this->mutex);
 	this->iface_cache->insert_first(this->iface_cache, entry);
+	this->mutex->unlock(this->mutex);
 }
 
 /**
@@ -80,6 +88,7 @@ static char* uncache_iface(private_updown_listener_t *this, u_int32_t reqid)
 	cache_entry_t *entry;
 	char *iface = NULL;
 
+	this->mutex->lock(this->mutex);
 	enumerator = this->iface_cache->create_enumerator(this->iface_cache);
 	while (enumerator->enumerate(enumerator, &entry))
 	{
@@ -92,6 +101,7 @@ static char* uncache_iface(private_updown_listener_t *this, u_int32_t reqid)
 		}
 	}
 	enumerator->destroy(enumerator);
+	this->mutex->unlock(this->mutex);
 	return iface;
 }
 
@@ -405,6 +415,7 @@ METHOD(updown_listener_t, destroy, void,
 	private_updown_listener_t *this)
 {
 	this->iface_cache->destroy(this->iface_cache);
+	this->mutex->destroy(this->mutex);
 	free(this);
 }
 
@@ -423,6 +434,7 @@ updown_listener_t *updown_listener_create(updown_handler_t *handler)
 			.destroy = _destroy,
 		},
 		.iface_cache = linked_list_create(),
+		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
 		.handler = handler,
 	);
 
@@ -15,6 +15,7 @@
 
 #include "inactivity_job.h"
 
+#include <hydra.h>
 #include <daemon.h>
 
 typedef struct private_inactivity_job_t private_inactivity_job_t;
@@ -54,16 +55,25 @@ METHOD(job_t, destroy, void,
 METHOD(job_t, execute, job_requeue_t,
 	private_inactivity_job_t *this)
 {
+	kernel_stats_t *stats = NULL;
 	ike_sa_t *ike_sa;
-	u_int32_t reschedule = 0;
-
+	u_int max_age;
+
+	max_age = lib->settings->get_int(lib->settings,
+							"%s.kernel_stats_max_age", 0, charon->name);
+	if (max_age)
+	{	/* shared with other inactivity checks, taken before checking out */
+		stats = hydra->kernel_interface->get_stats(hydra->kernel_interface,
+												   max_age);
+	}
 	ike_sa = charon->ike_sa_manager->checkout_by_id(charon->ike_sa_manager,
 													this->reqid, TRUE);
 	if (ike_sa)
 	{
 		enumerator_t *enumerator;
-		child_sa_t *child_sa;
-		u_int32_t delete = 0;
+		child_sa_t *child_sa, *found = NULL;
+		scheduler_handle_t handle;
+		u_int32_t delete = 0, reschedule = 0;
 		protocol_id_t proto = 0;
 		int children = 0;
 		status_t status = SUCCESS;
@@ -75,11 +85,21 @@ METHOD(job_t, execute, job_requeue_t,
 			{
 				time_t in, out, diff;
 
-				child_sa->get_usestats(child_sa, TRUE, &in, NULL, NULL);
-				child_sa->get_usestats(child_sa, FALSE, &out, NULL, NULL);
+				child_sa->get_usestats_snapshot(child_sa, stats, TRUE,
+												&in, NULL, NULL);
+				child_sa->get_usestats_snapshot(child_sa, stats, FALSE,
+												&out, NULL, NULL);
 
 				diff = time_monotonic(NULL) - max(in, out);
 
+				if (diff >= this->timeout && stats)
+				{	/* the snapshot might be outdated, verify before deleting */
+					child_sa->get_usestats(child_sa, TRUE, &in, NULL, NULL);
+					child_sa->get_usestats(child_sa, FALSE, &out, NULL, NULL);
+
+					diff = time_monotonic(NULL) - max(in, out);
+				}
+
 				if (diff >= this->timeout)
 				{
 					delete = child_sa->get_spi(child_sa, TRUE);
@@ -88,12 +108,21 @@ METHOD(job_t, execute, job_requeue_t,
 				else
 				{
 					reschedule = this->timeout - diff;
+					found = child_sa;
 				}
 			}
 			children++;
 		}
 		enumerator->destroy(enumerator);
 
+		if (found)
+		{	/* schedule a new check while the CHILD_SA is still around, so it
+			 * can cancel it if it gets deleted in the mean time */
+			handle = lib->scheduler->schedule_job(lib->scheduler, (job_t*)
+					inactivity_job_create(this->reqid, this->timeout,
+										  this->close_ike), reschedule);
+			found->set_inactivity_job(found, handle);
+		}
 		if (delete)
 		{
 			if (children == 1 && this->close_ike)
@@ -119,10 +148,7 @@ METHOD(job_t, execute, job_requeue_t,
 			charon->ike_sa_manager->checkin(charon->ike_sa_manager, ike_sa);
 		}
 	}
-	if (reschedule)
-	{
-		return JOB_RESCHEDULE(reschedule);
-	}
+	DESTROY_IF(stats);
 	return JOB_REQUEUE_NONE;
 }
 
@@ -158,6 +158,11 @@ struct private_child_sa_t {
 	 */
 	proposal_t *proposal;
 
+	/**
+	 * handle of the scheduled inactivity check
+	 */
+	scheduler_handle_t inactivity_job;
+
 	/**
 	 * config used to create this child
 	 */
@@ -331,6 +336,13 @@ METHOD(child_sa_t, set_proposal, void,
 	this->proposal = proposal->clone(proposal);
 }
 
+METHOD(child_sa_t, set_inactivity_job, void,
+	   private_child_sa_t *this, scheduler_handle_t handle)
+{
+	lib->scheduler->cancel(lib->scheduler, this->inactivity_job);
+	this->inactivity_job = handle;
+}
+
 METHOD(child_sa_t, get_traffic_selectors, linked_list_t*,
 	   private_child_sa_t *this, bool local)
 {
@@ -414,13 +426,46 @@ METHOD(child_sa_t, create_policy_enumerator, enumerator_t*,
 	return &e->public;
 }
 
+/**
+ * Query the usage statistics of an SA, from a snapshot if it contains the SA
+ */
+static status_t query_sa(kernel_stats_t *stats, host_t *src, host_t *dst,
+						 u_int32_t spi, u_int8_t protocol, mark_t mark,
+						 u_int64_t *bytes, u_int64_t *packets, u_int32_t *time)
+{
+	if (stats && stats->get_sa(stats, dst, spi, protocol, mark,
+							   bytes, packets, time))
+	{
+		return SUCCESS;
+	}
+	return hydra->kernel_interface->query_sa(hydra->kernel_interface,
+							src, dst, spi, protocol, mark, bytes, packets, time);
+}
+
+/**
+ * Query the use time of a policy, from a snapshot if it contains the policy
+ */
+static status_t query_policy(kernel_stats_t *stats, traffic_selector_t *src_ts,
+							 traffic_selector_t *dst_ts, policy_dir_t direction,
+							 mark_t mark, u_int32_t *use_time)
+{
+	if (stats && stats->get_policy(stats, src_ts, dst_ts, direction, mark,
+								   use_time))
+	{
+		return SUCCESS;
+	}
+	return hydra->kernel_interface->query_policy(hydra->kernel_interface,
+							src_ts, dst_ts, direction, mark, use_time);
+}
+
 /**
  * update the cached usebytes
  * returns SUCCESS if the usebytes have changed, FAILED if not or no SPIs
  * are available, and NOT_SUPPORTED if the kernel interface does not support
  * querying the usebytes.
  */
-static status_t update_usebytes(private_child_sa_t *this, bool inbound)
+static status_t update_usebytes(private_child_sa_t *this, kernel_stats_t *stats,
+								bool inbound)
 {
 	status_t status = FAILED;
 	u_int64_t bytes, packets;
@@ -430,10 +475,9 @@ static status_t update_usebytes(private_child_sa_t *this, bool inbound)
 	{
 		if (this->my_spi)
 		{
-			status = hydra->kernel_interface->query_sa(hydra->kernel_interface,
-							this->other_addr, this->my_addr, this->my_spi,
-							proto_ike2ip(this->protocol), this->mark_in,
-							&bytes, &packets, &time);
+			status = query_sa(stats, this->other_addr, this->my_addr,
+							  this->my_spi, proto_ike2ip(this->protocol),
+							  this->mark_in, &bytes, &packets, &time);
 			if (status == SUCCESS)
 			{
 				if (bytes > this->my_usebytes)
@@ -454,10 +498,9 @@ static status_t update_usebytes(private_child_sa_t *this, bool inbound)
 	{
 		if (this->other_spi)
 		{
-			status = hydra->kernel_interface->query_sa(hydra->kernel_interface,
-							this->my_addr, this->other_addr, this->other_spi,
-							proto_ike2ip(this->protocol), this->mark_out,
-							&bytes, &packets, &time);
+			status = query_sa(stats, this->my_addr, this->other_addr,
+							  this->other_spi, proto_ike2ip(this->protocol),
+							  this->mark_out, &bytes, &packets, &time);
 			if (status == SUCCESS)
 			{
 				if (bytes > this->other_usebytes)
@@ -480,7 +523,8 @@ static status_t update_usebytes(private_child_sa_t *this, bool inbound)
 /**
  * updates the cached usetime
  */
-static bool update_usetime(private_child_sa_t *this, bool inbound)
+static bool update_usetime(private_child_sa_t *this, kernel_stats_t *stats,
+						   bool inbound)
 {
 	enumerator_t *enumerator;
 	traffic_selector_t *my_ts, *other_ts;
@@ -493,15 +537,15 @@ static bool update_usetime(private_child_sa_t *this, bool inbound)
 
 		if (inbound)
 		{
-			if (hydra->kernel_interface->query_policy(hydra->kernel_interface,
-						other_ts, my_ts, POLICY_IN, this->mark_in, &in) == SUCCESS)
+			if (query_policy(stats, other_ts, my_ts, POLICY_IN,
+							 this->mark_in, &in) == SUCCESS)
 			{
 				last_use = max(last_use, in);
 			}
 			if (this->mode != MODE_TRANSPORT)
 			{
-				if (hydra->kernel_interface->query_policy(hydra->kernel_interface,
-						other_ts, my_ts, POLICY_FWD, this->mark_in, &fwd) == SUCCESS)
+				if (query_policy(stats, other_ts, my_ts, POLICY_FWD,
+								 this->mark_in, &fwd) == SUCCESS)
 				{
 					last_use = max(last_use, fwd);
 				}
@@ -509,8 +553,8 @@ static bool update_usetime(private_child_sa_t *this, bool inbound)
 		}
 		else
 		{
-			if (hydra->kernel_interface->query_policy(hydra->kernel_interface,
-						my_ts, other_ts, POLICY_OUT, this->mark_out, &out) == SUCCESS)
+			if (query_policy(stats, my_ts, other_ts, POLICY_OUT,
+							 this->mark_out, &out) == SUCCESS)
 			{
 				last_use = max(last_use, out);
 			}
@@ -533,21 +577,22 @@ static bool update_usetime(private_child_sa_t *this, bool inbound)
 	return TRUE;
 }
 
-METHOD(child_sa_t, get_usestats, void,
-	private_child_sa_t *this, bool inbound,
+METHOD(child_sa_t, get_usestats_snapshot, void,
+	private_child_sa_t *this, kernel_stats_t *stats, bool inbound,
 	time_t *time, u_int64_t *bytes, u_int64_t *packets)
 {
-	if ((!bytes && !packets) || update_usebytes(this, inbound) != FAILED)
+	if ((!bytes && !packets) ||
+		update_usebytes(this, stats, inbound) != FAILED)
 	{
 		/* there was traffic since last update or the kernel interface
 		 * does not support querying the number of usebytes.
 		 */
 		if (time)
 		{
-			if (!update_usetime(this, inbound) && !bytes && !packets)
+			if (!update_usetime(this, stats, inbound) && !bytes && !packets)
 			{
 				/* if policy query did not yield a usetime, query SAs instead */
-				update_usebytes(this, inbound);
+				update_usebytes(this, stats, inbound);
 			}
 		}
 	}
@@ -565,6 +610,13 @@ METHOD(child_sa_t, get_usestats, void,
 	}
 }
 
+METHOD(child_sa_t, get_usestats, void,
+	private_child_sa_t *this, bool inbound,
+	time_t *time, u_int64_t *bytes, u_int64_t *packets)
+{
+	get_usestats_snapshot(this, NULL, inbound, time, bytes, packets);
+}
+
 METHOD(child_sa_t, get_mark, mark_t,
 	private_child_sa_t *this, bool inbound)
 {
@@ -1030,6 +1082,8 @@ METHOD(child_sa_t, destroy, void,
 
 	set_state(this, CHILD_DESTROYING);
 
+	lib->scheduler->cancel(lib->scheduler, this->inactivity_job);
+
 	/* delete SAs in the kernel, if they are set up */
 	if (this->my_spi)
 	{
@@ -1101,8 +1155,10 @@ child_sa_t * child_sa_create(host_t *me, host_t* other,
 			.set_mode = _set_mode,
 			.get_proposal = _get_proposal,
 			.set_proposal = _set_proposal,
+			.set_inactivity_job = _set_inactivity_job,
 			.get_lifetime = _get_lifetime,
 			.get_usestats = _get_usestats,
+			.get_usestats_snapshot = _get_usestats_snapshot,
 			.get_mark = _get_mark,
 			.has_encap = _has_encap,
 			.get_ipcomp = _get_ipcomp,
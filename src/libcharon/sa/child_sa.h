@@ -31,6 +31,7 @@ typedef struct child_sa_t child_sa_t;
 #include <encoding/payloads/proposal_substructure.h>
 #include <config/proposal.h>
 #include <config/child_cfg.h>
+#include <kernel/kernel_stats.h>
 
 /**
  * States of a CHILD_SA
@@ -249,6 +250,16 @@ struct child_sa_t {
 	 */
 	void (*set_proposal)(child_sa_t *this, proposal_t *proposal);
 
+	/**
+	 * Set the handle of the scheduled inactivity_job_t checking this CHILD_SA.
+	 *
+	 * A previously scheduled check gets cancelled, as does the current one
+	 * when the CHILD_SA gets destroyed.
+	 *
+	 * @param handle	handle of the scheduled job
+	 */
+	void (*set_inactivity_job)(child_sa_t *this, scheduler_handle_t handle);
+
 	/**
 	 * Check if this CHILD_SA uses UDP encapsulation.
 	 *
@@ -275,6 +286,23 @@ struct child_sa_t {
 	void (*get_usestats)(child_sa_t *this, bool inbound, time_t *time,
 						 u_int64_t *bytes, u_int64_t *packets);
 
+	/**
+	 * Get last use time and the number of bytes processed, using a snapshot.
+	 *
+	 * Same as get_usestats(), but looks up the SAs and policies in a
+	 * snapshot of the kernel statistics first. Only SAs and policies missing
+	 * in it are queried individually.
+	 *
+	 * @param stats			kernel statistics snapshot, NULL to query directly
+	 * @param inbound		TRUE for inbound traffic, FALSE for outbound
+	 * @param[out] time		time of last use in seconds (NULL to ignore)
+	 * @param[out] bytes	number of processed bytes (NULL to ignore)
+	 * @param[out] packets	number of processed packets (NULL to ignore)
+	 */
+	void (*get_usestats_snapshot)(child_sa_t *this, kernel_stats_t *stats,
+								  bool inbound, time_t *time,
+								  u_int64_t *bytes, u_int64_t *packets);
+
 	/**
 	 * Get the mark used with this CHILD_SA.
 	 *
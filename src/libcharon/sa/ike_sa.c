@@ -54,6 +54,23 @@ ENUM(ike_sa_state_names, IKE_CREATED, IKE_DESTROYING,
 typedef struct private_ike_sa_t private_ike_sa_t;
 typedef struct attribute_entry_t attribute_entry_t;
 
+/**
+ * Jobs scheduled for an IKE_SA, a newly scheduled job replaces the old one
+ */
+typedef enum {
+	/** rekey_ike_sa_job_t for rekeying */
+	SCHEDULED_REKEY,
+	/** rekey_ike_sa_job_t for reauthentication */
+	SCHEDULED_REAUTH,
+	/** delete_ike_sa_job_t enforcing the maximum lifetime */
+	SCHEDULED_DELETE,
+	/** send_dpd_job_t */
+	SCHEDULED_DPD,
+	/** send_keepalive_job_t */
+	SCHEDULED_KEEPALIVE,
+	SCHEDULED_MAX,
+} scheduled_job_t;
+
 /**
  * Private data of an ike_sa_t object.
  */
@@ -232,6 +249,11 @@ struct private_ike_sa_t {
 	 */
 	u_int32_t stats[STAT_MAX];
 
+	/**
+	 * Handles of scheduled jobs, cancelled when the IKE_SA is destroyed
+	 */
+	scheduler_handle_t scheduled[SCHEDULED_MAX];
+
 	/**
 	 * how many times we have retried so far (keyingtries)
 	 */
@@ -455,6 +477,17 @@ METHOD(ike_sa_t, set_message_id, void,
 	}
 }
 
+/**
+ * Schedule a job for this IKE_SA, cancelling the one it replaces
+ */
+static void schedule_job(private_ike_sa_t *this, scheduled_job_t which,
+						 job_t *job, u_int32_t s)
+{
+	lib->scheduler->cancel(lib->scheduler, this->scheduled[which]);
+	this->scheduled[which] = lib->scheduler->schedule_job(lib->scheduler,
+														  job, s);
+}
+
 METHOD(ike_sa_t, send_keepalive, void,
 	private_ike_sa_t *this)
 {
@@ -488,8 +521,8 @@ METHOD(ike_sa_t, send_keepalive, void,
 		diff = 0;
 	}
 	job = send_keepalive_job_create(this->ike_sa_id);
-	lib->scheduler->schedule_job(lib->scheduler, (job_t*)job,
-								 this->keepalive_interval - diff);
+	schedule_job(this, SCHEDULED_KEEPALIVE, (job_t*)job,
+				 this->keepalive_interval - diff);
 }
 
 METHOD(ike_sa_t, get_ike_cfg, ike_cfg_t*,
@@ -607,7 +640,7 @@ METHOD(ike_sa_t, send_dpd, status_t,
 	if (delay)
 	{
 		job = (job_t*)send_dpd_job_create(this->ike_sa_id);
-		lib->scheduler->schedule_job(lib->scheduler, job, delay - diff);
+		schedule_job(this, SCHEDULED_DPD, job, delay - diff);
 	}
 	if (task_queued)
 	{
@@ -653,7 +686,7 @@ METHOD(ike_sa_t, set_state, void,
 				{
 					this->stats[STAT_REKEY] = t + this->stats[STAT_ESTABLISHED];
 					job = (job_t*)rekey_ike_sa_job_create(this->ike_sa_id, FALSE);
-					lib->scheduler->schedule_job(lib->scheduler, job, t);
+					schedule_job(this, SCHEDULED_REKEY, job, t);
 					DBG1(DBG_IKE, "scheduling rekeying in %ds", t);
 				}
 				t = this->peer_cfg->get_reauth_time(this->peer_cfg, TRUE);
@@ -662,7 +695,7 @@ METHOD(ike_sa_t, set_state, void,
 				{
 					this->stats[STAT_REAUTH] = t + this->stats[STAT_ESTABLISHED];
 					job = (job_t*)rekey_ike_sa_job_create(this->ike_sa_id, TRUE);
-					lib->scheduler->schedule_job(lib->scheduler, job, t);
+					schedule_job(this, SCHEDULED_REAUTH, job, t);
 					DBG1(DBG_IKE, "scheduling reauthentication in %ds", t);
 				}
 				t = this->peer_cfg->get_over_time(this->peer_cfg);
@@ -684,7 +717,7 @@ METHOD(ike_sa_t, set_state, void,
 					this->stats[STAT_DELETE] += t;
 					t = this->stats[STAT_DELETE] - this->stats[STAT_ESTABLISHED];
 					job = (job_t*)delete_ike_sa_job_create(this->ike_sa_id, TRUE);
-					lib->scheduler->schedule_job(lib->scheduler, job, t);
+					schedule_job(this, SCHEDULED_DELETE, job, t);
 					DBG1(DBG_IKE, "maximum IKE_SA lifetime %ds", t);
 				}
 				trigger_dpd = this->peer_cfg->get_dpd(this->peer_cfg);
@@ -1797,7 +1830,7 @@ METHOD(ike_sa_t, set_auth_lifetime, status_t,
 		{
 			DBG1(DBG_IKE, "received AUTH_LIFETIME of %ds, scheduling "
 				 "reauthentication in %ds", lifetime, lifetime - diff);
-			lib->scheduler->schedule_job(lib->scheduler,
+			schedule_job(this, SCHEDULED_REAUTH,
 						(job_t*)rekey_ike_sa_job_create(this->ike_sa_id, TRUE),
 						lifetime - diff);
 		}
@@ -2067,9 +2100,9 @@ METHOD(ike_sa_t, inherit, void,
 		this->stats[STAT_DELETE] = this->stats[STAT_REAUTH] + delete;
 		DBG1(DBG_IKE, "rescheduling reauthentication in %ds after rekeying, "
 			 "lifetime reduced to %ds", reauth, delete);
-		lib->scheduler->schedule_job(lib->scheduler,
+		schedule_job(this, SCHEDULED_REAUTH,
 				(job_t*)rekey_ike_sa_job_create(this->ike_sa_id, TRUE), reauth);
-		lib->scheduler->schedule_job(lib->scheduler,
+		schedule_job(this, SCHEDULED_DELETE,
 				(job_t*)delete_ike_sa_job_create(this->ike_sa_id, TRUE), delete);
 	}
 }
@@ -2079,12 +2112,18 @@ METHOD(ike_sa_t, destroy, void,
 {
 	attribute_entry_t *entry;
 	host_t *vip;
+	int i;
 
 	charon->bus->set_sa(charon->bus, &this->public);
 
 	set_state(this, IKE_DESTROYING);
 	DESTROY_IF(this->task_manager);
 
+	for (i = 0; i < SCHEDULED_MAX; i++)
+	{
+		lib->scheduler->cancel(lib->scheduler, this->scheduled[i]);
+	}
+
 	/* remove attributes first, as we pass the IKE_SA to the handler */
 	while (this->attributes->remove_last(this->attributes,
 										 (void**)&entry) == SUCCESS)
@@ -38,6 +38,33 @@
 /* the default number of segments (MUST be a power of 2) */
 #define DEFAULT_SEGMENT_COUNT 1
 
+typedef struct child_key_t child_key_t;
+
+/**
+ * A CHILD_SA registered in the secondary CHILD_SA indexes.
+ */
+struct child_key_t {
+
+	/**
+	 * reqid of the CHILD_SA
+	 */
+	u_int32_t reqid;
+
+	/**
+	 * name of the CHILD_SA
+	 */
+	char *name;
+};
+
+/**
+ * Destroy a child_key_t object.
+ */
+static void child_key_destroy(child_key_t *this)
+{
+	free(this->name);
+	free(this);
+}
+
 typedef struct entry_t entry_t;
 
 /**
@@ -111,6 +138,21 @@ struct entry_t {
 	 * message ID or hash of currently processing message, -1 if none
 	 */
 	u_int32_t processing;
+
+	/**
+	 * name under which the IKE_SA is registered in the name index, if any
+	 */
+	char *name;
+
+	/**
+	 * key under which the IKE_SA is registered in the IKE config index
+	 */
+	char *cfg_key;
+
+	/**
+	 * CHILD_SAs registered in the CHILD_SA indexes, as child_key_t
+	 */
+	linked_list_t *children;
 };
 
 /**
@@ -125,6 +167,9 @@ static status_t entry_destroy(entry_t *this)
 	DESTROY_IF(this->other);
 	DESTROY_IF(this->my_id);
 	DESTROY_IF(this->other_id);
+	this->children->destroy_function(this->children, (void*)child_key_destroy);
+	free(this->name);
+	free(this->cfg_key);
 	this->condvar->destroy(this->condvar);
 	free(this);
 	return SUCCESS;
@@ -140,23 +185,23 @@ static entry_t *entry_create()
 	INIT(this,
 		.condvar = condvar_create(CONDVAR_TYPE_DEFAULT),
 		.processing = -1,
+		.children = linked_list_create(),
 	);
 
 	return this;
 }
 
 /**
- * Function that matches entry_t objects by ike_sa_id_t.
+ * Check if two ike_sa_id_t objects refer to the same IKE_SA.
  */
-static bool entry_match_by_id(entry_t *entry, ike_sa_id_t *id)
+static bool ike_sa_id_match(ike_sa_id_t *a, ike_sa_id_t *b)
 {
-	if (id->equals(id, entry->ike_sa_id))
+	if (a->equals(a, b))
 	{
 		return TRUE;
 	}
-	if ((id->get_responder_spi(id) == 0 ||
-		 entry->ike_sa_id->get_responder_spi(entry->ike_sa_id) == 0) &&
-		id->get_initiator_spi(id) == entry->ike_sa_id->get_initiator_spi(entry->ike_sa_id))
+	if ((a->get_responder_spi(a) == 0 || b->get_responder_spi(b) == 0) &&
+		a->get_initiator_spi(a) == b->get_initiator_spi(b))
 	{
 		/* this is TRUE for IKE_SAs that we initiated but have not yet received a response */
 		return TRUE;
@@ -164,6 +209,14 @@ static bool entry_match_by_id(entry_t *entry, ike_sa_id_t *id)
 	return FALSE;
 }
 
+/**
+ * Function that matches entry_t objects by ike_sa_id_t.
+ */
+static bool entry_match_by_id(entry_t *entry, ike_sa_id_t *id)
+{
+	return ike_sa_id_match(id, entry->ike_sa_id);
+}
+
 /**
  * Function that matches entry_t objects by ike_sa_t pointers.
  */
@@ -301,6 +354,61 @@ struct table_item_t {
 	table_item_t *next;
 };
 
+/**
+ * Secondary indexes to look up IKE_SAs without enumerating the whole table.
+ *
+ * The indexes get updated when an IKE_SA is checked in, so IKE_SAs are found
+ * by the values they had when they were last checked in. Lookups verify that
+ * the checked out IKE_SA still matches.
+ */
+typedef enum {
+	/** unique ID of the IKE_SA */
+	INDEX_UNIQUE_ID,
+	/** name of the IKE_SA, i.e. of its peer config */
+	INDEX_IKE_NAME,
+	/** version, addresses and ports of the IKE config, see ike_cfg_key() */
+	INDEX_IKE_CFG,
+	/** reqid of a CHILD_SA */
+	INDEX_CHILD_REQID,
+	/** name of a CHILD_SA, i.e. of its child config */
+	INDEX_CHILD_NAME,
+	/** number of indexes */
+	INDEX_MAX,
+} index_type_t;
+
+typedef struct indexed_sas_t indexed_sas_t;
+
+/**
+ * IKE_SAs registered under a key in one of the secondary indexes.
+ */
+struct indexed_sas_t {
+	/** key of this item */
+	chunk_t key;
+
+	/** list of ike_sa_id_t objects of IKE_SAs registered under this key */
+	linked_list_t *sas;
+};
+
+static void indexed_sas_destroy(indexed_sas_t *this)
+{
+	chunk_free(&this->key);
+	this->sas->destroy(this->sas);
+	free(this);
+}
+
+typedef struct sa_index_t sa_index_t;
+
+/**
+ * Hash table and segments of a secondary index.
+ */
+struct sa_index_t {
+	/** hash table with indexed_sas_t objects */
+	table_item_t **table;
+
+	/** segments of the hash table */
+	shareable_segment_t *segments;
+};
+
 typedef struct private_ike_sa_manager_t private_ike_sa_manager_t;
 
 /**
@@ -372,6 +480,11 @@ struct private_ike_sa_manager_t {
 	 */
 	segment_t *init_hashes_segments;
 
+	/**
+	 * Secondary indexes, by index_type_t
+	 */
+	sa_index_t indexes[INDEX_MAX];
+
 	/**
 	 * RNG to get random SPIs for our side
 	 */
@@ -552,6 +665,394 @@ static enumerator_t* create_table_enumerator(private_ike_sa_manager_t *this)
 	return &enumerator->enumerator;
 }
 
+/**
+ * Put an IKE_SA into a secondary index under the given key.
+ */
+static void put_index(private_ike_sa_manager_t *this, index_type_t type,
+					  chunk_t key, ike_sa_id_t *ike_sa_id)
+{
+	sa_index_t *index = &this->indexes[type];
+	table_item_t *item;
+	u_int row, segment;
+	rwlock_t *lock;
+	indexed_sas_t *indexed;
+
+	row = chunk_hash(key) & this->table_mask;
+	segment = row & this->segment_mask;
+	lock = index->segments[segment].lock;
+	lock->write_lock(lock);
+	item = index->table[row];
+	while (item)
+	{
+		indexed = item->value;
+
+		if (chunk_equals(key, indexed->key))
+		{
+			if (indexed->sas->find_first(indexed->sas,
+					(linked_list_match_t)ike_sa_id_match,
+					NULL, ike_sa_id) == SUCCESS)
+			{
+				lock->unlock(lock);
+				return;
+			}
+			break;
+		}
+		item = item->next;
+	}
+
+	if (!item)
+	{
+		INIT(indexed,
+			.key = chunk_clone(key),
+			.sas = linked_list_create(),
+		);
+		INIT(item,
+			.value = indexed,
+			.next = index->table[row],
+		);
+		index->table[row] = item;
+	}
+	indexed->sas->insert_last(indexed->sas, ike_sa_id->clone(ike_sa_id));
+	index->segments[segment].count++;
+	lock->unlock(lock);
+}
+
+/**
+ * Remove an IKE_SA registered under the given key from a secondary index.
+ */
+static void remove_index(private_ike_sa_manager_t *this, index_type_t type,
+						 chunk_t key, ike_sa_id_t *ike_sa_id)
+{
+	sa_index_t *index = &this->indexes[type];
+	table_item_t *item, *prev = NULL;
+	u_int row, segment;
+	rwlock_t *lock;
+
+	row = chunk_hash(key) & this->table_mask;
+	segment = row & this->segment_mask;
+	lock = index->segments[segment].lock;
+	lock->write_lock(lock);
+	item = index->table[row];
+	while (item)
+	{
+		indexed_sas_t *current = item->value;
+
+		if (chunk_equals(key, current->key))
+		{
+			enumerator_t *enumerator;
+			ike_sa_id_t *id;
+
+			enumerator = current->sas->create_enumerator(current->sas);
+			while (enumerator->enumerate(enumerator, &id))
+			{
+				if (ike_sa_id_match(id, ike_sa_id))
+				{
+					current->sas->remove_at(current->sas, enumerator);
+					id->destroy(id);
+					index->segments[segment].count--;
+					break;
+				}
+			}
+			enumerator->destroy(enumerator);
+			if (current->sas->get_count(current->sas) == 0)
+			{
+				if (prev)
+				{
+					prev->next = item->next;
+				}
+				else
+				{
+					index->table[row] = item->next;
+				}
+				indexed_sas_destroy(current);
+				free(item);
+			}
+			break;
+		}
+		prev = item;
+		item = item->next;
+	}
+	lock->unlock(lock);
+}
+
+/**
+ * Cleanup function for create_id_enumerator and create_index_enumerator
+ */
+static void id_enumerator_cleanup(linked_list_t *ids)
+{
+	ids->destroy_offset(ids, offsetof(ike_sa_id_t, destroy));
+}
+
+/**
+ * Create an enumerator over the IDs of the IKE_SAs registered under the given
+ * key in a secondary index.
+ */
+static enumerator_t *create_index_enumerator(private_ike_sa_manager_t *this,
+											 index_type_t type, chunk_t key)
+{
+	sa_index_t *index = &this->indexes[type];
+	table_item_t *item;
+	u_int row, segment;
+	rwlock_t *lock;
+	linked_list_t *ids = NULL;
+
+	row = chunk_hash(key) & this->table_mask;
+	segment = row & this->segment_mask;
+	lock = index->segments[segment].lock;
+	lock->read_lock(lock);
+	item = index->table[row];
+	while (item)
+	{
+		indexed_sas_t *current = item->value;
+
+		if (chunk_equals(key, current->key))
+		{
+			ids = current->sas->clone_offset(current->sas,
+											 offsetof(ike_sa_id_t, clone));
+			break;
+		}
+		item = item->next;
+	}
+	lock->unlock(lock);
+
+	if (!ids)
+	{
+		return enumerator_create_empty();
+	}
+	return enumerator_create_cleaner(ids->create_enumerator(ids),
+									 (void*)id_enumerator_cleanup, ids);
+}
+
+/**
+ * Check if the CHILD_SAs of an IKE_SA differ from those registered in the
+ * CHILD_SA indexes.
+ */
+static bool children_changed(entry_t *entry)
+{
+	enumerator_t *enumerator, *registered;
+	child_sa_t *child_sa;
+	child_key_t *key;
+	bool has_child, has_key, changed = FALSE;
+
+	enumerator = entry->ike_sa->create_child_sa_enumerator(entry->ike_sa);
+	registered = entry->children->create_enumerator(entry->children);
+	while (TRUE)
+	{
+		has_child = enumerator->enumerate(enumerator, &child_sa);
+		has_key = registered->enumerate(registered, &key);
+		if (!has_child && !has_key)
+		{
+			break;
+		}
+		if (!has_child || !has_key ||
+			key->reqid != child_sa->get_reqid(child_sa) ||
+			!streq(key->name, child_sa->get_name(child_sa)))
+		{
+			changed = TRUE;
+			break;
+		}
+	}
+	registered->destroy(registered);
+	enumerator->destroy(enumerator);
+	return changed;
+}
+
+/**
+ * Remove the CHILD_SAs of an entry from the CHILD_SA indexes.
+ */
+static void remove_child_indexes(private_ike_sa_manager_t *this, entry_t *entry)
+{
+	child_key_t *key;
+
+	while (entry->children->remove_first(entry->children,
+										 (void**)&key) == SUCCESS)
+	{
+		if (key->reqid)
+		{
+			remove_index(this, INDEX_CHILD_REQID,
+						 chunk_from_thing(key->reqid), entry->ike_sa_id);
+		}
+		remove_index(this, INDEX_CHILD_NAME, chunk_from_str(key->name),
+					 entry->ike_sa_id);
+		child_key_destroy(key);
+	}
+}
+
+/**
+ * Register the unique ID of a new entry in the secondary index.
+ */
+static void put_unique_id_index(private_ike_sa_manager_t *this, entry_t *entry)
+{
+	u_int32_t unique_id;
+
+	unique_id = entry->ike_sa->get_unique_id(entry->ike_sa);
+	put_index(this, INDEX_UNIQUE_ID, chunk_from_thing(unique_id),
+			  entry->ike_sa_id);
+}
+
+/**
+ * Build the key of an IKE config for the IKE config index.
+ *
+ * It contains the properties ike_cfg_t.equals() compares that are cheap to
+ * get, so IKE_SAs with equal configs are registered under the same key.
+ */
+static char *ike_cfg_key(ike_cfg_t *ike_cfg)
+{
+	char *key;
+
+	if (asprintf(&key, "%d|%s|%u|%s|%u", ike_cfg->get_version(ike_cfg),
+				 ike_cfg->get_my_addr(ike_cfg, NULL),
+				 ike_cfg->get_my_port(ike_cfg),
+				 ike_cfg->get_other_addr(ike_cfg, NULL),
+				 ike_cfg->get_other_port(ike_cfg)) < 0)
+	{
+		return NULL;
+	}
+	return key;
+}
+
+/**
+ * Bring the name, IKE config and CHILD_SA indexes in sync with the checked
+ * out IKE_SA of an entry.
+ */
+static void update_indexes(private_ike_sa_manager_t *this, entry_t *entry)
+{
+	ike_sa_t *ike_sa = entry->ike_sa;
+	enumerator_t *enumerator;
+	child_sa_t *child_sa;
+	child_key_t *key;
+	peer_cfg_t *peer_cfg;
+	char *name = NULL, *cfg_key = NULL;
+
+	peer_cfg = ike_sa->get_peer_cfg(ike_sa);
+	if (peer_cfg)
+	{
+		name = ike_sa->get_name(ike_sa);
+		cfg_key = ike_cfg_key(peer_cfg->get_ike_cfg(peer_cfg));
+	}
+	if (entry->cfg_key && (!cfg_key || !streq(cfg_key, entry->cfg_key)))
+	{
+		remove_index(this, INDEX_IKE_CFG, chunk_from_str(entry->cfg_key),
+					 entry->ike_sa_id);
+		free(entry->cfg_key);
+		entry->cfg_key = NULL;
+	}
+	if (cfg_key && !entry->cfg_key)
+	{
+		entry->cfg_key = cfg_key;
+		put_index(this, INDEX_IKE_CFG, chunk_from_str(entry->cfg_key),
+				  entry->ike_sa_id);
+	}
+	else
+	{
+		free(cfg_key);
+	}
+	if (entry->name && (!name || !streq(name, entry->name)))
+	{
+		remove_index(this, INDEX_IKE_NAME, chunk_from_str(entry->name),
+					 entry->ike_sa_id);
+		free(entry->name);
+		entry->name = NULL;
+	}
+	if (name && !entry->name)
+	{
+		entry->name = strdup(name);
+		put_index(this, INDEX_IKE_NAME, chunk_from_str(entry->name),
+				  entry->ike_sa_id);
+	}
+
+	if (!children_changed(entry))
+	{
+		return;
+	}
+	remove_child_indexes(this, entry);
+	enumerator = ike_sa->create_child_sa_enumerator(ike_sa);
+	while (enumerator->enumerate(enumerator, &child_sa))
+	{
+		INIT(key,
+			.reqid = child_sa->get_reqid(child_sa),
+			.name = strdup(child_sa->get_name(child_sa)),
+		);
+		if (key->reqid)
+		{
+			put_index(this, INDEX_CHILD_REQID, chunk_from_thing(key->reqid),
+					  entry->ike_sa_id);
+		}
+		put_index(this, INDEX_CHILD_NAME, chunk_from_str(key->name),
+				  entry->ike_sa_id);
+		entry->children->insert_last(entry->children, key);
+	}
+	enumerator->destroy(enumerator);
+}
+
+/**
+ * Remove an entry from all secondary indexes.
+ */
+static void remove_indexes(private_ike_sa_manager_t *this, entry_t *entry)
+{
+	u_int32_t unique_id;
+
+	unique_id = entry->ike_sa->get_unique_id(entry->ike_sa);
+	remove_index(this, INDEX_UNIQUE_ID, chunk_from_thing(unique_id),
+				 entry->ike_sa_id);
+	if (entry->name)
+	{
+		remove_index(this, INDEX_IKE_NAME, chunk_from_str(entry->name),
+					 entry->ike_sa_id);
+		free(entry->name);
+		entry->name = NULL;
+	}
+	if (entry->cfg_key)
+	{
+		remove_index(this, INDEX_IKE_CFG, chunk_from_str(entry->cfg_key),
+					 entry->ike_sa_id);
+		free(entry->cfg_key);
+		entry->cfg_key = NULL;
+	}
+	remove_child_indexes(this, entry);
+}
+
+/**
+ * Check if an IKE_SA, or one of its CHILD_SAs, matches a secondary index key.
+ */
+static bool matches_index(ike_sa_t *ike_sa, index_type_t type, chunk_t key)
+{
+	enumerator_t *enumerator;
+	child_sa_t *child_sa;
+	u_int32_t value;
+	bool match = FALSE;
+
+	switch (type)
+	{
+		case INDEX_UNIQUE_ID:
+			value = ike_sa->get_unique_id(ike_sa);
+			return chunk_equals(key, chunk_from_thing(value));
+		case INDEX_IKE_NAME:
+			return ike_sa->get_peer_cfg(ike_sa) &&
+				   chunk_equals(key, chunk_from_str(ike_sa->get_name(ike_sa)));
+		case INDEX_CHILD_REQID:
+		case INDEX_CHILD_NAME:
+			enumerator = ike_sa->create_child_sa_enumerator(ike_sa);
+			while (!match && enumerator->enumerate(enumerator, &child_sa))
+			{
+				if (type == INDEX_CHILD_REQID)
+				{
+					value = child_sa->get_reqid(child_sa);
+					match = chunk_equals(key, chunk_from_thing(value));
+				}
+				else
+				{
+					match = chunk_equals(key,
+									chunk_from_str(child_sa->get_name(child_sa)));
+				}
+			}
+			enumerator->destroy(enumerator);
+			return match;
+		default:
+			return FALSE;
+	}
+}
+
 /**
  * Put an entry into the hash table.
  * Note: The caller has to unlock the returned segment.
@@ -576,6 +1077,7 @@ static u_int put_entry(private_ike_sa_manager_t *this, entry_t *entry)
 	}
 	this->ike_sa_table[row] = item;
 	this->segments[segment].count++;
+	put_unique_id_index(this, entry);
 	return segment;
 }
 
@@ -1328,166 +1830,6 @@ METHOD(ike_sa_manager_t, checkout_by_message, ike_sa_t*,
 	return ike_sa;
 }
 
-METHOD(ike_sa_manager_t, checkout_by_config, ike_sa_t*,
-	private_ike_sa_manager_t *this, peer_cfg_t *peer_cfg)
-{
-	enumerator_t *enumerator;
-	entry_t *entry;
-	ike_sa_t *ike_sa = NULL;
-	peer_cfg_t *current_peer;
-	ike_cfg_t *current_ike;
-	u_int segment;
-
-	DBG2(DBG_MGR, "checkout IKE_SA by config");
-
-	if (!this->reuse_ikesa)
-	{	/* IKE_SA reuse disable by config */
-		ike_sa = checkout_new(this, peer_cfg->get_ike_version(peer_cfg), TRUE);
-		charon->bus->set_sa(charon->bus, ike_sa);
-		return ike_sa;
-	}
-
-	enumerator = create_table_enumerator(this);
-	while (enumerator->enumerate(enumerator, &entry, &segment))
-	{
-		if (!wait_for_entry(this, entry, segment))
-		{
-			continue;
-		}
-		if (entry->ike_sa->get_state(entry->ike_sa) == IKE_DELETING)
-		{	/* skip IKE_SAs which are not usable */
-			continue;
-		}
-
-		current_peer = entry->ike_sa->get_peer_cfg(entry->ike_sa);
-		if (current_peer && current_peer->equals(current_peer, peer_cfg))
-		{
-			current_ike = current_peer->get_ike_cfg(current_peer);
-			if (current_ike->equals(current_ike, peer_cfg->get_ike_cfg(peer_cfg)))
-			{
-				entry->checked_out = TRUE;
-				ike_sa = entry->ike_sa;
-				DBG2(DBG_MGR, "found existing IKE_SA %u with a '%s' config",
-						ike_sa->get_unique_id(ike_sa),
-						current_peer->get_name(current_peer));
-				break;
-			}
-		}
-	}
-	enumerator->destroy(enumerator);
-
-	if (!ike_sa)
-	{	/* no IKE_SA using such a config, hand out a new */
-		ike_sa = checkout_new(this, peer_cfg->get_ike_version(peer_cfg), TRUE);
-	}
-	charon->bus->set_sa(charon->bus, ike_sa);
-	return ike_sa;
-}
-
-METHOD(ike_sa_manager_t, checkout_by_id, ike_sa_t*,
-	private_ike_sa_manager_t *this, u_int32_t id, bool child)
-{
-	enumerator_t *enumerator, *children;
-	entry_t *entry;
-	ike_sa_t *ike_sa = NULL;
-	child_sa_t *child_sa;
-	u_int segment;
-
-	DBG2(DBG_MGR, "checkout IKE_SA by ID");
-
-	enumerator = create_table_enumerator(this);
-	while (enumerator->enumerate(enumerator, &entry, &segment))
-	{
-		if (wait_for_entry(this, entry, segment))
-		{
-			/* look for a child with such a reqid ... */
-			if (child)
-			{
-				children = entry->ike_sa->create_child_sa_enumerator(entry->ike_sa);
-				while (children->enumerate(children, (void**)&child_sa))
-				{
-					if (child_sa->get_reqid(child_sa) == id)
-					{
-						ike_sa = entry->ike_sa;
-						break;
-					}
-				}
-				children->destroy(children);
-			}
-			else /* ... or for a IKE_SA with such a unique id */
-			{
-				if (entry->ike_sa->get_unique_id(entry->ike_sa) == id)
-				{
-					ike_sa = entry->ike_sa;
-				}
-			}
-			/* got one, return */
-			if (ike_sa)
-			{
-				entry->checked_out = TRUE;
-				DBG2(DBG_MGR, "IKE_SA %s[%u] successfully checked out",
-						ike_sa->get_name(ike_sa), ike_sa->get_unique_id(ike_sa));
-				break;
-			}
-		}
-	}
-	enumerator->destroy(enumerator);
-
-	charon->bus->set_sa(charon->bus, ike_sa);
-	return ike_sa;
-}
-
-METHOD(ike_sa_manager_t, checkout_by_name, ike_sa_t*,
-	private_ike_sa_manager_t *this, char *name, bool child)
-{
-	enumerator_t *enumerator, *children;
-	entry_t *entry;
-	ike_sa_t *ike_sa = NULL;
-	child_sa_t *child_sa;
-	u_int segment;
-
-	enumerator = create_table_enumerator(this);
-	while (enumerator->enumerate(enumerator, &entry, &segment))
-	{
-		if (wait_for_entry(this, entry, segment))
-		{
-			/* look for a child with such a policy name ... */
-			if (child)
-			{
-				children = entry->ike_sa->create_child_sa_enumerator(entry->ike_sa);
-				while (children->enumerate(children, (void**)&child_sa))
-				{
-					if (streq(child_sa->get_name(child_sa), name))
-					{
-						ike_sa = entry->ike_sa;
-						break;
-					}
-				}
-				children->destroy(children);
-			}
-			else /* ... or for a IKE_SA with such a connection name */
-			{
-				if (streq(entry->ike_sa->get_name(entry->ike_sa), name))
-				{
-					ike_sa = entry->ike_sa;
-				}
-			}
-			/* got one, return */
-			if (ike_sa)
-			{
-				entry->checked_out = TRUE;
-				DBG2(DBG_MGR, "IKE_SA %s[%u] successfully checked out",
-						ike_sa->get_name(ike_sa), ike_sa->get_unique_id(ike_sa));
-				break;
-			}
-		}
-	}
-	enumerator->destroy(enumerator);
-
-	charon->bus->set_sa(charon->bus, ike_sa);
-	return ike_sa;
-}
-
 /**
  * enumerator filter function, waiting variant
  */
@@ -1626,6 +1968,7 @@ METHOD(ike_sa_manager_t, checkin, void,
 		}
 		put_connected_peers(this, entry);
 	}
+	update_indexes(this, entry);
 
 	unlock_single_segment(this, segment);
 
@@ -1688,6 +2031,7 @@ METHOD(ike_sa_manager_t, checkin_and_destroy, void,
 		{
 			remove_init_hash(this, entry->init_hash);
 		}
+		remove_indexes(this, entry);
 
 		entry_destroy(entry);
 
@@ -1701,12 +2045,117 @@ METHOD(ike_sa_manager_t, checkin_and_destroy, void,
 	charon->bus->set_sa(charon->bus, NULL);
 }
 
+METHOD(ike_sa_manager_t, checkout_by_config, ike_sa_t*,
+	private_ike_sa_manager_t *this, peer_cfg_t *peer_cfg)
+{
+	enumerator_t *enumerator;
+	ike_sa_id_t *ike_sa_id;
+	ike_sa_t *ike_sa = NULL, *current;
+	peer_cfg_t *current_peer;
+	ike_cfg_t *current_ike;
+	char *key;
+
+	DBG2(DBG_MGR, "checkout IKE_SA by config");
+
+	if (!this->reuse_ikesa)
+	{	/* IKE_SA reuse disable by config */
+		ike_sa = checkout_new(this, peer_cfg->get_ike_version(peer_cfg), TRUE);
+		charon->bus->set_sa(charon->bus, ike_sa);
+		return ike_sa;
+	}
+
+	/* peer_cfg_t.equals() ignores the name, but an equal config requires an
+	 * equal IKE config, so candidates are IKE_SAs registered with its key */
+	key = ike_cfg_key(peer_cfg->get_ike_cfg(peer_cfg));
+	enumerator = create_index_enumerator(this, INDEX_IKE_CFG,
+										 chunk_from_str(key ?: ""));
+	free(key);
+	while (enumerator->enumerate(enumerator, &ike_sa_id))
+	{
+		current = checkout(this, ike_sa_id);
+		if (!current)
+		{
+			continue;
+		}
+		if (current->get_state(current) != IKE_DELETING)
+		{	/* skip IKE_SAs which are not usable */
+			current_peer = current->get_peer_cfg(current);
+			if (current_peer && current_peer->equals(current_peer, peer_cfg))
+			{
+				current_ike = current_peer->get_ike_cfg(current_peer);
+				if (current_ike->equals(current_ike,
+										peer_cfg->get_ike_cfg(peer_cfg)))
+				{
+					ike_sa = current;
+					DBG2(DBG_MGR, "found existing IKE_SA %u with a '%s' config",
+							ike_sa->get_unique_id(ike_sa),
+							current_peer->get_name(current_peer));
+					break;
+				}
+			}
+		}
+		checkin(this, current);
+	}
+	enumerator->destroy(enumerator);
+
+	if (!ike_sa)
+	{	/* no IKE_SA using such a config, hand out a new */
+		ike_sa = checkout_new(this, peer_cfg->get_ike_version(peer_cfg), TRUE);
+	}
+	charon->bus->set_sa(charon->bus, ike_sa);
+	return ike_sa;
+}
+
 /**
- * Cleanup function for create_id_enumerator
+ * Check out the first IKE_SA registered under the given key in a secondary
+ * index that still matches it.
  */
-static void id_enumerator_cleanup(linked_list_t *ids)
+static ike_sa_t *checkout_by_index(private_ike_sa_manager_t *this,
+								   index_type_t type, chunk_t key)
 {
-	ids->destroy_offset(ids, offsetof(ike_sa_id_t, destroy));
+	enumerator_t *enumerator;
+	ike_sa_id_t *ike_sa_id;
+	ike_sa_t *ike_sa = NULL;
+
+	enumerator = create_index_enumerator(this, type, key);
+	while (enumerator->enumerate(enumerator, &ike_sa_id))
+	{
+		ike_sa = checkout(this, ike_sa_id);
+		if (ike_sa)
+		{
+			/* the index is only updated during check-in, so verify that the
+			 * IKE_SA still matches */
+			if (matches_index(ike_sa, type, key))
+			{
+				break;
+			}
+			checkin(this, ike_sa);
+			ike_sa = NULL;
+		}
+	}
+	enumerator->destroy(enumerator);
+
+	charon->bus->set_sa(charon->bus, ike_sa);
+	return ike_sa;
+}
+
+METHOD(ike_sa_manager_t, checkout_by_id, ike_sa_t*,
+	private_ike_sa_manager_t *this, u_int32_t id, bool child)
+{
+	DBG2(DBG_MGR, "checkout IKE_SA by ID");
+
+	/* look for a child with such a reqid or for a IKE_SA with such a unique id */
+	return checkout_by_index(this, child ? INDEX_CHILD_REQID : INDEX_UNIQUE_ID,
+							 chunk_from_thing(id));
+}
+
+METHOD(ike_sa_manager_t, checkout_by_name, ike_sa_t*,
+	private_ike_sa_manager_t *this, char *name, bool child)
+{
+	/* look for a child with such a policy name or for a IKE_SA with such a
+	 * connection name */
+	return checkout_by_index(this, child ? INDEX_CHILD_NAME : INDEX_IKE_NAME,
+							 chunk_from_str(name));
 }
 
 METHOD(ike_sa_manager_t, create_id_enumerator, enumerator_t*,
@@ -2016,6 +2465,7 @@ METHOD(ike_sa_manager_t, flush, void,
 		{
 			remove_init_hash(this, entry->init_hash);
 		}
+		remove_indexes(this, entry);
 		remove_entry_at((private_enumerator_t*)enumerator);
 		entry_destroy(entry);
 	}
@@ -2046,6 +2496,18 @@ METHOD(ike_sa_manager_t, destroy, void,
 		this->connected_peers_segments[i].lock->destroy(this->connected_peers_segments[i].lock);
 		this->init_hashes_segments[i].mutex->destroy(this->init_hashes_segments[i].mutex);
 	}
+	for (i = 0; i < INDEX_MAX; i++)
+	{
+		u_int j;
+
+		free(this->indexes[i].table);
+		for (j = 0; j < this->segment_count; j++)
+		{
+			this->indexes[i].segments[j].lock->destroy(
+											this->indexes[i].segments[j].lock);
+		}
+		free(this->indexes[i].segments);
+	}
 	free(this->segments);
 	free(this->half_open_segments);
 	free(this->connected_peers_segments);
@@ -2167,6 +2629,20 @@ ike_sa_manager_t *ike_sa_manager_create()
 		this->init_hashes_segments[i].count = 0;
 	}
 
+	/* and for the secondary indexes to look up IKE_SAs by ID and name */
+	for (i = 0; i < INDEX_MAX; i++)
+	{
+		u_int j;
+
+		this->indexes[i].table = calloc(this->table_size, sizeof(table_item_t*));
+		this->indexes[i].segments = calloc(this->segment_count,
+										   sizeof(shareable_segment_t));
+		for (j = 0; j < this->segment_count; j++)
+		{
+			this->indexes[i].segments[j].lock = rwlock_create(RWLOCK_TYPE_DEFAULT);
+		}
+	}
+
 	this->reuse_ikesa = lib->settings->get_bool(lib->settings,
 										"%s.reuse_ikesa", TRUE, charon->name);
 	return &this->public;
@@ -91,6 +91,8 @@ struct ike_sa_manager_t {
 	 * is returned.
 	 * If no IKE_SA is found, a new one is created. This is also the case when
 	 * the found IKE_SA is in the DELETING state.
+	 * IKE_SAs are looked up by the config they had when they were last
+	 * checked in, changes to IKE_SAs currently checked out are not seen.
 	 *
 	 * @param peer_cfg			configuration used to find an existing IKE_SA
 	 * @return					checked out/created IKE_SA
@@ -133,6 +135,8 @@ struct ike_sa_manager_t {
 	 * These checkout function uses, depending
 	 * on the child parameter, the unique ID of the IKE_SA or the reqid
 	 * of one of a IKE_SAs CHILD_SA.
+	 * CHILD_SAs are found by the reqid they had when the IKE_SA was last
+	 * checked in.
 	 *
 	 * @param id				unique ID of the object
 	 * @param child				TRUE to use CHILD, FALSE to use IKE_SA
@@ -148,6 +152,8 @@ struct ike_sa_manager_t {
 	 *
 	 * Check out the IKE_SA by the configuration name, either from the IKE- or
 	 * one of its CHILD_SAs.
+	 * IKE_SAs are found by the names they had when they were last checked in,
+	 * changes to IKE_SAs currently checked out are not seen.
 	 *
 	 * @param name				name of the connection/policy
 	 * @param child				TRUE to use policy name, FALSE to use conn name
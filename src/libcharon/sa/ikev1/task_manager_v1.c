@@ -141,6 +141,11 @@ struct private_task_manager_t {
 		 */
 		u_int retransmitted;
 
+		/**
+		 * handle of the scheduled retransmit_job_t
+		 */
+		scheduler_handle_t retransmit;
+
 	} responding;
 
 	/**
@@ -182,6 +187,11 @@ struct private_task_manager_t {
 		 */
 		exchange_type_t type;
 
+		/**
+		 * handle of the scheduled retransmit_job_t
+		 */
+		scheduler_handle_t retransmit;
+
 	} initiating;
 
 	/**
@@ -323,6 +333,9 @@ METHOD(task_manager_t, flush_queue, void,
 			this->initiating.type = EXCHANGE_TYPE_UNDEFINED;
 			DESTROY_IF(this->initiating.packet);
 			this->initiating.packet = NULL;
+			lib->scheduler->cancel(lib->scheduler,
+								   this->initiating.retransmit);
+			this->initiating.retransmit = 0;
 			break;
 		case TASK_QUEUE_PASSIVE:
 			list = this->passive_tasks;
@@ -475,6 +488,7 @@ static bool send_packet(private_task_manager_t *this, bool request,
 static status_t retransmit_packet(private_task_manager_t *this, bool request,
 			u_int32_t seqnr, u_int mid, u_int retransmitted, packet_t *packet)
 {
+	scheduler_handle_t *handle;
 	u_int32_t t;
 
 	if (retransmitted > this->retransmit_tries)
@@ -496,7 +510,16 @@ static status_t retransmit_packet(private_task_manager_t *this, bool request,
 	{
 		return DESTROY_ME;
 	}
-	lib->scheduler->schedule_job_ms(lib->scheduler, (job_t*)
+	if (seqnr < RESPONDING_SEQ)
+	{
+		handle = &this->initiating.retransmit;
+	}
+	else
+	{
+		handle = &this->responding.retransmit;
+	}
+	lib->scheduler->cancel(lib->scheduler, *handle);
+	*handle = lib->scheduler->schedule_job_ms(lib->scheduler, (job_t*)
 			retransmit_job_create(seqnr, this->ike_sa->get_id(this->ike_sa)), t);
 	return NEED_MORE;
 }
@@ -1221,6 +1244,8 @@ static status_t process_response(private_task_manager_t *this,
 	this->initiating.type = EXCHANGE_TYPE_UNDEFINED;
 	DESTROY_IF(this->initiating.packet);
 	this->initiating.packet = NULL;
+	lib->scheduler->cancel(lib->scheduler, this->initiating.retransmit);
+	this->initiating.retransmit = 0;
 
 	if (this->queued && this->active_tasks->get_count(this->active_tasks) == 0)
 	{
@@ -1928,6 +1953,9 @@ METHOD(task_manager_t, reset, void,
 	this->initiating.seqnr = 0;
 	this->initiating.retransmitted = 0;
 	this->initiating.type = EXCHANGE_TYPE_UNDEFINED;
+	lib->scheduler->cancel(lib->scheduler, this->initiating.retransmit);
+	lib->scheduler->cancel(lib->scheduler, this->responding.retransmit);
+	this->initiating.retransmit = this->responding.retransmit = 0;
 	clear_fragments(this, 0);
 	if (initiate != UINT_MAX)
 	{
@@ -1985,6 +2013,8 @@ METHOD(task_manager_t, destroy, void,
 	DESTROY_IF(this->responding.packet);
 	DESTROY_IF(this->initiating.packet);
 	DESTROY_IF(this->rng);
+	lib->scheduler->cancel(lib->scheduler, this->initiating.retransmit);
+	lib->scheduler->cancel(lib->scheduler, this->responding.retransmit);
 	free(this);
 }
 
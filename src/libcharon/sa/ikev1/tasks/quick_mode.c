@@ -182,6 +182,7 @@ struct private_quick_mode_t {
  */
 static void schedule_inactivity_timeout(private_quick_mode_t *this)
 {
+	scheduler_handle_t handle;
 	u_int32_t timeout;
 	bool close_ike;
 
@@ -190,9 +191,10 @@ static void schedule_inactivity_timeout(private_quick_mode_t *this)
 	{
 		close_ike = lib->settings->get_bool(lib->settings,
 								"%s.inactivity_close_ike", FALSE, charon->name);
-		lib->scheduler->schedule_job(lib->scheduler, (job_t*)
+		handle = lib->scheduler->schedule_job(lib->scheduler, (job_t*)
 				inactivity_job_create(this->child_sa->get_reqid(this->child_sa),
 									  timeout, close_ike), timeout);
+		this->child_sa->set_inactivity_job(this->child_sa, handle);
 	}
 }
 
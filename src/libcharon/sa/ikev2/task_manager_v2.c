@@ -44,6 +44,12 @@
 #include <sa/ikev2/tasks/ike_me.h>
 #endif
 
+/**
+ * Upper limit for the configured window size, as each IKE_SA allocates a
+ * response cache slot per request in the window
+ */
+#define MAX_WINDOW_SIZE 64
+
 typedef struct exchange_t exchange_t;
 
 /**
@@ -60,6 +66,31 @@ struct exchange_t {
 	 * generated packet for retransmission
 	 */
 	packet_t *packet;
+
+	/**
+	 * type of the exchange, if initiated by us
+	 */
+	exchange_type_t type;
+
+	/**
+	 * how many times we have retransmitted so far, if initiated by us
+	 */
+	u_int retransmitted;
+
+	/**
+	 * handle of the scheduled retransmit_job_t, if initiated by us
+	 */
+	scheduler_handle_t retransmit;
+
+	/**
+	 * TRUE if the exchange handles all unbound active tasks exclusively
+	 */
+	bool exclusive;
+
+	/**
+	 * single active task handled by a concurrent exchange, if not completed
+	 */
+	task_t *task;
 };
 
 typedef struct private_task_manager_t private_task_manager_t;
@@ -80,46 +111,57 @@ struct private_task_manager_t {
 	ike_sa_t *ike_sa;
 
 	/**
-	 * Exchange we are currently handling as responder
+	 * Exchanges we are currently handling as responder
 	 */
 	struct {
 		/**
-		 * Message ID of the exchange
+		 * Lowest Message ID of a request not yet processed
 		 */
 		u_int32_t mid;
 
 		/**
-		 * packet for retransmission
+		 * responses for retransmission, indexed by Message ID % window
 		 */
-		packet_t *packet;
+		exchange_t *cache;
 
 	} responding;
 
 	/**
-	 * Exchange we are currently handling as initiator
+	 * Exchanges we are currently handling as initiator
 	 */
 	struct {
 		/**
-		 * Message ID of the exchange
+		 * Message ID to use for the next initiated exchange
 		 */
 		u_int32_t mid;
 
 		/**
-		 * how many times we have retransmitted so far
+		 * exchanges in the air, exchange_t ordered by Message ID
 		 */
-		u_int retransmitted;
+		linked_list_t *exchanges;
 
+	} initiating;
+
+	/**
+	 * Window of concurrent exchanges, see RFC 5996 section 2.3
+	 */
+	struct {
 		/**
-		 * packet for retransmission
+		 * number of requests we accept, as announced to the peer
 		 */
-		packet_t *packet;
+		u_int32_t local;
 
 		/**
-		 * type of the initated exchange
+		 * number of requests the peer accepts, as announced by the peer
 		 */
-		exchange_type_t type;
+		u_int32_t peer;
 
-	} initiating;
+		/**
+		 * TRUE if we have sent a SET_WINDOW_SIZE notify to the peer
+		 */
+		bool announced;
+
+	} window;
 
 	/**
 	 * List of queued tasks not yet in action
@@ -157,6 +199,150 @@ struct private_task_manager_t {
 	double retransmit_base;
 };
 
+/**
+ * destroy an initiated exchange, cancelling its retransmission
+ */
+static void exchange_destroy(exchange_t *exchange)
+{
+	lib->scheduler->cancel(lib->scheduler, exchange->retransmit);
+	DESTROY_IF(exchange->packet);
+	free(exchange);
+}
+
+/**
+ * destroy all initiated exchanges in the air
+ */
+static void flush_exchanges(private_task_manager_t *this)
+{
+	exchange_t *exchange;
+
+	while (this->initiating.exchanges->remove_last(this->initiating.exchanges,
+										(void**)&exchange) == SUCCESS)
+	{
+		exchange_destroy(exchange);
+	}
+}
+
+/**
+ * destroy all cached responses
+ */
+static void flush_responses(private_task_manager_t *this)
+{
+	u_int32_t i;
+
+	for (i = 0; i < this->window.local; i++)
+	{
+		DESTROY_IF(this->responding.cache[i].packet);
+		this->responding.cache[i].packet = NULL;
+	}
+}
+
+/**
+ * find an initiated exchange in the air by its Message ID
+ */
+static exchange_t* find_exchange(private_task_manager_t *this, u_int32_t mid)
+{
+	enumerator_t *enumerator;
+	exchange_t *exchange, *found = NULL;
+
+	enumerator = this->initiating.exchanges->create_enumerator(
+												this->initiating.exchanges);
+	while (enumerator->enumerate(enumerator, &exchange))
+	{
+		if (exchange->mid == mid)
+		{
+			found = exchange;
+			break;
+		}
+	}
+	enumerator->destroy(enumerator);
+	return found;
+}
+
+/**
+ * Check if an exchange handling all unbound active tasks is in the air
+ */
+static bool exclusive_active(private_task_manager_t *this)
+{
+	enumerator_t *enumerator;
+	exchange_t *exchange;
+	bool found = FALSE;
+
+	enumerator = this->initiating.exchanges->create_enumerator(
+												this->initiating.exchanges);
+	while (enumerator->enumerate(enumerator, &exchange))
+	{
+		if (exchange->exclusive)
+		{
+			found = TRUE;
+			break;
+		}
+	}
+	enumerator->destroy(enumerator);
+	return found;
+}
+
+/**
+ * Check if an active task is handled by its own exchange in the air
+ */
+static bool is_bound(private_task_manager_t *this, task_t *task)
+{
+	enumerator_t *enumerator;
+	exchange_t *exchange;
+	bool found = FALSE;
+
+	enumerator = this->initiating.exchanges->create_enumerator(
+												this->initiating.exchanges);
+	while (enumerator->enumerate(enumerator, &exchange))
+	{
+		if (!exchange->exclusive && exchange->task == task)
+		{
+			found = TRUE;
+			break;
+		}
+	}
+	enumerator->destroy(enumerator);
+	return found;
+}
+
+/**
+ * Check if a task may run in its own exchange, concurrently to others.
+ * This is the case for CHILD_SA related exchanges on established IKE_SAs,
+ * anything affecting the IKE_SA itself is handled exclusively.
+ */
+static bool is_concurrent(private_task_manager_t *this, task_t *task)
+{
+	if (this->ike_sa->get_state(this->ike_sa) != IKE_ESTABLISHED)
+	{
+		return FALSE;
+	}
+	switch (task->get_type(task))
+	{
+		case TASK_CHILD_CREATE:
+		case TASK_CHILD_REKEY:
+		case TASK_CHILD_DELETE:
+			return TRUE;
+		default:
+			return FALSE;
+	}
+}
+
+/**
+ * Check if the window allows us to initiate another exchange
+ */
+static bool window_open(private_task_manager_t *this)
+{
+	exchange_t *exchange;
+
+	if (this->initiating.exchanges->get_first(this->initiating.exchanges,
+											  (void**)&exchange) != SUCCESS)
+	{
+		return TRUE;
+	}
+	return this->initiating.mid - exchange->mid <
+								min(this->window.local, this->window.peer);
+}
+
 METHOD(task_manager_t, flush_queue, void,
 	private_task_manager_t *this, task_queue_t queue)
 {
@@ -166,6 +352,7 @@ METHOD(task_manager_t, flush_queue, void,
 	switch (queue)
 	{
 		case TASK_QUEUE_ACTIVE:
+			flush_exchanges(this);
 			list = this->active_tasks;
 			break;
 		case TASK_QUEUE_PASSIVE:
@@ -193,6 +380,58 @@ static void flush(private_task_manager_t *this)
 	flush_queue(this, TASK_QUEUE_ACTIVE);
 }
 
+/**
+ * Get the CHILD_SA a rekey or delete task operates on, if any
+ */
+static child_sa_t* get_task_child(task_t *task)
+{
+	switch (task->get_type(task))
+	{
+		case TASK_CHILD_REKEY:
+		{
+			child_rekey_t *rekey = (child_rekey_t*)task;
+			return rekey->get_child(rekey);
+		}
+		case TASK_CHILD_DELETE:
+		{
+			child_delete_t *del = (child_delete_t*)task;
+			return del->get_child(del);
+		}
+		default:
+			return NULL;
+	}
+}
+
+/**
+ * Check if an active task operates on the same CHILD_SA as the given task.
+ * Exchanges on the same CHILD_SA are serialized, only different CHILD_SAs
+ * get handled concurrently.
+ */
+static bool child_busy(private_task_manager_t *this, task_t *task)
+{
+	enumerator_t *enumerator;
+	child_sa_t *child_sa;
+	task_t *active;
+	bool found = FALSE;
+
+	child_sa = get_task_child(task);
+	if (!child_sa)
+	{
+		return FALSE;
+	}
+	enumerator = this->active_tasks->create_enumerator(this->active_tasks);
+	while (enumerator->enumerate(enumerator, (void**)&active))
+	{
+		if (get_task_child(active) == child_sa)
+		{
+			found = TRUE;
+			break;
+		}
+	}
+	enumerator->destroy(enumerator);
+	return found;
+}
+
 /**
  * move a task of a specific type from the queue to the active list
  */
@@ -207,6 +446,12 @@ static bool activate_task(private_task_manager_t *this, task_type_t type)
 	{
 		if (task->get_type(task) == type)
 		{
+			if (child_busy(this, task))
+			{
+				DBG2(DBG_IKE, "  delaying %N task, CHILD_SA in use by an "
+					 "active task", task_type_names, type);
+				continue;
+			}
 			DBG2(DBG_IKE, "  activating %N task", task_type_names, type);
 			this->queued_tasks->remove_at(this->queued_tasks, enumerator);
 			this->active_tasks->insert_last(this->active_tasks, task);
@@ -221,7 +466,10 @@ static bool activate_task(private_task_manager_t *this, task_type_t type)
 METHOD(task_manager_t, retransmit, status_t,
 	private_task_manager_t *this, u_int32_t message_id)
 {
-	if (this->initiating.packet && message_id == this->initiating.mid)
+	exchange_t *exchange;
+
+	exchange = find_exchange(this, message_id);
+	if (exchange && exchange->packet)
 	{
 		u_int32_t timeout;
 		job_t *job;
@@ -231,223 +479,135 @@ METHOD(task_manager_t, retransmit, status_t,
 		ike_mobike_t *mobike = NULL;
 
 		/* check if we are retransmitting a MOBIKE routability check */
-		enumerator = this->active_tasks->create_enumerator(this->active_tasks);
-		while (enumerator->enumerate(enumerator, (void*)&task))
+		if (exchange->exclusive)
 		{
-			if (task->get_type(task) == TASK_IKE_MOBIKE)
+			enumerator = this->active_tasks->create_enumerator(
+														this->active_tasks);
+			while (enumerator->enumerate(enumerator, (void*)&task))
 			{
-				mobike = (ike_mobike_t*)task;
-				if (!mobike->is_probing(mobike))
+				if (task->get_type(task) == TASK_IKE_MOBIKE)
 				{
-					mobike = NULL;
+					mobike = (ike_mobike_t*)task;
+					if (!mobike->is_probing(mobike))
+					{
+						mobike = NULL;
+					}
+					break;
 				}
-				break;
 			}
+			enumerator->destroy(enumerator);
 		}
-		enumerator->destroy(enumerator);
 
 		if (mobike == NULL)
 		{
-			if (this->initiating.retransmitted <= this->retransmit_tries)
+			if (exchange->retransmitted <= this->retransmit_tries)
 			{
 				timeout = (u_int32_t)(this->retransmit_timeout * 1000.0 *
-					pow(this->retransmit_base, this->initiating.retransmitted));
+					pow(this->retransmit_base, exchange->retransmitted));
 			}
 			else
 			{
 				DBG1(DBG_IKE, "giving up after %d retransmits",
-					 this->initiating.retransmitted - 1);
+					 exchange->retransmitted - 1);
 				charon->bus->alert(charon->bus, ALERT_RETRANSMIT_SEND_TIMEOUT,
-								   this->initiating.packet);
+								   exchange->packet);
 				return DESTROY_ME;
 			}
 
-			if (this->initiating.retransmitted)
+			if (exchange->retransmitted)
 			{
 				DBG1(DBG_IKE, "retransmit %d of request with message ID %d",
-					 this->initiating.retransmitted, message_id);
+					 exchange->retransmitted, message_id);
 				charon->bus->alert(charon->bus, ALERT_RETRANSMIT_SEND,
-								   this->initiating.packet);
+								   exchange->packet);
 			}
-			packet = this->initiating.packet->clone(this->initiating.packet);
+			packet = exchange->packet->clone(exchange->packet);
 			charon->sender->send(charon->sender, packet);
 		}
 		else
 		{	/* for routeability checks, we use a more aggressive behavior */
-			if (this->initiating.retransmitted <= ROUTEABILITY_CHECK_TRIES)
+			if (exchange->retransmitted <= ROUTEABILITY_CHECK_TRIES)
 			{
 				timeout = ROUTEABILITY_CHECK_INTERVAL;
 			}
 			else
 			{
 				DBG1(DBG_IKE, "giving up after %d path probings",
-					 this->initiating.retransmitted - 1);
+					 exchange->retransmitted - 1);
 				return DESTROY_ME;
 			}
 
-			if (this->initiating.retransmitted)
+			if (exchange->retransmitted)
 			{
 				DBG1(DBG_IKE, "path probing attempt %d",
-					 this->initiating.retransmitted);
+					 exchange->retransmitted);
 			}
-			mobike->transmit(mobike, this->initiating.packet);
+			mobike->transmit(mobike, exchange->packet);
 		}
 
-		this->initiating.retransmitted++;
-		job = (job_t*)retransmit_job_create(this->initiating.mid,
+		exchange->retransmitted++;
+		job = (job_t*)retransmit_job_create(exchange->mid,
 											this->ike_sa->get_id(this->ike_sa));
-		lib->scheduler->schedule_job_ms(lib->scheduler, job, timeout);
+		lib->scheduler->cancel(lib->scheduler, exchange->retransmit);
+		exchange->retransmit = lib->scheduler->schedule_job_ms(lib->scheduler,
+															   job, timeout);
 	}
 	return SUCCESS;
 }
 
-METHOD(task_manager_t, initiate, status_t,
-	private_task_manager_t *this)
+/**
+ * Announce the window of requests we accept to the peer, once per IKE_SA
+ */
+static void announce_window(private_task_manager_t *this, message_t *message)
 {
-	enumerator_t *enumerator;
-	task_t *task;
-	message_t *message;
-	host_t *me, *other;
-	status_t status;
-	exchange_type_t exchange = 0;
+	u_int32_t size;
 
-	if (this->initiating.type != EXCHANGE_TYPE_UNDEFINED)
+	if (!this->window.announced && this->window.local > 1 &&
+		message->get_exchange_type(message) != IKE_SA_INIT)
 	{
-		DBG2(DBG_IKE, "delaying task initiation, %N exchange in progress",
-				exchange_type_names, this->initiating.type);
-		/* do not initiate if we already have a message in the air */
-		return SUCCESS;
+		htoun32(&size, this->window.local);
+		message->add_notify(message, FALSE, SET_WINDOW_SIZE,
+							chunk_from_thing(size));
+		this->window.announced = TRUE;
 	}
+}
 
-	if (this->active_tasks->get_count(this->active_tasks) == 0)
-	{
-		DBG2(DBG_IKE, "activating new tasks");
-		switch (this->ike_sa->get_state(this->ike_sa))
-		{
-			case IKE_CREATED:
-				activate_task(this, TASK_IKE_VENDOR);
-				if (activate_task(this, TASK_IKE_INIT))
-				{
-					this->initiating.mid = 0;
-					exchange = IKE_SA_INIT;
-					activate_task(this, TASK_IKE_NATD);
-					activate_task(this, TASK_IKE_CERT_PRE);
-#ifdef ME
-					/* this task has to be activated before the TASK_IKE_AUTH
-					 * task, because that task pregenerates the packet after
-					 * which no payloads can be added to the message anymore.
-					 */
-					activate_task(this, TASK_IKE_ME);
-#endif /* ME */
-					activate_task(this, TASK_IKE_AUTH);
-					activate_task(this, TASK_IKE_CERT_POST);
-					activate_task(this, TASK_IKE_CONFIG);
-					activate_task(this, TASK_CHILD_CREATE);
-					activate_task(this, TASK_IKE_AUTH_LIFETIME);
-					activate_task(this, TASK_IKE_MOBIKE);
-				}
-				break;
-			case IKE_ESTABLISHED:
-				if (activate_task(this, TASK_CHILD_CREATE))
-				{
-					exchange = CREATE_CHILD_SA;
-					break;
-				}
-				if (activate_task(this, TASK_CHILD_DELETE))
-				{
-					exchange = INFORMATIONAL;
-					break;
-				}
-				if (activate_task(this, TASK_CHILD_REKEY))
-				{
-					exchange = CREATE_CHILD_SA;
-					break;
-				}
-				if (activate_task(this, TASK_IKE_DELETE))
-				{
-					exchange = INFORMATIONAL;
-					break;
-				}
-				if (activate_task(this, TASK_IKE_REKEY))
-				{
-					exchange = CREATE_CHILD_SA;
-					break;
-				}
-				if (activate_task(this, TASK_IKE_REAUTH))
-				{
-					exchange = INFORMATIONAL;
-					break;
-				}
-				if (activate_task(this, TASK_IKE_MOBIKE))
-				{
-					exchange = INFORMATIONAL;
-					break;
-				}
-				if (activate_task(this, TASK_IKE_DPD))
-				{
-					exchange = INFORMATIONAL;
-					break;
-				}
-				if (activate_task(this, TASK_IKE_AUTH_LIFETIME))
-				{
-					exchange = INFORMATIONAL;
-					break;
-				}
-#ifdef ME
-				if (activate_task(this, TASK_IKE_ME))
-				{
-					exchange = ME_CONNECT;
-					break;
-				}
-#endif /* ME */
-			case IKE_REKEYING:
-				if (activate_task(this, TASK_IKE_DELETE))
-				{
-					exchange = INFORMATIONAL;
-					break;
-				}
-			case IKE_DELETING:
-			default:
-				break;
-		}
-	}
-	else
+/**
+ * Adopt the window of requests the peer accepts, if announced
+ */
+static void process_window(private_task_manager_t *this, message_t *message)
+{
+	notify_payload_t *notify;
+	chunk_t data;
+
+	notify = message->get_notify(message, SET_WINDOW_SIZE);
+	if (notify)
 	{
-		DBG2(DBG_IKE, "reinitiating already active tasks");
-		enumerator = this->active_tasks->create_enumerator(this->active_tasks);
-		while (enumerator->enumerate(enumerator, (void**)&task))
+		data = notify->get_notification_data(notify);
+		if (data.len == sizeof(u_int32_t) && untoh32(data.ptr))
 		{
-			DBG2(DBG_IKE, "  %N task", task_type_names, task->get_type(task));
-			switch (task->get_type(task))
-			{
-				case TASK_IKE_INIT:
-					exchange = IKE_SA_INIT;
-					break;
-				case TASK_IKE_AUTH:
-					exchange = IKE_AUTH;
-					break;
-				case TASK_CHILD_CREATE:
-				case TASK_CHILD_REKEY:
-				case TASK_IKE_REKEY:
-					exchange = CREATE_CHILD_SA;
-					break;
-				case TASK_IKE_MOBIKE:
-					exchange = INFORMATIONAL;
-					break;
-				default:
-					continue;
-			}
-			break;
+			this->window.peer = untoh32(data.ptr);
+			DBG2(DBG_IKE, "peer accepts a window of %u requests",
+				 this->window.peer);
 		}
-		enumerator->destroy(enumerator);
 	}
+}
 
-	if (exchange == 0)
-	{
-		DBG2(DBG_IKE, "nothing to initiate");
-		/* nothing to do yet... */
-		return SUCCESS;
-	}
+/**
+ * Build and send a request for a concurrent exchange handling a single task,
+ * or for an exclusive exchange handling all unbound active tasks if NULL
+ */
+static status_t initiate_exchange(private_task_manager_t *this,
+								  exchange_type_t type, task_t *single)
+{
+	enumerator_t *enumerator;
+	exchange_t *exchange;
+	task_t *task;
+	message_t *message;
+	packet_t *packet;
+	host_t *me, *other;
+	status_t status;
+	bool pending = FALSE;
 
 	me = this->ike_sa->get_my_host(this->ike_sa);
 	other = this->ike_sa->get_other_host(this->ike_sa);
@@ -456,13 +616,15 @@ METHOD(task_manager_t, initiate, status_t,
 	message->set_message_id(message, this->initiating.mid);
 	message->set_source(message, me->clone(me));
 	message->set_destination(message, other->clone(other));
-	message->set_exchange_type(message, exchange);
-	this->initiating.type = exchange;
-	this->initiating.retransmitted = 0;
+	message->set_exchange_type(message, type);
 
 	enumerator = this->active_tasks->create_enumerator(this->active_tasks);
 	while (enumerator->enumerate(enumerator, (void*)&task))
 	{
+		if (single ? task != single : is_bound(this, task))
+		{
+			continue;
+		}
 		switch (task->build(task, message))
 		{
 			case SUCCESS:
@@ -472,10 +634,10 @@ METHOD(task_manager_t, initiate, status_t,
 				break;
 			case NEED_MORE:
 				/* processed, but task needs another exchange */
+				pending = TRUE;
 				break;
 			case FAILED:
 			default:
-				this->initiating.type = EXCHANGE_TYPE_UNDEFINED;
 				if (this->ike_sa->get_state(this->ike_sa) != IKE_CONNECTING)
 				{
 					charon->bus->ike_updown(charon->bus, this->ike_sa, FALSE);
@@ -491,11 +653,8 @@ METHOD(task_manager_t, initiate, status_t,
 	}
 	enumerator->destroy(enumerator);
 
-	/* update exchange type if a task changed it */
-	this->initiating.type = message->get_exchange_type(message);
-
-	status = this->ike_sa->generate_message(this->ike_sa, message,
-											&this->initiating.packet);
+	announce_window(this, message);
+	status = this->ike_sa->generate_message(this->ike_sa, message, &packet);
 	if (status != SUCCESS)
 	{
 		/* message generation failed. There is nothing more to do than to
@@ -505,34 +664,275 @@ METHOD(task_manager_t, initiate, status_t,
 		charon->bus->ike_updown(charon->bus, this->ike_sa, FALSE);
 		return DESTROY_ME;
 	}
+
+	INIT(exchange,
+		.mid = this->initiating.mid++,
+		/* update exchange type if a task changed it */
+		.type = message->get_exchange_type(message),
+		.packet = packet,
+		.exclusive = single == NULL,
+		.task = pending ? single : NULL,
+	);
 	message->destroy(message);
+	this->initiating.exchanges->insert_last(this->initiating.exchanges,
+											exchange);
 
-	return retransmit(this, this->initiating.mid);
+	return retransmit(this, exchange->mid);
+}
+
+/**
+ * Get the first active task not handled by a concurrent exchange in the air
+ */
+static task_t* get_unbound(private_task_manager_t *this)
+{
+	enumerator_t *enumerator;
+	task_t *task, *found = NULL;
+
+	enumerator = this->active_tasks->create_enumerator(this->active_tasks);
+	while (enumerator->enumerate(enumerator, &task))
+	{
+		if (!is_bound(this, task))
+		{
+			found = task;
+			break;
+		}
+	}
+	enumerator->destroy(enumerator);
+	return found;
+}
+
+METHOD(task_manager_t, initiate, status_t,
+	private_task_manager_t *this)
+{
+	enumerator_t *enumerator;
+	task_t *task, *single;
+	status_t status;
+	exchange_type_t exchange;
+
+	while (TRUE)
+	{
+		if (exclusive_active(this))
+		{
+			DBG2(DBG_IKE, "delaying task initiation, exclusive exchange "
+				 "in progress");
+			/* do not initiate if we already have a message in the air */
+			return SUCCESS;
+		}
+		if (!window_open(this))
+		{
+			DBG2(DBG_IKE, "delaying task initiation, window of %u exchanges "
+				 "in use", this->initiating.exchanges->get_count(
+												this->initiating.exchanges));
+			return SUCCESS;
+		}
+
+		exchange = 0;
+		single = NULL;
+		task = get_unbound(this);
+		if (task == NULL)
+		{
+			DBG2(DBG_IKE, "activating new tasks");
+			switch (this->ike_sa->get_state(this->ike_sa))
+			{
+				case IKE_CREATED:
+					activate_task(this, TASK_IKE_VENDOR);
+					if (activate_task(this, TASK_IKE_INIT))
+					{
+						this->initiating.mid = 0;
+						exchange = IKE_SA_INIT;
+						activate_task(this, TASK_IKE_NATD);
+						activate_task(this, TASK_IKE_CERT_PRE);
+#ifdef ME
+						/* this task has to be activated before the TASK_IKE_AUTH
+						 * task, because that task pregenerates the packet after
+						 * which no payloads can be added to the message anymore.
+						 */
+						activate_task(this, TASK_IKE_ME);
+#endif /* ME */
+						activate_task(this, TASK_IKE_AUTH);
+						activate_task(this, TASK_IKE_CERT_POST);
+						activate_task(this, TASK_IKE_CONFIG);
+						activate_task(this, TASK_CHILD_CREATE);
+						activate_task(this, TASK_IKE_AUTH_LIFETIME);
+						activate_task(this, TASK_IKE_MOBIKE);
+					}
+					break;
+				case IKE_ESTABLISHED:
+					if (activate_task(this, TASK_CHILD_CREATE))
+					{
+						exchange = CREATE_CHILD_SA;
+						break;
+					}
+					if (activate_task(this, TASK_CHILD_DELETE))
+					{
+						exchange = INFORMATIONAL;
+						break;
+					}
+					if (activate_task(this, TASK_CHILD_REKEY))
+					{
+						exchange = CREATE_CHILD_SA;
+						break;
+					}
+					if (this->initiating.exchanges->get_count(
+												this->initiating.exchanges))
+					{	/* exclusive exchanges wait for concurrent ones */
+						break;
+					}
+					if (activate_task(this, TASK_IKE_DELETE))
+					{
+						exchange = INFORMATIONAL;
+						break;
+					}
+					if (activate_task(this, TASK_IKE_REKEY))
+					{
+						exchange = CREATE_CHILD_SA;
+						break;
+					}
+					if (activate_task(this, TASK_IKE_REAUTH))
+					{
+						exchange = INFORMATIONAL;
+						break;
+					}
+					if (activate_task(this, TASK_IKE_MOBIKE))
+					{
+						exchange = INFORMATIONAL;
+						break;
+					}
+					if (activate_task(this, TASK_IKE_DPD))
+					{
+						exchange = INFORMATIONAL;
+						break;
+					}
+					if (activate_task(this, TASK_IKE_AUTH_LIFETIME))
+					{
+						exchange = INFORMATIONAL;
+						break;
+					}
+#ifdef ME
+					if (activate_task(this, TASK_IKE_ME))
+					{
+						exchange = ME_CONNECT;
+						break;
+					}
+#endif /* ME */
+				case IKE_REKEYING:
+					if (activate_task(this, TASK_IKE_DELETE))
+					{
+						exchange = INFORMATIONAL;
+						break;
+					}
+				case IKE_DELETING:
+				default:
+					break;
+			}
+			if (exchange &&
+				this->active_tasks->get_last(this->active_tasks,
+											 (void**)&task) == SUCCESS &&
+				is_concurrent(this, task))
+			{
+				single = task;
+			}
+		}
+		else if (is_concurrent(this, task))
+		{
+			DBG2(DBG_IKE, "reinitiating already active %N task",
+				 task_type_names, task->get_type(task));
+			single = task;
+			exchange = CREATE_CHILD_SA;
+			if (task->get_type(task) == TASK_CHILD_DELETE)
+			{
+				exchange = INFORMATIONAL;
+			}
+		}
+		else if (this->initiating.exchanges->get_count(
+												this->initiating.exchanges))
+		{
+			DBG2(DBG_IKE, "delaying task initiation, concurrent exchanges "
+				 "in progress");
+			return SUCCESS;
+		}
+		else
+		{
+			DBG2(DBG_IKE, "reinitiating already active tasks");
+			enumerator = this->active_tasks->create_enumerator(
+														this->active_tasks);
+			while (enumerator->enumerate(enumerator, (void**)&task))
+			{
+				DBG2(DBG_IKE, "  %N task", task_type_names, task->get_type(task));
+				switch (task->get_type(task))
+				{
+					case TASK_IKE_INIT:
+						exchange = IKE_SA_INIT;
+						break;
+					case TASK_IKE_AUTH:
+						exchange = IKE_AUTH;
+						break;
+					case TASK_CHILD_CREATE:
+					case TASK_CHILD_REKEY:
+					case TASK_IKE_REKEY:
+						exchange = CREATE_CHILD_SA;
+						break;
+					case TASK_IKE_MOBIKE:
+						exchange = INFORMATIONAL;
+						break;
+					default:
+						continue;
+				}
+				break;
+			}
+			enumerator->destroy(enumerator);
+		}
+
+		if (exchange == 0)
+		{
+			DBG2(DBG_IKE, "nothing to initiate");
+			/* nothing to do yet... */
+			return SUCCESS;
+		}
+
+		status = initiate_exchange(this, exchange, single);
+		if (status != SUCCESS || single == NULL)
+		{
+			return status;
+		}
+	}
 }
 
 /**
  * handle an incoming response message
  */
 static status_t process_response(private_task_manager_t *this,
-								 message_t *message)
+								 exchange_t *exchange, message_t *message)
 {
 	enumerator_t *enumerator;
-	task_t *task;
+	task_t *task, *single;
+	bool exclusive;
 
-	if (message->get_exchange_type(message) != this->initiating.type)
+	if (message->get_exchange_type(message) != exchange->type)
 	{
 		DBG1(DBG_IKE, "received %N response, but expected %N",
 			 exchange_type_names, message->get_exchange_type(message),
-			 exchange_type_names, this->initiating.type);
+			 exchange_type_names, exchange->type);
 		charon->bus->ike_updown(charon->bus, this->ike_sa, FALSE);
 		return DESTROY_ME;
 	}
 
+	/* the exchange is complete, its tasks might get reinitiated below */
+	this->initiating.exchanges->remove(this->initiating.exchanges,
+									   exchange, NULL);
+	exclusive = exchange->exclusive;
+	single = exchange->task;
+	exchange_destroy(exchange);
+
 	/* catch if we get resetted while processing */
 	this->reset = FALSE;
 	enumerator = this->active_tasks->create_enumerator(this->active_tasks);
 	while (enumerator->enumerate(enumerator, (void*)&task))
 	{
+		if (exclusive ? is_bound(this, task) : task != single)
+		{
+			continue;
+		}
 		switch (task->process(task, message))
 		{
 			case SUCCESS:
@@ -563,11 +963,6 @@ static status_t process_response(private_task_manager_t *this,
 	}
 	enumerator->destroy(enumerator);
 
-	this->initiating.mid++;
-	this->initiating.type = EXCHANGE_TYPE_UNDEFINED;
-	this->initiating.packet->destroy(this->initiating.packet);
-	this->initiating.packet = NULL;
-
 	return initiate(this);
 }
 
@@ -603,11 +998,15 @@ static bool handle_collisions(private_task_manager_t *this, task_t *task)
 					}
 					continue;
 				case TASK_CHILD_REKEY:
+					/* with a window, multiple rekeyings may be active, so we
+					 * offer the task to each until one handles its CHILD_SA */
 					if (type == TASK_CHILD_REKEY || type == TASK_CHILD_DELETE)
 					{
 						child_rekey_t *rekey = (child_rekey_t*)active;
-						rekey->collide(rekey, task);
-						break;
+						if (rekey->collide(rekey, task))
+						{
+							break;
+						}
 					}
 					continue;
 				default:
@@ -633,6 +1032,7 @@ static status_t build_response(private_task_manager_t *this, message_t *request)
 	bool delete = FALSE, hook = FALSE;
 	ike_sa_id_t *id = NULL;
 	u_int64_t responder_spi;
+	exchange_t *cached;
 	status_t status;
 
 	me = request->get_destination(request);
@@ -643,7 +1043,7 @@ static status_t build_response(private_task_manager_t *this, message_t *request)
 	/* send response along the path the request came in */
 	message->set_source(message, me->clone(me));
 	message->set_destination(message, other->clone(other));
-	message->set_message_id(message, this->responding.mid);
+	message->set_message_id(message, request->get_message_id(request));
 	message->set_request(message, FALSE);
 
 	enumerator = this->passive_tasks->create_enumerator(this->passive_tasks);
@@ -695,11 +1095,15 @@ static status_t build_response(private_task_manager_t *this, message_t *request)
 		id->set_responder_spi(id, 0);
 	}
 
-	/* message complete, send it */
-	DESTROY_IF(this->responding.packet);
-	this->responding.packet = NULL;
+	/* message complete, send it and cache it for retransmits */
+	cached = &this->responding.cache[request->get_message_id(request) %
+									 this->window.local];
+	DESTROY_IF(cached->packet);
+	cached->packet = NULL;
+	cached->mid = request->get_message_id(request);
+	announce_window(this, message);
 	status = this->ike_sa->generate_message(this->ike_sa, message,
-											&this->responding.packet);
+											&cached->packet);
 	message->destroy(message);
 	if (id)
 	{
@@ -711,8 +1115,7 @@ static status_t build_response(private_task_manager_t *this, message_t *request)
 		return DESTROY_ME;
 	}
 
-	charon->sender->send(charon->sender,
-						 this->responding.packet->clone(this->responding.packet));
+	charon->sender->send(charon->sender, cached->packet->clone(cached->packet));
 	if (delete)
 	{
 		if (hook)
@@ -980,6 +1383,37 @@ static void send_notify_response(private_task_manager_t *this,
 	response->destroy(response);
 }
 
+/**
+ * Move the responding window past all requests answered in sequence
+ */
+static void advance_responding(private_task_manager_t *this)
+{
+	exchange_t *exchange;
+
+	exchange = &this->responding.cache[this->responding.mid %
+									   this->window.local];
+	while (exchange->packet && exchange->mid == this->responding.mid)
+	{
+		this->responding.mid++;
+		exchange = &this->responding.cache[this->responding.mid %
+										   this->window.local];
+	}
+}
+
+/**
+ * Skip a request we rejected with an error notify. The expected message ID
+ * only advances if the request carries it, a failed request further up in
+ * the window does not move it.
+ */
+static void skip_request(private_task_manager_t *this, message_t *msg)
+{
+	if (msg->get_message_id(msg) == this->responding.mid)
+	{
+		this->responding.mid++;
+		advance_responding(this);
+	}
+}
+
 /**
  * Parse the given message and verify that it is valid.
  */
@@ -1026,7 +1460,7 @@ static status_t parse_message(private_task_manager_t *this, message_t *msg)
 					send_notify_response(this, msg,
 										 UNSUPPORTED_CRITICAL_PAYLOAD,
 										 chunk_from_thing(type));
-					incr_mid(this, FALSE);
+					skip_request(this, msg);
 				}
 				break;
 			case PARSE_ERROR:
@@ -1035,7 +1469,7 @@ static status_t parse_message(private_task_manager_t *this, message_t *msg)
 				{
 					send_notify_response(this, msg,
 										 INVALID_SYNTAX, chunk_empty);
-					incr_mid(this, FALSE);
+					skip_request(this, msg);
 				}
 				break;
 			case VERIFY_ERROR:
@@ -1044,7 +1478,7 @@ static status_t parse_message(private_task_manager_t *this, message_t *msg)
 				{
 					send_notify_response(this, msg,
 										 INVALID_SYNTAX, chunk_empty);
-					incr_mid(this, FALSE);
+					skip_request(this, msg);
 				}
 				break;
 			case FAILED:
@@ -1076,6 +1510,7 @@ METHOD(task_manager_t, process_message, status_t,
 	private_task_manager_t *this, message_t *msg)
 {
 	host_t *me, *other;
+	exchange_t *exchange;
 	status_t status;
 	u_int32_t mid;
 
@@ -1085,6 +1520,10 @@ METHOD(task_manager_t, process_message, status_t,
 	{
 		return status;
 	}
+	if (msg->get_exchange_type(msg) != IKE_SA_INIT)
+	{
+		process_window(this, msg);
+	}
 
 	me = msg->get_destination(msg);
 	other = msg->get_source(msg);
@@ -1122,7 +1561,25 @@ METHOD(task_manager_t, process_message, status_t,
 	mid = msg->get_message_id(msg);
 	if (msg->get_request(msg))
 	{
-		if (mid == this->responding.mid)
+		exchange = &this->responding.cache[mid % this->window.local];
+		if (exchange->packet && exchange->mid == mid)
+		{
+			packet_t *clone;
+			host_t *host;
+
+			DBG1(DBG_IKE, "received retransmit of request with ID %d, "
+				 "retransmitting response", mid);
+			charon->bus->alert(charon->bus, ALERT_RETRANSMIT_RECEIVE, msg);
+			clone = exchange->packet->clone(exchange->packet);
+			host = msg->get_destination(msg);
+			clone->set_source(clone, host->clone(host));
+			host = msg->get_source(msg);
+			clone->set_destination(clone, host->clone(host));
+			charon->sender->send(charon->sender, clone);
+		}
+		else if (mid == this->responding.mid ||
+				 (mid - this->responding.mid < this->window.local &&
+				  this->ike_sa->get_state(this->ike_sa) == IKE_ESTABLISHED))
 		{
 			/* reject initial messages once established */
 			if (msg->get_exchange_type(msg) == IKE_SA_INIT ||
@@ -1155,22 +1612,7 @@ METHOD(task_manager_t, process_message, status_t,
 				flush(this);
 				return DESTROY_ME;
 			}
-			this->responding.mid++;
-		}
-		else if ((mid == this->responding.mid - 1) && this->responding.packet)
-		{
-			packet_t *clone;
-			host_t *host;
-
-			DBG1(DBG_IKE, "received retransmit of request with ID %d, "
-				 "retransmitting response", mid);
-			charon->bus->alert(charon->bus, ALERT_RETRANSMIT_RECEIVE, msg);
-			clone = this->responding.packet->clone(this->responding.packet);
-			host = msg->get_destination(msg);
-			clone->set_source(clone, host->clone(host));
-			host = msg->get_source(msg);
-			clone->set_destination(clone, host->clone(host));
-			charon->sender->send(charon->sender, clone);
+			advance_responding(this);
 		}
 		else
 		{
@@ -1184,7 +1626,8 @@ METHOD(task_manager_t, process_message, status_t,
 	}
 	else
 	{
-		if (mid == this->initiating.mid)
+		exchange = find_exchange(this, mid);
+		if (exchange)
 		{
 			if (this->ike_sa->get_state(this->ike_sa) == IKE_CREATED ||
 				this->ike_sa->get_state(this->ike_sa) == IKE_CONNECTING ||
@@ -1200,7 +1643,7 @@ METHOD(task_manager_t, process_message, status_t,
 			{	/* ignore messages altered to EXCHANGE_TYPE_UNDEFINED */
 				return SUCCESS;
 			}
-			if (process_response(this, msg) != SUCCESS)
+			if (process_response(this, exchange, msg) != SUCCESS)
 			{
 				flush(this);
 				return DESTROY_ME;
@@ -1208,8 +1651,8 @@ METHOD(task_manager_t, process_message, status_t,
 		}
 		else
 		{
-			DBG1(DBG_IKE, "received message ID %d, expected %d. Ignored",
-				 mid, this->initiating.mid);
+			DBG1(DBG_IKE, "received response with message ID %d, but no "
+				 "such request outstanding. Ignored", mid);
 			return SUCCESS;
 		}
 	}
@@ -1426,10 +1869,8 @@ METHOD(task_manager_t, reset, void,
 	task_t *task;
 
 	/* reset message counters and retransmit packets */
-	DESTROY_IF(this->responding.packet);
-	DESTROY_IF(this->initiating.packet);
-	this->responding.packet = NULL;
-	this->initiating.packet = NULL;
+	flush_responses(this);
+	flush_exchanges(this);
 	if (initiate != UINT_MAX)
 	{
 		this->initiating.mid = initiate;
@@ -1438,7 +1879,6 @@ METHOD(task_manager_t, reset, void,
 	{
 		this->responding.mid = respond;
 	}
-	this->initiating.type = EXCHANGE_TYPE_UNDEFINED;
 
 	/* reset queued tasks */
 	enumerator = this->queued_tasks->create_enumerator(this->queued_tasks);
@@ -1483,9 +1923,10 @@ METHOD(task_manager_t, destroy, void,
 	this->active_tasks->destroy(this->active_tasks);
 	this->queued_tasks->destroy(this->queued_tasks);
 	this->passive_tasks->destroy(this->passive_tasks);
+	this->initiating.exchanges->destroy(this->initiating.exchanges);
 
-	DESTROY_IF(this->responding.packet);
-	DESTROY_IF(this->initiating.packet);
+	flush_responses(this);
+	free(this->responding.cache);
 	free(this);
 }
 
@@ -1522,7 +1963,13 @@ task_manager_v2_t *task_manager_v2_create(ike_sa_t *ike_sa)
 			},
 		},
 		.ike_sa = ike_sa,
-		.initiating.type = EXCHANGE_TYPE_UNDEFINED,
+		.initiating.exchanges = linked_list_create(),
+		.window = {
+			.local = min(MAX_WINDOW_SIZE, max(1,
+						lib->settings->get_int(lib->settings,
+								"%s.window_size", 1, charon->name))),
+			.peer = 1,
+		},
 		.queued_tasks = linked_list_create(),
 		.active_tasks = linked_list_create(),
 		.passive_tasks = linked_list_create(),
@@ -1533,6 +1980,7 @@ task_manager_v2_t *task_manager_v2_create(ike_sa_t *ike_sa)
 		.retransmit_base = lib->settings->get_double(lib->settings,
 					"%s.retransmit_base", RETRANSMIT_BASE, charon->name),
 	);
+	this->responding.cache = calloc(this->window.local, sizeof(exchange_t));
 
 	return &this->public;
 }
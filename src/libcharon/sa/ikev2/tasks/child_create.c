@@ -271,6 +271,7 @@ static bool allocate_spi(private_child_create_t *this)
  */
 static void schedule_inactivity_timeout(private_child_create_t *this)
 {
+	scheduler_handle_t handle;
 	u_int32_t timeout;
 	bool close_ike;
 
@@ -279,9 +280,10 @@ static void schedule_inactivity_timeout(private_child_create_t *this)
 	{
 		close_ike = lib->settings->get_bool(lib->settings,
 								"%s.inactivity_close_ike", FALSE, charon->name);
-		lib->scheduler->schedule_job(lib->scheduler, (job_t*)
+		handle = lib->scheduler->schedule_job(lib->scheduler, (job_t*)
 				inactivity_job_create(this->child_sa->get_reqid(this->child_sa),
 									  timeout, close_ike), timeout);
+		this->child_sa->set_inactivity_job(this->child_sa, handle);
 	}
 }
 
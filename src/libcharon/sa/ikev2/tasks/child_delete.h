@@ -41,7 +41,10 @@ struct child_delete_t {
 	/**
 	 * Get the CHILD_SA to delete by this task.
 	 *
-	 * @return			child_sa
+	 * As initiator, the CHILD_SA is looked up if the task has not been
+	 * initiated yet.
+	 *
+	 * @return			child_sa, NULL if none
 	 */
 	child_sa_t* (*get_child) (child_delete_t *this);
 };
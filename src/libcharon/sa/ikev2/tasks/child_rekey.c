@@ -381,7 +381,25 @@ METHOD(task_t, get_type, task_type_t,
 	return TASK_CHILD_REKEY;
 }
 
-METHOD(child_rekey_t, collide, void,
+METHOD(child_rekey_t, get_child, child_sa_t*,
+	private_child_rekey_t *this)
+{
+	child_sa_t *child_sa = this->child_sa;
+
+	if (!child_sa && this->protocol != PROTO_NONE)
+	{	/* not initiated yet, look up the CHILD_SA we are going to rekey */
+		child_sa = this->ike_sa->get_child_sa(this->ike_sa, this->protocol,
+											  this->spi, TRUE);
+		if (!child_sa)
+		{
+			child_sa = this->ike_sa->get_child_sa(this->ike_sa, this->protocol,
+												  this->spi, FALSE);
+		}
+	}
+	return child_sa;
+}
+
+METHOD(child_rekey_t, collide, bool,
 	private_child_rekey_t *this, task_t *other)
 {
 	/* the task manager only detects exchange collision, but not if
@@ -392,37 +410,36 @@ METHOD(child_rekey_t, collide, void,
 		if (rekey->child_sa != this->child_sa)
 		{
 			/* not the same child => no collision */
-			other->destroy(other);
-			return;
+			return FALSE;
 		}
 	}
 	else if (other->get_type(other) == TASK_CHILD_DELETE)
 	{
 		child_delete_t *del = (child_delete_t*)other;
-		if (del->get_child(del) == this->child_create->get_child(this->child_create))
+		if (this->child_create && del->get_child(del) ==
+							this->child_create->get_child(this->child_create))
 		{
 			/* peer deletes redundant child created in collision */
 			this->other_child_destroyed = TRUE;
 			other->destroy(other);
-			return;
+			return TRUE;
 		}
 		if (del->get_child(del) != this->child_sa)
 		{
 			/* not the same child => no collision */
-			other->destroy(other);
-			return;
+			return FALSE;
 		}
 	}
 	else
 	{
 		/* any other task is not critical for collisisions, ignore */
-		other->destroy(other);
-		return;
+		return FALSE;
 	}
 	DBG1(DBG_IKE, "detected %N collision with %N", task_type_names,
 		 TASK_CHILD_REKEY, task_type_names, other->get_type(other));
 	DESTROY_IF(this->collision);
 	this->collision = other;
+	return TRUE;
 }
 
 METHOD(task_t, migrate, void,
@@ -472,6 +489,7 @@ child_rekey_t *child_rekey_create(ike_sa_t *ike_sa, protocol_id_t protocol,
 				.migrate = _migrate,
 				.destroy = _destroy,
 			},
+			.get_child = _get_child,
 			.collide = _collide,
 		},
 		.ike_sa = ike_sa,
@@ -38,6 +38,16 @@ struct child_rekey_t {
 	 */
 	task_t task;
 
+	/**
+	 * Get the CHILD_SA rekeyed by this task.
+	 *
+	 * As initiator, the CHILD_SA is looked up if the task has not been
+	 * initiated yet.
+	 *
+	 * @return			child_sa, NULL if none
+	 */
+	child_sa_t* (*get_child)(child_rekey_t *this);
+
 	/**
 	 * Register a rekeying task which collides with this one
 	 *
@@ -46,8 +56,10 @@ struct child_rekey_t {
 	 * are going on and notifies the outgoing task by passing the incoming.
 	 *
 	 * @param other		incoming task
+	 * @return			TRUE if other collides with this task and got adopted,
+	 *					FALSE if it is for a different CHILD_SA
 	 */
-	void (*collide)(child_rekey_t* this, task_t *other);
+	bool (*collide)(child_rekey_t* this, task_t *other);
 };
 
 /**
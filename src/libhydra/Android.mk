@@ -11,6 +11,7 @@ attributes/mem_pool.c attributes/mem_pool.h \
 kernel/kernel_interface.c kernel/kernel_interface.h \
 kernel/kernel_ipsec.c kernel/kernel_ipsec.h \
 kernel/kernel_net.c kernel/kernel_net.h \
+kernel/kernel_stats.c kernel/kernel_stats.h \
 kernel/kernel_listener.h
 
 LOCAL_SRC_FILES := $(filter %.c,$(libhydra_la_SOURCES))
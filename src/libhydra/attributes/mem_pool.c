@@ -23,7 +23,45 @@
 
 #define POOL_LIMIT (sizeof(u_int)*8 - 1)
 
+/**
+ * Number of bits selecting the shard of an identity, 2^SHARD_BITS shards
+ */
+#define SHARD_BITS 4
+
+/**
+ * Number of bits selecting a lease in a page, 2^PAGE_BITS leases per page
+ */
+#define PAGE_BITS 12
+
+/**
+ * Number of leases per page
+ */
+#define PAGE_LEASES (1 << PAGE_BITS)
+
 typedef struct private_mem_pool_t private_mem_pool_t;
+typedef struct entry_t entry_t;
+
+/**
+ * Lease table shard, holding the leases of a subset of identities
+ */
+typedef struct {
+	/** lease hashtable [identity => entry] */
+	hashtable_t *leases;
+	/** lock for this shard and the entries in it */
+	mutex_t *mutex;
+} shard_t;
+
+/**
+ * A page of leases, allocated when the first lease in it gets assigned
+ */
+typedef struct {
+	/** owning entry of each lease, indexed by offset */
+	entry_t *owners[PAGE_LEASES];
+	/** bitmap of offline leases */
+	u_int32_t offline[PAGE_LEASES / 32];
+	/** number of offline leases in this page */
+	u_int count;
+} page_t;
 
 /**
  * private data of mem_pool_t
@@ -55,12 +93,27 @@ struct private_mem_pool_t {
 	u_int unused;
 
 	/**
-	 * lease hashtable [identity => entry]
+	 * lease tables, sharded by identity
 	 */
-	hashtable_t *leases;
+	shard_t shards[1 << SHARD_BITS];
+
+	/**
+	 * pages of leases, indexed by offset
+	 */
+	page_t **pages;
+
+	/**
+	 * number of online leases
+	 */
+	u_int online;
 
 	/**
-	 * lock to safely access the pool
+	 * number of offline leases
+	 */
+	u_int offline;
+
+	/**
+	 * lock for unused, pages and counters, acquired after shard locks
 	 */
 	mutex_t *mutex;
 };
@@ -68,21 +121,21 @@ struct private_mem_pool_t {
 /**
  * Lease entry.
  */
-typedef struct {
+struct entry_t {
 	/* identitiy reference */
 	identification_t *id;
 	/* list of online leases, as offset */
 	linked_list_t *online;
 	/* list of offline leases, as offset */
 	linked_list_t *offline;
-} entry_t;
+};
 
 /**
  * hashtable hash function for identities
  */
 static u_int id_hash(identification_t *id)
 {
-	return chunk_hash(id->get_encoding(id));
+	return id->hash(id, 0);
 }
 
 /**
@@ -93,6 +146,145 @@ static bool id_equals(identification_t *a, identification_t *b)
 	return a->equals(a, b);
 }
 
+/**
+ * Get the shard an identity belongs to
+ */
+static shard_t *get_shard(private_mem_pool_t *this, identification_t *id)
+{
+	return &this->shards[id_hash(id) >> (sizeof(u_int) * 8 - SHARD_BITS)];
+}
+
+/**
+ * Lock all shards, in order
+ */
+static void lock_shards(private_mem_pool_t *this)
+{
+	int i;
+
+	for (i = 0; i < countof(this->shards); i++)
+	{
+		this->shards[i].mutex->lock(this->shards[i].mutex);
+	}
+}
+
+/**
+ * Unlock all shards
+ */
+static void unlock_shards(private_mem_pool_t *this)
+{
+	int i;
+
+	for (i = countof(this->shards) - 1; i >= 0; i--)
+	{
+		this->shards[i].mutex->unlock(this->shards[i].mutex);
+	}
+}
+
+/**
+ * Get the page of a lease offset
+ */
+static inline page_t *get_page(private_mem_pool_t *this, u_int offset)
+{
+	return this->pages[offset >> PAGE_BITS];
+}
+
+/**
+ * Mark a lease as online or offline, updating the counters, pool mutex must
+ * be held
+ */
+static void set_offline(private_mem_pool_t *this, u_int offset, bool offline)
+{
+	page_t *page = get_page(this, offset);
+	u_int bit = offset & (PAGE_LEASES - 1);
+
+	if (offline)
+	{
+		page->offline[bit / 32] |= (1U << (bit % 32));
+		page->count++;
+		this->offline++;
+		this->online--;
+	}
+	else
+	{
+		page->offline[bit / 32] &= ~(1U << (bit % 32));
+		page->count--;
+		this->offline--;
+		this->online++;
+	}
+}
+
+/**
+ * Find an offline lease, pool mutex must be held
+ */
+static u_int find_offline(private_mem_pool_t *this)
+{
+	page_t *page;
+	u_int i, j, bit;
+
+	for (i = 0; i <= (this->unused >> PAGE_BITS); i++)
+	{
+		page = this->pages[i];
+		if (!page || !page->count)
+		{
+			continue;
+		}
+		for (j = 0; j < countof(page->offline); j++)
+		{
+			if (page->offline[j])
+			{
+				for (bit = 0; !(page->offline[j] & (1U << bit)); bit++)
+				{
+					/* find first set bit */
+				}
+				return (i << PAGE_BITS) + j * 32 + bit;
+			}
+		}
+	}
+	return 0;
+}
+
+/**
+ * Allocate an unused lease offset, 0 if the pool is exhausted
+ */
+static u_int allocate_offset(private_mem_pool_t *this)
+{
+	u_int offset = 0;
+
+	this->mutex->lock(this->mutex);
+	if (this->unused < this->size)
+	{
+		/* assigning offset, starting by 1 */
+		offset = ++this->unused;
+		if (!get_page(this, offset))
+		{
+			this->pages[offset >> PAGE_BITS] = calloc(1, sizeof(page_t));
+		}
+		this->online++;
+	}
+	this->mutex->unlock(this->mutex);
+	return offset;
+}
+
+/**
+ * Get the lease entry of an identity, create it if necessary
+ */
+static entry_t *get_entry(shard_t *shard, identification_t *id)
+{
+	entry_t *entry;
+
+	entry = shard->leases->get(shard->leases, id);
+	if (!entry)
+	{
+		INIT(entry,
+			.id = id->clone(id),
+			.online = linked_list_create(),
+			.offline = linked_list_create(),
+		);
+		shard->leases->put(shard->leases, entry->id, entry);
+	}
+	return entry;
+}
+
 /**
  * convert a pool offset to an address
  */
@@ -177,17 +369,10 @@ METHOD(mem_pool_t, get_size, u_int,
 METHOD(mem_pool_t, get_online, u_int,
 	private_mem_pool_t *this)
 {
-	enumerator_t *enumerator;
-	entry_t *entry;
-	u_int count = 0;
+	u_int count;
 
 	this->mutex->lock(this->mutex);
-	enumerator = this->leases->create_enumerator(this->leases);
-	while (enumerator->enumerate(enumerator, NULL, &entry))
-	{
-		count += entry->online->get_count(entry->online);
-	}
-	enumerator->destroy(enumerator);
+	count = this->online;
 	this->mutex->unlock(this->mutex);
 
 	return count;
@@ -196,52 +381,42 @@ METHOD(mem_pool_t, get_online, u_int,
 METHOD(mem_pool_t, get_offline, u_int,
 	private_mem_pool_t *this)
 {
-	enumerator_t *enumerator;
-	entry_t *entry;
-	u_int count = 0;
+	u_int count;
 
 	this->mutex->lock(this->mutex);
-	enumerator = this->leases->create_enumerator(this->leases);
-	while (enumerator->enumerate(enumerator, NULL, &entry))
-	{
-		count += entry->offline->get_count(entry->offline);
-	}
-	enumerator->destroy(enumerator);
+	count = this->offline;
 	this->mutex->unlock(this->mutex);
 
 	return count;
 }
 
 /**
- * Get an existing lease for id
+ * Get an existing lease for id, shard must be locked
  */
-static int get_existing(private_mem_pool_t *this, identification_t *id,
-						host_t *requested)
+static int get_existing(private_mem_pool_t *this, shard_t *shard,
+						identification_t *id, host_t *requested)
 {
 	enumerator_t *enumerator;
 	uintptr_t current;
 	entry_t *entry;
 	int offset = 0;
 
-	entry = this->leases->get(this->leases, id);
+	entry = shard->leases->get(shard->leases, id);
 	if (!entry)
 	{
 		return 0;
 	}
 
 	/* check for a valid offline lease, refresh */
-	enumerator = entry->offline->create_enumerator(entry->offline);
-	if (enumerator->enumerate(enumerator, &current))
+	if (entry->offline->remove_first(entry->offline,
+									 (void**)&current) == SUCCESS)
 	{
-		entry->offline->remove_at(entry->offline, enumerator);
 		entry->online->insert_last(entry->online, (void*)current);
-		offset = current;
-	}
-	enumerator->destroy(enumerator);
-	if (offset)
-	{
+		this->mutex->lock(this->mutex);
+		set_offline(this, current, FALSE);
+		this->mutex->unlock(this->mutex);
 		DBG1(DBG_CFG, "reassigning offline lease to '%Y'", id);
-		return offset;
+		return current;
 	}
 
 	/* check for a valid online lease to reassign */
@@ -263,27 +438,19 @@ static int get_existing(private_mem_pool_t *this, identification_t *id,
 }
 
 /**
- * Get a new lease for id
+ * Get a new lease for id, shard must be locked
  */
-static int get_new(private_mem_pool_t *this, identification_t *id)
+static int get_new(private_mem_pool_t *this, shard_t *shard,
+				   identification_t *id)
 {
 	entry_t *entry;
-	uintptr_t offset = 0;
+	uintptr_t offset;
 
-	if (this->unused < this->size)
+	offset = allocate_offset(this);
+	if (offset)
 	{
-		entry = this->leases->get(this->leases, id);
-		if (!entry)
-		{
-			INIT(entry,
-				.id = id->clone(id),
-				.online = linked_list_create(),
-				.offline = linked_list_create(),
-			);
-			this->leases->put(this->leases, entry->id, entry);
-		}
-		/* assigning offset, starting by 1 */
-		offset = ++this->unused;
+		entry = get_entry(shard, id);
+		get_page(this, offset)->owners[offset & (PAGE_LEASES - 1)] = entry;
 		entry->online->insert_last(entry->online, (void*)offset);
 		DBG1(DBG_CFG, "assigning new lease to '%Y'", id);
 	}
@@ -291,37 +458,33 @@ static int get_new(private_mem_pool_t *this, identification_t *id)
 }
 
 /**
- * Get a reassigned lease for id in case the pool is full
+ * Get a reassigned lease for id in case the pool is full, all shards must be
+ * locked
  */
-static int get_reassigned(private_mem_pool_t *this, identification_t *id)
+static int get_reassigned(private_mem_pool_t *this, shard_t *shard,
+						  identification_t *id)
 {
-	enumerator_t *enumerator;
-	entry_t *entry;
-	uintptr_t current, offset = 0;
+	entry_t *entry, *owner;
+	uintptr_t offset;
 
-	enumerator = this->leases->create_enumerator(this->leases);
-	while (enumerator->enumerate(enumerator, NULL, &entry))
+	this->mutex->lock(this->mutex);
+	offset = find_offline(this);
+	if (offset)
 	{
-		if (entry->offline->remove_first(entry->offline,
-										 (void**)&current) == SUCCESS)
-		{
-			offset = current;
-			DBG1(DBG_CFG, "reassigning existing offline lease by '%Y'"
-				 " to '%Y'", entry->id, id);
-			break;
-		}
+		set_offline(this, offset, FALSE);
 	}
-	enumerator->destroy(enumerator);
+	this->mutex->unlock(this->mutex);
 
 	if (offset)
 	{
-		INIT(entry,
-			.id = id->clone(id),
-			.online = linked_list_create(),
-			.offline = linked_list_create(),
-		);
+		owner = get_page(this, offset)->owners[offset & (PAGE_LEASES - 1)];
+		owner->offline->remove(owner->offline, (void*)offset, NULL);
+		DBG1(DBG_CFG, "reassigning existing offline lease by '%Y'"
+			 " to '%Y'", owner->id, id);
+
+		entry = get_entry(shard, id);
+		get_page(this, offset)->owners[offset & (PAGE_LEASES - 1)] = entry;
 		entry->online->insert_last(entry->online, (void*)offset);
-		this->leases->put(this->leases, entry->id, entry);
 	}
 	return offset;
 }
@@ -330,6 +493,7 @@ METHOD(mem_pool_t, acquire_address, host_t*,
 	private_mem_pool_t *this, identification_t *id, host_t *requested,
 	mem_pool_op_t operation)
 {
+	shard_t *shard;
 	int offset = 0;
 
 	/* if the pool is empty (e.g. in the %config case) we simply return the
@@ -345,17 +509,24 @@ METHOD(mem_pool_t, acquire_address, host_t*,
 		return NULL;
 	}
 
-	this->mutex->lock(this->mutex);
+	shard = get_shard(this, id);
 	switch (operation)
 	{
 		case MEM_POOL_EXISTING:
-			offset = get_existing(this, id, requested);
+			shard->mutex->lock(shard->mutex);
+			offset = get_existing(this, shard, id, requested);
+			shard->mutex->unlock(shard->mutex);
 			break;
 		case MEM_POOL_NEW:
-			offset = get_new(this, id);
+			shard->mutex->lock(shard->mutex);
+			offset = get_new(this, shard, id);
+			shard->mutex->unlock(shard->mutex);
 			break;
 		case MEM_POOL_REASSIGN:
-			offset = get_reassigned(this, id);
+			/* takes a lease from another identity, lock all shards */
+			lock_shards(this);
+			offset = get_reassigned(this, shard, id);
+			unlock_shards(this);
 			if (!offset)
 			{
 				DBG1(DBG_CFG, "pool '%s' is full, unable to assign address",
@@ -365,7 +536,6 @@ METHOD(mem_pool_t, acquire_address, host_t*,
 		default:
 			break;
 	}
-	this->mutex->unlock(this->mutex);
 
 	if (offset)
 	{
@@ -378,13 +548,15 @@ METHOD(mem_pool_t, release_address, bool,
 	private_mem_pool_t *this, host_t *address, identification_t *id)
 {
 	bool found = FALSE;
+	shard_t *shard;
 	entry_t *entry;
 	uintptr_t offset;
 
 	if (this->size != 0)
 	{
-		this->mutex->lock(this->mutex);
-		entry = this->leases->get(this->leases, id);
+		shard = get_shard(this, id);
+		shard->mutex->lock(shard->mutex);
+		entry = shard->leases->get(shard->leases, id);
 		if (entry)
 		{
 			offset = host2offset(this, address);
@@ -392,10 +564,13 @@ METHOD(mem_pool_t, release_address, bool,
 			{
 				DBG1(DBG_CFG, "lease %H by '%Y' went offline", address, id);
 				entry->offline->insert_last(entry->offline, (void*)offset);
+				this->mutex->lock(this->mutex);
+				set_offline(this, offset, TRUE);
+				this->mutex->unlock(this->mutex);
 				found = TRUE;
 			}
 		}
-		this->mutex->unlock(this->mutex);
+		shard->mutex->unlock(shard->mutex);
 	}
 	return found;
 }
@@ -406,8 +581,10 @@ METHOD(mem_pool_t, release_address, bool,
 typedef struct {
 	/** implemented enumerator interface */
 	enumerator_t public;
-	/** hash-table enumerator */
+	/** hash-table enumerator of the current shard */
 	enumerator_t *entries;
+	/** index of the current shard */
+	int shard;
 	/** online enumerator */
 	enumerator_t *online;
 	/** offline enumerator */
@@ -423,6 +600,7 @@ typedef struct {
 METHOD(enumerator_t, lease_enumerate, bool,
 	lease_enumerator_t *this, identification_t **id, host_t **addr, bool *online)
 {
+	hashtable_t *leases;
 	uintptr_t offset;
 
 	DESTROY_IF(this->addr);
@@ -450,9 +628,16 @@ METHOD(enumerator_t, lease_enumerate, bool,
 			this->offline->destroy(this->offline);
 			this->online = this->offline = NULL;
 		}
-		if (!this->entries->enumerate(this->entries, NULL, &this->entry))
+		while (!this->entries->enumerate(this->entries, NULL, &this->entry))
 		{
-			return FALSE;
+			if (++this->shard >= countof(this->pool->shards))
+			{
+				this->entry = NULL;
+				return FALSE;
+			}
+			leases = this->pool->shards[this->shard].leases;
+			this->entries->destroy(this->entries);
+			this->entries = leases->create_enumerator(leases);
 		}
 		this->online = this->entry->online->create_enumerator(
 														this->entry->online);
@@ -468,7 +653,7 @@ METHOD(enumerator_t, lease_enumerator_destroy, void,
 	DESTROY_IF(this->online);
 	DESTROY_IF(this->offline);
 	this->entries->destroy(this->entries);
-	this->pool->mutex->unlock(this->pool->mutex);
+	unlock_shards(this->pool);
 	free(this);
 }
 
@@ -477,14 +662,15 @@ METHOD(mem_pool_t, create_lease_enumerator, enumerator_t*,
 {
 	lease_enumerator_t *enumerator;
 
-	this->mutex->lock(this->mutex);
+	lock_shards(this);
 	INIT(enumerator,
 		.public = {
 			.enumerate = (void*)_lease_enumerate,
 			.destroy = _lease_enumerator_destroy,
 		},
 		.pool = this,
-		.entries = this->leases->create_enumerator(this->leases),
+		.entries = this->shards[0].leases->create_enumerator(
+													this->shards[0].leases),
 	);
 	return &enumerator->public;
 }
@@ -494,18 +680,31 @@ METHOD(mem_pool_t, destroy, void,
 {
 	enumerator_t *enumerator;
 	entry_t *entry;
+	int i;
 
-	enumerator = this->leases->create_enumerator(this->leases);
-	while (enumerator->enumerate(enumerator, NULL, &entry))
+	for (i = 0; i < countof(this->shards); i++)
 	{
-		entry->id->destroy(entry->id);
-		entry->online->destroy(entry->online);
-		entry->offline->destroy(entry->offline);
-		free(entry);
+		enumerator = this->shards[i].leases->create_enumerator(
+													this->shards[i].leases);
+		while (enumerator->enumerate(enumerator, NULL, &entry))
+		{
+			entry->id->destroy(entry->id);
+			entry->online->destroy(entry->online);
+			entry->offline->destroy(entry->offline);
+			free(entry);
+		}
+		enumerator->destroy(enumerator);
+		this->shards[i].leases->destroy(this->shards[i].leases);
+		this->shards[i].mutex->destroy(this->shards[i].mutex);
+	}
+	if (this->pages)
+	{
+		for (i = 0; i <= (this->size >> PAGE_BITS); i++)
+		{
+			free(this->pages[i]);
+		}
+		free(this->pages);
 	}
-	enumerator->destroy(enumerator);
-
-	this->leases->destroy(this->leases);
 	this->mutex->destroy(this->mutex);
 	DESTROY_IF(this->base);
 	free(this->name);
@@ -518,6 +717,7 @@ METHOD(mem_pool_t, destroy, void,
 static private_mem_pool_t *create_generic(char *name)
 {
 	private_mem_pool_t *this;
+	int i;
 
 	INIT(this,
 		.public = {
@@ -532,14 +732,27 @@ static private_mem_pool_t *create_generic(char *name)
 			.destroy = _destroy,
 		},
 		.name = strdup(name),
-		.leases = hashtable_create((hashtable_hash_t)id_hash,
-								   (hashtable_equals_t)id_equals, 16),
 		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
 	);
+	for (i = 0; i < countof(this->shards); i++)
+	{
+		this->shards[i].leases = hashtable_create((hashtable_hash_t)id_hash,
+										(hashtable_equals_t)id_equals, 16);
+		this->shards[i].mutex = mutex_create(MUTEX_TYPE_DEFAULT);
+	}
 
 	return this;
 }
 
+/**
+ * Allocate the page table once the size of the pool is known, pages get
+ * allocated on demand
+ */
+static void create_pages(private_mem_pool_t *this)
+{
+	this->pages = calloc((this->size >> PAGE_BITS) + 1, sizeof(page_t*));
+}
+
 /**
  * Described in header
  */
@@ -569,6 +782,7 @@ mem_pool_t *mem_pool_create(char *name, host_t *base, int bits)
 			this->size -= 2;
 		}
 		this->base = base->clone(base);
+		create_pages(this);
 	}
 
 	return &this->public;
@@ -605,6 +819,7 @@ mem_pool_t *mem_pool_create_range(char *name, host_t *from, host_t *to)
 	diff = untoh32(toaddr.ptr + toaddr.len - sizeof(diff)) -
 		   untoh32(fromaddr.ptr + fromaddr.len - sizeof(diff));
 	this->size = diff + 1;
+	create_pages(this);
 
 	return &this->public;
 }
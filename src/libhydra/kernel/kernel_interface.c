@@ -135,6 +135,16 @@ struct private_kernel_interface_t {
 	 * only those listed there
 	 */
 	bool ifaces_exclude;
+
+	/**
+	 * Shared snapshot of SA and policy statistics, if any
+	 */
+	kernel_stats_t *stats;
+
+	/**
+	 * mutex for stats snapshot, held while refreshing it
+	 */
+	mutex_t *mutex_stats;
 };
 
 METHOD(kernel_interface_t, get_features, kernel_feature_t,
@@ -266,6 +276,35 @@ METHOD(kernel_interface_t, query_policy, status_t,
 									 direction, mark, use_time);
 }
 
+METHOD(kernel_interface_t, get_stats, kernel_stats_t*,
+	private_kernel_interface_t *this, u_int max_age)
+{
+	kernel_stats_t *stats = NULL;
+
+	this->mutex_stats->lock(this->mutex_stats);
+	if (this->stats &&
+		time_monotonic(NULL) - this->stats->get_time(this->stats) <= max_age)
+	{
+		stats = this->stats->get_ref(this->stats);
+	}
+	else if (this->ipsec && this->ipsec->query_stats)
+	{
+		stats = kernel_stats_create();
+		if (this->ipsec->query_stats(this->ipsec, stats) == SUCCESS)
+		{
+			DESTROY_IF(this->stats);
+			this->stats = stats->get_ref(stats);
+		}
+		else
+		{
+			stats->destroy(stats);
+			stats = NULL;
+		}
+	}
+	this->mutex_stats->unlock(this->mutex_stats);
+	return stats;
+}
+
 METHOD(kernel_interface_t, del_policy, status_t,
 	private_kernel_interface_t *this, traffic_selector_t *src_ts,
 	traffic_selector_t *dst_ts, policy_dir_t direction, u_int32_t reqid,
@@ -510,6 +549,10 @@ METHOD(kernel_interface_t, remove_ipsec_interface, void,
 	{
 		this->ipsec->destroy(this->ipsec);
 		this->ipsec = NULL;
+		this->mutex_stats->lock(this->mutex_stats);
+		DESTROY_IF(this->stats);
+		this->stats = NULL;
+		this->mutex_stats->unlock(this->mutex_stats);
 	}
 }
 
@@ -706,6 +749,8 @@ METHOD(kernel_interface_t, destroy, void,
 	}
 	this->algorithms->destroy(this->algorithms);
 	this->mutex_algs->destroy(this->mutex_algs);
+	DESTROY_IF(this->stats);
+	this->mutex_stats->destroy(this->mutex_stats);
 	DESTROY_IF(this->ipsec);
 	DESTROY_IF(this->net);
 	DESTROY_FUNCTION_IF(this->ifaces_filter, (void*)free);
@@ -734,6 +779,7 @@ kernel_interface_t *kernel_interface_create()
 			.flush_sas = _flush_sas,
 			.add_policy = _add_policy,
 			.query_policy = _query_policy,
+			.get_stats = _get_stats,
 			.del_policy = _del_policy,
 			.flush_policies = _flush_policies,
 			.get_source_addr = _get_source_addr,
@@ -770,6 +816,7 @@ kernel_interface_t *kernel_interface_create()
 		.listeners = linked_list_create(),
 		.mutex_algs = mutex_create(MUTEX_TYPE_DEFAULT),
 		.algorithms = linked_list_create(),
+		.mutex_stats = mutex_create(MUTEX_TYPE_DEFAULT),
 	);
 
 	ifaces = lib->settings->get_str(lib->settings,
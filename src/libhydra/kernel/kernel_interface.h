@@ -55,6 +55,7 @@ typedef enum kernel_feature_t kernel_feature_t;
 #include <kernel/kernel_listener.h>
 #include <kernel/kernel_ipsec.h>
 #include <kernel/kernel_net.h>
+#include <kernel/kernel_stats.h>
 
 /**
  * Bitfield of optional features a kernel backend supports.
@@ -270,6 +271,18 @@ struct kernel_interface_t {
 							  policy_dir_t direction, mark_t mark,
 							  u_int32_t *use_time);
 
+	/**
+	 * Get a snapshot of the usage statistics of all SAs and policies.
+	 *
+	 * The snapshot is shared, and gets replaced with a single bulk query to
+	 * the kernel if it is older than max_age seconds. SAs and policies
+	 * installed after the snapshot has been taken are not found in it.
+	 *
+	 * @param max_age		maximum age of the snapshot, in seconds
+	 * @return				snapshot (call destroy()), NULL if not supported
+	 */
+	kernel_stats_t* (*get_stats) (kernel_interface_t *this, u_int max_age);
+
 	/**
 	 * Remove a policy from the SPD.
 	 *
@@ -31,6 +31,7 @@ typedef struct kernel_ipsec_t kernel_ipsec_t;
 #include <selectors/traffic_selector.h>
 #include <plugins/plugin.h>
 #include <kernel/kernel_interface.h>
+#include <kernel/kernel_stats.h>
 
 /**
  * Interface to the ipsec subsystem of the kernel.
@@ -229,6 +230,17 @@ struct kernel_ipsec_t {
 							  policy_dir_t direction, mark_t mark,
 							  u_int32_t *use_time);
 
+	/**
+	 * Query the usage statistics of all SAs and policies at once.
+	 *
+	 * This is optional, backends not supporting bulk queries set it to NULL.
+	 * Use times are monotonic timestamps, as with query_sa()/query_policy().
+	 *
+	 * @param stats			snapshot to add SA and policy statistics to
+	 * @return				SUCCESS if operation completed
+	 */
+	status_t (*query_stats) (kernel_ipsec_t *this, kernel_stats_t *stats);
+
 	/**
 	 * Remove a policy from the SPD.
 	 *
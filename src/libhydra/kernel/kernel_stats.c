@@ -0,0 +1,320 @@
+/*
+ * Copyright (C) 2013 strongSwan Project
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include "kernel_stats.h"
+
+#include <collections/hashtable.h>
+
+/**
+ * Maximum length of an SA or policy key
+ */
+#define MAX_KEY_LEN 64
+
+typedef struct private_kernel_stats_t private_kernel_stats_t;
+
+/**
+ * Private data of a kernel_stats_t object.
+ */
+struct private_kernel_stats_t {
+
+	/**
+	 * Public kernel_stats_t interface.
+	 */
+	kernel_stats_t public;
+
+	/**
+	 * SA statistics, entry_t
+	 */
+	hashtable_t *sas;
+
+	/**
+	 * Policy statistics, entry_t
+	 */
+	hashtable_t *policies;
+
+	/**
+	 * Creation time
+	 */
+	time_t created;
+
+	/**
+	 * Reference counter
+	 */
+	refcount_t ref;
+};
+
+/**
+ * Statistics of an SA or a policy
+ */
+typedef struct {
+	/** encoded SA or policy identity */
+	chunk_t key;
+	/** processed bytes, SAs only */
+	u_int64_t bytes;
+	/** processed packets, SAs only */
+	u_int64_t packets;
+	/** last use time */
+	u_int32_t time;
+	/** buffer for key */
+	u_char buf[MAX_KEY_LEN];
+} entry_t;
+
+/**
+ * Hash function for entries
+ */
+static u_int entry_hash(entry_t *entry)
+{
+	return chunk_hash(entry->key);
+}
+
+/**
+ * Comparison function for entries
+ */
+static bool entry_equals(entry_t *a, entry_t *b)
+{
+	return chunk_equals(a->key, b->key);
+}
+
+/**
+ * Append data to an entry key
+ */
+static void key_append(entry_t *entry, void *data, size_t len)
+{
+	memcpy(entry->buf + entry->key.len, data, len);
+	entry->key.len += len;
+}
+
+/**
+ * Append a mark to an entry key, ignoring bits outside of its mask
+ */
+static void key_append_mark(entry_t *entry, mark_t mark)
+{
+	mark.value &= mark.mask;
+	key_append(entry, &mark.value, sizeof(mark.value));
+	key_append(entry, &mark.mask, sizeof(mark.mask));
+}
+
+/**
+ * Append a traffic selector to an entry key, in the subnet and port form
+ * used by the kernel
+ */
+static void key_append_ts(entry_t *entry, traffic_selector_t *ts)
+{
+	host_t *net;
+	chunk_t addr;
+	u_int16_t port = 0;
+	u_int8_t prefix;
+
+	ts->to_subnet(ts, &net, &prefix);
+	addr = net->get_address(net);
+	key_append(entry, addr.ptr, addr.len);
+	key_append(entry, &prefix, sizeof(prefix));
+	net->destroy(net);
+	if (ts->get_from_port(ts) == ts->get_to_port(ts))
+	{
+		port = ts->get_from_port(ts);
+	}
+	key_append(entry, &port, sizeof(port));
+}
+
+/**
+ * Build the key of an SA
+ */
+static void build_sa_key(entry_t *entry, host_t *dst, u_int32_t spi,
+						 u_int8_t protocol, mark_t mark)
+{
+	chunk_t addr;
+
+	entry->key = chunk_create(entry->buf, 0);
+	key_append(entry, &spi, sizeof(spi));
+	key_append(entry, &protocol, sizeof(protocol));
+	key_append_mark(entry, mark);
+	addr = dst->get_address(dst);
+	key_append(entry, addr.ptr, addr.len);
+}
+
+/**
+ * Build the key of a policy
+ */
+static void build_policy_key(entry_t *entry, traffic_selector_t *src_ts,
+							 traffic_selector_t *dst_ts, policy_dir_t direction,
+							 mark_t mark)
+{
+	u_int8_t dir = direction, proto;
+
+	/* either protocol may be "any" (0), the kernel uses the restrictive one */
+	proto = max(src_ts->get_protocol(src_ts), dst_ts->get_protocol(dst_ts));
+
+	entry->key = chunk_create(entry->buf, 0);
+	key_append(entry, &dir, sizeof(dir));
+	key_append(entry, &proto, sizeof(proto));
+	key_append_mark(entry, mark);
+	key_append_ts(entry, src_ts);
+	key_append_ts(entry, dst_ts);
+}
+
+/**
+ * Store a new entry, replacing any existing one
+ */
+static void add_entry(hashtable_t *table, entry_t *entry)
+{
+	entry_t *clone;
+
+	clone = malloc_thing(entry_t);
+	*clone = *entry;
+	clone->key.ptr = clone->buf;
+	free(table->put(table, clone, clone));
+}
+
+METHOD(kernel_stats_t, add_sa, void,
+	private_kernel_stats_t *this, host_t *dst, u_int32_t spi,
+	u_int8_t protocol, mark_t mark, u_int64_t bytes, u_int64_t packets,
+	u_int32_t time)
+{
+	entry_t entry = {
+		.bytes = bytes,
+		.packets = packets,
+		.time = time,
+	};
+
+	build_sa_key(&entry, dst, spi, protocol, mark);
+	add_entry(this->sas, &entry);
+}
+
+METHOD(kernel_stats_t, get_sa, bool,
+	private_kernel_stats_t *this, host_t *dst, u_int32_t spi,
+	u_int8_t protocol, mark_t mark, u_int64_t *bytes, u_int64_t *packets,
+	u_int32_t *time)
+{
+	entry_t lookup, *found;
+
+	build_sa_key(&lookup, dst, spi, protocol, mark);
+	found = this->sas->get(this->sas, &lookup);
+	if (!found)
+	{
+		return FALSE;
+	}
+	if (bytes)
+	{
+		*bytes = found->bytes;
+	}
+	if (packets)
+	{
+		*packets = found->packets;
+	}
+	if (time)
+	{
+		*time = found->time;
+	}
+	return TRUE;
+}
+
+METHOD(kernel_stats_t, add_policy, void,
+	private_kernel_stats_t *this, traffic_selector_t *src_ts,
+	traffic_selector_t *dst_ts, policy_dir_t direction, mark_t mark,
+	u_int32_t use_time)
+{
+	entry_t entry = {
+		.time = use_time,
+	};
+
+	build_policy_key(&entry, src_ts, dst_ts, direction, mark);
+	add_entry(this->policies, &entry);
+}
+
+METHOD(kernel_stats_t, get_policy, bool,
+	private_kernel_stats_t *this, traffic_selector_t *src_ts,
+	traffic_selector_t *dst_ts, policy_dir_t direction, mark_t mark,
+	u_int32_t *use_time)
+{
+	entry_t lookup, *found;
+
+	build_policy_key(&lookup, src_ts, dst_ts, direction, mark);
+	found = this->policies->get(this->policies, &lookup);
+	if (!found)
+	{
+		return FALSE;
+	}
+	*use_time = found->time;
+	return TRUE;
+}
+
+METHOD(kernel_stats_t, get_time, time_t,
+	private_kernel_stats_t *this)
+{
+	return this->created;
+}
+
+METHOD(kernel_stats_t, get_ref, kernel_stats_t*,
+	private_kernel_stats_t *this)
+{
+	ref_get(&this->ref);
+	return &this->public;
+}
+
+/**
+ * Destroy a hashtable and all its entries
+ */
+static void table_destroy(hashtable_t *table)
+{
+	enumerator_t *enumerator;
+	entry_t *entry;
+
+	enumerator = table->create_enumerator(table);
+	while (enumerator->enumerate(enumerator, NULL, &entry))
+	{
+		free(entry);
+	}
+	enumerator->destroy(enumerator);
+	table->destroy(table);
+}
+
+METHOD(kernel_stats_t, destroy, void,
+	private_kernel_stats_t *this)
+{
+	if (ref_put(&this->ref))
+	{
+		table_destroy(this->sas);
+		table_destroy(this->policies);
+		free(this);
+	}
+}
+
+/**
+ * Described in header.
+ */
+kernel_stats_t *kernel_stats_create()
+{
+	private_kernel_stats_t *this;
+
+	INIT(this,
+		.public = {
+			.add_sa = _add_sa,
+			.get_sa = _get_sa,
+			.add_policy = _add_policy,
+			.get_policy = _get_policy,
+			.get_time = _get_time,
+			.get_ref = _get_ref,
+			.destroy = _destroy,
+		},
+		.sas = hashtable_create((hashtable_hash_t)entry_hash,
+								(hashtable_equals_t)entry_equals, 128),
+		.policies = hashtable_create((hashtable_hash_t)entry_hash,
+									 (hashtable_equals_t)entry_equals, 128),
+		.created = time_monotonic(NULL),
+		.ref = 1,
+	);
+
+	return &this->public;
+}
@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2013 strongSwan Project
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/**
+ * @defgroup kernel_stats kernel_stats
+ * @{ @ingroup hkernel
+ */
+
+#ifndef KERNEL_STATS_H_
+#define KERNEL_STATS_H_
+
+typedef struct kernel_stats_t kernel_stats_t;
+
+#include <networking/host.h>
+#include <ipsec/ipsec_types.h>
+#include <selectors/traffic_selector.h>
+
+/**
+ * Snapshot of the usage statistics of all SAs and policies in the kernel.
+ *
+ * A snapshot gets filled by a kernel_ipsec_t backend with a single bulk
+ * query, and allows looking up the statistics of many SAs and policies
+ * without querying each of them individually.
+ *
+ * SAs are identified by destination, SPI, protocol and mark, policies by
+ * their selectors, direction and mark. As the kernel stores selectors as
+ * subnets with either a single or any port, traffic selectors are compared
+ * in that form.
+ */
+struct kernel_stats_t {
+
+	/**
+	 * Add the usage statistics of an SA.
+	 *
+	 * @param dst			destination address of SA
+	 * @param spi			SPI of SA
+	 * @param protocol		protocol of SA (ESP/AH)
+	 * @param mark			mark of SA
+	 * @param bytes			number of bytes processed by SA
+	 * @param packets		number of packets processed by SA
+	 * @param time			last (monotonic) time of SA use, 0 if unknown
+	 */
+	void (*add_sa)(kernel_stats_t *this, host_t *dst, u_int32_t spi,
+				   u_int8_t protocol, mark_t mark, u_int64_t bytes,
+				   u_int64_t packets, u_int32_t time);
+
+	/**
+	 * Look up the usage statistics of an SA.
+	 *
+	 * @param dst			destination address of SA
+	 * @param spi			SPI of SA
+	 * @param protocol		protocol of SA (ESP/AH)
+	 * @param mark			mark of SA
+	 * @param[out] bytes	number of bytes processed by SA (NULL to ignore)
+	 * @param[out] packets	number of packets processed by SA (NULL to ignore)
+	 * @param[out] time		last (monotonic) time of SA use (NULL to ignore)
+	 * @return				TRUE if SA found in snapshot
+	 */
+	bool (*get_sa)(kernel_stats_t *this, host_t *dst, u_int32_t spi,
+				   u_int8_t protocol, mark_t mark, u_int64_t *bytes,
+				   u_int64_t *packets, u_int32_t *time);
+
+	/**
+	 * Add the use time of a policy.
+	 *
+	 * @param src_ts		traffic selector to match traffic source
+	 * @param dst_ts		traffic selector to match traffic dest
+	 * @param direction		direction of traffic, POLICY_(IN|OUT|FWD)
+	 * @param mark			mark of policy
+	 * @param use_time		last (monotonic) time of policy use, 0 if unused
+	 */
+	void (*add_policy)(kernel_stats_t *this, traffic_selector_t *src_ts,
+					   traffic_selector_t *dst_ts, policy_dir_t direction,
+					   mark_t mark, u_int32_t use_time);
+
+	/**
+	 * Look up the use time of a policy.
+	 *
+	 * @param src_ts		traffic selector to match traffic source
+	 * @param dst_ts		traffic selector to match traffic dest
+	 * @param direction		direction of traffic, POLICY_(IN|OUT|FWD)
+	 * @param mark			mark of policy
+	 * @param[out] use_time	last (monotonic) time of policy use
+	 * @return				TRUE if policy found in snapshot
+	 */
+	bool (*get_policy)(kernel_stats_t *this, traffic_selector_t *src_ts,
+					   traffic_selector_t *dst_ts, policy_dir_t direction,
+					   mark_t mark, u_int32_t *use_time);
+
+	/**
+	 * Get the (monotonic) time the snapshot has been created.
+	 *
+	 * @return				creation time
+	 */
+	time_t (*get_time)(kernel_stats_t *this);
+
+	/**
+	 * Get a new reference to this snapshot.
+	 *
+	 * @return				this, with an increased refcount
+	 */
+	kernel_stats_t* (*get_ref)(kernel_stats_t *this);
+
+	/**
+	 * Release a reference, destroy the snapshot if it is the last one.
+	 */
+	void (*destroy)(kernel_stats_t *this);
+};
+
+/**
+ * Create an empty kernel_stats_t snapshot.
+ *
+ * @return					snapshot, with a refcount of one
+ */
+kernel_stats_t *kernel_stats_create();
+
+#endif /** KERNEL_STATS_H_ @}*/
@@ -19,6 +19,7 @@
 #include <library.h>
 
 #include "sql_attribute.h"
+#include "sql_lease_cache.h"
 
 typedef struct private_sql_attribute_t private_sql_attribute_t;
 
@@ -41,6 +42,11 @@ struct private_sql_attribute_t {
 	 * whether to record lease history in lease table
 	 */
 	bool history;
+
+	/**
+	 * in-memory leases written back to the database, if enabled
+	 */
+	sql_lease_cache_t *cache;
 };
 
 /**
@@ -249,6 +255,12 @@ METHOD(attribute_provider_t, acquire_address, host_t*,
 	char *name;
 	int family;
 
+	if (this->cache)
+	{
+		return this->cache->acquire_address(this->cache, pools, id,
+											requested->get_family(requested));
+	}
+
 	identity = get_identity(this, id);
 	if (identity)
 	{
@@ -302,6 +314,11 @@ METHOD(attribute_provider_t, release_address, bool,
 	char *name;
 	int family;
 
+	if (this->cache)
+	{
+		return this->cache->release_address(this->cache, pools, address);
+	}
+
 	family = address->get_family(address);
 	enumerator = pools->create_enumerator(pools);
 	while (enumerator->enumerate(enumerator, &name))
@@ -436,6 +453,7 @@ METHOD(attribute_provider_t, create_attribute_enumerator, enumerator_t*,
 METHOD(sql_attribute_t, destroy, void,
 	private_sql_attribute_t *this)
 {
+	DESTROY_IF(this->cache);
 	free(this);
 }
 
@@ -446,6 +464,7 @@ sql_attribute_t *sql_attribute_create(database_t *db)
 {
 	private_sql_attribute_t *this;
 	time_t now = time(NULL);
+	u_int interval;
 
 	INIT(this,
 		.public = {
@@ -472,6 +491,13 @@ sql_attribute_t *sql_attribute_create(database_t *db)
 	this->db->execute(this->db, NULL,
 					  "UPDATE addresses SET released = ? WHERE released = 0",
 					  DB_UINT, now);
+
+	interval = lib->settings->get_int(lib->settings,
+							"libhydra.plugins.attr-sql.write_behind", 0);
+	if (interval)
+	{
+		this->cache = sql_lease_cache_create(db, this->history, interval);
+	}
 	return &this->public;
 }
 
@@ -0,0 +1,892 @@
+/*
+ * Copyright (C) 2013 strongSwan Project
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include <time.h>
+
+#include "sql_lease_cache.h"
+
+#include <utils/debug.h>
+#include <collections/hashtable.h>
+#include <threading/mutex.h>
+#include <processing/jobs/callback_job.h>
+
+typedef struct private_sql_lease_cache_t private_sql_lease_cache_t;
+
+/**
+ * Private data of an sql_lease_cache_t object.
+ */
+struct private_sql_lease_cache_t {
+
+	/**
+	 * Public sql_lease_cache_t interface.
+	 */
+	sql_lease_cache_t public;
+
+	/**
+	 * Database connection
+	 */
+	database_t *db;
+
+	/**
+	 * Whether to record lease history in lease table
+	 */
+	bool history;
+
+	/**
+	 * Interval to write back changes, in seconds
+	 */
+	u_int interval;
+
+	/**
+	 * Loaded pools, name => pool_t
+	 */
+	hashtable_t *pools;
+
+	/**
+	 * Cached identity rows, identification_t => uintptr_t
+	 */
+	hashtable_t *identities;
+
+	/**
+	 * Leases changed since the last write back, as lease_t
+	 */
+	linked_list_t *dirty;
+
+	/**
+	 * Lease history records to write back, as record_t
+	 */
+	linked_list_t *records;
+
+	/**
+	 * Records of a failed write back, replayed with the next one
+	 */
+	linked_list_t *failed;
+
+	/**
+	 * Lock for pools, identities and the pending changes
+	 */
+	mutex_t *mutex;
+
+	/**
+	 * Lock serializing write backs and rescheduling the flush job
+	 */
+	mutex_t *flush_mutex;
+
+	/**
+	 * Handle of the scheduled flush job
+	 */
+	scheduler_handle_t flush_handle;
+
+	/**
+	 * Set during destruction, stops rescheduling the flush job
+	 */
+	bool stopped;
+};
+
+/**
+ * A lease of an address in a pool
+ */
+typedef struct {
+	/** row of the address */
+	u_int id;
+	/** the address */
+	chunk_t address;
+	/** row of the identity holding the lease, 0 if none */
+	u_int identity;
+	/** time the lease has been acquired */
+	time_t acquired;
+	/** time the lease has been released, 0 if online */
+	time_t released;
+	/** whether the lease is queued for write back */
+	bool dirty;
+} lease_t;
+
+/**
+ * A pool loaded from the database
+ */
+typedef struct {
+	/** row of the pool, 0 if the pool does not exist */
+	u_int id;
+	/** name of the pool */
+	char *name;
+	/** address family of the pool */
+	int family;
+	/** lease timeout, 0 for static leases */
+	u_int timeout;
+	/** time to retry loading a pool not found */
+	time_t retry;
+	/** leases by address, chunk_t => lease_t */
+	hashtable_t *addresses;
+	/** leases by identity, uintptr_t => linked_list_t of lease_t */
+	hashtable_t *identities;
+	/** available leases in the order to hand them out, as free_t */
+	linked_list_t *free;
+} pool_t;
+
+/**
+ * Entry in the list of available leases
+ */
+typedef struct {
+	/** the lease */
+	lease_t *lease;
+	/** released time of the lease when queued, stale if it differs */
+	time_t released;
+} free_t;
+
+/**
+ * Record to write back, a lease state or a lease history entry
+ */
+typedef struct {
+	/** TRUE for a lease history entry, FALSE for a lease state */
+	bool history;
+	/** row of the address */
+	u_int id;
+	/** row of the identity */
+	u_int identity;
+	/** time the lease has been acquired */
+	time_t acquired;
+	/** time the lease has been released */
+	time_t released;
+} record_t;
+
+/**
+ * Hashtable hash function for strings
+ */
+static u_int hash_str(char *key)
+{
+	return chunk_hash(chunk_create(key, strlen(key)));
+}
+
+/**
+ * Hashtable equals function for strings
+ */
+static bool equals_str(char *a, char *b)
+{
+	return streq(a, b);
+}
+
+/**
+ * Hashtable hash function for addresses
+ */
+static u_int hash_chunk(chunk_t *key)
+{
+	return chunk_hash(*key);
+}
+
+/**
+ * Hashtable equals function for addresses
+ */
+static bool equals_chunk(chunk_t *a, chunk_t *b)
+{
+	return chunk_equals(*a, *b);
+}
+
+/**
+ * Hashtable hash function for identity rows
+ */
+static u_int hash_row(void *key)
+{
+	return (uintptr_t)key;
+}
+
+/**
+ * Hashtable equals function for identity rows
+ */
+static bool equals_row(void *a, void *b)
+{
+	return a == b;
+}
+
+/**
+ * Hashtable hash function for identities
+ */
+static u_int hash_id(identification_t *id)
+{
+	return id->hash(id, 0);
+}
+
+/**
+ * Hashtable equals function for identities
+ */
+static bool equals_id(identification_t *a, identification_t *b)
+{
+	return a->equals(a, b);
+}
+
+/**
+ * Create an empty pool
+ */
+static pool_t *pool_create(char *name)
+{
+	pool_t *pool;
+
+	INIT(pool,
+		.name = strdup(name),
+		.addresses = hashtable_create((hashtable_hash_t)hash_chunk,
+									  (hashtable_equals_t)equals_chunk, 32),
+		.identities = hashtable_create(hash_row, equals_row, 32),
+		.free = linked_list_create(),
+	);
+	return pool;
+}
+
+/**
+ * Destroy a pool and its leases
+ */
+static void pool_destroy(pool_t *pool)
+{
+	enumerator_t *enumerator;
+	linked_list_t *list;
+	lease_t *lease;
+
+	enumerator = pool->identities->create_enumerator(pool->identities);
+	while (enumerator->enumerate(enumerator, NULL, &list))
+	{
+		list->destroy(list);
+	}
+	enumerator->destroy(enumerator);
+	enumerator = pool->addresses->create_enumerator(pool->addresses);
+	while (enumerator->enumerate(enumerator, NULL, &lease))
+	{
+		free(lease->address.ptr);
+		free(lease);
+	}
+	enumerator->destroy(enumerator);
+	pool->identities->destroy(pool->identities);
+	pool->addresses->destroy(pool->addresses);
+	pool->free->destroy_function(pool->free, free);
+	free(pool->name);
+	free(pool);
+}
+
+/**
+ * Add a lease to the leases of its identity
+ */
+static void add_to_identity(pool_t *pool, lease_t *lease)
+{
+	linked_list_t *list;
+
+	if (lease->identity)
+	{
+		list = pool->identities->get(pool->identities,
+									 (void*)(uintptr_t)lease->identity);
+		if (!list)
+		{
+			list = linked_list_create();
+			pool->identities->put(pool->identities,
+								  (void*)(uintptr_t)lease->identity, list);
+		}
+		list->insert_last(list, lease);
+	}
+}
+
+/**
+ * Remove a lease from the leases of its identity
+ */
+static void remove_from_identity(pool_t *pool, lease_t *lease)
+{
+	linked_list_t *list;
+
+	if (lease->identity)
+	{
+		list = pool->identities->get(pool->identities,
+									 (void*)(uintptr_t)lease->identity);
+		if (list)
+		{
+			list->remove(list, lease, NULL);
+			if (!list->get_count(list))
+			{
+				pool->identities->remove(pool->identities,
+										 (void*)(uintptr_t)lease->identity);
+				list->destroy(list);
+			}
+		}
+	}
+}
+
+/**
+ * Queue a lease as available
+ */
+static void add_to_free(pool_t *pool, lease_t *lease)
+{
+	free_t *entry;
+
+	INIT(entry,
+		.lease = lease,
+		.released = lease->released,
+	);
+	pool->free->insert_last(pool->free, entry);
+}
+
+/**
+ * Load a pool and its leases from the database
+ */
+static pool_t *load_pool(private_sql_lease_cache_t *this, char *name)
+{
+	enumerator_t *e;
+	pool_t *pool;
+	lease_t *lease;
+	chunk_t start, address;
+	u_int id, identity, acquired, released;
+
+	pool = pool_create(name);
+	e = this->db->query(this->db,
+						"SELECT id, start, timeout FROM pools WHERE name = ?",
+						DB_TEXT, name, DB_UINT, DB_BLOB, DB_UINT);
+	if (!e || !e->enumerate(e, &pool->id, &start, &pool->timeout))
+	{
+		DESTROY_IF(e);
+		pool->id = 0;
+		pool->retry = time_monotonic(NULL) + this->interval;
+		return pool;
+	}
+	pool->family = start.len == 4 ? AF_INET : AF_INET6;
+	e->destroy(e);
+
+	/* pools with a timeout hand out the leases released first */
+	e = this->db->query(this->db,
+						"SELECT id, address, identity, acquired, released "
+						"FROM addresses WHERE pool = ? ORDER BY released",
+						DB_UINT, pool->id,
+						DB_UINT, DB_BLOB, DB_UINT, DB_UINT, DB_UINT);
+	if (!e)
+	{
+		DBG1(DBG_CFG, "loading addresses of pool '%s' failed", name);
+		pool->id = 0;
+		pool->retry = time_monotonic(NULL) + this->interval;
+		return pool;
+	}
+	while (e->enumerate(e, &id, &address, &identity, &acquired, &released))
+	{
+		INIT(lease,
+			.id = id,
+			.address = chunk_clone(address),
+			.identity = identity,
+			.acquired = acquired,
+			.released = released,
+		);
+		pool->addresses->put(pool->addresses, &lease->address, lease);
+		add_to_identity(pool, lease);
+		if (pool->timeout ? released != 0 : identity == 0)
+		{
+			add_to_free(pool, lease);
+		}
+	}
+	e->destroy(e);
+	DBG1(DBG_CFG, "loaded %d addresses of pool '%s'",
+		 pool->addresses->get_count(pool->addresses), name);
+	return pool;
+}
+
+/**
+ * Get a pool by name and address family, load it if necessary
+ */
+static pool_t *get_pool(private_sql_lease_cache_t *this, char *name,
+						int family)
+{
+	pool_t *pool;
+
+	pool = this->pools->get(this->pools, name);
+	if (pool && !pool->id && pool->retry < time_monotonic(NULL))
+	{	/* pool might have been created in the meantime */
+		this->pools->remove(this->pools, name);
+		pool_destroy(pool);
+		pool = NULL;
+	}
+	if (!pool)
+	{
+		pool = load_pool(this, name);
+		this->pools->put(this->pools, pool->name, pool);
+	}
+	if (pool->id && pool->family == family)
+	{
+		return pool;
+	}
+	return NULL;
+}
+
+/**
+ * Lookup/insert an identity
+ */
+static u_int get_identity(private_sql_lease_cache_t *this, identification_t *id)
+{
+	enumerator_t *e;
+	u_int row = 0;
+
+	this->mutex->lock(this->mutex);
+	row = (uintptr_t)this->identities->get(this->identities, id);
+	this->mutex->unlock(this->mutex);
+	if (row)
+	{
+		return row;
+	}
+
+	/* look for peer identity in the identities table */
+	e = this->db->query(this->db,
+						"SELECT id FROM identities WHERE type = ? AND data = ?",
+						DB_INT, id->get_type(id), DB_BLOB, id->get_encoding(id),
+						DB_UINT);
+	if (!e || !e->enumerate(e, &row))
+	{
+		row = 0;
+	}
+	DESTROY_IF(e);
+	/* not found, insert new one */
+	if (!row && this->db->execute(this->db, &row,
+				  "INSERT INTO identities (type, data) VALUES (?, ?)",
+				  DB_INT, id->get_type(id), DB_BLOB, id->get_encoding(id)) != 1)
+	{
+		return 0;
+	}
+
+	this->mutex->lock(this->mutex);
+	if (!this->identities->get(this->identities, id))
+	{
+		id = id->clone(id);
+		this->identities->put(this->identities, id, (void*)(uintptr_t)row);
+	}
+	this->mutex->unlock(this->mutex);
+	return row;
+}
+
+/**
+ * Queue a changed lease for write back
+ */
+static void mark_dirty(private_sql_lease_cache_t *this, lease_t *lease)
+{
+	if (!lease->dirty)
+	{
+		lease->dirty = TRUE;
+		this->dirty->insert_last(this->dirty, lease);
+	}
+}
+
+/**
+ * Create an address from a lease
+ */
+static host_t *lease2host(lease_t *lease)
+{
+	return host_create_from_chunk(AF_UNSPEC, lease->address, 0);
+}
+
+/**
+ * Look up an existing lease
+ */
+static host_t* check_lease(private_sql_lease_cache_t *this, pool_t *pool,
+						   u_int identity)
+{
+	enumerator_t *enumerator;
+	linked_list_t *list;
+	lease_t *lease, *found = NULL;
+
+	list = pool->identities->get(pool->identities, (void*)(uintptr_t)identity);
+	if (!list)
+	{
+		return NULL;
+	}
+	enumerator = list->create_enumerator(list);
+	while (enumerator->enumerate(enumerator, &lease))
+	{
+		if (lease->released)
+		{
+			found = lease;
+			break;
+		}
+	}
+	enumerator->destroy(enumerator);
+	if (!found)
+	{
+		return NULL;
+	}
+	/* an entry in the free list gets stale, no need to remove it */
+	found->acquired = time(NULL);
+	found->released = 0;
+	mark_dirty(this, found);
+	return lease2host(found);
+}
+
+/**
+ * Get an unallocated address or expired lease
+ */
+static host_t* get_lease(private_sql_lease_cache_t *this, pool_t *pool,
+						 u_int identity)
+{
+	time_t now = time(NULL);
+	free_t *entry;
+	lease_t *lease;
+
+	while (pool->free->get_first(pool->free, (void**)&entry) == SUCCESS)
+	{
+		lease = entry->lease;
+		if (pool->timeout)
+		{
+			if (!lease->released || lease->released != entry->released)
+			{	/* reacquired since queued, drop stale entry */
+				pool->free->remove_first(pool->free, (void**)&entry);
+				free(entry);
+				continue;
+			}
+			if (lease->released >= now - pool->timeout)
+			{	/* released in release order, no older lease available */
+				break;
+			}
+		}
+		else if (lease->identity)
+		{
+			pool->free->remove_first(pool->free, (void**)&entry);
+			free(entry);
+			continue;
+		}
+		pool->free->remove_first(pool->free, (void**)&entry);
+		free(entry);
+
+		remove_from_identity(pool, lease);
+		lease->identity = identity;
+		lease->acquired = now;
+		lease->released = 0;
+		add_to_identity(pool, lease);
+		mark_dirty(this, lease);
+		return lease2host(lease);
+	}
+	return NULL;
+}
+
+METHOD(sql_lease_cache_t, acquire_address, host_t*,
+	private_sql_lease_cache_t *this, linked_list_t *pools,
+	identification_t *id, int family)
+{
+	enumerator_t *enumerator;
+	host_t *address = NULL;
+	u_int identity;
+	pool_t *pool;
+	char *name;
+
+	identity = get_identity(this, id);
+	if (!identity)
+	{
+		return NULL;
+	}
+
+	this->mutex->lock(this->mutex);
+	/* check for an existing lease in all pools */
+	enumerator = pools->create_enumerator(pools);
+	while (enumerator->enumerate(enumerator, &name))
+	{
+		pool = get_pool(this, name, family);
+		if (pool)
+		{
+			address = check_lease(this, pool, identity);
+			if (address)
+			{
+				DBG1(DBG_CFG, "acquired existing lease for address %H in"
+					 " pool '%s'", address, name);
+				break;
+			}
+		}
+	}
+	enumerator->destroy(enumerator);
+
+	if (!address)
+	{
+		/* get an unallocated address or expired lease */
+		enumerator = pools->create_enumerator(pools);
+		while (enumerator->enumerate(enumerator, &name))
+		{
+			pool = get_pool(this, name, family);
+			if (pool)
+			{
+				address = get_lease(this, pool, identity);
+				if (address)
+				{
+					DBG1(DBG_CFG, "acquired new lease for address %H in "
+						 "pool '%s'", address, name);
+					break;
+				}
+				DBG1(DBG_CFG, "no available address found in pool '%s'", name);
+			}
+		}
+		enumerator->destroy(enumerator);
+	}
+	this->mutex->unlock(this->mutex);
+
+	return address;
+}
+
+METHOD(sql_lease_cache_t, release_address, bool,
+	private_sql_lease_cache_t *this, linked_list_t *pools, host_t *address)
+{
+	enumerator_t *enumerator;
+	chunk_t addr;
+	lease_t *lease;
+	record_t *record;
+	pool_t *pool;
+	bool found = FALSE;
+	char *name;
+
+	addr = address->get_address(address);
+
+	this->mutex->lock(this->mutex);
+	enumerator = pools->create_enumerator(pools);
+	while (enumerator->enumerate(enumerator, &name))
+	{
+		pool = get_pool(this, name, address->get_family(address));
+		if (!pool)
+		{
+			continue;
+		}
+		lease = pool->addresses->get(pool->addresses, &addr);
+		if (lease)
+		{
+			lease->released = time(NULL);
+			mark_dirty(this, lease);
+			if (pool->timeout)
+			{
+				add_to_free(pool, lease);
+			}
+			if (this->history)
+			{
+				INIT(record,
+					.history = TRUE,
+					.id = lease->id,
+					.identity = lease->identity,
+					.acquired = lease->acquired,
+					.released = lease->released,
+				);
+				this->records->insert_last(this->records, record);
+			}
+			found = TRUE;
+			break;
+		}
+	}
+	enumerator->destroy(enumerator);
+	this->mutex->unlock(this->mutex);
+
+	return found;
+}
+
+/**
+ * Write a record to the database
+ */
+static bool write_record(private_sql_lease_cache_t *this, record_t *record)
+{
+	if (record->history)
+	{
+		return this->db->execute(this->db, NULL,
+					"INSERT INTO leases (address, identity, acquired, released)"
+					" VALUES (?, ?, ?, ?)",
+					DB_UINT, record->id, DB_UINT, record->identity,
+					DB_UINT, record->acquired, DB_UINT, record->released) == 1;
+	}
+	return this->db->execute(this->db, NULL,
+					"UPDATE addresses SET identity = ?, acquired = ?, "
+					"released = ? WHERE id = ?",
+					DB_UINT, record->identity, DB_UINT, record->acquired,
+					DB_UINT, record->released, DB_UINT, record->id) >= 0;
+}
+
+/**
+ * Write back pending changes in a single transaction, flush_mutex must be held
+ */
+static void flush(private_sql_lease_cache_t *this)
+{
+	enumerator_t *enumerator;
+	linked_list_t *batch;
+	record_t *record;
+	lease_t *lease;
+	bool success = TRUE;
+
+	this->mutex->lock(this->mutex);
+	/* replay a failed batch first, as later states overwrite it */
+	batch = this->failed;
+	this->failed = linked_list_create();
+	while (this->dirty->remove_first(this->dirty, (void**)&lease) == SUCCESS)
+	{
+		INIT(record,
+			.id = lease->id,
+			.identity = lease->identity,
+			.acquired = lease->acquired,
+			.released = lease->released,
+		);
+		lease->dirty = FALSE;
+		batch->insert_last(batch, record);
+	}
+	while (this->records->remove_first(this->records,
+									   (void**)&record) == SUCCESS)
+	{
+		batch->insert_last(batch, record);
+	}
+	this->mutex->unlock(this->mutex);
+
+	if (batch->get_count(batch))
+	{
+		success = this->db->transaction(this->db);
+		if (success)
+		{
+			enumerator = batch->create_enumerator(batch);
+			while (success && enumerator->enumerate(enumerator, &record))
+			{
+				success = write_record(this, record);
+			}
+			enumerator->destroy(enumerator);
+			if (success)
+			{
+				success = this->db->commit(this->db);
+			}
+			else
+			{
+				this->db->rollback(this->db);
+			}
+		}
+		if (!success)
+		{
+			DBG1(DBG_CFG, "writing back %d lease changes failed, retrying",
+				 batch->get_count(batch));
+			this->mutex->lock(this->mutex);
+			this->failed->destroy(this->failed);
+			this->failed = batch;
+			this->mutex->unlock(this->mutex);
+			batch = NULL;
+		}
+		else
+		{
+			DBG2(DBG_CFG, "wrote back %d lease changes",
+				 batch->get_count(batch));
+		}
+	}
+	DESTROY_FUNCTION_IF(batch, free);
+}
+
+static job_requeue_t flush_job(private_sql_lease_cache_t *this);
+
+/**
+ * Schedule the flush job, flush_mutex must be held
+ */
+static void schedule_flush(private_sql_lease_cache_t *this)
+{
+	this->flush_handle = lib->scheduler->schedule_job(lib->scheduler,
+		(job_t*)callback_job_create_with_prio((callback_job_cb_t)flush_job,
+			this, NULL, (callback_job_cancel_t)return_false, JOB_PRIO_CRITICAL),
+		this->interval);
+}
+
+/**
+ * Job writing back pending changes periodically
+ */
+static job_requeue_t flush_job(private_sql_lease_cache_t *this)
+{
+	this->flush_mutex->lock(this->flush_mutex);
+	flush(this);
+	if (!this->stopped)
+	{
+		schedule_flush(this);
+	}
+	this->flush_mutex->unlock(this->flush_mutex);
+	return JOB_REQUEUE_NONE;
+}
+
+METHOD(sql_lease_cache_t, destroy, void,
+	private_sql_lease_cache_t *this)
+{
+	enumerator_t *enumerator;
+	identification_t *id;
+	pool_t *pool;
+
+	this->flush_mutex->lock(this->flush_mutex);
+	this->stopped = TRUE;
+	lib->scheduler->cancel(lib->scheduler, this->flush_handle);
+	flush(this);
+	this->flush_mutex->unlock(this->flush_mutex);
+
+	enumerator = this->pools->create_enumerator(this->pools);
+	while (enumerator->enumerate(enumerator, NULL, &pool))
+	{
+		pool_destroy(pool);
+	}
+	enumerator->destroy(enumerator);
+	enumerator = this->identities->create_enumerator(this->identities);
+	while (enumerator->enumerate(enumerator, &id, NULL))
+	{
+		id->destroy(id);
+	}
+	enumerator->destroy(enumerator);
+	this->pools->destroy(this->pools);
+	this->identities->destroy(this->identities);
+	this->dirty->destroy(this->dirty);
+	this->records->destroy_function(this->records, free);
+	this->failed->destroy_function(this->failed, free);
+	this->mutex->destroy(this->mutex);
+	this->flush_mutex->destroy(this->flush_mutex);
+	free(this);
+}
+
+/**
+ * See header
+ */
+sql_lease_cache_t *sql_lease_cache_create(database_t *db, bool history,
+										  u_int interval)
+{
+	private_sql_lease_cache_t *this;
+	linked_list_t *names;
+	enumerator_t *e;
+	pool_t *pool;
+	char *name;
+
+	INIT(this,
+		.public = {
+			.acquire_address = _acquire_address,
+			.release_address = _release_address,
+			.destroy = _destroy,
+		},
+		.db = db,
+		.history = history,
+		.interval = interval,
+		.pools = hashtable_create((hashtable_hash_t)hash_str,
+								  (hashtable_equals_t)equals_str, 8),
+		.identities = hashtable_create((hashtable_hash_t)hash_id,
+									   (hashtable_equals_t)equals_id, 32),
+		.dirty = linked_list_create(),
+		.records = linked_list_create(),
+		.failed = linked_list_create(),
+		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
+		.flush_mutex = mutex_create(MUTEX_TYPE_DEFAULT),
+	);
+
+	/* load all pools upfront, pools created later get loaded on demand */
+	names = linked_list_create();
+	e = this->db->query(this->db, "SELECT name FROM pools", DB_TEXT);
+	if (e)
+	{
+		while (e->enumerate(e, &name))
+		{
+			names->insert_last(names, strdup(name));
+		}
+		e->destroy(e);
+	}
+	while (names->remove_first(names, (void**)&name) == SUCCESS)
+	{
+		if (!this->pools->get(this->pools, name))
+		{
+			pool = load_pool(this, name);
+			this->pools->put(this->pools, pool->name, pool);
+		}
+		free(name);
+	}
+	names->destroy(names);
+
+	this->flush_mutex->lock(this->flush_mutex);
+	schedule_flush(this);
+	this->flush_mutex->unlock(this->flush_mutex);
+
+	return &this->public;
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2013 strongSwan Project
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/**
+ * @defgroup sql_lease_cache sql_lease_cache
+ * @{ @ingroup attr_sql
+ */
+
+#ifndef SQL_LEASE_CACHE_H_
+#define SQL_LEASE_CACHE_H_
+
+#include <database/database.h>
+#include <networking/host.h>
+#include <utils/identification.h>
+#include <collections/linked_list.h>
+
+typedef struct sql_lease_cache_t sql_lease_cache_t;
+
+/**
+ * In-memory copy of the SQL address pools, writing lease changes behind.
+ *
+ * Pools are loaded from the database when first used, leases are served from
+ * memory. Changes to leases and lease history records are written back to
+ * the database periodically, each batch in a single transaction. A batch
+ * failing to commit is rolled back and replayed with the next one.
+ *
+ * The cache assumes it is the only writer to the addresses of its pools,
+ * pools must not be shared with other daemons in this mode.
+ */
+struct sql_lease_cache_t {
+
+	/**
+	 * Acquire an address for an identity from one of the given pools.
+	 *
+	 * Existing leases of the identity are preferred over new ones.
+	 *
+	 * @param pools		list of pool names to acquire from, as char*
+	 * @param id		identity to acquire an address for
+	 * @param family	address family of the address to acquire
+	 * @return			acquired address, NULL if none available
+	 */
+	host_t* (*acquire_address)(sql_lease_cache_t *this, linked_list_t *pools,
+							   identification_t *id, int family);
+
+	/**
+	 * Release an address previously acquired.
+	 *
+	 * @param pools		list of pool names the address might belong to
+	 * @param address	address to release
+	 * @return			TRUE if the address has been released
+	 */
+	bool (*release_address)(sql_lease_cache_t *this, linked_list_t *pools,
+							host_t *address);
+
+	/**
+	 * Destroy a sql_lease_cache_t, writing back all pending changes.
+	 */
+	void (*destroy)(sql_lease_cache_t *this);
+};
+
+/**
+ * Create a sql_lease_cache instance.
+ *
+ * @param db			database to load pools from and write leases to
+ * @param history		TRUE to record lease history in the leases table
+ * @param interval		interval in seconds to write back changes
+ * @return				lease cache
+ */
+sql_lease_cache_t *sql_lease_cache_create(database_t *db, bool history,
+										  u_int interval);
+
+#endif /** SQL_LEASE_CACHE_H_ @}*/
@@ -2354,6 +2354,138 @@ METHOD(kernel_ipsec_t, query_policy, status_t,
 	return SUCCESS;
 }
 
+/**
+ * Get the mark of an SA or policy from its XFRMA_MARK attribute, if any
+ */
+static mark_t get_mark(struct rtattr *rta, size_t rtasize)
+{
+	struct xfrm_mark *xmrk;
+	mark_t mark = {};
+
+	while (RTA_OK(rta, rtasize))
+	{
+		if (rta->rta_type == XFRMA_MARK &&
+			RTA_PAYLOAD(rta) == sizeof(struct xfrm_mark))
+		{
+			xmrk = (struct xfrm_mark*)RTA_DATA(rta);
+			mark.value = xmrk->v;
+			mark.mask = xmrk->m;
+			break;
+		}
+		rta = RTA_NEXT(rta, rtasize);
+	}
+	return mark;
+}
+
+/**
+ * Dump all SAs or policies, add them to the stats snapshot
+ */
+static status_t dump_stats(private_kernel_netlink_ipsec_t *this,
+						   kernel_stats_t *stats, u_int16_t type)
+{
+	netlink_buf_t request;
+	struct nlmsghdr *out = NULL, *hdr;
+	time_t now, mono;
+	status_t status = SUCCESS;
+	size_t len, total;
+
+	memset(&request, 0, sizeof(request));
+
+	hdr = (struct nlmsghdr*)request;
+	hdr->nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	hdr->nlmsg_type = type;
+	hdr->nlmsg_len = NLMSG_LENGTH(0);
+
+	if (this->socket_xfrm->send(this->socket_xfrm, hdr, &out, &len) != SUCCESS)
+	{
+		return FAILED;
+	}
+	/* we need monotonic use times, but the kernel returns system time */
+	now = time(NULL);
+	mono = time_monotonic(NULL);
+	total = len;
+
+	for (hdr = out; NLMSG_OK(hdr, len); hdr = NLMSG_NEXT(hdr, len))
+	{
+		switch (hdr->nlmsg_type)
+		{
+			case XFRM_MSG_NEWSA:
+			{
+				struct xfrm_usersa_info *sa;
+				host_t *dst;
+
+				sa = (struct xfrm_usersa_info*)NLMSG_DATA(hdr);
+				dst = xfrm2host(sa->family, &sa->id.daddr, 0);
+				if (dst)
+				{	/* curlft contains the first, not the last use time */
+					stats->add_sa(stats, dst, sa->id.spi, sa->id.proto,
+							get_mark(XFRM_RTA(hdr, struct xfrm_usersa_info),
+								XFRM_PAYLOAD(hdr, struct xfrm_usersa_info)),
+							sa->curlft.bytes, sa->curlft.packets, 0);
+					dst->destroy(dst);
+				}
+				continue;
+			}
+			case XFRM_MSG_NEWPOLICY:
+			{
+				struct xfrm_userpolicy_info *policy;
+				traffic_selector_t *src_ts, *dst_ts;
+				u_int32_t use_time = 0;
+
+				policy = (struct xfrm_userpolicy_info*)NLMSG_DATA(hdr);
+				src_ts = selector2ts(&policy->sel, TRUE);
+				dst_ts = selector2ts(&policy->sel, FALSE);
+				if (src_ts && dst_ts)
+				{
+					if (policy->curlft.use_time)
+					{
+						use_time = mono - (now - policy->curlft.use_time);
+					}
+					stats->add_policy(stats, src_ts, dst_ts, policy->dir,
+							get_mark(XFRM_RTA(hdr, struct xfrm_userpolicy_info),
+								XFRM_PAYLOAD(hdr, struct xfrm_userpolicy_info)),
+							use_time);
+				}
+				DESTROY_IF(src_ts);
+				DESTROY_IF(dst_ts);
+				continue;
+			}
+			case NLMSG_ERROR:
+			{
+				struct nlmsgerr *err = NLMSG_DATA(hdr);
+				DBG1(DBG_KNL, "dumping %s failed: %s (%d)",
+					 type == XFRM_MSG_GETSA ? "SAD" : "SPD",
+					 strerror(-err->error), -err->error);
+				status = FAILED;
+				break;
+			}
+			default:
+				continue;
+			case NLMSG_DONE:
+				break;
+		}
+		break;
+	}
+	/* SA dumps include keys */
+	memwipe(out, total);
+	free(out);
+	return status;
+}
+
+METHOD(kernel_ipsec_t, query_stats, status_t,
+	private_kernel_netlink_ipsec_t *this, kernel_stats_t *stats)
+{
+	DBG2(DBG_KNL, "querying usage statistics of all SAD and SPD entries");
+
+	if (dump_stats(this, stats, XFRM_MSG_GETSA) != SUCCESS ||
+		dump_stats(this, stats, XFRM_MSG_GETPOLICY) != SUCCESS)
+	{
+		DBG1(DBG_KNL, "unable to query usage statistics of SAD/SPD entries");
+		return FAILED;
+	}
+	return SUCCESS;
+}
+
 METHOD(kernel_ipsec_t, del_policy, status_t,
 	private_kernel_netlink_ipsec_t *this, traffic_selector_t *src_ts,
 	traffic_selector_t *dst_ts, policy_dir_t direction, u_int32_t reqid,
@@ -2622,6 +2754,7 @@ kernel_netlink_ipsec_t *kernel_netlink_ipsec_create()
 				.flush_sas = _flush_sas,
 				.add_policy = _add_policy,
 				.query_policy = _query_policy,
+				.query_stats = _query_stats,
 				.del_policy = _del_policy,
 				.flush_policies = _flush_policies,
 				.bypass_socket = _bypass_socket,
@@ -2657,7 +2790,10 @@ kernel_netlink_ipsec_t *kernel_netlink_ipsec_create()
 		close(fd);
 	}
 
-	this->socket_xfrm = netlink_socket_create(NETLINK_XFRM);
+	this->socket_xfrm = netlink_socket_create(NETLINK_XFRM,
+						lib->settings->get_bool(lib->settings,
+							"%s.plugins.kernel-netlink.parallel_xfrm", TRUE,
+							hydra->daemon));
 	if (!this->socket_xfrm)
 	{
 		destroy(this);
@@ -14,15 +14,40 @@
  */
 
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <linux/netlink.h>
 #include <linux/rtnetlink.h>
 #include <errno.h>
 #include <unistd.h>
+#include <poll.h>
 
 #include "kernel_netlink_shared.h"
 
 #include <utils/debug.h>
 #include <threading/mutex.h>
+#include <threading/condvar.h>
+#include <collections/hashtable.h>
+#include <collections/linked_list.h>
+
+/**
+ * Maximum number of requests written with a single sendmsg()
+ */
+#define MAX_BATCH 16
+
+/**
+ * Number of message types we collect latency statistics for
+ */
+#define MAX_STATS_TYPES 128
+
+/**
+ * Time in ms a reading thread waits before checking if it still has to read
+ */
+#define READ_TIMEOUT 1000
+
+/**
+ * Upper bounds of the latency histogram buckets, in microseconds
+ */
+static u_int latency_buckets[] = { 100, 1000, 10000, 100000, 1000000, 0 };
 
 typedef struct private_netlink_socket_t private_netlink_socket_t;
 
@@ -36,10 +61,40 @@ struct private_netlink_socket_t {
 	netlink_socket_t public;
 
 	/**
-	 * mutex to lock access to netlink socket
+	 * mutex to lock access to requests and statistics
 	 */
 	mutex_t *mutex;
 
+	/**
+	 * condvar signaled when a response arrived or a thread stopped reading
+	 */
+	condvar_t *condvar;
+
+	/**
+	 * mutex serializing requests, if they are not sent in parallel
+	 */
+	mutex_t *send_mutex;
+
+	/**
+	 * in-flight requests, sequence number => entry_t
+	 */
+	hashtable_t *entries;
+
+	/**
+	 * requests queued for writing, as entry_t
+	 */
+	linked_list_t *queue;
+
+	/**
+	 * whether a thread is currently writing queued requests
+	 */
+	bool writing;
+
+	/**
+	 * whether a thread is currently reading from the socket
+	 */
+	bool reading;
+
 	/**
 	 * current sequence number for netlink request
 	 */
@@ -54,129 +109,371 @@ struct private_netlink_socket_t {
 	 * netlink socket
 	 */
 	int socket;
+
+	/**
+	 * latency histograms per message type
+	 */
+	u_int stats[MAX_STATS_TYPES][countof(latency_buckets)];
 };
 
+/**
+ * An in-flight request
+ */
+typedef struct {
+	/** request message */
+	struct nlmsghdr *in;
+	/** received response messages */
+	chunk_t response;
+	/** time the request has been queued */
+	timeval_t start;
+	/** whether the response is complete */
+	bool complete;
+	/** whether sending or receiving failed */
+	bool failed;
+} entry_t;
+
 /**
  * Imported from kernel_netlink_ipsec.c
  */
 extern enum_name_t *xfrm_msg_names;
 
-METHOD(netlink_socket_t, netlink_send, status_t,
-	private_netlink_socket_t *this, struct nlmsghdr *in, struct nlmsghdr **out,
-	size_t *out_len)
+/**
+ * Hashtable hash function for sequence numbers
+ */
+static u_int hash_seq(void *key)
 {
-	int len, addr_len;
-	struct sockaddr_nl addr;
-	chunk_t result = chunk_empty, tmp;
-	struct nlmsghdr *msg, peek;
+	return (uintptr_t)key;
+}
 
-	this->mutex->lock(this->mutex);
+/**
+ * Hashtable equals function for sequence numbers
+ */
+static bool equals_seq(void *a, void *b)
+{
+	return a == b;
+}
 
-	in->nlmsg_seq = ++this->seq;
-	in->nlmsg_pid = getpid();
+/**
+ * Fail a request, mutex must be held
+ */
+static void fail_entry(private_netlink_socket_t *this, entry_t *entry)
+{
+	entry->failed = TRUE;
+	entry->complete = TRUE;
+	this->condvar->broadcast(this->condvar);
+}
+
+/**
+ * Write queued requests, batching multiple requests into one sendmsg().
+ * Dump requests are written alone, as the kernel handles only one dump at a
+ * time per socket. Mutex must be held.
+ */
+static void write_queued(private_netlink_socket_t *this)
+{
+	entry_t *entry, *batch[MAX_BATCH];
+	struct iovec iov[MAX_BATCH];
+	struct sockaddr_nl addr;
+	struct msghdr msg;
+	size_t total;
+	int i, count, len;
+
+	if (this->writing)
+	{	/* the active writer picks up our request */
+		return;
+	}
+	this->writing = TRUE;
 
 	memset(&addr, 0, sizeof(addr));
 	addr.nl_family = AF_NETLINK;
 	addr.nl_pid = 0;
 	addr.nl_groups = 0;
 
-	if (this->protocol == NETLINK_XFRM)
+	while (this->queue->get_first(this->queue, (void**)&entry) == SUCCESS)
 	{
-		chunk_t in_chunk = { (u_char*)in, in->nlmsg_len };
-
-		DBG3(DBG_KNL, "sending %N: %B", xfrm_msg_names, in->nlmsg_type, &in_chunk);
-	}
+		count = 0;
+		total = 0;
+		while (count < MAX_BATCH &&
+			   this->queue->get_first(this->queue, (void**)&entry) == SUCCESS)
+		{
+			if (count && (entry->in->nlmsg_flags & NLM_F_DUMP) == NLM_F_DUMP)
+			{
+				break;
+			}
+			this->queue->remove_first(this->queue, (void**)&entry);
+			batch[count] = entry;
+			iov[count].iov_base = entry->in;
+			iov[count].iov_len = entry->in->nlmsg_len;
+			total += entry->in->nlmsg_len;
+			if ((entry->in->nlmsg_flags & NLM_F_DUMP) == NLM_F_DUMP)
+			{
+				count++;
+				break;
+			}
+			count++;
+		}
+		this->mutex->unlock(this->mutex);
 
-	while (TRUE)
-	{
-		len = sendto(this->socket, in, in->nlmsg_len, 0,
-					 (struct sockaddr*)&addr, sizeof(addr));
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_name = &addr;
+		msg.msg_namelen = sizeof(addr);
+		msg.msg_iov = iov;
+		msg.msg_iovlen = count;
 
-		if (len != in->nlmsg_len)
+		while (TRUE)
 		{
-			if (errno == EINTR)
+			len = sendmsg(this->socket, &msg, 0);
+			if (len != total)
 			{
-				/* interrupted, try again */
-				continue;
+				if (len < 0 && errno == EINTR)
+				{
+					/* interrupted, try again */
+					continue;
+				}
+				DBG1(DBG_KNL, "error sending to netlink socket: %s",
+					 strerror(errno));
+				this->mutex->lock(this->mutex);
+				for (i = 0; i < count; i++)
+				{
+					fail_entry(this, batch[i]);
+				}
+				this->mutex->unlock(this->mutex);
 			}
-			this->mutex->unlock(this->mutex);
-			DBG1(DBG_KNL, "error sending to netlink socket: %s", strerror(errno));
-			return FAILED;
+			break;
 		}
-		break;
+		if (count > 1)
+		{
+			DBG3(DBG_KNL, "sent %d netlink messages in one batch", count);
+		}
+		this->mutex->lock(this->mutex);
 	}
+	this->writing = FALSE;
+}
+
+/**
+ * Check if a datagram completes the response to a request. Dump responses
+ * are only complete with an NLMSG_DONE or NLMSG_ERROR message.
+ */
+static bool is_complete(private_netlink_socket_t *this, struct nlmsghdr *msg,
+						int len, bool dump)
+{
+	struct sockaddr_nl addr;
+	socklen_t addr_len;
+	struct nlmsghdr peek;
+	u_int32_t seq = msg->nlmsg_seq;
 
-	while (TRUE)
+	while (NLMSG_OK(msg, len))
 	{
-		char buf[4096];
-		tmp.len = sizeof(buf);
-		tmp.ptr = buf;
-		msg = (struct nlmsghdr*)tmp.ptr;
+		if (msg->nlmsg_type == NLMSG_DONE || msg->nlmsg_type == NLMSG_ERROR)
+		{
+			return TRUE;
+		}
+		msg = NLMSG_NEXT(msg, len);
+	}
+	if (dump)
+	{
+		return FALSE;
+	}
 
-		memset(&addr, 0, sizeof(addr));
-		addr.nl_family = AF_NETLINK;
-		addr.nl_pid = getpid();
-		addr.nl_groups = 0;
-		addr_len = sizeof(addr);
+	/* NLM_F_MULTI flag does not seem to be set correctly, we use sequence
+	 * numbers to detect multi header messages of other requests. The kernel
+	 * processes requests in order, so the parts of a response are never
+	 * interleaved with the response to another request. */
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_pid = getpid();
+	addr.nl_groups = 0;
+	addr_len = sizeof(addr);
 
-		len = recvfrom(this->socket, tmp.ptr, tmp.len, 0,
-					   (struct sockaddr*)&addr, &addr_len);
+	len = recvfrom(this->socket, &peek, sizeof(peek), MSG_PEEK | MSG_DONTWAIT,
+				   (struct sockaddr*)&addr, &addr_len);
+	return len != sizeof(peek) || peek.nlmsg_seq != seq;
+}
 
-		if (len < 0)
+/**
+ * Read a datagram from the socket and queue it to the request it belongs to.
+ * Mutex must not be held, returns FALSE on socket errors.
+ */
+static bool read_and_queue(private_netlink_socket_t *this)
+{
+	char buf[4096];
+	struct nlmsghdr *msg = (struct nlmsghdr*)buf;
+	struct sockaddr_nl addr;
+	socklen_t addr_len;
+	struct pollfd pfd = {
+		.fd = this->socket,
+		.events = POLLIN,
+	};
+	entry_t *entry;
+	int len;
+
+	/* the response we wait for might never arrive if sending failed */
+	len = poll(&pfd, 1, READ_TIMEOUT);
+	if (len <= 0)
+	{
+		if (len < 0 && errno != EINTR)
 		{
-			if (errno == EINTR)
-			{
-				DBG1(DBG_KNL, "got interrupted");
-				/* interrupted, try again */
-				continue;
-			}
-			DBG1(DBG_KNL, "error reading from netlink socket: %s", strerror(errno));
-			this->mutex->unlock(this->mutex);
-			free(result.ptr);
-			return FAILED;
+			DBG1(DBG_KNL, "error polling netlink socket: %s", strerror(errno));
+			return FALSE;
 		}
-		if (!NLMSG_OK(msg, len))
+		return TRUE;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_pid = getpid();
+	addr.nl_groups = 0;
+	addr_len = sizeof(addr);
+
+	len = recvfrom(this->socket, buf, sizeof(buf), 0,
+				   (struct sockaddr*)&addr, &addr_len);
+	if (len < 0)
+	{
+		if (errno == EINTR)
 		{
-			DBG1(DBG_KNL, "received corrupted netlink message");
-			this->mutex->unlock(this->mutex);
-			free(result.ptr);
-			return FAILED;
+			DBG1(DBG_KNL, "got interrupted");
+			/* interrupted, try again */
+			return TRUE;
 		}
-		if (msg->nlmsg_seq != this->seq)
+		DBG1(DBG_KNL, "error reading from netlink socket: %s",
+			 strerror(errno));
+		return FALSE;
+	}
+	if (!NLMSG_OK(msg, len))
+	{
+		DBG1(DBG_KNL, "received corrupted netlink message");
+		return FALSE;
+	}
+
+	this->mutex->lock(this->mutex);
+	entry = this->entries->get(this->entries,
+							   (void*)(uintptr_t)msg->nlmsg_seq);
+	if (entry && !entry->complete)
+	{
+		entry->response.ptr = realloc(entry->response.ptr,
+									  entry->response.len + len);
+		memcpy(entry->response.ptr + entry->response.len, buf, len);
+		entry->response.len += len;
+		if (is_complete(this, msg, len,
+				(entry->in->nlmsg_flags & NLM_F_DUMP) == NLM_F_DUMP))
 		{
-			DBG1(DBG_KNL, "received invalid netlink sequence number");
-			if (msg->nlmsg_seq < this->seq)
-			{
-				continue;
-			}
-			this->mutex->unlock(this->mutex);
-			free(result.ptr);
-			return FAILED;
+			entry->complete = TRUE;
+			this->condvar->broadcast(this->condvar);
 		}
+	}
+	else
+	{
+		DBG1(DBG_KNL, "received invalid netlink sequence number");
+	}
+	this->mutex->unlock(this->mutex);
+	return TRUE;
+}
 
-		tmp.len = len;
-		result.ptr = realloc(result.ptr, result.len + tmp.len);
-		memcpy(result.ptr + result.len, tmp.ptr, tmp.len);
-		result.len += tmp.len;
-
-		/* NLM_F_MULTI flag does not seem to be set correctly, we use sequence
-		 * numbers to detect multi header messages */
-		len = recvfrom(this->socket, &peek, sizeof(peek), MSG_PEEK | MSG_DONTWAIT,
-					   (struct sockaddr*)&addr, &addr_len);
+/**
+ * Add the latency of a completed request to the statistics, mutex must be held
+ */
+static void add_latency(private_netlink_socket_t *this, entry_t *entry)
+{
+	timeval_t now, diff;
+	u_int usec;
+	int i;
 
-		if (len == sizeof(peek) && peek.nlmsg_seq == this->seq)
+	if (entry->in->nlmsg_type >= MAX_STATS_TYPES)
+	{
+		return;
+	}
+	time_monotonic(&now);
+	timersub(&now, &entry->start, &diff);
+	usec = diff.tv_sec * 1000000 + diff.tv_usec;
+	for (i = 0; i < countof(latency_buckets) - 1; i++)
+	{
+		if (usec < latency_buckets[i])
 		{
-			/* seems to be multipart */
-			continue;
+			break;
 		}
-		break;
 	}
+	this->stats[entry->in->nlmsg_type][i]++;
+}
+
+METHOD(netlink_socket_t, netlink_send, status_t,
+	private_netlink_socket_t *this, struct nlmsghdr *in, struct nlmsghdr **out,
+	size_t *out_len)
+{
+	entry_t entry = {
+		.in = in,
+	};
+	uintptr_t seq;
+
+	if (this->send_mutex)
+	{
+		this->send_mutex->lock(this->send_mutex);
+	}
+	this->mutex->lock(this->mutex);
+
+	seq = ++this->seq;
+	in->nlmsg_seq = seq;
+	in->nlmsg_pid = getpid();
+
+	if (this->protocol == NETLINK_XFRM)
+	{
+		chunk_t in_chunk = { (u_char*)in, in->nlmsg_len };
+
+		DBG3(DBG_KNL, "sending %N: %B", xfrm_msg_names, in->nlmsg_type, &in_chunk);
+	}
+
+	time_monotonic(&entry.start);
+	this->entries->put(this->entries, (void*)seq, &entry);
+	this->queue->insert_last(this->queue, &entry);
+	write_queued(this);
 
-	*out_len = result.len;
-	*out = (struct nlmsghdr*)result.ptr;
+	while (!entry.complete)
+	{
+		if (this->reading)
+		{	/* another thread reads, it queues our response */
+			this->condvar->wait(this->condvar, this->mutex);
+			continue;
+		}
+		this->reading = TRUE;
+		this->mutex->unlock(this->mutex);
+		if (!read_and_queue(this))
+		{
+			/* we can't tell which responses got lost, fail all written */
+			enumerator_t *enumerator;
+			entry_t *current;
 
+			this->mutex->lock(this->mutex);
+			enumerator = this->entries->create_enumerator(this->entries);
+			while (enumerator->enumerate(enumerator, NULL, &current))
+			{
+				if (!current->complete &&
+					this->queue->find_first(this->queue, NULL,
+											(void**)&current) != SUCCESS)
+				{
+					fail_entry(this, current);
+				}
+			}
+			enumerator->destroy(enumerator);
+			this->mutex->unlock(this->mutex);
+		}
+		this->mutex->lock(this->mutex);
+		this->reading = FALSE;
+		/* let another waiting thread take over reading */
+		this->condvar->broadcast(this->condvar);
+	}
+	this->entries->remove(this->entries, (void*)seq);
+	add_latency(this, &entry);
 	this->mutex->unlock(this->mutex);
+	if (this->send_mutex)
+	{
+		this->send_mutex->unlock(this->send_mutex);
+	}
 
+	if (entry.failed)
+	{
+		free(entry.response.ptr);
+		return FAILED;
+	}
+	*out_len = entry.response.len;
+	*out = (struct nlmsghdr*)entry.response.ptr;
 	return SUCCESS;
 }
 
@@ -232,6 +529,37 @@ METHOD(netlink_socket_t, netlink_send_ack, status_t,
 	return FAILED;
 }
 
+/**
+ * Log the latency statistics of a socket
+ */
+static void log_stats(private_netlink_socket_t *this)
+{
+	u_int *stats;
+	int type;
+
+	for (type = 0; type < MAX_STATS_TYPES; type++)
+	{
+		stats = this->stats[type];
+		if (!stats[0] && !stats[1] && !stats[2] && !stats[3] && !stats[4] &&
+			!stats[5])
+		{
+			continue;
+		}
+		if (this->protocol == NETLINK_XFRM)
+		{
+			DBG2(DBG_KNL, "%N latency: <0.1ms: %u, <1ms: %u, <10ms: %u, "
+				 "<100ms: %u, <1s: %u, >=1s: %u", xfrm_msg_names, type,
+				 stats[0], stats[1], stats[2], stats[3], stats[4], stats[5]);
+		}
+		else
+		{
+			DBG2(DBG_KNL, "netlink message %d latency: <0.1ms: %u, <1ms: %u, "
+				 "<10ms: %u, <100ms: %u, <1s: %u, >=1s: %u", type,
+				 stats[0], stats[1], stats[2], stats[3], stats[4], stats[5]);
+		}
+	}
+}
+
 METHOD(netlink_socket_t, destroy, void,
 	private_netlink_socket_t *this)
 {
@@ -239,14 +567,19 @@ METHOD(netlink_socket_t, destroy, void,
 	{
 		close(this->socket);
 	}
+	log_stats(this);
+	this->entries->destroy(this->entries);
+	this->queue->destroy(this->queue);
+	this->condvar->destroy(this->condvar);
 	this->mutex->destroy(this->mutex);
+	DESTROY_IF(this->send_mutex);
 	free(this);
 }
 
 /**
  * Described in header.
  */
-netlink_socket_t *netlink_socket_create(int protocol)
+netlink_socket_t *netlink_socket_create(int protocol, bool parallel)
 {
 	private_netlink_socket_t *this;
 	struct sockaddr_nl addr;
@@ -259,6 +592,10 @@ netlink_socket_t *netlink_socket_create(int protocol)
 		},
 		.seq = 200,
 		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
+		.condvar = condvar_create(CONDVAR_TYPE_DEFAULT),
+		.send_mutex = parallel ? NULL : mutex_create(MUTEX_TYPE_DEFAULT),
+		.entries = hashtable_create(hash_seq, equals_seq, 8),
+		.queue = linked_list_create(),
 		.protocol = protocol,
 	);
 
@@ -32,6 +32,10 @@ typedef struct netlink_socket_t netlink_socket_t;
 
 /**
  * Wrapper around a netlink socket.
+ *
+ * Requests get demultiplexed by sequence number, so multiple threads may have
+ * requests in flight on the same socket. Requests queued concurrently are
+ * written to the kernel in a single batch.
  */
 struct netlink_socket_t {
 
@@ -62,8 +66,9 @@ struct netlink_socket_t {
  * Create a netlink_socket_t object.
  *
  * @param	protocol	protocol type (e.g. NETLINK_XFRM or NETLINK_ROUTE)
+ * @param	parallel	TRUE to allow concurrent requests, FALSE to serialize
  */
-netlink_socket_t *netlink_socket_create(int protocol);
+netlink_socket_t *netlink_socket_create(int protocol, bool parallel);
 
 /**
  * Creates an rtattr and adds it to the given netlink message.
@@ -45,6 +45,11 @@ struct private_esp_context_t {
 	 */
 	aead_t *aead;
 
+	/**
+	 * RNG to generate IVs, created on first use
+	 */
+	rng_t *rng;
+
 	/**
 	 * The highest sequence number that was successfully verified
 	 * and authenticated, or assigned in an outbound context
@@ -196,11 +201,22 @@ METHOD(esp_context_t, get_aead, aead_t*,
 	return this->aead;
 }
 
+METHOD(esp_context_t, get_rng, rng_t*,
+	private_esp_context_t *this)
+{
+	if (!this->rng)
+	{
+		this->rng = lib->crypto->create_rng(lib->crypto, RNG_WEAK);
+	}
+	return this->rng;
+}
+
 METHOD(esp_context_t, destroy, void,
 	private_esp_context_t *this)
 {
 	chunk_free(&this->window);
 	DESTROY_IF(this->aead);
+	DESTROY_IF(this->rng);
 	free(this);
 }
 
@@ -309,6 +325,7 @@ esp_context_t *esp_context_create(int enc_alg, chunk_t enc_key,
 	INIT(this,
 		.public = {
 			.get_aead = _get_aead,
+			.get_rng = _get_rng,
 			.get_seqno = _get_seqno,
 			.next_seqno = _next_seqno,
 			.verify_seqno = _verify_seqno,
@@ -25,6 +25,7 @@
 
 #include <library.h>
 #include <crypto/aead.h>
+#include <crypto/rngs/rng.h>
 
 typedef struct esp_context_t esp_context_t;
 
@@ -40,6 +41,17 @@ struct esp_context_t {
 	 */
 	aead_t *(*get_aead)(esp_context_t *this);
 
+	/**
+	 * Get the RNG to generate IVs for outbound ESP packets.
+	 *
+	 * The RNG is created on first use and kept for the lifetime of the
+	 * context. Like the context itself, it may only be used while the SA
+	 * is checked out.
+	 *
+	 * @return				RNG instance, NULL if none available
+	 */
+	rng_t *(*get_rng)(esp_context_t *this);
+
 	/**
 	 * Get the current outbound ESP sequence number or the highest authenticated
 	 * inbound sequence number.
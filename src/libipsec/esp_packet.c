@@ -22,8 +22,6 @@
 #include <utils/debug.h>
 #include <crypto/crypters/crypter.h>
 #include <crypto/signers/signer.h>
-#include <bio/bio_reader.h>
-#include <bio/bio_writer.h>
 
 #include <netinet/in.h>
 
@@ -129,21 +127,20 @@ METHOD(packet_t, clone, packet_t*,
 METHOD(esp_packet_t, parse_header, bool,
 	private_esp_packet_t *this, u_int32_t *spi)
 {
-	bio_reader_t *reader;
 	u_int32_t seq;
+	chunk_t data;
 
-	reader = bio_reader_create(this->packet->get_data(this->packet));
-	if (!reader->read_uint32(reader, spi) ||
-		!reader->read_uint32(reader, &seq))
+	data = this->packet->get_data(this->packet);
+	if (data.len < 2 * sizeof(u_int32_t))
 	{
 		DBG1(DBG_ESP, "failed to parse ESP header: invalid length");
-		reader->destroy(reader);
 		return FALSE;
 	}
-	reader->destroy(reader);
+	memcpy(spi, data.ptr, sizeof(*spi));
+	seq = untoh32(data.ptr + sizeof(*spi));
 
-	DBG2(DBG_ESP, "parsed ESP header with SPI %.8x [seq %u]", *spi, seq);
-	*spi = htonl(*spi);
+	DBG2(DBG_ESP, "parsed ESP header with SPI %.8x [seq %u]", ntohl(*spi),
+		 seq);
 	return TRUE;
 }
 
@@ -165,29 +162,37 @@ static bool check_padding(chunk_t padding)
 }
 
 /**
- * Remove the padding from the payload and set the next header info
+ * Remove the padding from the payload and set the next header info.
+ *
+ * The plaintext buffer is adopted by the payload, so no copy is required.
  */
 static bool remove_padding(private_esp_packet_t *this, chunk_t plaintext)
 {
 	u_int8_t next_header, pad_length;
 	chunk_t padding, payload;
-	bio_reader_t *reader;
+	size_t len;
 
-	reader = bio_reader_create(plaintext);
-	if (!reader->read_uint8_end(reader, &next_header) ||
-		!reader->read_uint8_end(reader, &pad_length))
+	if (plaintext.len < 2)
 	{
 		DBG1(DBG_ESP, "parsing ESP payload failed: invalid length");
 		goto failed;
 	}
-	if (!reader->read_data_end(reader, pad_length, &padding) ||
-		!check_padding(padding))
+	next_header = plaintext.ptr[plaintext.len - 1];
+	pad_length = plaintext.ptr[plaintext.len - 2];
+	len = plaintext.len - 2;
+	if (pad_length > len)
 	{
 		DBG1(DBG_ESP, "parsing ESP payload failed: invalid padding");
 		goto failed;
 	}
-	this->payload = ip_packet_create(reader->peek(reader));
-	reader->destroy(reader);
+	len -= pad_length;
+	padding = chunk_create(plaintext.ptr + len, pad_length);
+	if (!check_padding(padding))
+	{
+		DBG1(DBG_ESP, "parsing ESP payload failed: invalid padding");
+		goto failed;
+	}
+	this->payload = ip_packet_create_from_buffer(plaintext, 0, len);
 	if (!this->payload)
 	{
 		DBG1(DBG_ESP, "parsing ESP payload failed: unsupported payload");
@@ -202,7 +207,6 @@ static bool remove_padding(private_esp_packet_t *this, chunk_t plaintext)
 	return TRUE;
 
 failed:
-	reader->destroy(reader);
 	chunk_free(&plaintext);
 	return FALSE;
 }
@@ -210,9 +214,9 @@ failed:
 METHOD(esp_packet_t, decrypt, status_t,
 	private_esp_packet_t *this, esp_context_t *esp_context)
 {
-	bio_reader_t *reader;
 	u_int32_t spi, seq;
 	chunk_t data, iv, icv, aad, ciphertext, plaintext;
+	size_t hdrlen;
 	aead_t *aead;
 
 	DESTROY_IF(this->payload);
@@ -221,19 +225,21 @@ METHOD(esp_packet_t, decrypt, status_t,
 	data = this->packet->get_data(this->packet);
 	aead = esp_context->get_aead(esp_context);
 
-	reader = bio_reader_create(data);
-	if (!reader->read_uint32(reader, &spi) ||
-		!reader->read_uint32(reader, &seq) ||
-		!reader->read_data(reader, aead->get_iv_size(aead), &iv) ||
-		!reader->read_data_end(reader, aead->get_icv_size(aead), &icv) ||
-		reader->remaining(reader) % aead->get_block_size(aead))
+	iv.len = aead->get_iv_size(aead);
+	icv.len = aead->get_icv_size(aead);
+	hdrlen = 2 * sizeof(u_int32_t) + iv.len;
+	if (data.len < hdrlen + icv.len ||
+		(data.len - hdrlen - icv.len) % aead->get_block_size(aead))
 	{
 		DBG1(DBG_ESP, "ESP decryption failed: invalid length");
 		return PARSE_ERROR;
 	}
-	ciphertext = reader->peek(reader);
-	ciphertext.len += icv.len;
-	reader->destroy(reader);
+	spi = untoh32(data.ptr);
+	seq = untoh32(data.ptr + sizeof(spi));
+	iv.ptr = data.ptr + 2 * sizeof(u_int32_t);
+	icv.ptr = data.ptr + data.len - icv.len;
+	/* ciphertext includes the ICV */
+	ciphertext = chunk_create(data.ptr + hdrlen, data.len - hdrlen);
 
 	if (!esp_context->verify_seqno(esp_context, seq))
 	{
@@ -278,10 +284,11 @@ static void generate_padding(chunk_t padding)
 METHOD(esp_packet_t, encrypt, status_t,
 	private_esp_packet_t *this, esp_context_t *esp_context, u_int32_t spi)
 {
-	chunk_t iv, icv, aad, padding, payload, ciphertext;
-	bio_writer_t *writer;
+	chunk_t iv, icv, aad, padding, ciphertext;
+	chunk_t payload = chunk_empty, buffer = chunk_empty;
 	u_int32_t next_seqno;
-	size_t blocksize, plainlen;
+	size_t blocksize, plainlen, hdrlen, offset = 0;
+	u_char *header;
 	aead_t *aead;
 	rng_t *rng;
 
@@ -293,7 +300,7 @@ METHOD(esp_packet_t, encrypt, status_t,
 		return FAILED;
 	}
 
-	rng = lib->crypto->create_rng(lib->crypto, RNG_WEAK);
+	rng = esp_context->get_rng(esp_context);
 	if (!rng)
 	{
 		DBG1(DBG_ESP, "ESP encryption failed: could not find RNG");
@@ -304,47 +311,63 @@ METHOD(esp_packet_t, encrypt, status_t,
 	blocksize = aead->get_block_size(aead);
 	iv.len = aead->get_iv_size(aead);
 	icv.len = aead->get_icv_size(aead);
+	hdrlen = 2 * sizeof(u_int32_t) + iv.len;
 
 	/* plaintext = payload, padding, pad_length, next_header */
-	payload = this->payload ? this->payload->get_encoding(this->payload)
-							: chunk_empty;
+	if (this->payload)
+	{
+		payload = this->payload->get_encoding(this->payload);
+		buffer = this->payload->extract_buffer(this->payload, &offset);
+		payload.ptr = buffer.ptr + offset;
+		this->payload->destroy(this->payload);
+		this->payload = NULL;
+	}
 	plainlen = payload.len + 2;
 	padding.len = blocksize - (plainlen % blocksize);
 	plainlen += padding.len;
 
-	/* len = spi, seq, IV, plaintext, ICV */
-	writer = bio_writer_create(2 * sizeof(u_int32_t) + iv.len + plainlen +
-							   icv.len);
-	writer->write_uint32(writer, ntohl(spi));
-	writer->write_uint32(writer, next_seqno);
+	/* packet = spi, seq, IV, plaintext, ICV. If the buffer of the payload
+	 * has enough room around it we encapsulate it in place */
+	if (offset < hdrlen || buffer.len - offset < plainlen + icv.len)
+	{
+		chunk_t packet;
+
+		packet = chunk_alloc(hdrlen + plainlen + icv.len);
+		memcpy(packet.ptr + hdrlen, payload.ptr, payload.len);
+		chunk_free(&buffer);
+		buffer = packet;
+		offset = hdrlen;
+		payload.ptr = buffer.ptr + offset;
+	}
+	/* the packet data has to start at the beginning of the buffer, so we
+	 * skip the unused headroom after setting it */
+	offset -= hdrlen;
+	buffer.len = offset + hdrlen + plainlen + icv.len;
+	header = buffer.ptr + offset;
+
+	memcpy(header, &spi, sizeof(spi));
+	htoun32(header + sizeof(spi), next_seqno);
 
-	iv = writer->skip(writer, iv.len);
+	iv.ptr = header + 2 * sizeof(u_int32_t);
 	if (!rng->get_bytes(rng, iv.len, iv.ptr))
 	{
 		DBG1(DBG_ESP, "ESP encryption failed: could not generate IV");
-		writer->destroy(writer);
-		rng->destroy(rng);
+		chunk_free(&buffer);
 		return FAILED;
 	}
-	rng->destroy(rng);
-
-	/* plain-/ciphertext will start here */
-	ciphertext = writer->get_buf(writer);
-	ciphertext.ptr += ciphertext.len;
-	ciphertext.len = plainlen;
 
-	writer->write_data(writer, payload);
+	/* plain-/ciphertext starts after the IV */
+	ciphertext = chunk_create(header + hdrlen, plainlen);
 
-	padding = writer->skip(writer, padding.len);
+	padding.ptr = payload.ptr + payload.len;
 	generate_padding(padding);
 
-	writer->write_uint8(writer, padding.len);
-	writer->write_uint8(writer, this->next_header);
+	padding.ptr[padding.len] = padding.len;
+	padding.ptr[padding.len + 1] = this->next_header;
 
 	/* aad = spi + seq */
-	aad = writer->get_buf(writer);
-	aad.len = 8;
-	icv = writer->skip(writer, icv.len);
+	aad = chunk_create(header, 8);
+	icv.ptr = ciphertext.ptr + ciphertext.len;
 
 	DBG3(DBG_ESP, "ESP before encryption:\n  payload = %B\n  padding = %B\n  "
 		 "padding length = %hhu, next header = %hhu", &payload, &padding,
@@ -354,7 +377,7 @@ METHOD(esp_packet_t, encrypt, status_t,
 	if (!aead->encrypt(aead, ciphertext, aad, iv, NULL))
 	{
 		DBG1(DBG_ESP, "ESP encryption or ICV generation failed");
-		writer->destroy(writer);
+		chunk_free(&buffer);
 		return FAILED;
 	}
 
@@ -362,8 +385,8 @@ METHOD(esp_packet_t, encrypt, status_t,
 		 "encrypted %B\n  ICV %B", ntohl(spi), next_seqno, &iv,
 		 &ciphertext, &icv);
 
-	this->packet->set_data(this->packet, writer->extract_buf(writer));
-	writer->destroy(writer);
+	this->packet->set_data(this->packet, buffer);
+	this->packet->skip_bytes(this->packet, offset);
 	return SUCCESS;
 }
 
@@ -32,6 +32,19 @@
 
 typedef struct esp_packet_t esp_packet_t;
 
+/**
+ * Room to reserve in front of an IP packet to encapsulate it in place: SPI,
+ * sequence number and an IV of up to 16 bytes.
+ */
+#define ESP_PACKET_HEADROOM 24
+
+/**
+ * Room to reserve after an IP packet to encapsulate it in place: padding to
+ * a block size of up to 16 bytes, pad length, next header and an ICV of up to
+ * 32 bytes.
+ */
+#define ESP_PACKET_TAILROOM 64
+
 /**
  *  ESP packet
  */
@@ -86,6 +99,10 @@ struct esp_packet_t {
 	 * Encapsulate and encrypt the packet. The sequence number will be generated
 	 * using the supplied ESP context.
 	 *
+	 * If the buffer of the plaintext payload provides enough head- and
+	 * tailroom (see ip_packet_create_from_buffer()), the packet is built in
+	 * place. The payload is consumed once encapsulation starts.
+	 *
 	 * @param esp_context		ESP context of corresponding outbound IPsec SA
 	 * @param spi				SPI value to use, in network byte order
 	 * @return					- SUCCESS if encrypted
@@ -49,10 +49,15 @@ struct private_ip_packet_t {
 	host_t *dst;
 
 	/**
-	 * IP packet
+	 * IP packet, located in buffer
 	 */
 	chunk_t packet;
 
+	/**
+	 * Allocated buffer containing the packet, including head- and tailroom
+	 */
+	chunk_t buffer;
+
 	/**
 	 * IP version
 	 */
@@ -95,10 +100,21 @@ METHOD(ip_packet_t, get_next_header, u_int8_t,
 	return this->next_header;
 }
 
+METHOD(ip_packet_t, extract_buffer, chunk_t,
+	private_ip_packet_t *this, size_t *offset)
+{
+	chunk_t buffer;
+
+	buffer = this->buffer;
+	*offset = this->packet.ptr - buffer.ptr;
+	this->buffer = this->packet = chunk_empty;
+	return buffer;
+}
+
 METHOD(ip_packet_t, clone, ip_packet_t*,
 	private_ip_packet_t *this)
 {
-	return ip_packet_create(this->packet);
+	return ip_packet_create(chunk_clone(this->packet));
 }
 
 METHOD(ip_packet_t, destroy, void,
@@ -106,7 +122,7 @@ METHOD(ip_packet_t, destroy, void,
 {
 	this->src->destroy(this->src);
 	this->dst->destroy(this->dst);
-	chunk_free(&this->packet);
+	chunk_free(&this->buffer);
 	free(this);
 }
 
@@ -114,10 +130,27 @@ METHOD(ip_packet_t, destroy, void,
  * Described in header.
  */
 ip_packet_t *ip_packet_create(chunk_t packet)
+{
+	return ip_packet_create_from_buffer(packet, 0, packet.len);
+}
+
+/**
+ * Described in header.
+ */
+ip_packet_t *ip_packet_create_from_buffer(chunk_t buffer, size_t offset,
+										  size_t len)
 {
 	private_ip_packet_t *this;
 	u_int8_t version, next_header;
 	host_t *src, *dst;
+	chunk_t packet;
+
+	if (offset + len > buffer.len)
+	{
+		DBG1(DBG_ESP, "IP packet exceeds buffer");
+		goto failed;
+	}
+	packet = chunk_create(buffer.ptr + offset, len);
 
 	if (packet.len < 1)
 	{
@@ -177,18 +210,20 @@ ip_packet_t *ip_packet_create(chunk_t packet)
 			.get_destination = _get_destination,
 			.get_next_header = _get_next_header,
 			.get_encoding = _get_encoding,
+			.extract_buffer = _extract_buffer,
 			.clone = _clone,
 			.destroy = _destroy,
 		},
 		.src = src,
 		.dst = dst,
 		.packet = packet,
+		.buffer = buffer,
 		.version = version,
 		.next_header = next_header,
 	);
 	return &this->public;
 
 failed:
-	chunk_free(&packet);
+	chunk_free(&buffer);
 	return NULL;
 }
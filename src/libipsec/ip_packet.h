@@ -67,6 +67,17 @@ struct ip_packet_t {
 	 */
 	chunk_t (*get_encoding)(ip_packet_t *this);
 
+	/**
+	 * Take over the buffer containing the IP packet, including any head- and
+	 * tailroom reserved around it.
+	 *
+	 * The packet is empty afterwards and may only be destroyed.
+	 *
+	 * @param offset		receives the offset of the packet in the buffer
+	 * @return				allocated buffer, owned by the caller
+	 */
+	chunk_t (*extract_buffer)(ip_packet_t *this, size_t *offset);
+
 	/**
 	 * Clone the IP packet
 	 *
@@ -93,4 +104,21 @@ struct ip_packet_t {
  */
 ip_packet_t *ip_packet_create(chunk_t packet);
 
+/**
+ * Create an IP packet located in a larger buffer.
+ *
+ * Reserving room before and after the packet allows encapsulating it in place
+ * (see ESP_PACKET_HEADROOM and ESP_PACKET_TAILROOM).
+ *
+ * @note The buffer gets either owned by the new object, or destroyed, if the
+ * data is invalid.
+ *
+ * @param buffer		allocated buffer containing the packet, gets owned
+ * @param offset		offset of the IP packet in the buffer
+ * @param len			length of the IP packet
+ * @return				ip_packet_t instance, or NULL if invalid
+ */
+ip_packet_t *ip_packet_create_from_buffer(chunk_t buffer, size_t offset,
+										  size_t len);
+
 #endif /** IP_PACKET_H_ @}*/
@@ -25,6 +25,7 @@
 #define PRIO_BASE 512
 
 typedef struct private_ipsec_policy_mgr_t private_ipsec_policy_mgr_t;
+typedef struct policy_node_t policy_node_t;
 
 /**
  * Private additions to ipsec_policy_mgr_t.
@@ -37,12 +38,18 @@ struct private_ipsec_policy_mgr_t {
 	ipsec_policy_mgr_t public;
 
 	/**
-	 * Installed policies (ipsec_policy_entry_t*)
+	 * Installed policies, a trie on the destination selector for each
+	 * direction (inbound/outbound) and address family (IPv4/IPv6)
 	 */
-	linked_list_t *policies;
+	policy_node_t *policies[2][2];
+
+	/**
+	 * Sequence number assigned to added policies
+	 */
+	u_int seq;
 
 	/**
-	 * Lock to safely access the list of policies
+	 * Lock to safely access the policies
 	 */
 	rwlock_t *lock;
 
@@ -59,6 +66,11 @@ typedef struct {
 	 */
 	u_int32_t priority;
 
+	/**
+	 * Sequence number, policies added later are preferred on equal priority
+	 */
+	u_int seq;
+
 	/**
 	 * The policy
 	 */
@@ -66,6 +78,26 @@ typedef struct {
 
 } ipsec_policy_entry_t;
 
+/**
+ * Node in a binary trie on the destination address of policies.
+ *
+ * Policies are stored in the node of the subnet enclosing their destination
+ * selector. The policies of a node are sorted by priority, policies added
+ * later are inserted before policies with the same priority.
+ */
+struct policy_node_t {
+
+	/**
+	 * Child nodes for a 0 and a 1 bit at the next position
+	 */
+	policy_node_t *child[2];
+
+	/**
+	 * Policies of this node (ipsec_policy_entry_t*), NULL if none
+	 */
+	linked_list_t *policies;
+};
+
 /**
  * Calculate the pseudo-priority to sort policies.  This is the same algorithm
  * used by the NETLINK kernel interface (i.e. high priority -> low value).
@@ -112,11 +144,13 @@ static u_int32_t calculate_priority(policy_priority_t policy_priority,
 /**
  * Create a policy entry
  */
-static ipsec_policy_entry_t *policy_entry_create(ipsec_policy_t *policy)
+static ipsec_policy_entry_t *policy_entry_create(ipsec_policy_t *policy,
+												  u_int seq)
 {
 	ipsec_policy_entry_t *this;
 
 	INIT(this,
+		.seq = seq,
 		.policy = policy,
 		.priority = calculate_priority(policy->get_priority(policy),
 									   policy->get_source_ts(policy),
@@ -134,6 +168,123 @@ static void policy_entry_destroy(ipsec_policy_entry_t *this)
 	free(this);
 }
 
+/**
+ * Check if a policy entry is preferred over another
+ */
+static bool is_preferred(ipsec_policy_entry_t *entry,
+						 ipsec_policy_entry_t *other)
+{
+	return entry->priority < other->priority ||
+		  (entry->priority == other->priority && entry->seq > other->seq);
+}
+
+/**
+ * Get the bit at the given position of an address
+ */
+static inline u_int get_bit(chunk_t addr, u_int pos)
+{
+	return (addr.ptr[pos / 8] >> (7 - pos % 8)) & 0x01;
+}
+
+/**
+ * Get the root node pointer for policies of a direction and address family
+ */
+static policy_node_t **get_root(private_ipsec_policy_mgr_t *this,
+								bool inbound, int family)
+{
+	return &this->policies[inbound ? 0 : 1][family == AF_INET6 ? 1 : 0];
+}
+
+/**
+ * Find the node for the subnet enclosing a destination selector, optionally
+ * creating it
+ */
+static policy_node_t *find_node(private_ipsec_policy_mgr_t *this,
+								traffic_selector_t *dst_ts, policy_dir_t dir,
+								bool create)
+{
+	policy_node_t **node;
+	host_t *net;
+	chunk_t addr;
+	u_int8_t mask;
+	u_int pos;
+
+	dst_ts->to_subnet(dst_ts, &net, &mask);
+	addr = net->get_address(net);
+	mask = min(mask, addr.len * 8);
+	node = get_root(this, dir == POLICY_IN, net->get_family(net));
+	for (pos = 0; *node || create; pos++)
+	{
+		if (!*node)
+		{
+			INIT(*node);
+		}
+		if (pos == mask)
+		{
+			break;
+		}
+		node = &(*node)->child[get_bit(addr, pos)];
+	}
+	net->destroy(net);
+	return *node;
+}
+
+/**
+ * Remove nodes without policies and children along the path to the node of
+ * a destination selector, starting at that node and stopping at the first
+ * node still in use
+ */
+static void prune_path(private_ipsec_policy_mgr_t *this,
+					   traffic_selector_t *dst_ts, policy_dir_t dir)
+{
+	/* one node per bit of an IPv6 address, plus the root */
+	policy_node_t **path[128 + 1], **node;
+	host_t *net;
+	chunk_t addr;
+	u_int8_t mask;
+	u_int pos, count = 0;
+
+	dst_ts->to_subnet(dst_ts, &net, &mask);
+	addr = net->get_address(net);
+	mask = min(mask, addr.len * 8);
+	node = get_root(this, dir == POLICY_IN, net->get_family(net));
+	for (pos = 0; *node; pos++)
+	{
+		path[count++] = node;
+		if (pos == mask)
+		{
+			break;
+		}
+		node = &(*node)->child[get_bit(addr, pos)];
+	}
+	net->destroy(net);
+
+	while (count--)
+	{
+		node = path[count];
+		if ((*node)->policies || (*node)->child[0] || (*node)->child[1])
+		{
+			break;
+		}
+		free(*node);
+		*node = NULL;
+	}
+}
+
+/**
+ * Destroy a node, its children and all their policies
+ */
+static void destroy_nodes(policy_node_t *node)
+{
+	if (node)
+	{
+		destroy_nodes(node->child[0]);
+		destroy_nodes(node->child[1]);
+		DESTROY_FUNCTION_IF(node->policies, (void*)policy_entry_destroy);
+		free(node);
+	}
+}
+
 METHOD(ipsec_policy_mgr_t, add_policy, status_t,
 	private_ipsec_policy_mgr_t *this, host_t *src, host_t *dst,
 	traffic_selector_t *src_ts, traffic_selector_t *dst_ts,
@@ -143,6 +294,7 @@ METHOD(ipsec_policy_mgr_t, add_policy, status_t,
 	enumerator_t *enumerator;
 	ipsec_policy_entry_t *entry, *current;
 	ipsec_policy_t *policy;
+	policy_node_t *node;
 
 	if (type != POLICY_IPSEC || direction == POLICY_FWD)
 	{	/* we ignore these policies as we currently have no use for them */
@@ -154,10 +306,15 @@ METHOD(ipsec_policy_mgr_t, add_policy, status_t,
 
 	policy = ipsec_policy_create(src, dst, src_ts, dst_ts, direction, type, sa,
 								 mark, priority);
-	entry = policy_entry_create(policy);
 
 	this->lock->write_lock(this->lock);
-	enumerator = this->policies->create_enumerator(this->policies);
+	entry = policy_entry_create(policy, this->seq++);
+	node = find_node(this, dst_ts, direction, TRUE);
+	if (!node->policies)
+	{
+		node->policies = linked_list_create();
+	}
+	enumerator = node->policies->create_enumerator(node->policies);
 	while (enumerator->enumerate(enumerator, (void**)&current))
 	{
 		if (current->priority >= entry->priority)
@@ -165,7 +322,7 @@ METHOD(ipsec_policy_mgr_t, add_policy, status_t,
 			break;
 		}
 	}
-	this->policies->insert_before(this->policies, enumerator, entry);
+	node->policies->insert_before(node->policies, enumerator, entry);
 	enumerator->destroy(enumerator);
 	this->lock->unlock(this->lock);
 	return SUCCESS;
@@ -178,6 +335,7 @@ METHOD(ipsec_policy_mgr_t, del_policy, status_t,
 {
 	enumerator_t *enumerator;
 	ipsec_policy_entry_t *current, *found = NULL;
+	policy_node_t *node;
 	u_int32_t priority;
 
 	if (direction == POLICY_FWD)
@@ -190,19 +348,29 @@ METHOD(ipsec_policy_mgr_t, del_policy, status_t,
 	priority = calculate_priority(policy_priority, src_ts, dst_ts);
 
 	this->lock->write_lock(this->lock);
-	enumerator = this->policies->create_enumerator(this->policies);
-	while (enumerator->enumerate(enumerator, (void**)&current))
+	node = find_node(this, dst_ts, direction, FALSE);
+	if (node && node->policies)
 	{
-		if (current->priority == priority &&
-			current->policy->match(current->policy, src_ts, dst_ts, direction,
-								   reqid, mark, policy_priority))
+		enumerator = node->policies->create_enumerator(node->policies);
+		while (enumerator->enumerate(enumerator, (void**)&current))
 		{
-			this->policies->remove_at(this->policies, enumerator);
-			found = current;
-			break;
+			if (current->priority == priority &&
+				current->policy->match(current->policy, src_ts, dst_ts,
+									direction, reqid, mark, policy_priority))
+			{
+				node->policies->remove_at(node->policies, enumerator);
+				found = current;
+				break;
+			}
+		}
+		enumerator->destroy(enumerator);
+		if (node->policies->get_count(node->policies) == 0)
+		{
+			node->policies->destroy(node->policies);
+			node->policies = NULL;
+			prune_path(this, dst_ts, direction);
 		}
 	}
-	enumerator->destroy(enumerator);
 	this->lock->unlock(this->lock);
 	if (found)
 	{
@@ -215,15 +383,18 @@ METHOD(ipsec_policy_mgr_t, del_policy, status_t,
 METHOD(ipsec_policy_mgr_t, flush_policies, status_t,
 	private_ipsec_policy_mgr_t *this)
 {
-	ipsec_policy_entry_t *entry;
+	int i, j;
 
 	DBG2(DBG_ESP, "flushing policies");
 
 	this->lock->write_lock(this->lock);
-	while (this->policies->remove_last(this->policies,
-									  (void**)&entry) == SUCCESS)
+	for (i = 0; i < countof(this->policies); i++)
 	{
-		policy_entry_destroy(entry);
+		for (j = 0; j < countof(this->policies[i]); j++)
+		{
+			destroy_nodes(this->policies[i][j]);
+			this->policies[i][j] = NULL;
+		}
 	}
 	this->lock->unlock(this->lock);
 	return SUCCESS;
@@ -233,32 +404,57 @@ METHOD(ipsec_policy_mgr_t, find_by_packet, ipsec_policy_t*,
 	private_ipsec_policy_mgr_t *this, ip_packet_t *packet, bool inbound)
 {
 	enumerator_t *enumerator;
-	ipsec_policy_entry_t *current;
-	ipsec_policy_t *found = NULL;
+	ipsec_policy_entry_t *current, *found = NULL;
+	ipsec_policy_t *policy = NULL;
+	policy_node_t *node;
+	host_t *dst;
+	chunk_t addr;
+	u_int pos = 0;
+
+	dst = packet->get_destination(packet);
+	addr = dst->get_address(dst);
 
 	this->lock->read_lock(this->lock);
-	enumerator = this->policies->create_enumerator(this->policies);
-	while (enumerator->enumerate(enumerator, (void**)&current))
+	/* walk down the path of the destination address, each node on it holds
+	 * candidate policies, the best matching one of each node is the first */
+	node = *get_root(this, inbound, dst->get_family(dst));
+	while (node)
 	{
-		ipsec_policy_t *policy = current->policy;
-
-		if ((inbound == (policy->get_direction(policy) == POLICY_IN)) &&
-			 policy->match_packet(policy, packet))
+		if (node->policies)
+		{
+			enumerator = node->policies->create_enumerator(node->policies);
+			while (enumerator->enumerate(enumerator, (void**)&current))
+			{
+				if (found && !is_preferred(current, found))
+				{
+					break;
+				}
+				if (current->policy->match_packet(current->policy, packet))
+				{
+					found = current;
+					break;
+				}
+			}
+			enumerator->destroy(enumerator);
+		}
+		if (pos == addr.len * 8)
 		{
-			found = policy->get_ref(policy);
 			break;
 		}
+		node = node->child[get_bit(addr, pos++)];
+	}
+	if (found)
+	{
+		policy = found->policy->get_ref(found->policy);
 	}
-	enumerator->destroy(enumerator);
 	this->lock->unlock(this->lock);
-	return found;
+	return policy;
 }
 
 METHOD(ipsec_policy_mgr_t, destroy, void,
 	private_ipsec_policy_mgr_t *this)
 {
 	flush_policies(this);
-	this->policies->destroy(this->policies);
 	this->lock->destroy(this->lock);
 	free(this);
 }
@@ -278,7 +474,6 @@ ipsec_policy_mgr_t *ipsec_policy_mgr_create()
 			.find_by_packet = _find_by_packet,
 			.destroy = _destroy,
 		},
-		.policies = linked_list_create(),
 		.lock = rwlock_create(RWLOCK_TYPE_DEFAULT),
 	);
 
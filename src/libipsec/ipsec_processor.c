@@ -23,6 +23,7 @@
 #include <processing/jobs/callback_job.h>
 
 typedef struct private_ipsec_processor_t private_ipsec_processor_t;
+typedef struct worker_t worker_t;
 
 /**
  * Private additions to ipsec_processor_t.
@@ -35,14 +36,19 @@ struct private_ipsec_processor_t {
 	ipsec_processor_t public;
 
 	/**
-	 * Queue for inbound packets (esp_packet_t*)
+	 * Workers processing inbound packets (esp_packet_t*), sharded by SPI
 	 */
-	blocking_queue_t *inbound_queue;
+	worker_t *inbound_workers;
 
 	/**
-	 * Queue for outbound packets (ip_packet_t*)
+	 * Workers processing outbound packets (outbound_t*), sharded by reqid
 	 */
-	blocking_queue_t *outbound_queue;
+	worker_t *outbound_workers;
+
+	/**
+	 * Number of workers per direction
+	 */
+	u_int workers;
 
 	/**
 	 * Registered inbound callback
@@ -66,6 +72,53 @@ struct private_ipsec_processor_t {
 	rwlock_t *lock;
 };
 
+/**
+ * A worker thread processing the packets of a subset of the SAs.
+ *
+ * All packets of an SA are processed by the same worker, so they are handled
+ * in order, and the sequence numbers of outbound packets are assigned in the
+ * order the packets have been queued.
+ */
+struct worker_t {
+
+	/**
+	 * Processor this worker belongs to
+	 */
+	private_ipsec_processor_t *this;
+
+	/**
+	 * Queue of packets for this worker
+	 */
+	blocking_queue_t *queue;
+};
+
+/**
+ * Outbound packet with the matching policy, as queued to workers
+ */
+typedef struct {
+
+	/**
+	 * Plaintext IP packet
+	 */
+	ip_packet_t *packet;
+
+	/**
+	 * Outbound policy matching the packet
+	 */
+	ipsec_policy_t *policy;
+
+} outbound_t;
+
+/**
+ * Destroy a queued outbound packet
+ */
+static void outbound_destroy(outbound_t *this)
+{
+	this->packet->destroy(this->packet);
+	this->policy->destroy(this->policy);
+	free(this);
+}
+
 /**
  * Deliver an inbound IP packet to the registered listener
  */
@@ -88,14 +141,15 @@ static void deliver_inbound(private_ipsec_processor_t *this,
 /**
  * Processes inbound packets
  */
-static job_requeue_t process_inbound(private_ipsec_processor_t *this)
+static job_requeue_t process_inbound(worker_t *worker)
 {
+	private_ipsec_processor_t *this = worker->this;
 	esp_packet_t *packet;
 	ipsec_sa_t *sa;
 	u_int8_t next_header;
 	u_int32_t spi;
 
-	packet = (esp_packet_t*)this->inbound_queue->dequeue(this->inbound_queue);
+	packet = (esp_packet_t*)worker->queue->dequeue(worker->queue);
 
 	if (!packet->parse_header(packet, &spi))
 	{
@@ -183,24 +237,20 @@ static void send_outbound(private_ipsec_processor_t *this,
 /**
  * Processes outbound packets
  */
-static job_requeue_t process_outbound(private_ipsec_processor_t *this)
+static job_requeue_t process_outbound(worker_t *worker)
 {
+	private_ipsec_processor_t *this = worker->this;
 	ipsec_policy_t *policy;
 	esp_packet_t *esp_packet;
 	ip_packet_t *packet;
+	outbound_t *outbound;
 	ipsec_sa_t *sa;
 	host_t *src, *dst;
 
-	packet = (ip_packet_t*)this->outbound_queue->dequeue(this->outbound_queue);
-
-	policy = ipsec->policies->find_by_packet(ipsec->policies, packet, FALSE);
-	if (!policy)
-	{
-		DBG2(DBG_ESP, "no matching outbound IPsec policy for %H == %H",
-			 packet->get_source(packet), packet->get_destination(packet));
-		packet->destroy(packet);
-		return JOB_REQUEUE_DIRECT;
-	}
+	outbound = (outbound_t*)worker->queue->dequeue(worker->queue);
+	packet = outbound->packet;
+	policy = outbound->policy;
+	free(outbound);
 
 	sa = ipsec->sas->checkout_by_reqid(ipsec->sas, policy->get_reqid(policy),
 									   FALSE);
@@ -234,13 +284,41 @@ static job_requeue_t process_outbound(private_ipsec_processor_t *this)
 METHOD(ipsec_processor_t, queue_inbound, void,
 	private_ipsec_processor_t *this, esp_packet_t *packet)
 {
-	this->inbound_queue->enqueue(this->inbound_queue, packet);
+	worker_t *worker;
+	chunk_t data;
+	u_int32_t spi = 0;
+
+	/* peek at the SPI to pick the worker, the header is parsed by it */
+	data = packet->packet.get_data(&packet->packet);
+	if (data.len >= sizeof(spi))
+	{
+		spi = untoh32(data.ptr);
+	}
+	worker = &this->inbound_workers[spi % this->workers];
+	worker->queue->enqueue(worker->queue, packet);
 }
 
 METHOD(ipsec_processor_t, queue_outbound, void,
 	private_ipsec_processor_t *this, ip_packet_t *packet)
 {
-	this->outbound_queue->enqueue(this->outbound_queue, packet);
+	ipsec_policy_t *policy;
+	outbound_t *outbound;
+	worker_t *worker;
+
+	policy = ipsec->policies->find_by_packet(ipsec->policies, packet, FALSE);
+	if (!policy)
+	{
+		DBG2(DBG_ESP, "no matching outbound IPsec policy for %H == %H",
+			 packet->get_source(packet), packet->get_destination(packet));
+		packet->destroy(packet);
+		return;
+	}
+	INIT(outbound,
+		.packet = packet,
+		.policy = policy,
+	);
+	worker = &this->outbound_workers[policy->get_reqid(policy) % this->workers];
+	worker->queue->enqueue(worker->queue, outbound);
 }
 
 METHOD(ipsec_processor_t, register_inbound, void,
@@ -286,10 +364,17 @@ METHOD(ipsec_processor_t, unregister_outbound, void,
 METHOD(ipsec_processor_t, destroy, void,
 	private_ipsec_processor_t *this)
 {
-	this->inbound_queue->destroy_offset(this->inbound_queue,
-										offsetof(esp_packet_t, destroy));
-	this->outbound_queue->destroy_offset(this->outbound_queue,
-										 offsetof(ip_packet_t, destroy));
+	u_int i;
+
+	for (i = 0; i < this->workers; i++)
+	{
+		this->inbound_workers[i].queue->destroy_offset(
+				this->inbound_workers[i].queue, offsetof(esp_packet_t, destroy));
+		this->outbound_workers[i].queue->destroy_function(
+				this->outbound_workers[i].queue, (void*)outbound_destroy);
+	}
+	free(this->inbound_workers);
+	free(this->outbound_workers);
 	this->lock->destroy(this->lock);
 	free(this);
 }
@@ -300,6 +385,7 @@ METHOD(ipsec_processor_t, destroy, void,
 ipsec_processor_t *ipsec_processor_create()
 {
 	private_ipsec_processor_t *this;
+	u_int i;
 
 	INIT(this,
 		.public = {
@@ -311,16 +397,31 @@ ipsec_processor_t *ipsec_processor_create()
 			.unregister_outbound = _unregister_outbound,
 			.destroy = _destroy,
 		},
-		.inbound_queue = blocking_queue_create(),
-		.outbound_queue = blocking_queue_create(),
+		.workers = max(1, lib->settings->get_int(lib->settings,
+											"libipsec.workers", 1)),
 		.lock = rwlock_create(RWLOCK_TYPE_DEFAULT),
 	);
 
-	lib->processor->queue_job(lib->processor,
-		(job_t*)callback_job_create((callback_job_cb_t)process_inbound, this,
-									NULL, (callback_job_cancel_t)return_false));
-	lib->processor->queue_job(lib->processor,
-		(job_t*)callback_job_create((callback_job_cb_t)process_outbound, this,
-									NULL, (callback_job_cancel_t)return_false));
+	this->inbound_workers = calloc(this->workers, sizeof(worker_t));
+	this->outbound_workers = calloc(this->workers, sizeof(worker_t));
+	for (i = 0; i < this->workers; i++)
+	{
+		this->inbound_workers[i] = (worker_t){
+			.this = this,
+			.queue = blocking_queue_create(),
+		};
+		this->outbound_workers[i] = (worker_t){
+			.this = this,
+			.queue = blocking_queue_create(),
+		};
+		lib->processor->queue_job(lib->processor,
+			(job_t*)callback_job_create((callback_job_cb_t)process_inbound,
+					&this->inbound_workers[i], NULL,
+					(callback_job_cancel_t)return_false));
+		lib->processor->queue_job(lib->processor,
+			(job_t*)callback_job_create((callback_job_cb_t)process_outbound,
+					&this->outbound_workers[i], NULL,
+					(callback_job_cancel_t)return_false));
+	}
 	return &this->public;
 }
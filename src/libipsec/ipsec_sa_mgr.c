@@ -39,9 +39,19 @@ struct private_ipsec_sa_mgr_t {
 	ipsec_sa_mgr_t public;
 
 	/**
-	 * Installed SAs
+	 * Installed SAs, ipsec_sa_t* => ipsec_sa_entry_t*
 	 */
-	linked_list_t *sas;
+	hashtable_t *sas;
+
+	/**
+	 * Installed SAs by SPI, chained via ipsec_sa_entry_t.next_spi
+	 */
+	hashtable_t *spis;
+
+	/**
+	 * Installed SAs by reqid, chained via ipsec_sa_entry_t.next_reqid
+	 */
+	hashtable_t *reqids;
 
 	/**
 	 * SPIs allocated using get_spi()
@@ -89,6 +99,16 @@ typedef struct {
 	 */
 	bool awaits_deletion;
 
+	/**
+	 * Next entry with the same SPI, in the order they have been added
+	 */
+	void *next_spi;
+
+	/**
+	 * Next entry with the same reqid, in the order they have been added
+	 */
+	void *next_reqid;
+
 }  ipsec_sa_entry_t;
 
 /**
@@ -106,6 +126,11 @@ typedef struct {
 	 */
 	ipsec_sa_entry_t *entry;
 
+	/**
+	 * SA of the expired entry, to look it up
+	 */
+	ipsec_sa_t *sa;
+
 	/**
 	 * 0 if this is a hard expire, otherwise the offset in s (soft->hard)
 	 */
@@ -126,6 +151,125 @@ static u_int spi_hash(u_int32_t *spi)
 	return chunk_hash(chunk_from_thing(*spi));
 }
 
+/*
+ * Used for the hash tables of installed SAs, keyed by SA, SPI or reqid
+ */
+static u_int hash_key(void *key)
+{
+	uintptr_t value = (uintptr_t)key;
+
+	return chunk_hash(chunk_from_thing(value));
+}
+
+static bool equals_key(void *key, void *other_key)
+{
+	return key == other_key;
+}
+
+/**
+ * Add an entry to the end of a chain of entries with the same key
+ */
+static void chain_add(hashtable_t *table, void *key, ipsec_sa_entry_t *entry,
+					  size_t offset)
+{
+	ipsec_sa_entry_t *current;
+	void **next;
+
+	current = table->get(table, key);
+	if (!current)
+	{
+		table->put(table, key, entry);
+		return;
+	}
+	next = (void**)((char*)current + offset);
+	while (*next)
+	{
+		next = (void**)((char*)*next + offset);
+	}
+	*next = entry;
+}
+
+/**
+ * Remove an entry from a chain of entries with the same key
+ */
+static void chain_remove(hashtable_t *table, void *key, ipsec_sa_entry_t *entry,
+						 size_t offset)
+{
+	ipsec_sa_entry_t *current;
+	void **next;
+
+	current = table->get(table, key);
+	if (current == entry)
+	{
+		next = (void**)((char*)entry + offset);
+		if (*next)
+		{
+			table->put(table, key, *next);
+		}
+		else
+		{
+			table->remove(table, key);
+		}
+		return;
+	}
+	while (current)
+	{
+		next = (void**)((char*)current + offset);
+		if (*next == entry)
+		{
+			*next = *(void**)((char*)entry + offset);
+			return;
+		}
+		current = *next;
+	}
+}
+
+/**
+ * Get the first entry with the given SPI
+ */
+static ipsec_sa_entry_t *first_by_spi(private_ipsec_sa_mgr_t *this,
+									  u_int32_t spi)
+{
+	return this->spis->get(this->spis, (void*)(uintptr_t)spi);
+}
+
+/**
+ * Get the first entry with the given reqid
+ */
+static ipsec_sa_entry_t *first_by_reqid(private_ipsec_sa_mgr_t *this,
+										u_int32_t reqid)
+{
+	return this->reqids->get(this->reqids, (void*)(uintptr_t)reqid);
+}
+
+/**
+ * Add an entry to the lookup tables
+ */
+static void add_entry(private_ipsec_sa_mgr_t *this, ipsec_sa_entry_t *entry)
+{
+	ipsec_sa_t *sa = entry->sa;
+
+	this->sas->put(this->sas, sa, entry);
+	chain_add(this->spis, (void*)(uintptr_t)sa->get_spi(sa), entry,
+			  offsetof(ipsec_sa_entry_t, next_spi));
+	chain_add(this->reqids, (void*)(uintptr_t)sa->get_reqid(sa), entry,
+			  offsetof(ipsec_sa_entry_t, next_reqid));
+}
+
+/**
+ * Remove an entry from the lookup tables
+ */
+static void unlink_entry(private_ipsec_sa_mgr_t *this, ipsec_sa_entry_t *entry)
+{
+	ipsec_sa_t *sa = entry->sa;
+
+	this->sas->remove(this->sas, sa);
+	chain_remove(this->spis, (void*)(uintptr_t)sa->get_spi(sa), entry,
+				 offsetof(ipsec_sa_entry_t, next_spi));
+	chain_remove(this->reqids, (void*)(uintptr_t)sa->get_reqid(sa), entry,
+				 offsetof(ipsec_sa_entry_t, next_reqid));
+}
+
 /**
  * Create an SA entry
  */
@@ -202,90 +346,70 @@ static bool wait_for_entry(private_ipsec_sa_mgr_t *this,
 }
 
 /**
- * Flushes all entries
- * Must be called with this->mutex held.
+ * Find an entry by SPI, source and destination address
  */
-static void flush_entries(private_ipsec_sa_mgr_t *this)
+static ipsec_sa_entry_t *find_by_spi_src_dst(private_ipsec_sa_mgr_t *this,
+											 u_int32_t spi, host_t *src,
+											 host_t *dst)
 {
-	ipsec_sa_entry_t *current;
-	enumerator_t *enumerator;
-
-	DBG2(DBG_ESP, "flushing SAD");
+	ipsec_sa_entry_t *entry;
 
-	enumerator = this->sas->create_enumerator(this->sas);
-	while (enumerator->enumerate(enumerator, (void**)&current))
+	for (entry = first_by_spi(this, spi); entry; entry = entry->next_spi)
 	{
-		if (wait_remove_entry(this, current))
+		if (entry->sa->match_by_spi_src_dst(entry->sa, spi, src, dst))
 		{
-			this->sas->remove_at(this->sas, enumerator);
-			destroy_entry(current);
+			return entry;
 		}
 	}
-	enumerator->destroy(enumerator);
+	return NULL;
 }
 
-/*
- * Different match functions to find SAs in the linked list
+/**
+ * Remove an entry
  */
-static bool match_entry_by_ptr(ipsec_sa_entry_t *item, ipsec_sa_entry_t *entry)
-{
-	return item == entry;
-}
-
-static bool match_entry_by_sa_ptr(ipsec_sa_entry_t *item, ipsec_sa_t *sa)
-{
-	return item->sa == sa;
-}
-
-static bool match_entry_by_spi_inbound(ipsec_sa_entry_t *item, u_int32_t *spi,
-									   bool *inbound)
-{
-	return item->sa->get_spi(item->sa) == *spi &&
-		   item->sa->is_inbound(item->sa) == *inbound;
-}
-
-static bool match_entry_by_spi_src_dst(ipsec_sa_entry_t *item, u_int32_t *spi,
-									   host_t *src, host_t *dst)
-{
-	return item->sa->match_by_spi_src_dst(item->sa, *spi, src, dst);
-}
-
-static bool match_entry_by_reqid_inbound(ipsec_sa_entry_t *item,
-										 u_int32_t *reqid, bool *inbound)
-{
-	return item->sa->match_by_reqid(item->sa, *reqid, *inbound);
-}
-
-static bool match_entry_by_spi_dst(ipsec_sa_entry_t *item, u_int32_t *spi,
-								   host_t *dst)
+static bool remove_entry(private_ipsec_sa_mgr_t *this, ipsec_sa_entry_t *entry)
 {
-	return item->sa->match_by_spi_dst(item->sa, *spi, dst);
+	if (this->sas->get(this->sas, entry->sa) == entry &&
+		wait_remove_entry(this, entry))
+	{
+		unlink_entry(this, entry);
+		return TRUE;
+	}
+	return FALSE;
 }
 
 /**
- * Remove an entry
+ * Flushes all entries
+ * Must be called with this->mutex held.
  */
-static bool remove_entry(private_ipsec_sa_mgr_t *this, ipsec_sa_entry_t *entry)
+static void flush_entries(private_ipsec_sa_mgr_t *this)
 {
 	ipsec_sa_entry_t *current;
 	enumerator_t *enumerator;
-	bool removed = FALSE;
+	linked_list_t *sas;
+	ipsec_sa_t *sa;
+
+	DBG2(DBG_ESP, "flushing SAD");
 
+	/* the mutex is released while waiting for entries, which might get
+	 * removed meanwhile, so collect the SAs first and look them up again */
+	sas = linked_list_create();
 	enumerator = this->sas->create_enumerator(this->sas);
-	while (enumerator->enumerate(enumerator, (void**)&current))
+	while (enumerator->enumerate(enumerator, (void**)&sa, NULL))
 	{
-		if (current == entry)
+		sas->insert_last(sas, sa);
+	}
+	enumerator->destroy(enumerator);
+
+	while (sas->remove_first(sas, (void**)&sa) == SUCCESS)
+	{
+		current = this->sas->get(this->sas, sa);
+		if (current && remove_entry(this, current))
 		{
-			if (wait_remove_entry(this, current))
-			{
-				this->sas->remove_at(this->sas, enumerator);
-				removed = TRUE;
-			}
-			break;
+			destroy_entry(current);
 		}
 	}
-	enumerator->destroy(enumerator);
-	return removed;
+	sas->destroy(sas);
 }
 
 /**
@@ -296,8 +420,7 @@ static job_requeue_t sa_expired(ipsec_sa_expired_t *expired)
 	private_ipsec_sa_mgr_t *this = expired->manager;
 
 	this->mutex->lock(this->mutex);
-	if (this->sas->find_first(this->sas, (void*)match_entry_by_ptr,
-							  NULL, expired->entry) == SUCCESS)
+	if (this->sas->get(this->sas, expired->sa) == expired->entry)
 	{
 		u_int32_t hard_offset = expired->hard_offset;
 		ipsec_sa_t *sa = expired->entry->sa;
@@ -335,6 +458,7 @@ static void schedule_expiration(private_ipsec_sa_mgr_t *this,
 	INIT(expired,
 		.manager = this,
 		.entry = entry,
+		.sa = entry->sa,
 	);
 
 	/* schedule a rekey first, a hard timeout will be scheduled then, if any */
@@ -377,14 +501,20 @@ static void flush_allocated_spis(private_ipsec_sa_mgr_t *this)
  */
 static bool allocate_spi(private_ipsec_sa_mgr_t *this, u_int32_t spi)
 {
+	ipsec_sa_entry_t *entry;
 	u_int32_t *spi_alloc;
 
-	if (this->allocated_spis->get(this->allocated_spis, &spi) ||
-		this->sas->find_first(this->sas, (void*)match_entry_by_spi_inbound,
-							  NULL, &spi, TRUE) == SUCCESS)
+	if (this->allocated_spis->get(this->allocated_spis, &spi))
 	{
 		return FALSE;
 	}
+	for (entry = first_by_spi(this, spi); entry; entry = entry->next_spi)
+	{
+		if (entry->sa->is_inbound(entry->sa))
+		{
+			return FALSE;
+		}
+	}
 	spi_alloc = malloc_thing(u_int32_t);
 	*spi_alloc = spi;
 	this->allocated_spis->put(this->allocated_spis, spi_alloc, spi_alloc);
@@ -470,8 +600,7 @@ METHOD(ipsec_sa_mgr_t, add_sa, status_t,
 		free(spi_alloc);
 	}
 
-	if (this->sas->find_first(this->sas, (void*)match_entry_by_spi_src_dst,
-							  NULL, &spi, src, dst) == SUCCESS)
+	if (find_by_spi_src_dst(this, spi, src, dst))
 	{
 		this->mutex->unlock(this->mutex);
 		DBG1(DBG_ESP, "failed to install SAD entry: already installed");
@@ -481,7 +610,7 @@ METHOD(ipsec_sa_mgr_t, add_sa, status_t,
 
 	entry = create_entry(sa_new);
 	schedule_expiration(this, entry);
-	this->sas->insert_last(this->sas, entry);
+	add_entry(this, entry);
 
 	this->mutex->unlock(this->mutex);
 	return SUCCESS;
@@ -505,9 +634,8 @@ METHOD(ipsec_sa_mgr_t, update_sa, status_t,
 	}
 
 	this->mutex->lock(this->mutex);
-	if (this->sas->find_first(this->sas, (void*)match_entry_by_spi_src_dst,
-							 (void**)&entry, &spi, src, dst) == SUCCESS &&
-		wait_for_entry(this, entry))
+	entry = find_by_spi_src_dst(this, spi, src, dst);
+	if (entry && wait_for_entry(this, entry))
 	{
 		entry->sa->set_source(entry->sa, new_src);
 		entry->sa->set_destination(entry->sa, new_dst);
@@ -530,23 +658,13 @@ METHOD(ipsec_sa_mgr_t, del_sa, status_t,
 	u_int8_t protocol, u_int16_t cpi, mark_t mark)
 {
 	ipsec_sa_entry_t *current, *found = NULL;
-	enumerator_t *enumerator;
 
 	this->mutex->lock(this->mutex);
-	enumerator = this->sas->create_enumerator(this->sas);
-	while (enumerator->enumerate(enumerator, (void**)&current))
+	current = find_by_spi_src_dst(this, spi, src, dst);
+	if (current && remove_entry(this, current))
 	{
-		if (match_entry_by_spi_src_dst(current, &spi, src, dst))
-		{
-			if (wait_remove_entry(this, current))
-			{
-				this->sas->remove_at(this->sas, enumerator);
-				found = current;
-			}
-			break;
-		}
+		found = current;
 	}
-	enumerator->destroy(enumerator);
 	this->mutex->unlock(this->mutex);
 
 	if (found)
@@ -566,11 +684,16 @@ METHOD(ipsec_sa_mgr_t, checkout_by_reqid, ipsec_sa_t*,
 	ipsec_sa_t *sa = NULL;
 
 	this->mutex->lock(this->mutex);
-	if (this->sas->find_first(this->sas, (void*)match_entry_by_reqid_inbound,
-							 (void**)&entry, &reqid, &inbound) == SUCCESS &&
-		wait_for_entry(this, entry))
+	for (entry = first_by_reqid(this, reqid); entry; entry = entry->next_reqid)
 	{
-		sa = entry->sa;
+		if (entry->sa->match_by_reqid(entry->sa, reqid, inbound))
+		{
+			if (wait_for_entry(this, entry))
+			{
+				sa = entry->sa;
+			}
+			break;
+		}
 	}
 	this->mutex->unlock(this->mutex);
 	return sa;
@@ -583,11 +706,16 @@ METHOD(ipsec_sa_mgr_t, checkout_by_spi, ipsec_sa_t*,
 	ipsec_sa_t *sa = NULL;
 
 	this->mutex->lock(this->mutex);
-	if (this->sas->find_first(this->sas, (void*)match_entry_by_spi_dst,
-							 (void**)&entry, &spi, dst) == SUCCESS &&
-		wait_for_entry(this, entry))
+	for (entry = first_by_spi(this, spi); entry; entry = entry->next_spi)
 	{
-		sa = entry->sa;
+		if (entry->sa->match_by_spi_dst(entry->sa, spi, dst))
+		{
+			if (wait_for_entry(this, entry))
+			{
+				sa = entry->sa;
+			}
+			break;
+		}
 	}
 	this->mutex->unlock(this->mutex);
 	return sa;
@@ -599,8 +727,8 @@ METHOD(ipsec_sa_mgr_t, checkin, void,
 	ipsec_sa_entry_t *entry;
 
 	this->mutex->lock(this->mutex);
-	if (this->sas->find_first(this->sas, (void*)match_entry_by_sa_ptr,
-							 (void**)&entry, sa) == SUCCESS)
+	entry = this->sas->get(this->sas, sa);
+	if (entry)
 	{
 		if (entry->locked)
 		{
@@ -630,6 +758,8 @@ METHOD(ipsec_sa_mgr_t, destroy, void,
 
 	this->allocated_spis->destroy(this->allocated_spis);
 	this->sas->destroy(this->sas);
+	this->spis->destroy(this->spis);
+	this->reqids->destroy(this->reqids);
 
 	this->mutex->destroy(this->mutex);
 	DESTROY_IF(this->rng);
@@ -655,7 +785,9 @@ ipsec_sa_mgr_t *ipsec_sa_mgr_create()
 			.flush_sas = _flush_sas,
 			.destroy = _destroy,
 		},
-		.sas = linked_list_create(),
+		.sas = hashtable_create(hash_key, equals_key, 32),
+		.spis = hashtable_create(hash_key, equals_key, 32),
+		.reqids = hashtable_create(hash_key, equals_key, 32),
 		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
 		.allocated_spis = hashtable_create((hashtable_hash_t)spi_hash,
 										   (hashtable_equals_t)spi_equals, 16),
@@ -78,12 +78,13 @@ static void save_state(private_radius_client_t *this, radius_message_t *msg)
 	chunk_free(&this->state);
 }
 
-METHOD(radius_client_t, request, radius_message_t*,
-	private_radius_client_t *this, radius_message_t *req)
+/**
+ * Add common attributes to a request and get a socket to send it over
+ */
+static radius_socket_t *prepare(private_radius_client_t *this,
+								radius_message_t *req)
 {
 	radius_socket_t *socket;
-	radius_message_t *res;
-	chunk_t data;
 
 	/* add our NAS-Identifier */
 	req->add(req, RAT_NAS_IDENTIFIER,
@@ -96,8 +97,17 @@ METHOD(radius_client_t, request, radius_message_t*,
 	socket = this->config->get_socket(this->config);
 	DBG1(DBG_CFG, "sending RADIUS %N to server '%s'", radius_message_code_names,
 		 req->get_code(req), this->config->get_name(this->config));
+	return socket;
+}
+
+/**
+ * Process a received response, release socket
+ */
+static void process(private_radius_client_t *this, radius_socket_t *socket,
+					radius_message_t *req, radius_message_t *res)
+{
+	chunk_t data;
 
-	res = socket->request(socket, req);
 	if (res)
 	{
 		DBG1(DBG_CFG, "received RADIUS %N from server '%s'",
@@ -113,10 +123,68 @@ METHOD(radius_client_t, request, radius_message_t*,
 			this->msk = socket->decrypt_msk(socket, req, res);
 		}
 		this->config->put_socket(this->config, socket, TRUE);
-		return res;
+		return;
 	}
 	this->config->put_socket(this->config, socket, FALSE);
-	return NULL;
+}
+
+METHOD(radius_client_t, request, radius_message_t*,
+	private_radius_client_t *this, radius_message_t *req)
+{
+	radius_socket_t *socket;
+	radius_message_t *res;
+
+	socket = prepare(this, req);
+	res = socket->request(socket, req);
+	process(this, socket, req, res);
+	return res;
+}
+
+/**
+ * Data for an asynchronous request
+ */
+typedef struct {
+	/** client sending the request */
+	private_radius_client_t *this;
+	/** socket the request is sent over */
+	radius_socket_t *socket;
+	/** user callback */
+	radius_client_cb_t cb;
+	/** user data */
+	void *data;
+} async_t;
+
+/**
+ * Callback for asynchronous requests
+ */
+static void async_cb(async_t *async, radius_message_t *req,
+					 radius_message_t *res)
+{
+	process(async->this, async->socket, req, res);
+	async->cb(async->data, req, res);
+	free(async);
+}
+
+METHOD(radius_client_t, request_async, bool,
+	private_radius_client_t *this, radius_message_t *req,
+	radius_client_cb_t cb, void *data)
+{
+	async_t *async;
+
+	INIT(async,
+		.this = this,
+		.socket = prepare(this, req),
+		.cb = cb,
+		.data = data,
+	);
+	if (!async->socket->request_async(async->socket, req,
+									  (radius_socket_cb_t)async_cb, async))
+	{
+		this->config->put_socket(this->config, async->socket, FALSE);
+		free(async);
+		return FALSE;
+	}
+	return TRUE;
 }
 
 METHOD(radius_client_t, get_msk, chunk_t,
@@ -144,6 +212,7 @@ radius_client_t *radius_client_create(radius_config_t *config)
 	INIT(this,
 		.public = {
 			.request = _request,
+			.request_async = _request_async,
 			.get_msk = _get_msk,
 			.destroy = _destroy,
 		},
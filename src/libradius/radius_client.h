@@ -26,6 +26,18 @@
 
 typedef struct radius_client_t radius_client_t;
 
+/**
+ * Callback function invoked when an asynchronous request completes.
+ *
+ * The callback may destroy the client the request has been sent over.
+ *
+ * @param data			user data passed to request_async()
+ * @param request		request message sent
+ * @param response		response message, NULL if timed out, gets owned
+ */
+typedef void (*radius_client_cb_t)(void *data, radius_message_t *request,
+								   radius_message_t *response);
+
 /**
  * RADIUS client functionality.
  *
@@ -44,6 +56,22 @@ struct radius_client_t {
 	 */
 	radius_message_t* (*request)(radius_client_t *this, radius_message_t *msg);
 
+	/**
+	 * Send a RADIUS request without waiting for the response.
+	 *
+	 * The callback gets invoked in a separate job once the response arrived
+	 * or the request timed out.
+	 * The client must not be used for other requests before the callback
+	 * has been invoked.
+	 *
+	 * @param msg			RADIUS request message to send, gets owned
+	 * @param cb			callback to invoke with the response
+	 * @param data			user data to pass to callback
+	 * @return				TRUE if sent, FALSE if sending failed
+	 */
+	bool (*request_async)(radius_client_t *this, radius_message_t *msg,
+						  radius_client_cb_t cb, void *data);
+
 	/**
 	 * Get the EAP MSK after successful RADIUS authentication.
 	 *
@@ -16,7 +16,6 @@
 #include "radius_config.h"
 
 #include <threading/mutex.h>
-#include <threading/condvar.h>
 #include <collections/linked_list.h>
 
 typedef struct private_radius_config_t private_radius_config_t;
@@ -37,7 +36,7 @@ struct private_radius_config_t {
 	linked_list_t *sockets;
 
 	/**
-	 * Total number of sockets, in list + currently in use
+	 * Total number of sockets
 	 */
 	int socket_count;
 
@@ -46,11 +45,6 @@ struct private_radius_config_t {
 	 */
 	mutex_t *mutex;
 
-	/**
-	 * condvar to wait for sockets
-	 */
-	condvar_t *condvar;
-
 	/**
 	 * Server name
 	 */
@@ -82,27 +76,51 @@ struct private_radius_config_t {
 	refcount_t ref;
 };
 
+/**
+ * Get the number of requests in flight on all sockets
+ */
+static u_int get_pending(private_radius_config_t *this)
+{
+	enumerator_t *enumerator;
+	radius_socket_t *skt;
+	u_int pending = 0;
+
+	enumerator = this->sockets->create_enumerator(this->sockets);
+	while (enumerator->enumerate(enumerator, &skt))
+	{
+		pending += skt->get_pending(skt);
+	}
+	enumerator->destroy(enumerator);
+	return pending;
+}
+
 METHOD(radius_config_t, get_socket, radius_socket_t*,
 	private_radius_config_t *this)
 {
-	radius_socket_t *skt;
+	enumerator_t *enumerator;
+	radius_socket_t *skt, *best = NULL;
+	u_int pending, least = 0;
 
+	/* sockets multiplex requests, use the one with the least load */
 	this->mutex->lock(this->mutex);
-	while (this->sockets->remove_first(this->sockets, (void**)&skt) != SUCCESS)
+	enumerator = this->sockets->create_enumerator(this->sockets);
+	while (enumerator->enumerate(enumerator, &skt))
 	{
-		this->condvar->wait(this->condvar, this->mutex);
+		pending = skt->get_pending(skt);
+		if (!best || pending < least)
+		{
+			best = skt;
+			least = pending;
+		}
 	}
+	enumerator->destroy(enumerator);
 	this->mutex->unlock(this->mutex);
-	return skt;
+	return best;
 }
 
 METHOD(radius_config_t, put_socket, void,
 	private_radius_config_t *this, radius_socket_t *skt, bool result)
 {
-	this->mutex->lock(this->mutex);
-	this->sockets->insert_last(this->sockets, skt);
-	this->mutex->unlock(this->mutex);
-	this->condvar->signal(this->condvar);
 	this->reachable = result;
 }
 
@@ -123,7 +141,10 @@ METHOD(radius_config_t, get_preference, int,
 	}
 	/* calculate preference between 0-100 + boost */
 	pref = this->preference;
-	pref += this->sockets->get_count(this->sockets) * 100 / this->socket_count;
+	this->mutex->lock(this->mutex);
+	pref += 100 - min(100, get_pending(this) * 100 /
+					  (this->socket_count * RADIUS_SOCKET_MAX_PENDING));
+	this->mutex->unlock(this->mutex);
 	if (this->reachable)
 	{	/* reachable server get a boost: pref = 110-210 + boost */
 		return pref + 110;
@@ -167,7 +188,6 @@ METHOD(radius_config_t, destroy, void,
 	if (ref_put(&this->ref))
 	{
 		this->mutex->destroy(this->mutex);
-		this->condvar->destroy(this->condvar);
 		this->sockets->destroy_offset(this->sockets,
 									  offsetof(radius_socket_t, destroy));
 		free(this);
@@ -200,7 +220,6 @@ radius_config_t *radius_config_create(char *name, char *address,
 		.socket_count = sockets,
 		.sockets = linked_list_create(),
 		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
-		.condvar = condvar_create(CONDVAR_TYPE_DEFAULT),
 		.name = name,
 		.preference = preference,
 		.ref = 1,
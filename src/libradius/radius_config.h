@@ -33,12 +33,16 @@ struct radius_config_t {
 	/**
 	 * Get a RADIUS socket from the pool to communicate with this config.
 	 *
+	 * Sockets multiplex requests and may be used by multiple threads
+	 * concurrently, the socket with the fewest requests in flight is
+	 * returned.
+	 *
 	 * @return			RADIUS socket
 	 */
 	radius_socket_t* (*get_socket)(radius_config_t *this);
 
 	/**
-	 * Release a socket to the pool after use.
+	 * Release a socket to the pool after use, completes get_socket().
 	 *
 	 * @param skt		RADIUS socket to release
 	 * @param result	result of the socket use, TRUE for success
@@ -55,8 +59,8 @@ struct radius_config_t {
 	/**
 	 * Get the preference of this server.
 	 *
-	 * Based on the available sockets and the server reachability a preference
-	 * value is calculated: better servers return a higher value.
+	 * Based on the requests in flight and the server reachability a
+	 * preference value is calculated: better servers return a higher value.
 	 */
 	int (*get_preference)(radius_config_t *this);
 
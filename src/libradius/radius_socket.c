@@ -18,51 +18,126 @@
 
 #include <errno.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/select.h>
 
 #include <pen/pen.h>
 #include <utils/debug.h>
+#include <threading/thread.h>
+#include <threading/mutex.h>
+#include <threading/condvar.h>
+#include <processing/jobs/callback_job.h>
+
+/**
+ * Number of retransmits before giving up, timeouts are 2, 3, 4, 5 seconds
+ */
+#define RETRANSMIT_TRIES 3
+
+/**
+ * Timeout of first transmission, increased by one second per retransmit
+ */
+#define RETRANSMIT_TIMEOUT 2
 
 typedef struct private_radius_socket_t private_radius_socket_t;
+typedef struct pending_t pending_t;
+typedef struct channel_t channel_t;
 
 /**
- * Private data of an radius_socket_t object.
+ * A request waiting for a response
  */
-struct private_radius_socket_t {
+struct pending_t {
 
 	/**
-	 * Public radius_socket_t interface.
+	 * Request message sent
 	 */
-	radius_socket_t public;
+	radius_message_t *request;
 
 	/**
-	 * Server port for authentication
+	 * Number of retransmits so far
 	 */
-	u_int16_t auth_port;
+	int retransmits;
 
 	/**
-	 * socket file descriptor for authentication
+	 * Time to retransmit or give up
 	 */
-	int auth_fd;
+	timeval_t deadline;
 
 	/**
-	 * Server port for accounting
+	 * Callback for asynchronous requests, NULL for synchronous
 	 */
-	u_int16_t acct_port;
+	radius_socket_cb_t cb;
 
 	/**
-	 * socket file descriptor for accounting
+	 * User data to pass to callback
 	 */
-	int acct_fd;
+	void *data;
 
 	/**
-	 * Server address
+	 * Response received, for synchronous requests
 	 */
-	char *address;
+	radius_message_t *response;
+
+	/**
+	 * Has a synchronous request been completed
+	 */
+	bool done;
+};
+
+/**
+ * Connection to either the authentication or accounting port
+ */
+struct channel_t {
+
+	/**
+	 * Server port
+	 */
+	u_int16_t port;
+
+	/**
+	 * socket file descriptor
+	 */
+	int fd;
+
+	/**
+	 * Requests in flight, indexed by RADIUS identifier
+	 */
+	pending_t *pending[RADIUS_SOCKET_MAX_PENDING];
+
+	/**
+	 * Number of requests in flight
+	 */
+	u_int count;
 
 	/**
-	 * current RADIUS identifier
+	 * next RADIUS identifier to try
 	 */
 	u_int8_t identifier;
+};
+
+/**
+ * Private data of an radius_socket_t object.
+ */
+struct private_radius_socket_t {
+
+	/**
+	 * Public radius_socket_t interface.
+	 */
+	radius_socket_t public;
+
+	/**
+	 * Connection for authentication
+	 */
+	channel_t auth;
+
+	/**
+	 * Connection for accounting
+	 */
+	channel_t acct;
+
+	/**
+	 * Server address
+	 */
+	char *address;
 
 	/**
 	 * hasher to use for response verification
@@ -83,150 +158,556 @@ struct private_radius_socket_t {
 	 * RADIUS secret
 	 */
 	chunk_t secret;
+
+	/**
+	 * Mutex to lock pending requests and crypto primitives
+	 */
+	mutex_t *mutex;
+
+	/**
+	 * Condvar to signal completed requests and freed identifiers
+	 */
+	condvar_t *condvar;
+
+	/**
+	 * Pipe to wake up the receiving thread
+	 */
+	int notify[2];
+
+	/**
+	 * Thread receiving responses and handling retransmits, if started
+	 */
+	thread_t *receiver;
+
+	/**
+	 * Is the socket getting destroyed
+	 */
+	bool stopping;
+
+	/**
+	 * Number of threads in request()/request_async() using the condvar
+	 */
+	u_int waiting;
 };
 
 /**
- * Check or establish RADIUS connection
+ * Get the connection to send a request over
  */
-static bool check_connection(private_radius_socket_t *this,
-							 int *fd, u_int16_t port)
+static channel_t *get_channel(private_radius_socket_t *this,
+							  radius_message_t *request)
 {
-	if (*fd == -1)
+	if (request->get_code(request) == RMC_ACCOUNTING_REQUEST)
 	{
-		host_t *server;
+		return &this->acct;
+	}
+	return &this->auth;
+}
+
+/**
+ * Resolve the server address if the connection for a request is not
+ * established yet. Called without holding the mutex, as DNS lookups may
+ * block for a while.
+ */
+static host_t *resolve(private_radius_socket_t *this, radius_message_t *request)
+{
+	channel_t *channel;
+	host_t *server;
+
+	channel = get_channel(this, request);
+	if (channel->fd != -1)
+	{
+		return NULL;
+	}
+	server = host_create_from_dns(this->address, AF_UNSPEC, channel->port);
+	if (!server)
+	{
+		DBG1(DBG_CFG, "resolving RADIUS server address '%s' failed",
+			 this->address);
+	}
+	return server;
+}
+
+/**
+ * Check or establish RADIUS connection to a resolved server address
+ */
+static bool check_connection(private_radius_socket_t *this, channel_t *channel,
+							 host_t *server)
+{
+	if (channel->fd == -1)
+	{
+		int fd;
 
-		server = host_create_from_dns(this->address, AF_UNSPEC, port);
 		if (!server)
 		{
-			DBG1(DBG_CFG, "resolving RADIUS server address '%s' failed",
-				 this->address);
 			return FALSE;
 		}
-		*fd = socket(server->get_family(server), SOCK_DGRAM, IPPROTO_UDP);
-		if (*fd == -1)
+		fd = socket(server->get_family(server), SOCK_DGRAM, IPPROTO_UDP);
+		if (fd == -1)
 		{
 			DBG1(DBG_CFG, "opening RADIUS socket for %#H failed: %s",
 				 server, strerror(errno));
-			server->destroy(server);
 			return FALSE;
 		}
-		if (connect(*fd, server->get_sockaddr(server),
+		if (connect(fd, server->get_sockaddr(server),
 					*server->get_sockaddr_len(server)) < 0)
 		{
 			DBG1(DBG_CFG, "connecting RADIUS socket to %#H failed: %s",
 				 server, strerror(errno));
-			server->destroy(server);
-			close(*fd);
-			*fd = -1;
+			close(fd);
 			return FALSE;
 		}
-		server->destroy(server);
+		channel->fd = fd;
 	}
 	return TRUE;
 }
 
-METHOD(radius_socket_t, request, radius_message_t*,
-	private_radius_socket_t *this, radius_message_t *request)
+/**
+ * Send (or resend) the encoding of a pending request
+ */
+static bool send_pending(channel_t *channel, pending_t *pending)
 {
 	chunk_t data;
-	int i, *fd;
-	u_int16_t port;
-	rng_t *rng = NULL;
 
-	if (request->get_code(request) == RMC_ACCOUNTING_REQUEST)
+	data = pending->request->get_encoding(pending->request);
+	if (send(channel->fd, data.ptr, data.len, 0) != data.len)
 	{
-		fd = &this->acct_fd;
-		port = this->acct_port;
+		DBG1(DBG_CFG, "sending RADIUS message failed: %s", strerror(errno));
+		return FALSE;
+	}
+	time_monotonic(&pending->deadline);
+	pending->deadline.tv_sec += RETRANSMIT_TIMEOUT + pending->retransmits;
+	return TRUE;
+}
+
+/**
+ * Invoke the callback of a completed asynchronous request
+ */
+static job_requeue_t invoke_callback(pending_t *pending)
+{
+	pending->cb(pending->data, pending->request, pending->response);
+	pending->response = NULL;
+	return JOB_REQUEUE_NONE;
+}
+
+/**
+ * Destroy a completed asynchronous request
+ */
+static void destroy_pending(pending_t *pending)
+{
+	DESTROY_IF(pending->response);
+	pending->request->destroy(pending->request);
+	free(pending);
+}
+
+/**
+ * Complete a pending request that has been removed from its channel.
+ *
+ * Must be called without holding the mutex.
+ */
+static void complete(private_radius_socket_t *this, pending_t *pending,
+					 radius_message_t *response)
+{
+	if (pending->cb)
+	{	/* invoke the callback in a separate job, as it might destroy this
+		 * socket and should not delay the receipt of other responses */
+		pending->response = response;
+		lib->processor->queue_job(lib->processor,
+			(job_t*)callback_job_create_with_prio(
+				(callback_job_cb_t)invoke_callback, pending,
+				(callback_job_cleanup_t)destroy_pending, NULL, JOB_PRIO_HIGH));
 	}
 	else
-	{
-		fd = &this->auth_fd;
-		port = this->auth_port;
-		rng = this->rng;
+	{	/* the waiting thread frees the pending entry */
+		this->mutex->lock(this->mutex);
+		pending->response = response;
+		pending->done = TRUE;
+		this->condvar->broadcast(this->condvar);
+		this->mutex->unlock(this->mutex);
 	}
+}
 
-	/* set Message Identifier */
-	request->set_identifier(request, this->identifier++);
-	/* sign the request */
-	if (!request->sign(request, NULL, this->secret, this->hasher, this->signer,
-					   rng, rng != NULL))
-	{
-		return NULL;
-	}
+/**
+ * Remove the pending request with the given identifier, mutex must be held
+ */
+static pending_t *remove_pending(private_radius_socket_t *this,
+								 channel_t *channel, u_int8_t identifier)
+{
+	pending_t *pending;
 
-	if (!check_connection(this, fd, port))
+	pending = channel->pending[identifier];
+	if (pending)
 	{
-		return NULL;
+		channel->pending[identifier] = NULL;
+		channel->count--;
+		/* wake up threads waiting for a free identifier */
+		this->condvar->broadcast(this->condvar);
 	}
+	return pending;
+}
 
-	data = request->get_encoding(request);
-	DBG3(DBG_CFG, "%B", &data);
+/**
+ * Read all responses currently available on a channel
+ */
+static void read_responses(private_radius_socket_t *this, channel_t *channel)
+{
+	radius_message_t *response;
+	pending_t *pending;
+	char buf[4096];
+	int res;
 
-	/* timeout after 2, 3, 4, 5 seconds */
-	for (i = 2; i <= 5; i++)
+	while (TRUE)
 	{
-		radius_message_t *response;
-		bool retransmit = FALSE;
-		struct timeval tv;
-		char buf[4096];
-		fd_set fds;
-		int res;
-
-		if (send(*fd, data.ptr, data.len, 0) != data.len)
+		res = recv(channel->fd, buf, sizeof(buf), MSG_DONTWAIT);
+		if (res <= 0)
 		{
-			DBG1(DBG_CFG, "sending RADIUS message failed: %s", strerror(errno));
-			return NULL;
-		}
-		tv.tv_sec = i;
-		tv.tv_usec = 0;
-
-		while (TRUE)
-		{
-			FD_ZERO(&fds);
-			FD_SET(*fd, &fds);
-			res = select((*fd) + 1, &fds, NULL, NULL, &tv);
-			/* TODO: updated tv to time not waited. Linux does this for us. */
-			if (res < 0)
-			{	/* failed */
-				DBG1(DBG_CFG, "waiting for RADIUS message failed: %s",
-					 strerror(errno));
-				break;
-			}
-			if (res == 0)
-			{	/* timeout */
-				DBG1(DBG_CFG, "retransmitting RADIUS message");
-				retransmit = TRUE;
-				break;
-			}
-			res = recv(*fd, buf, sizeof(buf), MSG_DONTWAIT);
-			if (res <= 0)
+			if (res < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
 			{
 				DBG1(DBG_CFG, "receiving RADIUS message failed: %s",
 					 strerror(errno));
-				break;
 			}
-			response = radius_message_parse(chunk_create(buf, res));
-			if (response)
+			return;
+		}
+		response = radius_message_parse(chunk_create(buf, res));
+		if (!response)
+		{
+			DBG1(DBG_CFG, "received invalid RADIUS message, ignored");
+			continue;
+		}
+		pending = NULL;
+		this->mutex->lock(this->mutex);
+		if (channel->pending[response->get_identifier(response)])
+		{
+			pending = channel->pending[response->get_identifier(response)];
+			if (response->verify(response,
+							pending->request->get_authenticator(pending->request),
+							this->secret, this->hasher, this->signer))
 			{
-				if (response->verify(response,
-							request->get_authenticator(request), this->secret,
-							this->hasher, this->signer))
-				{
-					return response;
-				}
-				response->destroy(response);
+				remove_pending(this, channel,
+							   response->get_identifier(response));
 			}
+			else
+			{
+				pending = NULL;
+			}
+		}
+		this->mutex->unlock(this->mutex);
+		if (pending)
+		{
+			complete(this, pending, response);
+		}
+		else
+		{
 			DBG1(DBG_CFG, "received invalid RADIUS message, ignored");
+			response->destroy(response);
+		}
+	}
+}
+
+/**
+ * Retransmit timed out requests of a channel, collect failed ones
+ */
+static void check_timeouts(private_radius_socket_t *this, channel_t *channel,
+						   timeval_t *now, pending_t **failed, int *count)
+{
+	pending_t *pending;
+	int i;
+
+	for (i = 0; i < RADIUS_SOCKET_MAX_PENDING && channel->count; i++)
+	{
+		pending = channel->pending[i];
+		if (!pending || timercmp(&pending->deadline, now, >))
+		{
+			continue;
+		}
+		if (pending->retransmits < RETRANSMIT_TRIES)
+		{
+			DBG1(DBG_CFG, "retransmitting RADIUS message");
+			pending->retransmits++;
+			if (send_pending(channel, pending))
+			{
+				continue;
+			}
+		}
+		else
+		{
+			DBG1(DBG_CFG, "RADIUS server is not responding");
+		}
+		failed[(*count)++] = remove_pending(this, channel, i);
+	}
+}
+
+/**
+ * Get the earliest deadline of all pending requests on a channel
+ */
+static bool get_deadline(channel_t *channel, timeval_t *deadline, bool found)
+{
+	int i;
+
+	for (i = 0; i < RADIUS_SOCKET_MAX_PENDING && channel->count; i++)
+	{
+		if (channel->pending[i] &&
+			(!found || timercmp(&channel->pending[i]->deadline, deadline, <)))
+		{
+			*deadline = channel->pending[i]->deadline;
+			found = TRUE;
+		}
+	}
+	return found;
+}
+
+/**
+ * Add a channel to an fd_set, if connected
+ */
+static int add_fd(channel_t *channel, fd_set *fds, int maxfd)
+{
+	if (channel->fd != -1)
+	{
+		FD_SET(channel->fd, fds);
+		return max(maxfd, channel->fd);
+	}
+	return maxfd;
+}
+
+/**
+ * Receive responses and handle retransmits of all pending requests, returns
+ * FALSE if the receiving thread should terminate
+ */
+static bool receive(private_radius_socket_t *this)
+{
+	pending_t *failed[2 * RADIUS_SOCKET_MAX_PENDING];
+	timeval_t deadline, now, timeout;
+	int maxfd, res, count = 0, i;
+	bool found, oldstate;
+	fd_set fds;
+	char buf[32];
+
+	FD_ZERO(&fds);
+	FD_SET(this->notify[0], &fds);
+
+	this->mutex->lock(this->mutex);
+	if (this->stopping)
+	{
+		this->mutex->unlock(this->mutex);
+		return FALSE;
+	}
+	maxfd = add_fd(&this->auth, &fds, this->notify[0]);
+	maxfd = add_fd(&this->acct, &fds, maxfd);
+	found = get_deadline(&this->auth, &deadline, FALSE);
+	found = get_deadline(&this->acct, &deadline, found);
+	this->mutex->unlock(this->mutex);
+
+	if (found)
+	{
+		time_monotonic(&now);
+		if (timercmp(&deadline, &now, >))
+		{
+			timersub(&deadline, &now, &timeout);
+		}
+		else
+		{
+			timerclear(&timeout);
 		}
-		if (!retransmit)
+	}
+
+	oldstate = thread_cancelability(TRUE);
+	res = select(maxfd + 1, &fds, NULL, NULL, found ? &timeout : NULL);
+	thread_cancelability(oldstate);
+
+	if (res < 0)
+	{
+		if (errno != EINTR)
 		{
-			break;
+			DBG1(DBG_CFG, "waiting for RADIUS message failed: %s",
+				 strerror(errno));
+			sleep(1);
 		}
+		return TRUE;
+	}
+	if (FD_ISSET(this->notify[0], &fds))
+	{
+		ignore_result(read(this->notify[0], buf, sizeof(buf)));
+	}
+	if (this->auth.fd != -1 && FD_ISSET(this->auth.fd, &fds))
+	{
+		read_responses(this, &this->auth);
+	}
+	if (this->acct.fd != -1 && FD_ISSET(this->acct.fd, &fds))
+	{
+		read_responses(this, &this->acct);
+	}
+
+	time_monotonic(&now);
+	this->mutex->lock(this->mutex);
+	check_timeouts(this, &this->auth, &now, failed, &count);
+	check_timeouts(this, &this->acct, &now, failed, &count);
+	this->mutex->unlock(this->mutex);
+
+	for (i = 0; i < count; i++)
+	{
+		complete(this, failed[i], NULL);
+	}
+	return TRUE;
+}
+
+/**
+ * Main function of the receiving thread.
+ *
+ * The receiver runs in its own thread and not as a job, as synchronous
+ * requests block worker threads while waiting for it.
+ */
+static void *receive_thread(private_radius_socket_t *this)
+{
+	while (receive(this))
+	{
+		/* loop until the socket gets destroyed */
 	}
-	DBG1(DBG_CFG, "RADIUS server is not responding");
 	return NULL;
 }
 
+/**
+ * Send a request and register it as pending, mutex must be held
+ */
+static bool submit(private_radius_socket_t *this, pending_t *pending,
+				   host_t *server)
+{
+	radius_message_t *request = pending->request;
+	channel_t *channel;
+	rng_t *rng = NULL;
+	chunk_t data;
+
+	channel = get_channel(this, request);
+	if (channel == &this->auth)
+	{
+		rng = this->rng;
+	}
+
+	if (this->stopping || !check_connection(this, channel, server))
+	{
+		return FALSE;
+	}
+	if (!this->receiver)
+	{
+		this->receiver = thread_create((thread_main_t)receive_thread, this);
+		if (!this->receiver)
+		{
+			DBG1(DBG_CFG, "starting RADIUS receiver thread failed");
+			return FALSE;
+		}
+	}
+	while (channel->count == RADIUS_SOCKET_MAX_PENDING)
+	{
+		this->condvar->wait(this->condvar, this->mutex);
+		if (this->stopping)
+		{
+			return FALSE;
+		}
+	}
+	/* find an unused Message Identifier */
+	while (channel->pending[channel->identifier])
+	{
+		channel->identifier++;
+	}
+	request->set_identifier(request, channel->identifier++);
+	/* sign the request */
+	if (!request->sign(request, NULL, this->secret, this->hasher, this->signer,
+					   rng, rng != NULL))
+	{
+		return FALSE;
+	}
+	data = request->get_encoding(request);
+	DBG3(DBG_CFG, "%B", &data);
+
+	if (!send_pending(channel, pending))
+	{
+		return FALSE;
+	}
+	channel->pending[request->get_identifier(request)] = pending;
+	channel->count++;
+
+	/* let the receiver update its retransmit timeout */
+	ignore_result(write(this->notify[1], "", 1));
+	return TRUE;
+}
+
+/**
+ * Unregister a thread that used the condvar, mutex must be held
+ */
+static void leave(private_radius_socket_t *this)
+{
+	this->waiting--;
+	if (this->stopping)
+	{	/* destroy() waits for us */
+		this->condvar->broadcast(this->condvar);
+	}
+}
+
+METHOD(radius_socket_t, request, radius_message_t*,
+	private_radius_socket_t *this, radius_message_t *request)
+{
+	radius_message_t *response = NULL;
+	pending_t pending = {
+		.request = request,
+	};
+	host_t *server;
+
+	server = resolve(this, request);
+	this->mutex->lock(this->mutex);
+	this->waiting++;
+	if (submit(this, &pending, server))
+	{
+		while (!pending.done)
+		{
+			this->condvar->wait(this->condvar, this->mutex);
+		}
+		response = pending.response;
+	}
+	leave(this);
+	this->mutex->unlock(this->mutex);
+	DESTROY_IF(server);
+	return response;
+}
+
+METHOD(radius_socket_t, request_async, bool,
+	private_radius_socket_t *this, radius_message_t *request,
+	radius_socket_cb_t cb, void *data)
+{
+	pending_t *pending;
+	host_t *server;
+	bool success;
+
+	INIT(pending,
+		.request = request,
+		.cb = cb,
+		.data = data,
+	);
+
+	server = resolve(this, request);
+	this->mutex->lock(this->mutex);
+	this->waiting++;
+	success = submit(this, pending, server);
+	leave(this);
+	this->mutex->unlock(this->mutex);
+	DESTROY_IF(server);
+
+	if (!success)
+	{
+		request->destroy(request);
+		free(pending);
+	}
+	return success;
+}
+
+METHOD(radius_socket_t, get_pending, u_int,
+	private_radius_socket_t *this)
+{
+	u_int count;
+
+	this->mutex->lock(this->mutex);
+	count = this->auth.count + this->acct.count;
+	this->mutex->unlock(this->mutex);
+	return count;
+}
+
 /**
  * Decrypt a MS-MPPE-Send/Recv-Key
  */
@@ -292,6 +773,7 @@ METHOD(radius_socket_t, decrypt_msk, chunk_t,
 	chunk_t data, send = chunk_empty, recv = chunk_empty;
 	int type;
 
+	this->mutex->lock(this->mutex);
 	enumerator = response->create_enumerator(response);
 	while (enumerator->enumerate(enumerator, &type, &data))
 	{
@@ -314,6 +796,7 @@ METHOD(radius_socket_t, decrypt_msk, chunk_t,
 		}
 	}
 	enumerator->destroy(enumerator);
+	this->mutex->unlock(this->mutex);
 	if (send.ptr && recv.ptr)
 	{
 		return chunk_cat("mm", recv, send);
@@ -326,17 +809,64 @@ METHOD(radius_socket_t, decrypt_msk, chunk_t,
 METHOD(radius_socket_t, destroy, void,
 	private_radius_socket_t *this)
 {
+	pending_t *failed[2 * RADIUS_SOCKET_MAX_PENDING];
+	int count = 0, i;
+
+	this->mutex->lock(this->mutex);
+	this->stopping = TRUE;
+	/* wake up threads waiting for a free identifier */
+	this->condvar->broadcast(this->condvar);
+	this->mutex->unlock(this->mutex);
+	if (this->receiver)
+	{
+		ignore_result(write(this->notify[1], "", 1));
+		this->receiver->join(this->receiver);
+
+		/* fail all requests that are still pending */
+		this->mutex->lock(this->mutex);
+		for (i = 0; i < RADIUS_SOCKET_MAX_PENDING; i++)
+		{
+			if (this->auth.pending[i])
+			{
+				failed[count++] = remove_pending(this, &this->auth, i);
+			}
+			if (this->acct.pending[i])
+			{
+				failed[count++] = remove_pending(this, &this->acct, i);
+			}
+		}
+		this->mutex->unlock(this->mutex);
+		for (i = 0; i < count; i++)
+		{
+			complete(this, failed[i], NULL);
+		}
+		/* wait until synchronous requesters released the condvar */
+		this->mutex->lock(this->mutex);
+		while (this->waiting)
+		{
+			this->condvar->wait(this->condvar, this->mutex);
+		}
+		this->mutex->unlock(this->mutex);
+	}
+
 	DESTROY_IF(this->hasher);
 	DESTROY_IF(this->signer);
 	DESTROY_IF(this->rng);
-	if (this->auth_fd != -1)
+	if (this->auth.fd != -1)
 	{
-		close(this->auth_fd);
-	};
-	if (this->acct_fd != -1)
+		close(this->auth.fd);
+	}
+	if (this->acct.fd != -1)
+	{
+		close(this->acct.fd);
+	}
+	if (this->notify[0] != -1)
 	{
-		close(this->acct_fd);
+		close(this->notify[0]);
+		close(this->notify[1]);
 	}
+	this->mutex->destroy(this->mutex);
+	this->condvar->destroy(this->condvar);
 	free(this);
 }
 
@@ -351,17 +881,26 @@ radius_socket_t *radius_socket_create(char *address, u_int16_t auth_port,
 	INIT(this,
 		.public = {
 			.request = _request,
+			.request_async = _request_async,
+			.get_pending = _get_pending,
 			.decrypt_msk = _decrypt_msk,
 			.destroy = _destroy,
 		},
 		.address = address,
-		.auth_port = auth_port,
-		.auth_fd = -1,
-		.acct_port = acct_port,
-		.acct_fd = -1,
+		.auth = {
+			.port = auth_port,
+			.fd = -1,
+		},
+		.acct = {
+			.port = acct_port,
+			.fd = -1,
+		},
+		.notify = { -1, -1 },
 		.hasher = lib->crypto->create_hasher(lib->crypto, HASH_MD5),
 		.signer = lib->crypto->create_signer(lib->crypto, AUTH_HMAC_MD5_128),
 		.rng = lib->crypto->create_rng(lib->crypto, RNG_WEAK),
+		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
+		.condvar = condvar_create(CONDVAR_TYPE_DEFAULT),
 	);
 
 	if (!this->hasher || !this->signer || !this->rng ||
@@ -371,9 +910,19 @@ radius_socket_t *radius_socket_create(char *address, u_int16_t auth_port,
 		destroy(this);
 		return NULL;
 	}
+	if (pipe(this->notify) == -1 ||
+		fcntl(this->notify[0], F_SETFL, O_NONBLOCK) == -1 ||
+		fcntl(this->notify[1], F_SETFL, O_NONBLOCK) == -1)
+	{
+		DBG1(DBG_CFG, "creating RADIUS notification pipe failed: %s",
+			 strerror(errno));
+		destroy(this);
+		return NULL;
+	}
 	this->secret = secret;
 	/* we use a random identifier, helps if we restart often */
-	this->identifier = random();
+	this->auth.identifier = random();
+	this->acct.identifier = random();
 
 	return &this->public;
 }
@@ -27,8 +27,30 @@ typedef struct radius_socket_t radius_socket_t;
 
 #include <networking/host.h>
 
+/**
+ * Maximum number of requests in flight on a single socket, limited by the
+ * 8-bit RADIUS Identifier.
+ */
+#define RADIUS_SOCKET_MAX_PENDING 256
+
+/**
+ * Callback function invoked when a request completes asynchronously.
+ *
+ * @param data			user data passed to request_async()
+ * @param request		request message sent
+ * @param response		response message, NULL if timed out, gets owned
+ */
+typedef void (*radius_socket_cb_t)(void *data, radius_message_t *request,
+								   radius_message_t *response);
+
 /**
  * RADIUS socket to a server.
+ *
+ * A socket multiplexes up to RADIUS_SOCKET_MAX_PENDING outstanding requests
+ * using the RADIUS Identifier. Responses are received and retransmits are
+ * handled by a dedicated thread that gets started with the first request and
+ * runs until the socket is destroyed, so each socket in use occupies one
+ * thread outside of the processor's thread pool.
  */
 struct radius_socket_t {
 
@@ -41,12 +63,35 @@ struct radius_socket_t {
 	 * The received response gets verified using the Response-Identifier
 	 * and the Message-Authenticator attribute.
 	 *
+	 * Multiple threads may issue requests over the same socket concurrently.
+	 *
 	 * @param request		request message
 	 * @return				response message, NULL if timed out
 	 */
 	radius_message_t* (*request)(radius_socket_t *this,
 								 radius_message_t *request);
 
+	/**
+	 * Send a RADIUS request, invoke a callback once it completes.
+	 *
+	 * Same as request(), but does not wait for the response. The callback
+	 * is invoked in a separate job once the request completes.
+	 *
+	 * @param request		request message, gets owned
+	 * @param cb			callback to invoke with the response
+	 * @param data			user data to pass to callback
+	 * @return				TRUE if request sent, FALSE if sending failed
+	 */
+	bool (*request_async)(radius_socket_t *this, radius_message_t *request,
+						  radius_socket_cb_t cb, void *data);
+
+	/**
+	 * Get the number of requests currently waiting for a response.
+	 *
+	 * @return				number of outstanding requests
+	 */
+	u_int (*get_pending)(radius_socket_t *this);
+
 	/**
 	 * Decrypt the MSK encoded in a messages MS-MPPE-Send/Recv-Key.
 	 *
@@ -59,6 +104,10 @@ struct radius_socket_t {
 
 	/**
 	 * Destroy a radius_socket_t.
+	 *
+	 * Requests still pending get completed with a NULL response: the
+	 * callbacks of asynchronous requests are invoked, synchronous requests
+	 * return NULL.
 	 */
 	void (*destroy)(radius_socket_t *this);
 };
@@ -21,6 +21,7 @@
 #include <threading/mutex.h>
 #include <threading/rwlock.h>
 #include <collections/linked_list.h>
+#include <collections/hashtable.h>
 #include <credentials/sets/cert_cache.h>
 #include <credentials/sets/auth_cfg_wrapper.h>
 #include <credentials/certificates/x509.h>
@@ -30,6 +31,11 @@
  */
 #define MAX_TRUST_PATH_LEN 7
 
+/**
+ * Maximum number of cached trust chain verification results
+ */
+#define MAX_CACHED_CHAINS 1024
+
 typedef struct private_credential_manager_t private_credential_manager_t;
 
 /**
@@ -81,8 +87,41 @@ struct private_credential_manager_t {
 	 * mutex for cache queue
 	 */
 	mutex_t *queue_mutex;
+
+	/**
+	 * cached trust chain verification results, chain_t => chain_t
+	 */
+	hashtable_t *chains;
+
+	/**
+	 * lifetime of cached trust chains in seconds, 0 to disable caching
+	 */
+	u_int chain_lifetime;
+
+	/**
+	 * mutex for cached trust chains
+	 */
+	mutex_t *chain_mutex;
 };
 
+/**
+ * A cached trust chain verification result
+ */
+typedef struct {
+	/** verified subject certificate */
+	certificate_t *subject;
+	/** TRUE if subject has been a trusted certificate */
+	bool trusted;
+	/** TRUE if online revocation checking has been done */
+	bool online;
+	/** auth info built during verification */
+	auth_cfg_t *auth;
+	/** trusted certificates the chain has been built on, certificate_t */
+	linked_list_t *anchors;
+	/** time this result expires */
+	time_t expires;
+} chain_t;
+
 /** data to pass to create_private_enumerator */
 typedef struct {
 	private_credential_manager_t *this;
@@ -461,6 +500,24 @@ METHOD(credential_manager_t, issued_by, bool,
 	return subject->issued_by(subject, issuer, scheme);
 }
 
+static void flush_chains(private_credential_manager_t *this, bool all);
+
+/**
+ * Check if caching a certificate may affect cached trust chains, i.e. it is
+ * not an end entity certificate but a CA certificate or revocation info
+ */
+static bool affects_chains(certificate_t *cert)
+{
+	x509_t *x509;
+
+	if (cert->get_type(cert) == CERT_X509)
+	{
+		x509 = (x509_t*)cert;
+		return (x509->get_flags(x509) & X509_CA) != 0;
+	}
+	return TRUE;
+}
+
 METHOD(credential_manager_t, cache_cert, void,
 	private_credential_manager_t *this, certificate_t *cert)
 {
@@ -483,6 +540,10 @@ METHOD(credential_manager_t, cache_cert, void,
 		this->cache_queue->insert_last(this->cache_queue, cert->get_ref(cert));
 		this->queue_mutex->unlock(this->queue_mutex);
 	}
+	if (affects_chains(cert))
+	{
+		flush_chains(this, TRUE);
+	}
 }
 
 /**
@@ -493,6 +554,7 @@ static void cache_queue(private_credential_manager_t *this)
 	credential_set_t *set;
 	certificate_t *cert;
 	enumerator_t *enumerator;
+	bool flush = FALSE;
 
 	this->queue_mutex->lock(this->queue_mutex);
 	if (this->cache_queue->get_count(this->cache_queue) > 0 &&
@@ -507,11 +569,16 @@ static void cache_queue(private_credential_manager_t *this)
 				set->cache_cert(set, cert);
 			}
 			enumerator->destroy(enumerator);
+			flush = flush || affects_chains(cert);
 			cert->destroy(cert);
 		}
 		this->lock->unlock(this->lock);
 	}
 	this->queue_mutex->unlock(this->queue_mutex);
+	if (flush)
+	{
+		flush_chains(this, TRUE);
+	}
 }
 
 /**
@@ -673,6 +740,220 @@ static void get_key_strength(certificate_t *cert, auth_cfg_t *auth)
 	}
 }
 
+/**
+ * Hashtable hash function for cached trust chains
+ */
+static u_int chain_hash(chain_t *key)
+{
+	identification_t *id;
+	u_int hash;
+
+	hash = chunk_hash(chunk_from_thing(key->trusted));
+	hash = chunk_hash_inc(chunk_from_thing(key->online), hash);
+	id = key->subject->get_subject(key->subject);
+	if (id)
+	{
+		hash = chunk_hash_inc(id->get_encoding(id), hash);
+	}
+	return hash;
+}
+
+/**
+ * Hashtable equals function for cached trust chains
+ */
+static bool chain_equals(chain_t *a, chain_t *b)
+{
+	return a->trusted == b->trusted && a->online == b->online &&
+		   a->subject->equals(a->subject, b->subject);
+}
+
+/**
+ * Destroy a cached trust chain
+ */
+static void chain_destroy(chain_t *this)
+{
+	this->subject->destroy(this->subject);
+	this->auth->destroy(this->auth);
+	this->anchors->destroy_offset(this->anchors,
+								  offsetof(certificate_t, destroy));
+	free(this);
+}
+
+/**
+ * Flush cached trust chains, all or just expired ones
+ */
+static void flush_chains(private_credential_manager_t *this, bool all)
+{
+	enumerator_t *enumerator;
+	chain_t *chain;
+	time_t now;
+
+	now = time_monotonic(NULL);
+	this->chain_mutex->lock(this->chain_mutex);
+	enumerator = this->chains->create_enumerator(this->chains);
+	while (enumerator->enumerate(enumerator, NULL, &chain))
+	{
+		if (all || chain->expires <= now)
+		{
+			this->chains->remove_at(this->chains, enumerator);
+			chain_destroy(chain);
+		}
+	}
+	enumerator->destroy(enumerator);
+	this->chain_mutex->unlock(this->chain_mutex);
+}
+
+/**
+ * Check that all certificates of a cached trust chain are still valid
+ */
+static bool chain_valid(chain_t *chain)
+{
+	enumerator_t *enumerator;
+	certificate_t *cert;
+	auth_rule_t rule;
+	bool valid = TRUE;
+
+	enumerator = chain->auth->create_enumerator(chain->auth);
+	while (enumerator->enumerate(enumerator, &rule, &cert))
+	{
+		switch (rule)
+		{
+			case AUTH_RULE_SUBJECT_CERT:
+			case AUTH_RULE_IM_CERT:
+			case AUTH_RULE_CA_CERT:
+				valid = cert->get_validity(cert, NULL, NULL, NULL);
+				break;
+			default:
+				break;
+		}
+		if (!valid)
+		{
+			break;
+		}
+	}
+	enumerator->destroy(enumerator);
+	return valid;
+}
+
+/**
+ * Check if a certificate is still provided as trusted certificate by the
+ * credential sets the calling thread currently uses
+ */
+static bool is_anchor(private_credential_manager_t *this, certificate_t *cert)
+{
+	enumerator_t *enumerator;
+	certificate_t *current;
+	bool found = FALSE;
+
+	enumerator = create_cert_enumerator(this, cert->get_type(cert), KEY_ANY,
+										cert->get_subject(cert), TRUE);
+	while (enumerator->enumerate(enumerator, &current))
+	{
+		if (current->equals(current, cert))
+		{
+			found = TRUE;
+			break;
+		}
+	}
+	enumerator->destroy(enumerator);
+	return found;
+}
+
+/**
+ * Look up a cached trust chain of subject, merge it into result if found.
+ *
+ * As the calling thread may use local credential sets, a cached chain is only
+ * used if the trusted certificates it has been built on are still provided
+ * as such. Intermediate certificates in the chain have been verified, so it
+ * does not matter if local sets provide them again.
+ */
+static bool get_cached_chain(private_credential_manager_t *this,
+							 certificate_t *subject, auth_cfg_t *result,
+							 bool trusted, bool online)
+{
+	chain_t *chain, key = {
+		.subject = subject,
+		.trusted = trusted,
+		.online = online,
+	};
+	enumerator_t *enumerator;
+	linked_list_t *anchors = NULL;
+	certificate_t *cert;
+	auth_cfg_t *auth = NULL;
+	bool found = TRUE;
+
+	this->chain_mutex->lock(this->chain_mutex);
+	chain = this->chains->get(this->chains, &key);
+	if (chain)
+	{
+		if (chain->expires > time_monotonic(NULL) && chain_valid(chain))
+		{
+			auth = chain->auth->clone(chain->auth);
+			anchors = chain->anchors->clone_offset(chain->anchors,
+											offsetof(certificate_t, get_ref));
+		}
+		else
+		{
+			this->chains->remove(this->chains, chain);
+			chain_destroy(chain);
+		}
+	}
+	this->chain_mutex->unlock(this->chain_mutex);
+
+	if (!auth)
+	{
+		return FALSE;
+	}
+	enumerator = anchors->create_enumerator(anchors);
+	while (found && enumerator->enumerate(enumerator, &cert))
+	{
+		found = is_anchor(this, cert);
+	}
+	enumerator->destroy(enumerator);
+	if (found)
+	{
+		DBG1(DBG_CFG, "  using cached trust chain of \"%Y\"",
+			 subject->get_subject(subject));
+		result->merge(result, auth, FALSE);
+	}
+	auth->destroy(auth);
+	anchors->destroy_offset(anchors, offsetof(certificate_t, destroy));
+	return found;
+}
+
+/**
+ * Cache the auth info of a verified trust chain, adopts the anchors list
+ */
+static void cache_chain(private_credential_manager_t *this,
+						certificate_t *subject, auth_cfg_t *auth,
+						linked_list_t *anchors, bool trusted, bool online)
+{
+	chain_t *chain;
+
+	if (this->chains->get_count(this->chains) >= MAX_CACHED_CHAINS)
+	{
+		flush_chains(this, FALSE);
+	}
+	INIT(chain,
+		.subject = subject->get_ref(subject),
+		.trusted = trusted,
+		.online = online,
+		.auth = auth->clone(auth),
+		.anchors = anchors,
+		.expires = time_monotonic(NULL) + this->chain_lifetime,
+	);
+	this->chain_mutex->lock(this->chain_mutex);
+	if (this->chains->get_count(this->chains) < MAX_CACHED_CHAINS)
+	{
+		chain = this->chains->put(this->chains, chain, chain);
+	}
+	this->chain_mutex->unlock(this->chain_mutex);
+	if (chain)
+	{	/* replaced an existing entry, or cache is full */
+		chain_destroy(chain);
+	}
+}
+
 /**
  * try to verify the trust chain of subject, return TRUE if trusted
  */
@@ -682,9 +963,18 @@ static bool verify_trust_chain(private_credential_manager_t *this,
 {
 	certificate_t *current, *issuer;
 	auth_cfg_t *auth;
+	linked_list_t *anchors;
 	signature_scheme_t scheme;
+	bool pretrusted = trusted;
 	int pathlen;
 
+	if (this->chain_lifetime &&
+		get_cached_chain(this, subject, result, trusted, online))
+	{
+		return TRUE;
+	}
+	anchors = linked_list_create();
+
 	auth = auth_cfg_create();
 	get_key_strength(subject, auth);
 	current = subject->get_ref(subject);
@@ -695,6 +985,7 @@ static bool verify_trust_chain(private_credential_manager_t *this,
 		issuer = get_issuer_cert(this, current, TRUE, &scheme);
 		if (issuer)
 		{
+			anchors->insert_last(anchors, issuer->get_ref(issuer));
 			/* accept only self-signed CAs as trust anchor */
 			if (issued_by(this, issuer, issuer, NULL))
 			{
@@ -762,9 +1053,18 @@ static bool verify_trust_chain(private_credential_manager_t *this,
 	}
 	if (trusted)
 	{
+		if (this->chain_lifetime)
+		{
+			cache_chain(this, subject, auth, anchors, pretrusted, online);
+			anchors = NULL;
+		}
 		result->merge(result, auth, FALSE);
 	}
 	auth->destroy(auth);
+	if (anchors)
+	{
+		anchors->destroy_offset(anchors, offsetof(certificate_t, destroy));
+	}
 	return trusted;
 }
 
@@ -1222,6 +1522,7 @@ METHOD(credential_manager_t, flush_cache, void,
 	{
 		this->cache->flush(this->cache, type);
 	}
+	flush_chains(this, TRUE);
 }
 
 METHOD(credential_manager_t, add_set, void,
@@ -1230,6 +1531,7 @@ METHOD(credential_manager_t, add_set, void,
 	this->lock->write_lock(this->lock);
 	this->sets->insert_last(this->sets, set);
 	this->lock->unlock(this->lock);
+	flush_chains(this, TRUE);
 }
 
 METHOD(credential_manager_t, remove_set, void,
@@ -1238,6 +1540,7 @@ METHOD(credential_manager_t, remove_set, void,
 	this->lock->write_lock(this->lock);
 	this->sets->remove(this->sets, set, NULL);
 	this->lock->unlock(this->lock);
+	flush_chains(this, TRUE);
 }
 
 METHOD(credential_manager_t, add_validator, void,
@@ -1270,6 +1573,9 @@ METHOD(credential_manager_t, destroy, void,
 	this->local_sets->destroy(this->local_sets);
 	this->exclusive_local_sets->destroy(this->exclusive_local_sets);
 	this->validators->destroy(this->validators);
+	flush_chains(this, TRUE);
+	this->chains->destroy(this->chains);
+	this->chain_mutex->destroy(this->chain_mutex);
 	this->lock->destroy(this->lock);
 	this->queue_mutex->destroy(this->queue_mutex);
 	free(this);
@@ -1308,6 +1614,11 @@ credential_manager_t *credential_manager_create()
 		.cache_queue = linked_list_create(),
 		.lock = rwlock_create(RWLOCK_TYPE_DEFAULT),
 		.queue_mutex = mutex_create(MUTEX_TYPE_DEFAULT),
+		.chains = hashtable_create((hashtable_hash_t)chain_hash,
+								   (hashtable_equals_t)chain_equals, 32),
+		.chain_lifetime = lib->settings->get_int(lib->settings,
+							"libstrongswan.cert_cache_chain_lifetime", 0),
+		.chain_mutex = mutex_create(MUTEX_TYPE_DEFAULT),
 	);
 
 	this->local_sets = thread_value_create((thread_cleanup_t)this->sets->destroy);
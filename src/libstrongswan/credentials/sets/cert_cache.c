@@ -15,21 +15,24 @@
 
 #include "cert_cache.h"
 
-#include <time.h>
-#include <sched.h>
-
 #include <library.h>
+#include <utils/debug.h>
+#include <threading/mutex.h>
 #include <threading/rwlock.h>
-#include <collections/linked_list.h>
+#include <collections/hashtable.h>
+
+/** default number of cached relations */
+#define CACHE_SIZE_DEFAULT 256
 
-/** cache size, a power of 2 for fast modulo */
-#define CACHE_SIZE 32
+/** number of bits of the subject hash selecting a shard */
+#define SHARD_BITS 4
 
-/** attempts to acquire a cache lock */
-#define REPLACE_TRIES 5
+/** number of shards the cache is split into */
+#define SHARDS (1 << SHARD_BITS)
 
 typedef struct private_cert_cache_t private_cert_cache_t;
 typedef struct relation_t relation_t;
+typedef struct shard_t shard_t;
 
 /**
  * A trusted relation between subject and issuer
@@ -51,15 +54,72 @@ struct relation_t {
 	 */
 	signature_scheme_t scheme;
 
+	/**
+	 * Hash over subject and issuer
+	 */
+	u_int hash;
+
+	/**
+	 * Previous (more recently used) relation in LRU list
+	 */
+	relation_t *prev;
+
+	/**
+	 * Next (less recently used) relation in LRU list
+	 */
+	relation_t *next;
+
+	/**
+	 * Next relation with a subject having the same subject identity
+	 */
+	relation_t *same;
+};
+
+/**
+ * A shard of the cache, with its own locks
+ */
+struct shard_t {
+
+	/**
+	 * Relations in this shard, relation_t => relation_t
+	 */
+	hashtable_t *relations;
+
+	/**
+	 * Relations by subject identity, identification_t => relation_t, chained
+	 * by relation_t.same
+	 */
+	hashtable_t *subjects;
+
+	/**
+	 * Most recently used relation
+	 */
+	relation_t *head;
+
+	/**
+	 * Least recently used relation
+	 */
+	relation_t *tail;
+
 	/**
 	 * Cache hits
 	 */
 	u_int hits;
 
 	/**
-	 * Lock for this relation
+	 * Cache misses
+	 */
+	u_int misses;
+
+	/**
+	 * Lock for the relations, held as reader while enumerating them
 	 */
 	rwlock_t *lock;
+
+	/**
+	 * Mutex for the LRU list and counters, updated by readers
+	 */
+	mutex_t *mutex;
 };
 
 /**
@@ -73,115 +133,284 @@ struct private_cert_cache_t {
 	cert_cache_t public;
 
 	/**
-	 * array of trusted subject-issuer relations
+	 * shards of the cache, selected by the upper bits of the subject hash
 	 */
-	relation_t relations[CACHE_SIZE];
+	shard_t shards[SHARDS];
+
+	/**
+	 * maximum number of relations per shard
+	 */
+	u_int shard_size;
 };
 
 /**
- * Cache relation in a free slot/replace an other
+ * Hash over the subject identity of a certificate, compatible with equals()
  */
-static void cache(private_cert_cache_t *this,
-				  certificate_t *subject, certificate_t *issuer,
-				  signature_scheme_t scheme)
+static u_int subject_hash(certificate_t *cert)
 {
-	relation_t *rel;
-	int i, offset, try;
-	u_int total_hits = 0;
+	identification_t *id;
+
+	id = cert->get_subject(cert);
+	return id ? id->hash(id, 0) : 0;
+}
 
-	/* check for a unused relation slot first */
-	for (i = 0; i < CACHE_SIZE; i++)
+/**
+ * Hash over the subject and issuer of a relation
+ */
+static u_int relation_hash(certificate_t *subject, certificate_t *issuer)
+{
+	identification_t *id;
+	u_int hash;
+
+	hash = subject_hash(subject);
+	id = issuer->get_subject(issuer);
+	if (id)
 	{
-		rel = &this->relations[i];
+		hash = id->hash(id, hash);
+	}
+	return hash;
+}
 
-		if (!rel->subject && rel->lock->try_write_lock(rel->lock))
+/**
+ * Hashtable hash function
+ */
+static u_int hash(relation_t *key)
+{
+	return key->hash;
+}
+
+/**
+ * Hashtable equals function
+ */
+static bool equals(relation_t *a, relation_t *b)
+{
+	return a->hash == b->hash &&
+		   a->issuer->equals(a->issuer, b->issuer) &&
+		   a->subject->equals(a->subject, b->subject);
+}
+
+/**
+ * Hashtable hash function for subject identities
+ */
+static u_int id_hash(identification_t *id)
+{
+	return id->hash(id, 0);
+}
+
+/**
+ * Hashtable equals function for subject identities
+ */
+static bool id_equals(identification_t *a, identification_t *b)
+{
+	return a->equals(a, b);
+}
+
+/**
+ * Get the shard relations of a subject with the given hash are stored in
+ */
+static shard_t *get_shard(private_cert_cache_t *this, u_int hash)
+{
+	/* the hashtables use the lower bits, so we use the upper ones */
+	return &this->shards[hash >> (sizeof(hash) * 8 - SHARD_BITS)];
+}
+
+/**
+ * Unlink a relation from the LRU list of a shard
+ */
+static void lru_remove(shard_t *shard, relation_t *rel)
+{
+	if (rel->prev)
+	{
+		rel->prev->next = rel->next;
+	}
+	else
+	{
+		shard->head = rel->next;
+	}
+	if (rel->next)
+	{
+		rel->next->prev = rel->prev;
+	}
+	else
+	{
+		shard->tail = rel->prev;
+	}
+	rel->prev = rel->next = NULL;
+}
+
+/**
+ * Link a relation as most recently used to the LRU list of a shard
+ */
+static void lru_insert(shard_t *shard, relation_t *rel)
+{
+	rel->prev = NULL;
+	rel->next = shard->head;
+	if (shard->head)
+	{
+		shard->head->prev = rel;
+	}
+	else
+	{
+		shard->tail = rel;
+	}
+	shard->head = rel;
+}
+
+/**
+ * Add a relation to the subject index of a shard
+ */
+static void index_add(shard_t *shard, relation_t *rel)
+{
+	identification_t *id;
+
+	id = rel->subject->get_subject(rel->subject);
+	if (id)
+	{
+		rel->same = shard->subjects->put(shard->subjects, id, rel);
+	}
+}
+
+/**
+ * Remove a relation from the subject index of a shard
+ */
+static void index_remove(shard_t *shard, relation_t *rel)
+{
+	identification_t *id;
+	relation_t *current;
+
+	id = rel->subject->get_subject(rel->subject);
+	if (!id)
+	{
+		return;
+	}
+	current = shard->subjects->get(shard->subjects, id);
+	if (current == rel)
+	{
+		if (rel->same)
+		{	/* the key must belong to the new first relation */
+			shard->subjects->put(shard->subjects,
+						rel->same->subject->get_subject(rel->same->subject),
+						rel->same);
+		}
+		else
 		{
-			/* double-check having lock */
-			if (!rel->subject)
-			{
-				rel->subject = subject->get_ref(subject);
-				rel->issuer = issuer->get_ref(issuer);
-				rel->scheme = scheme;
-				return rel->lock->unlock(rel->lock);
-			}
-			rel->lock->unlock(rel->lock);
+			shard->subjects->remove(shard->subjects, id);
 		}
-		total_hits += rel->hits;
+		return;
 	}
-	/* run several attempts to replace a random slot, never block. */
-	for (try = 0; try < REPLACE_TRIES; try++)
+	while (current)
 	{
-		/* replace a random relation */
-		offset = random();
-		for (i = 0; i < CACHE_SIZE; i++)
+		if (current->same == rel)
 		{
-			rel = &this->relations[(i + offset) % CACHE_SIZE];
-
-			if (rel->hits > total_hits / CACHE_SIZE)
-			{	/* skip often used slots */
-				continue;
-			}
-			if (rel->lock->try_write_lock(rel->lock))
-			{
-				if (rel->subject)
-				{
-					rel->subject->destroy(rel->subject);
-					rel->issuer->destroy(rel->issuer);
-				}
-				rel->subject = subject->get_ref(subject);
-				rel->issuer = issuer->get_ref(issuer);
-				rel->scheme = scheme;
-				rel->hits = 0;
-				return rel->lock->unlock(rel->lock);
-			}
+			current->same = rel->same;
+			break;
 		}
-		/* give other threads a chance to release locks */
-		sched_yield();
+		current = current->same;
 	}
 }
 
+/**
+ * Destroy a relation
+ */
+static void relation_destroy(relation_t *rel)
+{
+	rel->subject->destroy(rel->subject);
+	rel->issuer->destroy(rel->issuer);
+	free(rel);
+}
+
+/**
+ * Remove a relation from a shard and destroy it, write lock must be held
+ */
+static void remove_relation(shard_t *shard, relation_t *rel)
+{
+	shard->relations->remove(shard->relations, rel);
+	index_remove(shard, rel);
+	lru_remove(shard, rel);
+	relation_destroy(rel);
+}
+
+/**
+ * Cache a relation, replacing the least recently used one if shard is full.
+ *
+ * As the calling thread might currently enumerate the same shard, caching is
+ * skipped if the shard is in use.
+ */
+static void cache(private_cert_cache_t *this,
+				  certificate_t *subject, certificate_t *issuer,
+				  signature_scheme_t scheme, u_int hash)
+{
+	relation_t *rel;
+	shard_t *shard;
+
+	INIT(rel,
+		.subject = subject->get_ref(subject),
+		.issuer = issuer->get_ref(issuer),
+		.scheme = scheme,
+		.hash = hash,
+	);
+	shard = get_shard(this, subject_hash(subject));
+	if (!shard->lock->try_write_lock(shard->lock))
+	{
+		relation_destroy(rel);
+		return;
+	}
+	if (shard->relations->get(shard->relations, rel))
+	{	/* cached by another thread meanwhile */
+		shard->lock->unlock(shard->lock);
+		relation_destroy(rel);
+		return;
+	}
+	if (shard->relations->get_count(shard->relations) >= this->shard_size)
+	{
+		remove_relation(shard, shard->tail);
+	}
+	shard->relations->put(shard->relations, rel, rel);
+	index_add(shard, rel);
+	lru_insert(shard, rel);
+	shard->lock->unlock(shard->lock);
+}
+
 METHOD(cert_cache_t, issued_by, bool,
 	private_cert_cache_t *this, certificate_t *subject, certificate_t *issuer,
 	signature_scheme_t *schemep)
 {
-	relation_t *found = NULL, *current;
+	relation_t *found, key = {
+		.subject = subject,
+		.issuer = issuer,
+	};
 	signature_scheme_t scheme;
-	int i;
-
-	for (i = 0; i < CACHE_SIZE; i++)
+	shard_t *shard;
+
+	key.hash = relation_hash(subject, issuer);
+	shard = get_shard(this, subject_hash(subject));
+	shard->lock->read_lock(shard->lock);
+	found = shard->relations->get(shard->relations, &key);
+	shard->mutex->lock(shard->mutex);
+	if (found)
 	{
-		current = &this->relations[i];
-
-		current->lock->read_lock(current->lock);
-		if (current->subject)
+		shard->hits++;
+		if (found != shard->head)
 		{
-			/* check for equal issuer */
-			if (issuer->equals(issuer, current->issuer))
-			{
-				/* reuse issuer instance in cache() */
-				issuer = current->issuer;
-				if (subject->equals(subject, current->subject))
-				{
-					/* write hit counter is not locked, but not critical */
-					current->hits++;
-					found = current;;
-					if (schemep)
-					{
-						*schemep = current->scheme;
-					}
-				}
-			}
+			lru_remove(shard, found);
+			lru_insert(shard, found);
 		}
-		current->lock->unlock(current->lock);
-		if (found)
+		if (schemep)
 		{
-			return TRUE;
+			*schemep = found->scheme;
 		}
+		shard->mutex->unlock(shard->mutex);
+		shard->lock->unlock(shard->lock);
+		return TRUE;
 	}
+	shard->misses++;
+	shard->mutex->unlock(shard->mutex);
+	shard->lock->unlock(shard->lock);
+
 	/* no cache hit, check and cache signature */
 	if (subject->issued_by(subject, issuer, &scheme))
 	{
-		cache(this, subject, issuer, scheme);
+		cache(this, subject, issuer, scheme, key.hash);
 		if (schemep)
 		{
 			*schemep = scheme;
@@ -192,95 +421,114 @@ METHOD(cert_cache_t, issued_by, bool,
 }
 
 /**
- * certificate enumerator implemenation
+ * Check if the subject of a relation matches an enumeration request
+ */
+static bool cert_matches(certificate_t *subject, certificate_type_t cert,
+						 key_type_t key, identification_t *id)
+{
+	public_key_t *public;
+	bool match = FALSE;
+
+	/* CRL lookup is done using issuer/authkeyidentifier */
+	if (key == KEY_ANY && id &&
+		(cert == CERT_ANY || cert == CERT_X509_CRL) &&
+		subject->get_type(subject) == CERT_X509_CRL &&
+		subject->has_issuer(subject, id))
+	{
+		return TRUE;
+	}
+	if ((cert == CERT_ANY || subject->get_type(subject) == cert) &&
+		(!id || subject->has_subject(subject, id)))
+	{
+		if (key == KEY_ANY)
+		{
+			return TRUE;
+		}
+		public = subject->get_public_key(subject);
+		if (public)
+		{
+			match = public->get_type(public) == key;
+			public->destroy(public);
+		}
+	}
+	return match;
+}
+
+/**
+ * Enumerator over cached subjects, holds the read lock of the current shard
  */
 typedef struct {
-	/** implements enumerator_t interface */
+	/** implements enumerator_t */
 	enumerator_t public;
+	/** cache we enumerate */
+	private_cert_cache_t *cache;
 	/** type of requested certificate */
 	certificate_type_t cert;
 	/** type of requested key */
 	key_type_t key;
-	/** ID to get a cert for */
+	/** requested identity, NULL for any */
 	identification_t *id;
-	/** cache */
-	relation_t *relations;
-	/** current position in array cache */
-	int index;
-	/** currently locked relation */
-	int locked;
-} cert_enumerator_t;
-
-/**
- * filter function for certs enumerator
- */
-static bool cert_enumerate(cert_enumerator_t *this, certificate_t **out)
+	/** currently locked shard, if any */
+	shard_t *shard;
+	/** next relation with the requested subject, if looked up by index */
+	relation_t *rel;
+	/** enumerator over all relations of the shard, if scanning shards */
+	enumerator_t *inner;
+	/** index of the next shard to scan, SHARDS if none left */
+	int next;
+} cache_enumerator_t;
+
+METHOD(enumerator_t, cache_enumerate, bool,
+	cache_enumerator_t *this, certificate_t **out)
 {
-	public_key_t *public;
 	relation_t *rel;
 
-	if (this->locked >= 0)
-	{
-		rel = &this->relations[this->locked];
-		rel->lock->unlock(rel->lock);
-		this->locked = -1;
-	}
-
-	while (++this->index < CACHE_SIZE)
-	{
-		rel = &this->relations[this->index];
-		rel->lock->read_lock(rel->lock);
-		this->locked = this->index;
-		if (rel->subject)
+	if (!this->inner)
+	{	/* indexed lookup in a single shard */
+		while (this->rel)
 		{
-			/* CRL lookup is done using issuer/authkeyidentifier */
-			if (this->key == KEY_ANY && this->id &&
-				(this->cert == CERT_ANY || this->cert == CERT_X509_CRL) &&
-				rel->subject->get_type(rel->subject) == CERT_X509_CRL &&
-				rel->subject->has_issuer(rel->subject, this->id))
+			rel = this->rel;
+			this->rel = rel->same;
+			if (cert_matches(rel->subject, this->cert, this->key, this->id))
 			{
 				*out = rel->subject;
 				return TRUE;
 			}
-			if ((this->cert == CERT_ANY ||
-				 rel->subject->get_type(rel->subject) == this->cert) &&
-				(!this->id || rel->subject->has_subject(rel->subject, this->id)))
+		}
+		return FALSE;
+	}
+	while (TRUE)
+	{
+		while (this->inner->enumerate(this->inner, NULL, &rel))
+		{
+			if (cert_matches(rel->subject, this->cert, this->key, this->id))
 			{
-				if (this->key == KEY_ANY)
-				{
-					*out = rel->subject;
-					return TRUE;
-				}
-				public = rel->subject->get_public_key(rel->subject);
-				if (public)
-				{
-					if (public->get_type(public) == this->key)
-					{
-						public->destroy(public);
-						*out = rel->subject;
-						return TRUE;
-					}
-					public->destroy(public);
-				}
+				*out = rel->subject;
+				return TRUE;
 			}
 		}
-		this->locked = -1;
-		rel->lock->unlock(rel->lock);
+		this->inner->destroy(this->inner);
+		this->shard->lock->unlock(this->shard->lock);
+		if (this->next == SHARDS)
+		{
+			this->inner = NULL;
+			this->shard = NULL;
+			return FALSE;
+		}
+		this->shard = &this->cache->shards[this->next++];
+		this->shard->lock->read_lock(this->shard->lock);
+		this->inner = this->shard->relations->create_enumerator(
+													this->shard->relations);
 	}
-	return FALSE;
 }
 
-/**
- * clean up enumeration data
- */
-static void cert_enumerator_destroy(cert_enumerator_t *this)
+METHOD(enumerator_t, cache_enumerator_destroy, void,
+	cache_enumerator_t *this)
 {
-	relation_t *rel;
-
-	if (this->locked >= 0)
+	DESTROY_IF(this->inner);
+	if (this->shard)
 	{
-		rel = &this->relations[this->locked];
-		rel->lock->unlock(rel->lock);
+		this->shard->lock->unlock(this->shard->lock);
 	}
 	free(this);
 }
@@ -289,81 +537,86 @@ METHOD(credential_set_t, create_enumerator, enumerator_t*,
 	private_cert_cache_t *this, certificate_type_t cert, key_type_t key,
 	identification_t *id, bool trusted)
 {
-	cert_enumerator_t *enumerator;
+	cache_enumerator_t *enumerator;
 
 	if (trusted)
 	{
 		return NULL;
 	}
-	enumerator = malloc_thing(cert_enumerator_t);
-	enumerator->public.enumerate = (void*)cert_enumerate;
-	enumerator->public.destroy = (void*)cert_enumerator_destroy;
-	enumerator->cert = cert;
-	enumerator->key = key;
-	enumerator->id = id;
-	enumerator->relations = this->relations;
-	enumerator->index = -1;
-	enumerator->locked = -1;
-
+	INIT(enumerator,
+		.public = {
+			.enumerate = (void*)_cache_enumerate,
+			.destroy = _cache_enumerator_destroy,
+		},
+		.cache = this,
+		.cert = cert,
+		.key = key,
+		.id = id,
+	);
+	if (id && id->get_type(id) == ID_DER_ASN1_DN &&
+		!id->contains_wildcards(id))
+	{	/* subjects with this DN are stored in a single shard and chain */
+		enumerator->shard = get_shard(this, id->hash(id, 0));
+		enumerator->shard->lock->read_lock(enumerator->shard->lock);
+		enumerator->rel = enumerator->shard->subjects->get(
+										enumerator->shard->subjects, id);
+	}
+	else
+	{
+		enumerator->shard = &this->shards[0];
+		enumerator->next = 1;
+		enumerator->shard->lock->read_lock(enumerator->shard->lock);
+		enumerator->inner = enumerator->shard->relations->create_enumerator(
+												enumerator->shard->relations);
+	}
 	return &enumerator->public;
 }
 
 METHOD(cert_cache_t, flush, void,
 	private_cert_cache_t *this, certificate_type_t type)
 {
-	relation_t *rel;
+	relation_t *rel, *next;
+	shard_t *shard;
+	u_int hits = 0, misses = 0;
 	int i;
 
-	for (i = 0; i < CACHE_SIZE; i++)
+	for (i = 0; i < SHARDS; i++)
 	{
-		rel = &this->relations[i];
-		if (!rel->subject)
-		{
-			continue;
-		}
-		/* check with cheap read lock first */
-		if (type != CERT_ANY)
-		{
-			rel->lock->read_lock(rel->lock);
-			if (!rel->subject || type != rel->subject->get_type(rel->subject))
-			{
-				rel->lock->unlock(rel->lock);
-				continue;
-			}
-			rel->lock->unlock(rel->lock);
-		}
-		/* double check in write lock */
-		rel->lock->write_lock(rel->lock);
-		if (rel->subject)
+		shard = &this->shards[i];
+		shard->lock->write_lock(shard->lock);
+		for (rel = shard->head; rel; rel = next)
 		{
+			next = rel->next;
 			if (type == CERT_ANY || type == rel->subject->get_type(rel->subject))
 			{
-				rel->subject->destroy(rel->subject);
-				rel->issuer->destroy(rel->issuer);
-				rel->subject = NULL;
-				rel->issuer = NULL;
-				rel->hits = 0;
+				remove_relation(shard, rel);
 			}
 		}
-		rel->lock->unlock(rel->lock);
+		hits += shard->hits;
+		misses += shard->misses;
+		shard->lock->unlock(shard->lock);
 	}
+	DBG2(DBG_LIB, "flushed certificate cache, %u hits, %u misses",
+		 hits, misses);
 }
 
 METHOD(cert_cache_t, destroy, void,
 	private_cert_cache_t *this)
 {
-	relation_t *rel;
+	shard_t *shard;
 	int i;
 
-	for (i = 0; i < CACHE_SIZE; i++)
+	for (i = 0; i < SHARDS; i++)
 	{
-		rel = &this->relations[i];
-		if (rel->subject)
+		shard = &this->shards[i];
+		while (shard->head)
 		{
-			rel->subject->destroy(rel->subject);
-			rel->issuer->destroy(rel->issuer);
+			remove_relation(shard, shard->head);
 		}
-		rel->lock->destroy(rel->lock);
+		shard->relations->destroy(shard->relations);
+		shard->subjects->destroy(shard->subjects);
+		shard->lock->destroy(shard->lock);
+		shard->mutex->destroy(shard->mutex);
 	}
 	free(this);
 }
@@ -374,6 +627,7 @@ METHOD(cert_cache_t, destroy, void,
 cert_cache_t *cert_cache_create()
 {
 	private_cert_cache_t *this;
+	u_int size;
 	int i;
 
 	INIT(this,
@@ -391,12 +645,18 @@ cert_cache_t *cert_cache_create()
 		},
 	);
 
-	for (i = 0; i < CACHE_SIZE; i++)
+	size = lib->settings->get_int(lib->settings, "libstrongswan.cert_cache_size",
+								  CACHE_SIZE_DEFAULT);
+	this->shard_size = max(1, (size + SHARDS - 1) / SHARDS);
+
+	for (i = 0; i < SHARDS; i++)
 	{
-		this->relations[i].subject = NULL;
-		this->relations[i].issuer = NULL;
-		this->relations[i].hits = 0;
-		this->relations[i].lock = rwlock_create(RWLOCK_TYPE_DEFAULT);
+		this->shards[i].relations = hashtable_create((hashtable_hash_t)hash,
+										(hashtable_equals_t)equals, 8);
+		this->shards[i].subjects = hashtable_create((hashtable_hash_t)id_hash,
+										(hashtable_equals_t)id_equals, 8);
+		this->shards[i].lock = rwlock_create(RWLOCK_TYPE_DEFAULT);
+		this->shards[i].mutex = mutex_create(MUTEX_TYPE_DEFAULT);
 	}
 
 	return &this->public;
@@ -19,9 +19,46 @@
 
 #include <threading/rwlock.h>
 #include <collections/linked_list.h>
+#include <collections/hashtable.h>
+#include <credentials/certificates/x509.h>
+
+/**
+ * Maximum number of lists merged by an index lookup
+ */
+#define MAX_LOOKUP_LISTS 3
 
 typedef struct private_mem_cred_t private_mem_cred_t;
 
+/**
+ * Entry of a credential index
+ */
+typedef struct {
+	/** indexed credential */
+	void *item;
+	/** insertion sequence number, newer entries get a higher number */
+	u_int seq;
+	/** hashes the entry is indexed under, none if it is a wildcard */
+	u_int *hashes;
+	/** number of hashes */
+	int count;
+} entry_t;
+
+/**
+ * Index over credentials by hashes of identities or key identifiers.
+ *
+ * Entries that can't be indexed are kept in a wildcard list and returned
+ * for every lookup. Lookups return entries in insertion order, newest first,
+ * same as the plain lists used before.
+ */
+typedef struct {
+	/** all entries, newest first, as entry_t */
+	linked_list_t *all;
+	/** hash => linked_list_t of indexed entries, newest first */
+	hashtable_t *buckets;
+	/** entries without hashes, newest first, as entry_t */
+	linked_list_t *wildcards;
+} index_t;
+
 /**
  * Private data of an mem_cred_t object.
  */
@@ -38,31 +75,434 @@ struct private_mem_cred_t {
 	rwlock_t *lock;
 
 	/**
-	 * List of trusted certificates, certificate_t
+	 * Index of trusted certificates, certificate_t
 	 */
-	linked_list_t *trusted;
+	index_t *trusted;
 
 	/**
-	 * List of trusted and untrusted certificates, certificate_t
+	 * Index of trusted and untrusted certificates, certificate_t
 	 */
-	linked_list_t *untrusted;
+	index_t *untrusted;
 
 	/**
-	 * List of private keys, private_key_t
+	 * Index of private keys, private_key_t
 	 */
-	linked_list_t *keys;
+	index_t *keys;
 
 	/**
-	 * List of shared keys, as shared_entry_t
+	 * Index of shared keys, as shared_entry_t
 	 */
-	linked_list_t *shared;
+	index_t *shared;
 
 	/**
 	 * List of CDPs, as cdp_t
 	 */
 	linked_list_t *cdps;
+
+	/**
+	 * Sequence number for the next index entry
+	 */
+	u_int seq;
 };
 
+/**
+ * Hashtable hash function, keys are hashes already
+ */
+static u_int hash_key(void *key)
+{
+	return (uintptr_t)key;
+}
+
+/**
+ * Hashtable equals function
+ */
+static bool equals_key(void *a, void *b)
+{
+	return a == b;
+}
+
+/**
+ * Create an index entry for an item, without any hashes
+ */
+static entry_t *entry_create(private_mem_cred_t *this, void *item)
+{
+	entry_t *entry;
+
+	INIT(entry,
+		.item = item,
+		.seq = this->seq++,
+	);
+	return entry;
+}
+
+/**
+ * Add a hash to an entry, if it does not have it already
+ */
+static void entry_add_hash(entry_t *entry, u_int hash)
+{
+	int i;
+
+	for (i = 0; i < entry->count; i++)
+	{
+		if (entry->hashes[i] == hash)
+		{
+			return;
+		}
+	}
+	entry->hashes = realloc(entry->hashes, sizeof(u_int) * (entry->count + 1));
+	entry->hashes[entry->count++] = hash;
+}
+
+/**
+ * Add the hash of a binary key identifier to an entry
+ */
+static void entry_add_chunk(entry_t *entry, chunk_t chunk)
+{
+	if (chunk.len)
+	{
+		entry_add_hash(entry, chunk_hash(chunk));
+	}
+}
+
+/**
+ * Add the hashes of all key fingerprints of a public key to an entry
+ */
+static void entry_add_pubkey(entry_t *entry, public_key_t *public)
+{
+	cred_encoding_type_t type;
+	chunk_t fp;
+
+	/* some certificates match key identifiers against any encoding */
+	for (type = 0; type < CRED_ENCODING_MAX; type++)
+	{
+		if (public->get_fingerprint(public, type, &fp))
+		{
+			entry_add_chunk(entry, fp);
+		}
+	}
+}
+
+/**
+ * Destroy an index entry, but not the item
+ */
+static void entry_destroy(entry_t *entry)
+{
+	free(entry->hashes);
+	free(entry);
+}
+
+/**
+ * Create an empty index
+ */
+static index_t *index_create()
+{
+	index_t *index;
+
+	INIT(index,
+		.all = linked_list_create(),
+		.buckets = hashtable_create(hash_key, equals_key, 32),
+		.wildcards = linked_list_create(),
+	);
+	return index;
+}
+
+/**
+ * Add an entry to an index, as newest entry
+ */
+static void index_add(index_t *index, entry_t *entry)
+{
+	linked_list_t *bucket;
+	int i;
+
+	index->all->insert_first(index->all, entry);
+	if (!entry->count)
+	{
+		index->wildcards->insert_first(index->wildcards, entry);
+	}
+	for (i = 0; i < entry->count; i++)
+	{
+		bucket = index->buckets->get(index->buckets,
+									 (void*)(uintptr_t)entry->hashes[i]);
+		if (!bucket)
+		{
+			bucket = linked_list_create();
+			index->buckets->put(index->buckets,
+								(void*)(uintptr_t)entry->hashes[i], bucket);
+		}
+		bucket->insert_first(bucket, entry);
+	}
+}
+
+/**
+ * Remove an entry from an index, but do not destroy it
+ */
+static void index_remove(index_t *index, entry_t *entry)
+{
+	linked_list_t *bucket;
+	int i;
+
+	index->all->remove(index->all, entry, NULL);
+	if (!entry->count)
+	{
+		index->wildcards->remove(index->wildcards, entry, NULL);
+	}
+	for (i = 0; i < entry->count; i++)
+	{
+		bucket = index->buckets->get(index->buckets,
+									 (void*)(uintptr_t)entry->hashes[i]);
+		if (bucket)
+		{
+			bucket->remove(bucket, entry, NULL);
+			if (!bucket->get_count(bucket))
+			{
+				index->buckets->remove(index->buckets,
+									   (void*)(uintptr_t)entry->hashes[i]);
+				bucket->destroy(bucket);
+			}
+		}
+	}
+}
+
+/**
+ * Destroy an index, destroy items using the given function, if any
+ */
+static void index_destroy(index_t *index, void (*destroy)(void*))
+{
+	enumerator_t *enumerator;
+	linked_list_t *bucket;
+	entry_t *entry;
+
+	enumerator = index->buckets->create_enumerator(index->buckets);
+	while (enumerator->enumerate(enumerator, NULL, &bucket))
+	{
+		bucket->destroy(bucket);
+	}
+	enumerator->destroy(enumerator);
+	index->buckets->destroy(index->buckets);
+	index->wildcards->destroy(index->wildcards);
+	while (index->all->remove_first(index->all, (void**)&entry) == SUCCESS)
+	{
+		if (destroy)
+		{
+			destroy(entry->item);
+		}
+		entry_destroy(entry);
+	}
+	index->all->destroy(index->all);
+	free(index);
+}
+
+/**
+ * Enumerator merging the lists of an index lookup by sequence number
+ */
+typedef struct {
+	/** implements enumerator_t */
+	enumerator_t public;
+	/** enumerators over the merged lists */
+	enumerator_t *lists[MAX_LOOKUP_LISTS];
+	/** next entry of each list, NULL if exhausted */
+	entry_t *next[MAX_LOOKUP_LISTS];
+	/** number of merged lists */
+	int count;
+	/** last returned entry, to skip entries found in multiple lists */
+	entry_t *last;
+} index_enumerator_t;
+
+METHOD(enumerator_t, index_enumerate, bool,
+	index_enumerator_t *this, void **item)
+{
+	entry_t *entry;
+	int i, best;
+
+	while (TRUE)
+	{
+		best = -1;
+		for (i = 0; i < this->count; i++)
+		{
+			if (this->next[i] &&
+				(best < 0 || this->next[i]->seq > this->next[best]->seq))
+			{
+				best = i;
+			}
+		}
+		if (best < 0)
+		{
+			return FALSE;
+		}
+		entry = this->next[best];
+		if (!this->lists[best]->enumerate(this->lists[best],
+										  &this->next[best]))
+		{
+			this->next[best] = NULL;
+		}
+		if (entry != this->last)
+		{
+			this->last = entry;
+			*item = entry->item;
+			return TRUE;
+		}
+	}
+}
+
+METHOD(enumerator_t, index_enumerator_destroy, void,
+	index_enumerator_t *this)
+{
+	int i;
+
+	for (i = 0; i < this->count; i++)
+	{
+		this->lists[i]->destroy(this->lists[i]);
+	}
+	free(this);
+}
+
+/**
+ * Add a list to an index enumerator
+ */
+static void index_enumerator_add(index_enumerator_t *this, linked_list_t *list)
+{
+	enumerator_t *enumerator;
+
+	if (list && list->get_count(list) && this->count < MAX_LOOKUP_LISTS)
+	{
+		enumerator = list->create_enumerator(list);
+		if (!enumerator->enumerate(enumerator, &this->next[this->count]))
+		{
+			this->next[this->count] = NULL;
+		}
+		this->lists[this->count++] = enumerator;
+	}
+}
+
+/**
+ * Create an enumerator over the items of an index indexed under one of the
+ * given hashes, plus all wildcard items. With no hashes, all items are
+ * enumerated.
+ */
+static enumerator_t *index_create_enumerator(index_t *index, u_int *hashes,
+											 int count)
+{
+	index_enumerator_t *this;
+	int i, j;
+
+	INIT(this,
+		.public = {
+			.enumerate = (void*)_index_enumerate,
+			.destroy = _index_enumerator_destroy,
+		},
+	);
+	if (!count)
+	{
+		index_enumerator_add(this, index->all);
+		return &this->public;
+	}
+	index_enumerator_add(this, index->wildcards);
+	for (i = 0; i < count; i++)
+	{
+		for (j = 0; j < i; j++)
+		{
+			if (hashes[i] == hashes[j])
+			{
+				break;
+			}
+		}
+		if (j == i)
+		{
+			index_enumerator_add(this, index->buckets->get(index->buckets,
+											(void*)(uintptr_t)hashes[i]));
+		}
+	}
+	return &this->public;
+}
+
+/**
+ * Create an index entry for a certificate, indexed by subject, subjectAltNames
+ * and key identifiers for the certificate types supporting it
+ */
+static entry_t *cert_entry_create(private_mem_cred_t *this,
+								  certificate_t *cert)
+{
+	identification_t *id;
+	public_key_t *public;
+	enumerator_t *enumerator;
+	hasher_t *hasher;
+	x509_t *x509;
+	entry_t *entry;
+	chunk_t encoding, hash;
+
+	entry = entry_create(this, cert);
+	id = cert->get_subject(cert);
+	if (!id)
+	{
+		return entry;
+	}
+	switch (cert->get_type(cert))
+	{
+		case CERT_X509:
+			x509 = (x509_t*)cert;
+			enumerator = x509->create_subjectAltName_enumerator(x509);
+			while (enumerator->enumerate(enumerator, &id))
+			{
+				entry_add_hash(entry, id->hash(id, 0));
+			}
+			enumerator->destroy(enumerator);
+			entry_add_chunk(entry, x509->get_subjectKeyIdentifier(x509));
+			entry_add_chunk(entry, x509->get_serial(x509));
+			/* x509 certificates match against the SHA1 of their encoding */
+			hasher = lib->crypto->create_hasher(lib->crypto, HASH_SHA1);
+			if (!hasher)
+			{	/* can't index all identifiers, use a wildcard entry */
+				free(entry->hashes);
+				entry->hashes = NULL;
+				entry->count = 0;
+				return entry;
+			}
+			if (cert->get_encoding(cert, CERT_ASN1_DER, &encoding))
+			{
+				if (hasher->allocate_hash(hasher, encoding, &hash))
+				{
+					entry_add_chunk(entry, hash);
+					chunk_free(&hash);
+				}
+				chunk_free(&encoding);
+			}
+			hasher->destroy(hasher);
+			/* FALL */
+		case CERT_TRUSTED_PUBKEY:
+			id = cert->get_subject(cert);
+			entry_add_hash(entry, id->hash(id, 0));
+			public = cert->get_public_key(cert);
+			if (public)
+			{
+				entry_add_pubkey(entry, public);
+				public->destroy(public);
+			}
+			break;
+		default:
+			break;
+	}
+	return entry;
+}
+
+/**
+ * Collect the hashes to look up for an identity in a certificate or key index,
+ * returns the number of hashes
+ */
+static int id_hashes(identification_t *id, bool keyid, u_int hashes[2])
+{
+	int count = 0;
+
+	if (id && id->get_type(id) != ID_ANY && !id->contains_wildcards(id))
+	{
+		hashes[count++] = chunk_hash(id->get_encoding(id));
+		if (!keyid)
+		{
+			hashes[count++] = id->hash(id, 0);
+		}
+	}
+	return count;
+}
+
 /**
  * Data for the certificate enumerator
  */
@@ -126,6 +566,8 @@ METHOD(credential_set_t, create_cert_enumerator, enumerator_t*,
 {
 	cert_data_t *data;
 	enumerator_t *enumerator;
+	u_int hashes[2];
+	int count;
 
 	INIT(data,
 		.lock = this->lock,
@@ -133,22 +575,41 @@ METHOD(credential_set_t, create_cert_enumerator, enumerator_t*,
 		.key = key,
 		.id = id,
 	);
+	count = id_hashes(id, FALSE, hashes);
 	this->lock->read_lock(this->lock);
-	if (trusted)
-	{
-		enumerator = this->trusted->create_enumerator(this->trusted);
-	}
-	else
-	{
-		enumerator = this->untrusted->create_enumerator(this->untrusted);
-	}
+	enumerator = index_create_enumerator(trusted ? this->trusted
+												 : this->untrusted,
+										 hashes, count);
 	return enumerator_create_filter(enumerator, (void*)certs_filter, data,
 									(void*)cert_data_destroy);
 }
 
-static bool certificate_equals(certificate_t *item, certificate_t *cert)
+/**
+ * Find a cached certificate equal to the given one
+ */
+static certificate_t *find_cert(private_mem_cred_t *this, certificate_t *cert)
 {
-	return item->equals(item, cert);
+	certificate_t *current, *found = NULL;
+	identification_t *id;
+	enumerator_t *enumerator;
+	u_int hash = 0;
+
+	id = cert->get_subject(cert);
+	if (id)
+	{
+		hash = id->hash(id, 0);
+	}
+	enumerator = index_create_enumerator(this->untrusted, &hash, id ? 1 : 0);
+	while (enumerator->enumerate(enumerator, &current))
+	{
+		if (current->equals(current, cert))
+		{
+			found = current;
+			break;
+		}
+	}
+	enumerator->destroy(enumerator);
+	return found;
 }
 
 /**
@@ -160,9 +621,8 @@ static certificate_t *add_cert_internal(private_mem_cred_t *this, bool trusted,
 {
 	certificate_t *cached;
 	this->lock->write_lock(this->lock);
-	if (this->untrusted->find_first(this->untrusted,
-									(linked_list_match_t)certificate_equals,
-									(void**)&cached, cert) == SUCCESS)
+	cached = find_cert(this, cert);
+	if (cached)
 	{
 		cert->destroy(cert);
 		cert = cached->get_ref(cached);
@@ -171,9 +631,11 @@ static certificate_t *add_cert_internal(private_mem_cred_t *this, bool trusted,
 	{
 		if (trusted)
 		{
-			this->trusted->insert_first(this->trusted, cert->get_ref(cert));
+			index_add(this->trusted,
+					  cert_entry_create(this, cert->get_ref(cert)));
 		}
-		this->untrusted->insert_first(this->untrusted, cert->get_ref(cert));
+		index_add(this->untrusted,
+				  cert_entry_create(this, cert->get_ref(cert)));
 	}
 	this->lock->unlock(this->lock);
 	return cert;
@@ -197,12 +659,16 @@ METHOD(mem_cred_t, add_crl, bool,
 {
 	certificate_t *current, *cert = &crl->certificate;
 	enumerator_t *enumerator;
+	entry_t *entry, *found = NULL;
 	bool new = TRUE;
 
 	this->lock->write_lock(this->lock);
-	enumerator = this->untrusted->create_enumerator(this->untrusted);
-	while (enumerator->enumerate(enumerator, (void**)&current))
+	/* CRLs are not indexed, so they are all in the wildcard list */
+	enumerator = this->untrusted->wildcards->create_enumerator(
+												this->untrusted->wildcards);
+	while (enumerator->enumerate(enumerator, &entry))
 	{
+		current = entry->item;
 		if (current->get_type(current) == CERT_X509_CRL)
 		{
 			bool found = FALSE;
@@ -231,7 +697,7 @@ METHOD(mem_cred_t, add_crl, bool,
 				new = crl_is_newer(crl, crl_c);
 				if (new)
 				{
-					this->untrusted->remove_at(this->untrusted, enumerator);
+					found = entry;
 				}
 				else
 				{
@@ -243,9 +709,16 @@ METHOD(mem_cred_t, add_crl, bool,
 	}
 	enumerator->destroy(enumerator);
 
+	if (found)
+	{
+		index_remove(this->untrusted, found);
+		current = found->item;
+		current->destroy(current);
+		entry_destroy(found);
+	}
 	if (new)
 	{
-		this->untrusted->insert_first(this->untrusted, cert);
+		index_add(this->untrusted, cert_entry_create(this, cert));
 	}
 	this->lock->unlock(this->lock);
 	return new;
@@ -293,22 +766,46 @@ METHOD(credential_set_t, create_private_enumerator, enumerator_t*,
 	private_mem_cred_t *this, key_type_t type, identification_t *id)
 {
 	key_data_t *data;
+	u_int hashes[2];
+	int count;
 
 	INIT(data,
 		.lock = this->lock,
 		.type = type,
 		.id = id,
 	);
+	count = id_hashes(id, TRUE, hashes);
 	this->lock->read_lock(this->lock);
-	return enumerator_create_filter(this->keys->create_enumerator(this->keys),
-							(void*)key_filter, data, (void*)key_data_destroy);
+	return enumerator_create_filter(
+						index_create_enumerator(this->keys, hashes, count),
+						(void*)key_filter, data, (void*)key_data_destroy);
+}
+
+/**
+ * Create an index entry for a private key, indexed by its key identifiers
+ */
+static entry_t *key_entry_create(private_mem_cred_t *this, private_key_t *key)
+{
+	cred_encoding_type_t type;
+	entry_t *entry;
+	chunk_t fp;
+
+	entry = entry_create(this, key);
+	for (type = 0; type < KEYID_MAX; type++)
+	{
+		if (key->get_fingerprint(key, type, &fp))
+		{
+			entry_add_chunk(entry, fp);
+		}
+	}
+	return entry;
 }
 
 METHOD(mem_cred_t, add_key, void,
 	private_mem_cred_t *this, private_key_t *key)
 {
 	this->lock->write_lock(this->lock);
-	this->keys->insert_first(this->keys, key);
+	index_add(this->keys, key_entry_create(this, key));
 	this->lock->unlock(this->lock);
 }
 
@@ -419,6 +916,8 @@ METHOD(credential_set_t, create_shared_enumerator, enumerator_t*,
 	identification_t *me, identification_t *other)
 {
 	shared_data_t *data;
+	u_int hashes[2];
+	int count = 0;
 
 	INIT(data,
 		.lock = this->lock,
@@ -426,12 +925,67 @@ METHOD(credential_set_t, create_shared_enumerator, enumerator_t*,
 		.other = other,
 		.type = type,
 	);
+	if (me || other)
+	{	/* fall back to a full scan for wildcard queries */
+		if (me && (me->get_type(me) == ID_ANY || me->contains_wildcards(me)))
+		{
+			me = NULL;
+			other = NULL;
+		}
+		if (other && (other->get_type(other) == ID_ANY ||
+					  other->contains_wildcards(other)))
+		{
+			me = NULL;
+			other = NULL;
+		}
+		if (me)
+		{
+			hashes[count++] = me->hash(me, 0);
+		}
+		if (other)
+		{
+			hashes[count++] = other->hash(other, 0);
+		}
+	}
 	data->lock->read_lock(data->lock);
 	return enumerator_create_filter(
-						this->shared->create_enumerator(this->shared),
+						index_create_enumerator(this->shared, hashes, count),
 						(void*)shared_filter, data, (void*)shared_data_destroy);
 }
 
+/**
+ * Create an index entry for a shared key, indexed by its owners. Entries
+ * with wildcard owners go to the wildcard list.
+ */
+static entry_t *shared_entry_index(private_mem_cred_t *this,
+								   shared_entry_t *shared)
+{
+	enumerator_t *enumerator;
+	identification_t *id;
+	entry_t *entry;
+	bool wildcard = FALSE;
+
+	entry = entry_create(this, shared);
+	enumerator = shared->owners->create_enumerator(shared->owners);
+	while (enumerator->enumerate(enumerator, &id))
+	{
+		if (id->get_type(id) == ID_ANY || id->contains_wildcards(id))
+		{
+			wildcard = TRUE;
+			break;
+		}
+		entry_add_hash(entry, id->hash(id, 0));
+	}
+	enumerator->destroy(enumerator);
+	if (wildcard)
+	{
+		free(entry->hashes);
+		entry->hashes = NULL;
+		entry->count = 0;
+	}
+	return entry;
+}
+
 METHOD(mem_cred_t, add_shared_list, void,
 	private_mem_cred_t *this, shared_key_t *shared, linked_list_t* owners)
 {
@@ -443,7 +997,7 @@ METHOD(mem_cred_t, add_shared_list, void,
 	);
 
 	this->lock->write_lock(this->lock);
-	this->shared->insert_first(this->shared, entry);
+	index_add(this->shared, shared_entry_index(this, entry));
 	this->lock->unlock(this->lock);
 }
 
@@ -555,57 +1109,101 @@ METHOD(credential_set_t, create_cdp_enumerator, enumerator_t*,
 
 }
 
+/**
+ * Destroy a certificate
+ */
+static void cert_destroy(certificate_t *cert)
+{
+	cert->destroy(cert);
+}
+
+/**
+ * Destroy a private key
+ */
+static void key_destroy(private_key_t *key)
+{
+	key->destroy(key);
+}
+
 static void reset_secrets(private_mem_cred_t *this)
 {
-	this->keys->destroy_offset(this->keys, offsetof(private_key_t, destroy));
-	this->shared->destroy_function(this->shared, (void*)shared_entry_destroy);
-	this->keys = linked_list_create();
-	this->shared = linked_list_create();
+	index_destroy(this->keys, (void*)key_destroy);
+	index_destroy(this->shared, (void*)shared_entry_destroy);
+	this->keys = index_create();
+	this->shared = index_create();
+}
+
+/**
+ * Get the items of an index in reverse order, oldest first
+ */
+static void **index_get_reversed(index_t *index, int *count)
+{
+	enumerator_t *enumerator;
+	entry_t *entry;
+	void **items;
+	int i;
+
+	*count = index->all->get_count(index->all);
+	items = malloc(sizeof(void*) * max(*count, 1));
+	i = *count;
+	enumerator = index->all->create_enumerator(index->all);
+	while (enumerator->enumerate(enumerator, &entry))
+	{
+		items[--i] = entry->item;
+	}
+	enumerator->destroy(enumerator);
+	return items;
 }
 
 METHOD(mem_cred_t, replace_secrets, void,
 	private_mem_cred_t *this, mem_cred_t *other_set, bool clone)
 {
 	private_mem_cred_t *other = (private_mem_cred_t*)other_set;
-	enumerator_t *enumerator;
 	shared_entry_t *entry, *new_entry;
 	private_key_t *key;
+	void **items;
+	int i, count;
 
 	this->lock->write_lock(this->lock);
 
 	reset_secrets(this);
 
-	if (clone)
+	/* add the items oldest first to preserve their order */
+	items = index_get_reversed(other->keys, &count);
+	for (i = 0; i < count; i++)
 	{
-		enumerator = other->keys->create_enumerator(other->keys);
-		while (enumerator->enumerate(enumerator, &key))
+		key = items[i];
+		if (clone)
 		{
-			this->keys->insert_last(this->keys, key->get_ref(key));
+			key = key->get_ref(key);
 		}
-		enumerator->destroy(enumerator);
-		enumerator = other->shared->create_enumerator(other->shared);
-		while (enumerator->enumerate(enumerator, &entry))
+		index_add(this->keys, key_entry_create(this, key));
+	}
+	free(items);
+
+	items = index_get_reversed(other->shared, &count);
+	for (i = 0; i < count; i++)
+	{
+		entry = items[i];
+		if (clone)
 		{
 			INIT(new_entry,
 				.shared = entry->shared->get_ref(entry->shared),
 				.owners = entry->owners->clone_offset(entry->owners,
 											offsetof(identification_t, clone)),
 			);
-			this->shared->insert_last(this->shared, new_entry);
+			entry = new_entry;
 		}
-		enumerator->destroy(enumerator);
+		index_add(this->shared, shared_entry_index(this, entry));
 	}
-	else
+	free(items);
+
+	if (!clone)
 	{
-		while (other->keys->remove_first(other->keys, (void**)&key) == SUCCESS)
-		{
-			this->keys->insert_last(this->keys, key);
-		}
-		while (other->shared->remove_first(other->shared,
-										  (void**)&entry) == SUCCESS)
-		{
-			this->shared->insert_last(this->shared, entry);
-		}
+		index_destroy(other->keys, NULL);
+		index_destroy(other->shared, NULL);
+		other->keys = index_create();
+		other->shared = index_create();
 	}
 	this->lock->unlock(this->lock);
 }
@@ -622,13 +1220,11 @@ METHOD(mem_cred_t, clear_, void,
 	private_mem_cred_t *this)
 {
 	this->lock->write_lock(this->lock);
-	this->trusted->destroy_offset(this->trusted,
-								  offsetof(certificate_t, destroy));
-	this->untrusted->destroy_offset(this->untrusted,
-									offsetof(certificate_t, destroy));
+	index_destroy(this->trusted, (void*)cert_destroy);
+	index_destroy(this->untrusted, (void*)cert_destroy);
 	this->cdps->destroy_function(this->cdps, (void*)cdp_destroy);
-	this->trusted = linked_list_create();
-	this->untrusted = linked_list_create();
+	this->trusted = index_create();
+	this->untrusted = index_create();
 	this->cdps = linked_list_create();
 	this->lock->unlock(this->lock);
 
@@ -639,10 +1235,10 @@ METHOD(mem_cred_t, destroy, void,
 	private_mem_cred_t *this)
 {
 	clear_(this);
-	this->trusted->destroy(this->trusted);
-	this->untrusted->destroy(this->untrusted);
-	this->keys->destroy(this->keys);
-	this->shared->destroy(this->shared);
+	index_destroy(this->trusted, NULL);
+	index_destroy(this->untrusted, NULL);
+	index_destroy(this->keys, NULL);
+	index_destroy(this->shared, NULL);
 	this->cdps->destroy(this->cdps);
 	this->lock->destroy(this->lock);
 	free(this);
@@ -676,10 +1272,10 @@ mem_cred_t *mem_cred_create()
 			.clear_secrets = _clear_secrets,
 			.destroy = _destroy,
 		},
-		.trusted = linked_list_create(),
-		.untrusted = linked_list_create(),
-		.keys = linked_list_create(),
-		.shared = linked_list_create(),
+		.trusted = index_create(),
+		.untrusted = index_create(),
+		.keys = index_create(),
+		.shared = index_create(),
 		.cdps = linked_list_create(),
 		.lock = rwlock_create(RWLOCK_TYPE_DEFAULT),
 	);
@@ -19,6 +19,7 @@
 #include <threading/rwlock.h>
 #include <collections/linked_list.h>
 #include <crypto/crypto_tester.h>
+#include <crypto/dh_pool.h>
 
 const char *default_plugin_name = "default";
 
@@ -113,6 +114,11 @@ struct private_crypto_factory_t {
 	 */
 	crypto_tester_t *tester;
 
+	/**
+	 * pool of precomputed DH key pairs, if configured
+	 */
+	dh_pool_t *dh_pool;
+
 	/**
 	 * whether to test algorithms during registration
 	 */
@@ -354,24 +360,16 @@ METHOD(crypto_factory_t, create_nonce_gen, nonce_gen_t*,
 	return nonce_gen;
 }
 
-METHOD(crypto_factory_t, create_dh, diffie_hellman_t*,
-	private_crypto_factory_t *this, diffie_hellman_group_t group, ...)
+/**
+ * Create a DH object using the registered constructors, lock must be held
+ */
+static diffie_hellman_t *create_dh_locked(private_crypto_factory_t *this,
+							diffie_hellman_group_t group, chunk_t g, chunk_t p)
 {
 	enumerator_t *enumerator;
 	entry_t *entry;
-	va_list args;
-	chunk_t g = chunk_empty, p = chunk_empty;
 	diffie_hellman_t *diffie_hellman = NULL;
 
-	if (group == MODP_CUSTOM)
-	{
-		va_start(args, group);
-		g = va_arg(args, chunk_t);
-		p = va_arg(args, chunk_t);
-		va_end(args);
-	}
-
-	this->lock->read_lock(this->lock);
 	enumerator = this->dhs->create_enumerator(this->dhs);
 	while (enumerator->enumerate(enumerator, &entry))
 	{
@@ -385,6 +383,55 @@ METHOD(crypto_factory_t, create_dh, diffie_hellman_t*,
 		}
 	}
 	enumerator->destroy(enumerator);
+	return diffie_hellman;
+}
+
+/**
+ * Precompute a DH key pair for the pool, see dh_pool_fill_t
+ */
+static bool fill_dh_pool(private_crypto_factory_t *this,
+						 diffie_hellman_group_t group)
+{
+	diffie_hellman_t *diffie_hellman;
+
+	/* keep the lock while adding to the pool, so the backend can't get
+	 * unregistered in between */
+	this->lock->read_lock(this->lock);
+	diffie_hellman = create_dh_locked(this, group, chunk_empty, chunk_empty);
+	if (diffie_hellman &&
+		!this->dh_pool->put(this->dh_pool, group, diffie_hellman))
+	{
+		diffie_hellman->destroy(diffie_hellman);
+	}
+	this->lock->unlock(this->lock);
+	return diffie_hellman != NULL;
+}
+
+METHOD(crypto_factory_t, create_dh, diffie_hellman_t*,
+	private_crypto_factory_t *this, diffie_hellman_group_t group, ...)
+{
+	va_list args;
+	chunk_t g = chunk_empty, p = chunk_empty;
+	diffie_hellman_t *diffie_hellman;
+
+	if (group == MODP_CUSTOM)
+	{
+		va_start(args, group);
+		g = va_arg(args, chunk_t);
+		p = va_arg(args, chunk_t);
+		va_end(args);
+	}
+	else if (this->dh_pool)
+	{
+		diffie_hellman = this->dh_pool->get(this->dh_pool, group);
+		if (diffie_hellman)
+		{
+			return diffie_hellman;
+		}
+	}
+
+	this->lock->read_lock(this->lock);
+	diffie_hellman = create_dh_locked(this, group, g, p);
 	this->lock->unlock(this->lock);
 	return diffie_hellman;
 }
@@ -671,6 +718,10 @@ METHOD(crypto_factory_t, add_dh, void,
 	 const char *plugin_name, dh_constructor_t create)
 {
 	add_entry(this, this->dhs, group, plugin_name, 0, create);
+	if (this->dh_pool)
+	{
+		this->dh_pool->refill(this->dh_pool, group);
+	}
 }
 
 METHOD(crypto_factory_t, remove_dh, void,
@@ -690,6 +741,10 @@ METHOD(crypto_factory_t, remove_dh, void,
 		}
 	}
 	enumerator->destroy(enumerator);
+	if (this->dh_pool)
+	{	/* pooled key pairs might have been created by this backend */
+		this->dh_pool->flush(this->dh_pool);
+	}
 	this->lock->unlock(this->lock);
 }
 
@@ -820,6 +875,16 @@ METHOD(crypto_factory_t, create_dh_enumerator, enumerator_t*,
 	return create_enumerator(this, this->dhs, dh_filter);
 }
 
+METHOD(crypto_factory_t, create_dh_pool_enumerator, enumerator_t*,
+	private_crypto_factory_t *this)
+{
+	if (this->dh_pool)
+	{
+		return this->dh_pool->create_enumerator(this->dh_pool);
+	}
+	return enumerator_create_empty();
+}
+
 /**
  * Filter function to enumerate strength, not entry
  */
@@ -885,6 +950,7 @@ METHOD(crypto_factory_t, destroy, void,
 	this->prfs->destroy(this->prfs);
 	this->rngs->destroy(this->rngs);
 	this->nonce_gens->destroy(this->nonce_gens);
+	DESTROY_IF(this->dh_pool);
 	this->dhs->destroy(this->dhs);
 	this->tester->destroy(this->tester);
 	this->lock->destroy(this->lock);
@@ -930,6 +996,7 @@ crypto_factory_t *crypto_factory_create()
 			.create_hasher_enumerator = _create_hasher_enumerator,
 			.create_prf_enumerator = _create_prf_enumerator,
 			.create_dh_enumerator = _create_dh_enumerator,
+			.create_dh_pool_enumerator = _create_dh_pool_enumerator,
 			.create_rng_enumerator = _create_rng_enumerator,
 			.create_nonce_gen_enumerator = _create_nonce_gen_enumerator,
 			.add_test_vector = _add_test_vector,
@@ -952,6 +1019,7 @@ crypto_factory_t *crypto_factory_create()
 		.bench = lib->settings->get_bool(lib->settings,
 								"libstrongswan.crypto_test.bench", FALSE),
 	);
+	this->dh_pool = dh_pool_create((dh_pool_fill_t)fill_dh_pool, this);
 
 	return &this->public;
 }
@@ -148,7 +148,9 @@ struct crypto_factory_t {
 	/**
 	 * Create a diffie hellman instance.
 	 *
-	 * Additional arguments are passed to the DH constructor.
+	 * Additional arguments are passed to the DH constructor. For groups
+	 * configured in libstrongswan.dh_pool.groups, a precomputed instance
+	 * is returned, if available.
 	 *
 	 * @param group			diffie hellman group
 	 * @return				diffie_hellman_t instance, NULL if not supported
@@ -343,6 +345,17 @@ struct crypto_factory_t {
 	 */
 	enumerator_t* (*create_dh_enumerator)(crypto_factory_t *this);
 
+	/**
+	 * Create an enumerator over the pools of precomputed DH key pairs.
+	 *
+	 * Enumerates the group, the number of pooled key pairs, the pool size,
+	 * and the number of requests served from and missed by the pool.
+	 *
+	 * @return				enumerator over diffie_hellman_group_t, u_int,
+	 *						u_int, u_int, u_int
+	 */
+	enumerator_t* (*create_dh_pool_enumerator)(crypto_factory_t *this);
+
 	/**
 	 * Create an enumerator over all registered random generators.
 	 *
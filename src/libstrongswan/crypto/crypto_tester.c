@@ -17,6 +17,7 @@
 #define _GNU_SOURCE
 #include <dlfcn.h>
 #include <time.h>
+#include <inttypes.h>
 
 #include "crypto_tester.h"
 
@@ -310,6 +311,19 @@ failure:
 	return !failed;
 }
 
+/**
+ * Calculate the throughput in kB/s of a benchmark, each run processing half
+ * a buffer
+ */
+static u_int64_t get_throughput(private_crypto_tester_t *this, u_int runs)
+{
+	if (this->bench_time <= 0)
+	{
+		return 0;
+	}
+	return (u_int64_t)runs * this->bench_size / 2 / this->bench_time;
+}
+
 /**
  * Benchmark an aead transform
  */
@@ -487,8 +501,10 @@ failure:
 		if (speed)
 		{
 			*speed = bench_aead(this, alg, create);
-			DBG1(DBG_LIB, "enabled  %N[%s]: passed %u test vectors, %d points",
-				 encryption_algorithm_names, alg, plugin_name, tested, *speed);
+			DBG1(DBG_LIB, "enabled  %N[%s]: passed %u test vectors, %d points "
+				 "(%" PRIu64 " kB/s with %d byte buffers)",
+				 encryption_algorithm_names, alg, plugin_name, tested, *speed,
+				 get_throughput(this, *speed), this->bench_size);
 		}
 		else
 		{
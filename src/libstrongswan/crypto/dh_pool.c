@@ -0,0 +1,332 @@
+/*
+ * Copyright (C) 2013 strongSwan Project
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include "dh_pool.h"
+
+#include <library.h>
+#include <utils/debug.h>
+#include <threading/mutex.h>
+#include <collections/linked_list.h>
+#include <processing/jobs/callback_job.h>
+
+/**
+ * Default number of key pairs to keep per group
+ */
+#define DEFAULT_POOL_SIZE 8
+
+typedef struct private_dh_pool_t private_dh_pool_t;
+
+/**
+ * Private data of a dh_pool_t object.
+ */
+struct private_dh_pool_t {
+
+	/**
+	 * Public dh_pool_t interface.
+	 */
+	dh_pool_t public;
+
+	/**
+	 * Pooled groups, as group_t
+	 */
+	linked_list_t *groups;
+
+	/**
+	 * Callback to generate key pairs
+	 */
+	dh_pool_fill_t fill;
+
+	/**
+	 * User data for callback
+	 */
+	void *data;
+
+	/**
+	 * Lock for all groups
+	 */
+	mutex_t *mutex;
+};
+
+/**
+ * Stock of a pooled DH group
+ */
+typedef struct {
+	/** pool this group belongs to */
+	private_dh_pool_t *pool;
+	/** DH group */
+	diffie_hellman_group_t group;
+	/** precomputed key pairs, as diffie_hellman_t */
+	linked_list_t *stock;
+	/** number of key pairs to keep */
+	u_int size;
+	/** number of key pairs handed out */
+	u_int hits;
+	/** number of requests the stock could not satisfy */
+	u_int misses;
+	/** TRUE if a fill job is queued or running */
+	bool filling;
+} group_t;
+
+/**
+ * Destroy a group entry
+ */
+static void group_destroy(group_t *group)
+{
+	group->stock->destroy_offset(group->stock,
+								 offsetof(diffie_hellman_t, destroy));
+	free(group);
+}
+
+/**
+ * Find the entry of a group, if pooled
+ */
+static group_t *find_group(private_dh_pool_t *this,
+						   diffie_hellman_group_t group)
+{
+	enumerator_t *enumerator;
+	group_t *current, *found = NULL;
+
+	enumerator = this->groups->create_enumerator(this->groups);
+	while (enumerator->enumerate(enumerator, &current))
+	{
+		if (current->group == group)
+		{
+			found = current;
+			break;
+		}
+	}
+	enumerator->destroy(enumerator);
+	return found;
+}
+
+/**
+ * Generate a key pair for a group, requeued until the stock is complete
+ */
+static job_requeue_t fill_job(group_t *group)
+{
+	private_dh_pool_t *this = group->pool;
+	bool filled;
+
+	filled = this->fill(this->data, group->group);
+
+	this->mutex->lock(this->mutex);
+	if (!filled || group->stock->get_count(group->stock) >= group->size)
+	{
+		if (!filled)
+		{
+			DBG1(DBG_LIB, "precomputing %N key pair failed",
+				 diffie_hellman_group_names, group->group);
+		}
+		group->filling = FALSE;
+		this->mutex->unlock(this->mutex);
+		return JOB_REQUEUE_NONE;
+	}
+	this->mutex->unlock(this->mutex);
+	/* give other low priority jobs a chance between key pairs */
+	return JOB_REQUEUE_FAIR;
+}
+
+/**
+ * Schedule a fill job for a group if required, mutex must be held
+ */
+static void schedule_fill(group_t *group)
+{
+	if (!group->filling &&
+		group->stock->get_count(group->stock) < group->size)
+	{
+		group->filling = TRUE;
+		lib->processor->queue_job(lib->processor,
+				(job_t*)callback_job_create_with_prio((callback_job_cb_t)fill_job,
+								group, NULL, NULL, JOB_PRIO_LOW));
+	}
+}
+
+METHOD(dh_pool_t, get, diffie_hellman_t*,
+	private_dh_pool_t *this, diffie_hellman_group_t group)
+{
+	diffie_hellman_t *dh = NULL;
+	group_t *entry;
+
+	this->mutex->lock(this->mutex);
+	entry = find_group(this, group);
+	if (entry)
+	{
+		if (entry->stock->remove_first(entry->stock, (void**)&dh) == SUCCESS)
+		{
+			entry->hits++;
+		}
+		else
+		{
+			entry->misses++;
+		}
+		schedule_fill(entry);
+	}
+	this->mutex->unlock(this->mutex);
+	return dh;
+}
+
+METHOD(dh_pool_t, put, bool,
+	private_dh_pool_t *this, diffie_hellman_group_t group,
+	diffie_hellman_t *dh)
+{
+	group_t *entry;
+	bool added = FALSE;
+
+	this->mutex->lock(this->mutex);
+	entry = find_group(this, group);
+	if (entry && entry->stock->get_count(entry->stock) < entry->size)
+	{
+		entry->stock->insert_last(entry->stock, dh);
+		added = TRUE;
+	}
+	this->mutex->unlock(this->mutex);
+	return added;
+}
+
+METHOD(dh_pool_t, refill, void,
+	private_dh_pool_t *this, diffie_hellman_group_t group)
+{
+	group_t *entry;
+
+	this->mutex->lock(this->mutex);
+	entry = find_group(this, group);
+	if (entry)
+	{
+		schedule_fill(entry);
+	}
+	this->mutex->unlock(this->mutex);
+}
+
+METHOD(dh_pool_t, flush, void,
+	private_dh_pool_t *this)
+{
+	enumerator_t *enumerator;
+	diffie_hellman_t *dh;
+	group_t *entry;
+
+	this->mutex->lock(this->mutex);
+	enumerator = this->groups->create_enumerator(this->groups);
+	while (enumerator->enumerate(enumerator, &entry))
+	{
+		while (entry->stock->remove_last(entry->stock,
+										 (void**)&dh) == SUCCESS)
+		{
+			dh->destroy(dh);
+		}
+	}
+	enumerator->destroy(enumerator);
+	this->mutex->unlock(this->mutex);
+}
+
+/**
+ * Filter function to enumerate group state
+ */
+static bool state_filter(void *n, group_t **in, diffie_hellman_group_t *group,
+						 void *i2, u_int *fill, void *i3, u_int *size,
+						 void *i4, u_int *hits, void *i5, u_int *misses)
+{
+	*group = (*in)->group;
+	*fill = (*in)->stock->get_count((*in)->stock);
+	*size = (*in)->size;
+	*hits = (*in)->hits;
+	*misses = (*in)->misses;
+	return TRUE;
+}
+
+METHOD(dh_pool_t, create_enumerator, enumerator_t*,
+	private_dh_pool_t *this)
+{
+	this->mutex->lock(this->mutex);
+	return enumerator_create_filter(
+				this->groups->create_enumerator(this->groups),
+				(void*)state_filter, this->mutex,
+				(void*)this->mutex->unlock);
+}
+
+METHOD(dh_pool_t, destroy, void,
+	private_dh_pool_t *this)
+{
+	this->groups->destroy_function(this->groups, (void*)group_destroy);
+	this->mutex->destroy(this->mutex);
+	free(this);
+}
+
+/**
+ * Described in header.
+ */
+dh_pool_t *dh_pool_create(dh_pool_fill_t fill, void *data)
+{
+	private_dh_pool_t *this;
+	const proposal_token_t *token;
+	enumerator_t *enumerator;
+	group_t *entry;
+	char *groups, *name;
+	u_int size;
+
+	groups = lib->settings->get_str(lib->settings,
+									"libstrongswan.dh_pool.groups", NULL);
+	size = lib->settings->get_int(lib->settings,
+							"libstrongswan.dh_pool.size", DEFAULT_POOL_SIZE);
+	if (!groups || !size)
+	{
+		return NULL;
+	}
+
+	INIT(this,
+		.public = {
+			.get = _get,
+			.put = _put,
+			.refill = _refill,
+			.flush = _flush,
+			.create_enumerator = _create_enumerator,
+			.destroy = _destroy,
+		},
+		.groups = linked_list_create(),
+		.fill = fill,
+		.data = data,
+		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
+	);
+
+	enumerator = enumerator_create_token(groups, ",", " ");
+	while (enumerator->enumerate(enumerator, &name))
+	{
+		token = lib->proposal->get_token(lib->proposal, name);
+		if (!token || token->type != DIFFIE_HELLMAN_GROUP ||
+			token->algorithm == MODP_NONE || token->algorithm == MODP_CUSTOM)
+		{
+			DBG1(DBG_LIB, "ignoring invalid DH group '%s' in dh_pool.groups",
+				 name);
+			continue;
+		}
+		if (find_group(this, token->algorithm))
+		{
+			continue;
+		}
+		INIT(entry,
+			.pool = this,
+			.group = token->algorithm,
+			.stock = linked_list_create(),
+			.size = size,
+		);
+		this->groups->insert_last(this->groups, entry);
+	}
+	enumerator->destroy(enumerator);
+
+	if (!this->groups->get_count(this->groups))
+	{
+		destroy(this);
+		return NULL;
+	}
+	return &this->public;
+}
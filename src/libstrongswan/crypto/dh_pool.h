@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2013 strongSwan Project
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/**
+ * @defgroup dh_pool dh_pool
+ * @{ @ingroup crypto
+ */
+
+#ifndef DH_POOL_H_
+#define DH_POOL_H_
+
+typedef struct dh_pool_t dh_pool_t;
+
+#include <crypto/diffie_hellman.h>
+#include <collections/enumerator.h>
+
+/**
+ * Callback function to generate a key pair for the pool.
+ *
+ * The callback is expected to add the created key pair using
+ * dh_pool_t.put().
+ *
+ * @param data			user data passed to dh_pool_create()
+ * @param group			DH group to generate a key pair for
+ * @return				TRUE if a key pair has been added
+ */
+typedef bool (*dh_pool_fill_t)(void *data, diffie_hellman_group_t group);
+
+/**
+ * Pool of precomputed ephemeral Diffie-Hellman key pairs.
+ *
+ * Creating a diffie_hellman_t object generates the private and public value,
+ * an expensive operation for MODP groups. For the groups configured in
+ * libstrongswan.dh_pool.groups, the pool keeps key pairs in stock, generated
+ * by a low priority job whenever the stock is below the configured size.
+ */
+struct dh_pool_t {
+
+	/**
+	 * Take a precomputed key pair from the pool.
+	 *
+	 * A refill gets scheduled if the stock of the group runs low.
+	 *
+	 * @param group			DH group to get a key pair for
+	 * @return				key pair, NULL if group not pooled or stock empty
+	 */
+	diffie_hellman_t* (*get)(dh_pool_t *this, diffie_hellman_group_t group);
+
+	/**
+	 * Add a precomputed key pair to the pool.
+	 *
+	 * @param group			DH group of the key pair
+	 * @param dh			key pair to add, gets owned if added
+	 * @return				TRUE if added, FALSE if not pooled or stock full
+	 */
+	bool (*put)(dh_pool_t *this, diffie_hellman_group_t group,
+				diffie_hellman_t *dh);
+
+	/**
+	 * Schedule the generation of key pairs for a group, if it is pooled and
+	 * its stock is incomplete.
+	 *
+	 * @param group			DH group to refill
+	 */
+	void (*refill)(dh_pool_t *this, diffie_hellman_group_t group);
+
+	/**
+	 * Destroy all pooled key pairs, e.g. when a DH backend gets unloaded.
+	 */
+	void (*flush)(dh_pool_t *this);
+
+	/**
+	 * Create an enumerator over the state of the pooled groups.
+	 *
+	 * The enumerator enumerates over the group, the number of pooled key
+	 * pairs, the configured size of the pool, the number of key pairs handed
+	 * out from the pool and the number of requests it could not satisfy,
+	 * as diffie_hellman_group_t, u_int, u_int, u_int, u_int.
+	 *
+	 * @return				enumerator over pool state
+	 */
+	enumerator_t* (*create_enumerator)(dh_pool_t *this);
+
+	/**
+	 * Destroy a dh_pool_t, including all pooled key pairs.
+	 */
+	void (*destroy)(dh_pool_t *this);
+};
+
+/**
+ * Create a dh_pool instance for the configured DH groups.
+ *
+ * @param fill			callback to generate key pairs
+ * @param data			user data to pass to fill
+ * @return				pool, NULL if no groups are configured
+ */
+dh_pool_t *dh_pool_create(dh_pool_fill_t fill, void *data);
+
+#endif /** DH_POOL_H_ @}*/
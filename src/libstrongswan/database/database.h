@@ -111,6 +111,31 @@ struct database_t {
 	 */
 	int (*execute)(database_t *this, int *rowid, char *sql, ...);
 
+	/**
+	 * Start a transaction.
+	 *
+	 * Until the transaction is finished with commit() or rollback(), all
+	 * queries of the calling thread use the same connection. Transactions
+	 * can't be nested.
+	 *
+	 * @return			TRUE if transaction started
+	 */
+	bool (*transaction)(database_t *this);
+
+	/**
+	 * Commit the transaction of the calling thread.
+	 *
+	 * @return			TRUE if transaction committed
+	 */
+	bool (*commit)(database_t *this);
+
+	/**
+	 * Roll back the transaction of the calling thread.
+	 *
+	 * @return			TRUE if transaction rolled back
+	 */
+	bool (*rollback)(database_t *this);
+
 	/**
 	 * Get the database implementation type.
 	 *
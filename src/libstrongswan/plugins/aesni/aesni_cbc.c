@@ -0,0 +1,226 @@
+/*
+ * Copyright (C) 2013 strongSwan Project
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include "aesni_cbc.h"
+#include "aesni_key.h"
+
+/**
+ * Number of blocks decrypted in parallel
+ */
+#define CBC_DECRYPT_PARALLELISM 4
+
+typedef struct private_aesni_cbc_t private_aesni_cbc_t;
+
+/**
+ * Private data of an aesni_cbc_t object.
+ */
+struct private_aesni_cbc_t {
+
+	/**
+	 * Public aesni_cbc_t interface.
+	 */
+	aesni_cbc_t public;
+
+	/**
+	 * Key size
+	 */
+	u_int key_size;
+
+	/**
+	 * Expanded key schedule
+	 */
+	aesni_key_t key;
+};
+
+/**
+ * Encrypt data in CBC mode, in and out may point to the same buffer
+ */
+static void encrypt_cbc(private_aesni_cbc_t *this, u_char *in, size_t len,
+						u_char *iv, u_char *out)
+{
+	__m128i ks[AES_MAX_ROUNDS + 1], fb;
+	size_t i;
+
+	aesni_key_load(this->key.enc, this->key.rounds, ks);
+	fb = _mm_loadu_si128((__m128i*)iv);
+	for (i = 0; i < len; i += AES_BLOCK_SIZE)
+	{
+		fb = _mm_xor_si128(fb, _mm_loadu_si128((__m128i*)(in + i)));
+		fb = aesni_encrypt_block(ks, this->key.rounds, fb);
+		_mm_storeu_si128((__m128i*)(out + i), fb);
+	}
+}
+
+/**
+ * Decrypt data in CBC mode, in and out may point to the same buffer.
+ *
+ * Decryption of blocks does not depend on each other, so multiple blocks are
+ * processed in parallel to make use of the AES-NI pipeline.
+ */
+static void decrypt_cbc(private_aesni_cbc_t *this, u_char *in, size_t len,
+						u_char *iv, u_char *out)
+{
+	__m128i ks[AES_MAX_ROUNDS + 1], fb, c[CBC_DECRYPT_PARALLELISM];
+	__m128i t[CBC_DECRYPT_PARALLELISM];
+	int rounds = this->key.rounds, r, j;
+	size_t i = 0;
+
+	aesni_key_load(this->key.dec, rounds, ks);
+	fb = _mm_loadu_si128((__m128i*)iv);
+
+	for (; i + sizeof(c) <= len; i += sizeof(c))
+	{
+		for (j = 0; j < CBC_DECRYPT_PARALLELISM; j++)
+		{
+			c[j] = _mm_loadu_si128((__m128i*)(in + i) + j);
+			t[j] = _mm_xor_si128(c[j], ks[0]);
+		}
+		for (r = 1; r < rounds; r++)
+		{
+			for (j = 0; j < CBC_DECRYPT_PARALLELISM; j++)
+			{
+				t[j] = _mm_aesdec_si128(t[j], ks[r]);
+			}
+		}
+		for (j = 0; j < CBC_DECRYPT_PARALLELISM; j++)
+		{
+			t[j] = _mm_aesdeclast_si128(t[j], ks[rounds]);
+			t[j] = _mm_xor_si128(t[j], fb);
+			fb = c[j];
+			_mm_storeu_si128((__m128i*)(out + i) + j, t[j]);
+		}
+	}
+	for (; i < len; i += AES_BLOCK_SIZE)
+	{
+		c[0] = _mm_loadu_si128((__m128i*)(in + i));
+		t[0] = aesni_decrypt_block(ks, rounds, c[0]);
+		_mm_storeu_si128((__m128i*)(out + i), _mm_xor_si128(t[0], fb));
+		fb = c[0];
+	}
+}
+
+METHOD(crypter_t, encrypt, bool,
+	private_aesni_cbc_t *this, chunk_t data, chunk_t iv, chunk_t *encrypted)
+{
+	u_char *out;
+
+	if (data.len % AES_BLOCK_SIZE || iv.len != AES_BLOCK_SIZE)
+	{
+		return FALSE;
+	}
+	out = data.ptr;
+	if (encrypted)
+	{
+		*encrypted = chunk_alloc(data.len);
+		out = encrypted->ptr;
+	}
+	encrypt_cbc(this, data.ptr, data.len, iv.ptr, out);
+	return TRUE;
+}
+
+METHOD(crypter_t, decrypt, bool,
+	private_aesni_cbc_t *this, chunk_t data, chunk_t iv, chunk_t *decrypted)
+{
+	u_char *out;
+
+	if (data.len % AES_BLOCK_SIZE || iv.len != AES_BLOCK_SIZE)
+	{
+		return FALSE;
+	}
+	out = data.ptr;
+	if (decrypted)
+	{
+		*decrypted = chunk_alloc(data.len);
+		out = decrypted->ptr;
+	}
+	decrypt_cbc(this, data.ptr, data.len, iv.ptr, out);
+	return TRUE;
+}
+
+METHOD(crypter_t, get_block_size, size_t,
+	private_aesni_cbc_t *this)
+{
+	return AES_BLOCK_SIZE;
+}
+
+METHOD(crypter_t, get_iv_size, size_t,
+	private_aesni_cbc_t *this)
+{
+	return AES_BLOCK_SIZE;
+}
+
+METHOD(crypter_t, get_key_size, size_t,
+	private_aesni_cbc_t *this)
+{
+	return this->key_size;
+}
+
+METHOD(crypter_t, set_key, bool,
+	private_aesni_cbc_t *this, chunk_t key)
+{
+	if (key.len != this->key_size)
+	{
+		return FALSE;
+	}
+	return aesni_key_expand(&this->key, key);
+}
+
+METHOD(crypter_t, destroy, void,
+	private_aesni_cbc_t *this)
+{
+	aesni_key_wipe(&this->key);
+	free(this);
+}
+
+/**
+ * See header
+ */
+aesni_cbc_t *aesni_cbc_create(encryption_algorithm_t algo, size_t key_size)
+{
+	private_aesni_cbc_t *this;
+
+	if (algo != ENCR_AES_CBC)
+	{
+		return NULL;
+	}
+	switch (key_size)
+	{
+		case 0:
+			key_size = 16;
+			break;
+		case 16:
+		case 24:
+		case 32:
+			break;
+		default:
+			return NULL;
+	}
+
+	INIT(this,
+		.public = {
+			.crypter = {
+				.encrypt = _encrypt,
+				.decrypt = _decrypt,
+				.get_block_size = _get_block_size,
+				.get_iv_size = _get_iv_size,
+				.get_key_size = _get_key_size,
+				.set_key = _set_key,
+				.destroy = _destroy,
+			},
+		},
+		.key_size = key_size,
+	);
+
+	return &this->public;
+}
@@ -0,0 +1,213 @@
+/*
+ * Copyright (C) 2013 strongSwan Project
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include "aesni_ctr.h"
+#include "aesni_key.h"
+
+/**
+ * Number of counter blocks encrypted in parallel
+ */
+#define CTR_PARALLELISM 4
+
+typedef struct private_aesni_ctr_t private_aesni_ctr_t;
+
+/**
+ * Private data of an aesni_ctr_t object.
+ */
+struct private_aesni_ctr_t {
+
+	/**
+	 * Public aesni_ctr_t interface.
+	 */
+	aesni_ctr_t public;
+
+	/**
+	 * Key size, without nonce
+	 */
+	u_int key_size;
+
+	/**
+	 * Expanded key schedule
+	 */
+	aesni_key_t key;
+
+	/**
+	 * counter state
+	 */
+	struct {
+		char nonce[4];
+		char iv[8];
+		u_int32_t counter;
+	} __attribute__((packed)) state;
+};
+
+/**
+ * Do the CTR crypto operation, in and out may point to the same buffer
+ */
+static void crypt_ctr(private_aesni_ctr_t *this, u_char *in, size_t len,
+					  u_char *out)
+{
+	__m128i ks[AES_MAX_ROUNDS + 1], t[CTR_PARALLELISM];
+	int rounds = this->key.rounds, r, j;
+	u_int32_t counter = 1;
+	u_char last[AES_BLOCK_SIZE];
+	size_t i = 0;
+
+	aesni_key_load(this->key.enc, rounds, ks);
+
+	for (; i + sizeof(t) <= len; i += sizeof(t))
+	{
+		for (j = 0; j < CTR_PARALLELISM; j++)
+		{
+			this->state.counter = htonl(counter++);
+			t[j] = _mm_xor_si128(_mm_loadu_si128((__m128i*)&this->state),
+								 ks[0]);
+		}
+		for (r = 1; r < rounds; r++)
+		{
+			for (j = 0; j < CTR_PARALLELISM; j++)
+			{
+				t[j] = _mm_aesenc_si128(t[j], ks[r]);
+			}
+		}
+		for (j = 0; j < CTR_PARALLELISM; j++)
+		{
+			t[j] = _mm_aesenclast_si128(t[j], ks[rounds]);
+			t[j] = _mm_xor_si128(t[j],
+								 _mm_loadu_si128((__m128i*)(in + i) + j));
+			_mm_storeu_si128((__m128i*)(out + i) + j, t[j]);
+		}
+	}
+	for (; i < len; i += AES_BLOCK_SIZE)
+	{
+		this->state.counter = htonl(counter++);
+		t[0] = aesni_encrypt_block(ks, rounds,
+								   _mm_loadu_si128((__m128i*)&this->state));
+		if (len - i < AES_BLOCK_SIZE)
+		{	/* partial last block */
+			_mm_storeu_si128((__m128i*)last, t[0]);
+			if (in != out)
+			{
+				memcpy(out + i, in + i, len - i);
+			}
+			memxor(out + i, last, len - i);
+			memwipe(last, sizeof(last));
+			break;
+		}
+		t[0] = _mm_xor_si128(t[0], _mm_loadu_si128((__m128i*)(in + i)));
+		_mm_storeu_si128((__m128i*)(out + i), t[0]);
+	}
+}
+
+METHOD(crypter_t, crypt, bool,
+	private_aesni_ctr_t *this, chunk_t in, chunk_t iv, chunk_t *out)
+{
+	u_char *buf;
+
+	if (iv.len != sizeof(this->state.iv))
+	{
+		return FALSE;
+	}
+	memcpy(this->state.iv, iv.ptr, sizeof(this->state.iv));
+
+	buf = in.ptr;
+	if (out)
+	{
+		*out = chunk_alloc(in.len);
+		buf = out->ptr;
+	}
+	crypt_ctr(this, in.ptr, in.len, buf);
+	return TRUE;
+}
+
+METHOD(crypter_t, get_block_size, size_t,
+	private_aesni_ctr_t *this)
+{
+	return 1;
+}
+
+METHOD(crypter_t, get_iv_size, size_t,
+	private_aesni_ctr_t *this)
+{
+	return sizeof(this->state.iv);
+}
+
+METHOD(crypter_t, get_key_size, size_t,
+	private_aesni_ctr_t *this)
+{
+	return this->key_size + sizeof(this->state.nonce);
+}
+
+METHOD(crypter_t, set_key, bool,
+	private_aesni_ctr_t *this, chunk_t key)
+{
+	if (key.len != get_key_size(this))
+	{
+		return FALSE;
+	}
+	memcpy(this->state.nonce, key.ptr + key.len - sizeof(this->state.nonce),
+		   sizeof(this->state.nonce));
+	key.len -= sizeof(this->state.nonce);
+	return aesni_key_expand(&this->key, key);
+}
+
+METHOD(crypter_t, destroy, void,
+	private_aesni_ctr_t *this)
+{
+	aesni_key_wipe(&this->key);
+	memwipe(&this->state, sizeof(this->state));
+	free(this);
+}
+
+/**
+ * See header
+ */
+aesni_ctr_t *aesni_ctr_create(encryption_algorithm_t algo, size_t key_size)
+{
+	private_aesni_ctr_t *this;
+
+	if (algo != ENCR_AES_CTR)
+	{
+		return NULL;
+	}
+	switch (key_size)
+	{
+		case 0:
+			key_size = 16;
+			break;
+		case 16:
+		case 24:
+		case 32:
+			break;
+		default:
+			return NULL;
+	}
+
+	INIT(this,
+		.public = {
+			.crypter = {
+				.encrypt = _crypt,
+				.decrypt = _crypt,
+				.get_block_size = _get_block_size,
+				.get_iv_size = _get_iv_size,
+				.get_key_size = _get_key_size,
+				.set_key = _set_key,
+				.destroy = _destroy,
+			},
+		},
+		.key_size = key_size,
+	);
+
+	return &this->public;
+}
@@ -0,0 +1,406 @@
+/*
+ * Copyright (C) 2013 strongSwan Project
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include "aesni_gcm.h"
+#include "aesni_key.h"
+
+#include <tmmintrin.h>
+
+#define NONCE_SIZE 12
+#define IV_SIZE 8
+#define SALT_SIZE (NONCE_SIZE - IV_SIZE)
+
+/**
+ * Number of counter blocks encrypted in parallel
+ */
+#define GCM_PARALLELISM 4
+
+typedef struct private_aesni_gcm_t private_aesni_gcm_t;
+
+/**
+ * Private data of an aesni_gcm_t object.
+ */
+struct private_aesni_gcm_t {
+
+	/**
+	 * Public aesni_gcm_t interface.
+	 */
+	aesni_gcm_t public;
+
+	/**
+	 * Key size, without salt
+	 */
+	u_int key_size;
+
+	/**
+	 * Size of the integrity check value
+	 */
+	size_t icv_size;
+
+	/**
+	 * Expanded key schedule
+	 */
+	aesni_key_t key;
+
+	/**
+	 * GHASH subkey H, byte reflected
+	 */
+	u_char h[AES_BLOCK_SIZE];
+
+	/**
+	 * Salt value
+	 */
+	char salt[SALT_SIZE];
+};
+
+/**
+ * Swap the byte order of a 128-bit value
+ */
+static inline __m128i swap128(__m128i x)
+{
+	return _mm_shuffle_epi8(x, _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7,
+											8, 9, 10, 11, 12, 13, 14, 15));
+}
+
+/**
+ * Multiply two byte reflected blocks in GF128, as described in Intel's
+ * "Carry-Less Multiplication Instruction and its Usage for Computing the GCM
+ * Mode" white paper.
+ */
+static __m128i mult_block(__m128i a, __m128i b)
+{
+	__m128i t2, t3, t4, t5, t6, t7, t8, t9;
+
+	t3 = _mm_clmulepi64_si128(a, b, 0x00);
+	t4 = _mm_clmulepi64_si128(a, b, 0x10);
+	t5 = _mm_clmulepi64_si128(a, b, 0x01);
+	t6 = _mm_clmulepi64_si128(a, b, 0x11);
+
+	t4 = _mm_xor_si128(t4, t5);
+	t5 = _mm_slli_si128(t4, 8);
+	t4 = _mm_srli_si128(t4, 8);
+	t3 = _mm_xor_si128(t3, t5);
+	t6 = _mm_xor_si128(t6, t4);
+
+	/* shift the 256-bit result left by one bit, as operands are reflected */
+	t7 = _mm_srli_epi32(t3, 31);
+	t8 = _mm_srli_epi32(t6, 31);
+	t3 = _mm_slli_epi32(t3, 1);
+	t6 = _mm_slli_epi32(t6, 1);
+	t9 = _mm_srli_si128(t7, 12);
+	t8 = _mm_slli_si128(t8, 4);
+	t7 = _mm_slli_si128(t7, 4);
+	t3 = _mm_or_si128(t3, t7);
+	t6 = _mm_or_si128(t6, t8);
+	t6 = _mm_or_si128(t6, t9);
+
+	/* reduce modulo x^128 + x^7 + x^2 + x + 1 */
+	t7 = _mm_slli_epi32(t3, 31);
+	t8 = _mm_slli_epi32(t3, 30);
+	t9 = _mm_slli_epi32(t3, 25);
+	t7 = _mm_xor_si128(t7, t8);
+	t7 = _mm_xor_si128(t7, t9);
+	t8 = _mm_srli_si128(t7, 4);
+	t7 = _mm_slli_si128(t7, 12);
+	t3 = _mm_xor_si128(t3, t7);
+
+	t2 = _mm_srli_epi32(t3, 1);
+	t4 = _mm_srli_epi32(t3, 2);
+	t5 = _mm_srli_epi32(t3, 7);
+	t2 = _mm_xor_si128(t2, t4);
+	t2 = _mm_xor_si128(t2, t5);
+	t2 = _mm_xor_si128(t2, t8);
+	t3 = _mm_xor_si128(t3, t2);
+	return _mm_xor_si128(t6, t3);
+}
+
+/**
+ * GHASH over data, padded with zeros to the block size
+ */
+static __m128i ghash(__m128i h, __m128i y, u_char *data, size_t len)
+{
+	u_char last[AES_BLOCK_SIZE];
+
+	for (; len >= AES_BLOCK_SIZE; len -= AES_BLOCK_SIZE)
+	{
+		y = _mm_xor_si128(y, swap128(_mm_loadu_si128((__m128i*)data)));
+		y = mult_block(y, h);
+		data += AES_BLOCK_SIZE;
+	}
+	if (len)
+	{
+		memset(last, 0, sizeof(last));
+		memcpy(last, data, len);
+		y = _mm_xor_si128(y, swap128(_mm_loadu_si128((__m128i*)last)));
+		y = mult_block(y, h);
+	}
+	return y;
+}
+
+/**
+ * Build a counter block from J0 and a 32-bit counter
+ */
+static inline __m128i counter_block(u_char *j, u_int32_t counter)
+{
+	htoun32(j + NONCE_SIZE, counter);
+	return _mm_loadu_si128((__m128i*)j);
+}
+
+/**
+ * GCTR function starting at counter 2, en-/decrypts data from in to out
+ */
+static void gctr(private_aesni_gcm_t *this, __m128i *ks, u_char *j,
+				 u_char *in, size_t len, u_char *out)
+{
+	__m128i t[GCM_PARALLELISM];
+	int rounds = this->key.rounds, r, k;
+	u_char last[AES_BLOCK_SIZE];
+	u_int32_t counter = 2;
+	size_t i = 0;
+
+	for (; i + sizeof(t) <= len; i += sizeof(t))
+	{
+		for (k = 0; k < GCM_PARALLELISM; k++)
+		{
+			t[k] = _mm_xor_si128(counter_block(j, counter++), ks[0]);
+		}
+		for (r = 1; r < rounds; r++)
+		{
+			for (k = 0; k < GCM_PARALLELISM; k++)
+			{
+				t[k] = _mm_aesenc_si128(t[k], ks[r]);
+			}
+		}
+		for (k = 0; k < GCM_PARALLELISM; k++)
+		{
+			t[k] = _mm_aesenclast_si128(t[k], ks[rounds]);
+			t[k] = _mm_xor_si128(t[k],
+								 _mm_loadu_si128((__m128i*)(in + i) + k));
+			_mm_storeu_si128((__m128i*)(out + i) + k, t[k]);
+		}
+	}
+	for (; i < len; i += AES_BLOCK_SIZE)
+	{
+		t[0] = aesni_encrypt_block(ks, rounds, counter_block(j, counter++));
+		if (len - i < AES_BLOCK_SIZE)
+		{	/* partial last block */
+			_mm_storeu_si128((__m128i*)last, t[0]);
+			if (in != out)
+			{
+				memcpy(out + i, in + i, len - i);
+			}
+			memxor(out + i, last, len - i);
+			break;
+		}
+		t[0] = _mm_xor_si128(t[0], _mm_loadu_si128((__m128i*)(in + i)));
+		_mm_storeu_si128((__m128i*)(out + i), t[0]);
+	}
+}
+
+/**
+ * Calculate the ICV over associated and encrypted data
+ */
+static void create_icv(private_aesni_gcm_t *this, __m128i *ks, u_char *j,
+					   chunk_t assoc, u_char *crypt, size_t len, u_char *icv)
+{
+	__m128i h, y;
+	u_char lens[AES_BLOCK_SIZE];
+
+	h = _mm_loadu_si128((__m128i*)this->h);
+	y = _mm_setzero_si128();
+	y = ghash(h, y, assoc.ptr, assoc.len);
+	y = ghash(h, y, crypt, len);
+	htoun64(lens, (u_int64_t)assoc.len * 8);
+	htoun64(lens + 8, (u_int64_t)len * 8);
+	y = ghash(h, y, lens, sizeof(lens));
+
+	y = _mm_xor_si128(swap128(y), aesni_encrypt_block(ks, this->key.rounds,
+													  counter_block(j, 1)));
+	_mm_storeu_si128((__m128i*)lens, y);
+	memcpy(icv, lens, this->icv_size);
+}
+
+/**
+ * Generate the block J0, without counter
+ */
+static void create_j(private_aesni_gcm_t *this, u_char *iv, u_char *j)
+{
+	memcpy(j, this->salt, SALT_SIZE);
+	memcpy(j + SALT_SIZE, iv, IV_SIZE);
+}
+
+METHOD(aead_t, encrypt, bool,
+	private_aesni_gcm_t *this, chunk_t plain, chunk_t assoc, chunk_t iv,
+	chunk_t *encrypted)
+{
+	__m128i ks[AES_MAX_ROUNDS + 1];
+	u_char j[AES_BLOCK_SIZE], *out;
+
+	if (iv.len != IV_SIZE)
+	{
+		return FALSE;
+	}
+	out = plain.ptr;
+	if (encrypted)
+	{
+		*encrypted = chunk_alloc(plain.len + this->icv_size);
+		out = encrypted->ptr;
+	}
+	aesni_key_load(this->key.enc, this->key.rounds, ks);
+	create_j(this, iv.ptr, j);
+	gctr(this, ks, j, plain.ptr, plain.len, out);
+	create_icv(this, ks, j, assoc, out, plain.len, out + plain.len);
+	return TRUE;
+}
+
+METHOD(aead_t, decrypt, bool,
+	private_aesni_gcm_t *this, chunk_t encrypted, chunk_t assoc, chunk_t iv,
+	chunk_t *plain)
+{
+	__m128i ks[AES_MAX_ROUNDS + 1];
+	u_char j[AES_BLOCK_SIZE], icv[AES_BLOCK_SIZE], *out;
+
+	if (encrypted.len < this->icv_size || iv.len != IV_SIZE)
+	{
+		return FALSE;
+	}
+	encrypted.len -= this->icv_size;
+
+	aesni_key_load(this->key.enc, this->key.rounds, ks);
+	create_j(this, iv.ptr, j);
+	create_icv(this, ks, j, assoc, encrypted.ptr, encrypted.len, icv);
+	if (!memeq(icv, encrypted.ptr + encrypted.len, this->icv_size))
+	{
+		return FALSE;
+	}
+	out = encrypted.ptr;
+	if (plain)
+	{
+		*plain = chunk_alloc(encrypted.len);
+		out = plain->ptr;
+	}
+	gctr(this, ks, j, encrypted.ptr, encrypted.len, out);
+	return TRUE;
+}
+
+METHOD(aead_t, get_block_size, size_t,
+	private_aesni_gcm_t *this)
+{
+	return 1;
+}
+
+METHOD(aead_t, get_icv_size, size_t,
+	private_aesni_gcm_t *this)
+{
+	return this->icv_size;
+}
+
+METHOD(aead_t, get_iv_size, size_t,
+	private_aesni_gcm_t *this)
+{
+	return IV_SIZE;
+}
+
+METHOD(aead_t, get_key_size, size_t,
+	private_aesni_gcm_t *this)
+{
+	return this->key_size + SALT_SIZE;
+}
+
+METHOD(aead_t, set_key, bool,
+	private_aesni_gcm_t *this, chunk_t key)
+{
+	__m128i ks[AES_MAX_ROUNDS + 1], h;
+
+	if (key.len != get_key_size(this))
+	{
+		return FALSE;
+	}
+	memcpy(this->salt, key.ptr + key.len - SALT_SIZE, SALT_SIZE);
+	key.len -= SALT_SIZE;
+	if (!aesni_key_expand(&this->key, key))
+	{
+		return FALSE;
+	}
+	memset(ks, 0, sizeof(ks));
+	aesni_key_load(this->key.enc, this->key.rounds, ks);
+	h = aesni_encrypt_block(ks, this->key.rounds, _mm_setzero_si128());
+	_mm_storeu_si128((__m128i*)this->h, swap128(h));
+	memwipe(ks, sizeof(ks));
+	return TRUE;
+}
+
+METHOD(aead_t, destroy, void,
+	private_aesni_gcm_t *this)
+{
+	aesni_key_wipe(&this->key);
+	memwipe(this->h, sizeof(this->h));
+	memwipe(this->salt, sizeof(this->salt));
+	free(this);
+}
+
+/**
+ * See header
+ */
+aesni_gcm_t *aesni_gcm_create(encryption_algorithm_t algo, size_t key_size)
+{
+	private_aesni_gcm_t *this;
+	size_t icv_size;
+
+	switch (key_size)
+	{
+		case 0:
+			key_size = 16;
+			break;
+		case 16:
+		case 24:
+		case 32:
+			break;
+		default:
+			return NULL;
+	}
+	switch (algo)
+	{
+		case ENCR_AES_GCM_ICV8:
+			icv_size = 8;
+			break;
+		case ENCR_AES_GCM_ICV12:
+			icv_size = 12;
+			break;
+		case ENCR_AES_GCM_ICV16:
+			icv_size = 16;
+			break;
+		default:
+			return NULL;
+	}
+
+	INIT(this,
+		.public = {
+			.aead = {
+				.encrypt = _encrypt,
+				.decrypt = _decrypt,
+				.get_block_size = _get_block_size,
+				.get_icv_size = _get_icv_size,
+				.get_iv_size = _get_iv_size,
+				.get_key_size = _get_key_size,
+				.set_key = _set_key,
+				.destroy = _destroy,
+			},
+		},
+		.key_size = key_size,
+		.icv_size = icv_size,
+	);
+
+	return &this->public;
+}
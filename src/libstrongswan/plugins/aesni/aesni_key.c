@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2013 strongSwan Project
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include "aesni_key.h"
+
+/**
+ * Round constants, one per Nk words of expanded key
+ */
+static const u_int32_t rcon[] = {
+	0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36,
+};
+
+/**
+ * Apply the S-box to each byte of a word, rotate it if requested.
+ *
+ * AESKEYGENASSIST returns SubWord(X1) in the first and
+ * RotWord(SubWord(X1)) in the second double word of the result.
+ */
+static u_int32_t sub_word(u_int32_t word, bool rotate)
+{
+	__m128i x;
+
+	x = _mm_aeskeygenassist_si128(_mm_set1_epi32(word), 0x00);
+	if (rotate)
+	{
+		x = _mm_shuffle_epi32(x, 0x55);
+	}
+	return _mm_cvtsi128_si32(x);
+}
+
+/**
+ * See header
+ */
+bool aesni_key_expand(aesni_key_t *key, chunk_t raw)
+{
+	u_int32_t w[(AES_MAX_ROUNDS + 1) * 4], temp;
+	int nk, i;
+
+	switch (raw.len)
+	{
+		case 16:
+			key->rounds = 10;
+			break;
+		case 24:
+			key->rounds = 12;
+			break;
+		case 32:
+			key->rounds = 14;
+			break;
+		default:
+			return FALSE;
+	}
+	nk = raw.len / sizeof(u_int32_t);
+	/* words are kept in memory order, which matches the byte order
+	 * expected by AESKEYGENASSIST and AESENC */
+	memcpy(w, raw.ptr, raw.len);
+	for (i = nk; i < (key->rounds + 1) * 4; i++)
+	{
+		temp = w[i - 1];
+		if (i % nk == 0)
+		{
+			temp = sub_word(temp, TRUE) ^ rcon[i / nk - 1];
+		}
+		else if (nk > 6 && i % nk == 4)
+		{
+			temp = sub_word(temp, FALSE);
+		}
+		w[i] = w[i - nk] ^ temp;
+	}
+	memcpy(key->enc, w, (key->rounds + 1) * AES_BLOCK_SIZE);
+	memwipe(w, sizeof(w));
+
+	memcpy(key->dec[0], key->enc[key->rounds], AES_BLOCK_SIZE);
+	for (i = 1; i < key->rounds; i++)
+	{
+		_mm_storeu_si128((__m128i*)key->dec[i], _mm_aesimc_si128(
+						_mm_loadu_si128((__m128i*)key->enc[key->rounds - i])));
+	}
+	memcpy(key->dec[key->rounds], key->enc[0], AES_BLOCK_SIZE);
+	return TRUE;
+}
+
+/**
+ * See header
+ */
+void aesni_key_wipe(aesni_key_t *key)
+{
+	memwipe(key, sizeof(*key));
+}
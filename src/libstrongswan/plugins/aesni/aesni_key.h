@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2013 strongSwan Project
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/**
+ * @defgroup aesni_key aesni_key
+ * @{ @ingroup aesni
+ */
+
+#ifndef AESNI_KEY_H_
+#define AESNI_KEY_H_
+
+#include <library.h>
+
+#include <wmmintrin.h>
+
+/**
+ * AES block size, in bytes
+ */
+#define AES_BLOCK_SIZE 16
+
+/**
+ * Maximum number of AES rounds, for 256-bit keys
+ */
+#define AES_MAX_ROUNDS 14
+
+typedef struct aesni_key_t aesni_key_t;
+
+/**
+ * Expanded AES key schedule for use with AES-NI instructions.
+ *
+ * Round keys are stored unaligned and should be loaded to an aligned local
+ * schedule using aesni_key_load() before processing data.
+ */
+struct aesni_key_t {
+
+	/**
+	 * Number of AES rounds, 10, 12 or 14
+	 */
+	int rounds;
+
+	/**
+	 * Round keys for encryption
+	 */
+	u_char enc[AES_MAX_ROUNDS + 1][AES_BLOCK_SIZE];
+
+	/**
+	 * Round keys for decryption, using the equivalent inverse cipher
+	 */
+	u_char dec[AES_MAX_ROUNDS + 1][AES_BLOCK_SIZE];
+};
+
+/**
+ * Expand an AES key to encryption and decryption round keys.
+ *
+ * @param key			key to expand
+ * @param raw			AES key of 16, 24 or 32 bytes
+ * @return				TRUE if key expanded, FALSE if length invalid
+ */
+bool aesni_key_expand(aesni_key_t *key, chunk_t raw);
+
+/**
+ * Wipe an expanded AES key.
+ *
+ * @param key			key to wipe
+ */
+void aesni_key_wipe(aesni_key_t *key);
+
+/**
+ * Load round keys to an aligned local schedule.
+ *
+ * @param keys			round keys to load
+ * @param rounds		number of AES rounds
+ * @param ks			schedule to load keys to
+ */
+static inline void aesni_key_load(u_char keys[][AES_BLOCK_SIZE], int rounds,
+								  __m128i *ks)
+{
+	int i;
+
+	for (i = 0; i <= rounds; i++)
+	{
+		ks[i] = _mm_loadu_si128((__m128i*)keys[i]);
+	}
+}
+
+/**
+ * Encrypt a single block with a loaded encryption schedule.
+ *
+ * @param ks			loaded encryption round keys
+ * @param rounds		number of AES rounds
+ * @param b				block to encrypt
+ * @return				encrypted block
+ */
+static inline __m128i aesni_encrypt_block(__m128i *ks, int rounds, __m128i b)
+{
+	int i;
+
+	b = _mm_xor_si128(b, ks[0]);
+	for (i = 1; i < rounds; i++)
+	{
+		b = _mm_aesenc_si128(b, ks[i]);
+	}
+	return _mm_aesenclast_si128(b, ks[rounds]);
+}
+
+/**
+ * Decrypt a single block with a loaded decryption schedule.
+ *
+ * @param ks			loaded decryption round keys
+ * @param rounds		number of AES rounds
+ * @param b				block to decrypt
+ * @return				decrypted block
+ */
+static inline __m128i aesni_decrypt_block(__m128i *ks, int rounds, __m128i b)
+{
+	int i;
+
+	b = _mm_xor_si128(b, ks[0]);
+	for (i = 1; i < rounds; i++)
+	{
+		b = _mm_aesdec_si128(b, ks[i]);
+	}
+	return _mm_aesdeclast_si128(b, ks[rounds]);
+}
+
+#endif /** AESNI_KEY_H_ @}*/
@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2013 strongSwan Project
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include "drbg_plugin.h"
+#include "drbg_rng.h"
+
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <library.h>
+#include <utils/debug.h>
+
+#ifndef DEV_URANDOM
+# define DEV_URANDOM "/dev/urandom"
+#endif
+
+/**
+ * Default number of requests after which a DRBG state gets reseeded
+ */
+#define DEFAULT_RESEED_INTERVAL 1024
+
+typedef struct private_drbg_plugin_t private_drbg_plugin_t;
+
+/**
+ * private data of drbg_plugin
+ */
+struct private_drbg_plugin_t {
+
+	/**
+	 * public functions
+	 */
+	drbg_plugin_t public;
+
+	/**
+	 * file descriptor to read seed material from
+	 */
+	int fd;
+};
+
+METHOD(plugin_t, get_name, char*,
+	private_drbg_plugin_t *this)
+{
+	return "drbg";
+}
+
+METHOD(plugin_t, get_features, int,
+	private_drbg_plugin_t *this, plugin_feature_t *features[])
+{
+	static plugin_feature_t f[] = {
+		PLUGIN_REGISTER(RNG, drbg_rng_create),
+			PLUGIN_PROVIDE(RNG, RNG_WEAK),
+				PLUGIN_DEPENDS(PRF, PRF_HMAC_SHA2_256),
+			PLUGIN_PROVIDE(RNG, RNG_STRONG),
+				PLUGIN_DEPENDS(PRF, PRF_HMAC_SHA2_256),
+	};
+	*features = f;
+	return countof(f);
+}
+
+METHOD(plugin_t, destroy, void,
+	private_drbg_plugin_t *this)
+{
+	drbg_rng_deinit();
+	close(this->fd);
+	free(this);
+}
+
+/*
+ * see header file
+ */
+plugin_t *drbg_plugin_create()
+{
+	private_drbg_plugin_t *this;
+	char *file;
+
+	file = lib->settings->get_str(lib->settings,
+						"libstrongswan.plugins.drbg.urandom", DEV_URANDOM);
+
+	INIT(this,
+		.public = {
+			.plugin = {
+				.get_name = _get_name,
+				.get_features = _get_features,
+				.destroy = _destroy,
+			},
+		},
+		.fd = open(file, O_RDONLY),
+	);
+
+	if (this->fd == -1)
+	{
+		DBG1(DBG_LIB, "opening \"%s\" failed: %s", file, strerror(errno));
+		free(this);
+		return NULL;
+	}
+	drbg_rng_init(this->fd, lib->settings->get_int(lib->settings,
+						"libstrongswan.plugins.drbg.reseed_interval",
+						DEFAULT_RESEED_INTERVAL));
+
+	return &this->public.plugin;
+}
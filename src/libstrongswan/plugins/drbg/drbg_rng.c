@@ -0,0 +1,351 @@
+/*
+ * Copyright (C) 2013 strongSwan Project
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include "drbg_rng.h"
+
+#include <unistd.h>
+#include <errno.h>
+
+#include <library.h>
+#include <utils/debug.h>
+#include <threading/thread.h>
+#include <threading/thread_value.h>
+#include <threading/mutex.h>
+#include <collections/linked_list.h>
+
+/**
+ * Security strength of HMAC_DRBG with SHA-256, in bytes
+ */
+#define SECURITY_STRENGTH 32
+
+/**
+ * Maximum number of bytes per generate request (2^19 bits)
+ */
+#define MAX_REQUEST_SIZE 65536
+
+typedef struct private_drbg_rng_t private_drbg_rng_t;
+
+/**
+ * Private data of an drbg_rng_t object.
+ */
+struct private_drbg_rng_t {
+
+	/**
+	 * Public drbg_rng_t interface.
+	 */
+	drbg_rng_t public;
+};
+
+/**
+ * Working state of a HMAC_DRBG instance
+ */
+typedef struct {
+	/** HMAC-SHA-256 */
+	prf_t *prf;
+	/** key K */
+	chunk_t key;
+	/** value V */
+	chunk_t value;
+	/** requests since last (re-)seeding */
+	u_int requests;
+} drbg_state_t;
+
+/** file descriptor to read seed material from */
+static int seed_fd = -1;
+
+/** number of requests after which a state gets reseeded */
+static u_int reseed_interval;
+
+/** per-thread drbg_state_t */
+static thread_value_t *states;
+
+/** all instantiated states, as drbg_state_t, to destroy them on unload */
+static linked_list_t *all_states;
+
+/** lock for all_states */
+static mutex_t *mutex;
+
+/**
+ * Read seed material from the kernel
+ */
+static bool read_seed(u_int8_t *buffer, size_t bytes)
+{
+	ssize_t got;
+	size_t done = 0;
+
+	while (done < bytes)
+	{
+		got = read(seed_fd, buffer + done, bytes - done);
+		if (got <= 0)
+		{
+			DBG1(DBG_LIB, "reading DRBG seed failed: %s", strerror(errno));
+			return FALSE;
+		}
+		done += got;
+	}
+	return TRUE;
+}
+
+/**
+ * HMAC_DRBG_Update(), with optional provided data
+ */
+static bool update(drbg_state_t *state, chunk_t data)
+{
+	u_int8_t i;
+
+	for (i = 0; i < 2; i++)
+	{
+		/* K = HMAC(K, V || i || data), V = HMAC(K, V) */
+		if (!state->prf->set_key(state->prf, state->key) ||
+			!state->prf->get_bytes(state->prf, state->value, NULL) ||
+			!state->prf->get_bytes(state->prf, chunk_from_thing(i), NULL) ||
+			!state->prf->get_bytes(state->prf, data, state->key.ptr) ||
+			!state->prf->set_key(state->prf, state->key) ||
+			!state->prf->get_bytes(state->prf, state->value,
+								   state->value.ptr))
+		{
+			return FALSE;
+		}
+		if (!data.len)
+		{
+			break;
+		}
+	}
+	return TRUE;
+}
+
+/**
+ * HMAC_DRBG_Reseed(), without additional input
+ */
+static bool reseed(drbg_state_t *state)
+{
+	u_int8_t entropy[SECURITY_STRENGTH];
+	bool success;
+
+	success = read_seed(entropy, sizeof(entropy)) &&
+			  update(state, chunk_from_thing(entropy));
+	memwipe(entropy, sizeof(entropy));
+	if (success)
+	{
+		state->requests = 0;
+	}
+	return success;
+}
+
+/**
+ * Destroy a DRBG state
+ */
+static void state_destroy(drbg_state_t *state)
+{
+	DESTROY_IF(state->prf);
+	chunk_clear(&state->key);
+	chunk_clear(&state->value);
+	free(state);
+}
+
+/**
+ * Cleanup function for terminating threads
+ */
+static void state_cleanup(drbg_state_t *state)
+{
+	mutex->lock(mutex);
+	all_states->remove(all_states, state, NULL);
+	mutex->unlock(mutex);
+	state_destroy(state);
+}
+
+/**
+ * HMAC_DRBG_Instantiate(), personalized with the thread ID
+ */
+static drbg_state_t *instantiate()
+{
+	u_int8_t seed[SECURITY_STRENGTH * 3 / 2 + sizeof(u_int)];
+	drbg_state_t *state;
+	u_int id;
+	bool success;
+
+	INIT(state,
+		.prf = lib->crypto->create_prf(lib->crypto, PRF_HMAC_SHA2_256),
+	);
+	if (!state->prf)
+	{
+		DBG1(DBG_LIB, "DRBG instantiation failed: HMAC-SHA-256 not supported");
+		free(state);
+		return NULL;
+	}
+	state->key = chunk_alloc(state->prf->get_block_size(state->prf));
+	state->value = chunk_alloc(state->key.len);
+	memset(state->key.ptr, 0x00, state->key.len);
+	memset(state->value.ptr, 0x01, state->value.len);
+
+	/* seed = entropy || nonce || personalization string */
+	id = thread_current_id();
+	memcpy(seed + SECURITY_STRENGTH * 3 / 2, &id, sizeof(id));
+	success = read_seed(seed, SECURITY_STRENGTH * 3 / 2) &&
+			  update(state, chunk_from_thing(seed));
+	memwipe(seed, sizeof(seed));
+	if (!success)
+	{
+		state_destroy(state);
+		return NULL;
+	}
+	return state;
+}
+
+/**
+ * Get the DRBG state of the calling thread, instantiate it on first use
+ */
+static drbg_state_t *get_state()
+{
+	drbg_state_t *state;
+
+	state = states->get(states);
+	if (!state)
+	{
+		state = instantiate();
+		if (state)
+		{
+			mutex->lock(mutex);
+			all_states->insert_last(all_states, state);
+			mutex->unlock(mutex);
+			states->set(states, state);
+		}
+	}
+	return state;
+}
+
+/**
+ * HMAC_DRBG_Generate(), without additional input
+ */
+static bool generate(drbg_state_t *state, size_t bytes, u_int8_t *buffer)
+{
+	size_t len;
+
+	if (state->requests >= reseed_interval && !reseed(state))
+	{
+		return FALSE;
+	}
+	if (!state->prf->set_key(state->prf, state->key))
+	{
+		return FALSE;
+	}
+	while (bytes)
+	{
+		if (!state->prf->get_bytes(state->prf, state->value,
+								   state->value.ptr))
+		{
+			return FALSE;
+		}
+		len = min(bytes, state->value.len);
+		memcpy(buffer, state->value.ptr, len);
+		buffer += len;
+		bytes -= len;
+	}
+	state->requests++;
+	return update(state, chunk_empty);
+}
+
+METHOD(rng_t, get_bytes, bool,
+	private_drbg_rng_t *this, size_t bytes, u_int8_t *buffer)
+{
+	drbg_state_t *state;
+	size_t len;
+
+	state = get_state();
+	if (!state)
+	{
+		return FALSE;
+	}
+	while (bytes)
+	{
+		len = min(bytes, MAX_REQUEST_SIZE);
+		if (!generate(state, len, buffer))
+		{
+			return FALSE;
+		}
+		buffer += len;
+		bytes -= len;
+	}
+	return TRUE;
+}
+
+METHOD(rng_t, allocate_bytes, bool,
+	private_drbg_rng_t *this, size_t bytes, chunk_t *chunk)
+{
+	*chunk = chunk_alloc(bytes);
+	if (get_bytes(this, bytes, chunk->ptr))
+	{
+		return TRUE;
+	}
+	free(chunk->ptr);
+	return FALSE;
+}
+
+METHOD(rng_t, destroy, void,
+	private_drbg_rng_t *this)
+{
+	free(this);
+}
+
+/*
+ * Described in header.
+ */
+drbg_rng_t *drbg_rng_create(rng_quality_t quality)
+{
+	private_drbg_rng_t *this;
+
+	switch (quality)
+	{
+		case RNG_WEAK:
+		case RNG_STRONG:
+			break;
+		default:
+			return NULL;
+	}
+
+	INIT(this,
+		.public = {
+			.rng = {
+				.get_bytes = _get_bytes,
+				.allocate_bytes = _allocate_bytes,
+				.destroy = _destroy,
+			},
+		},
+	);
+
+	return &this->public;
+}
+
+/*
+ * Described in header.
+ */
+void drbg_rng_init(int fd, u_int reseed)
+{
+	seed_fd = fd;
+	reseed_interval = max(reseed, 1);
+	states = thread_value_create((thread_cleanup_t)state_cleanup);
+	all_states = linked_list_create();
+	mutex = mutex_create(MUTEX_TYPE_DEFAULT);
+}
+
+/*
+ * Described in header.
+ */
+void drbg_rng_deinit()
+{
+	/* no more cleanup calls for terminating threads after this */
+	states->destroy(states);
+	all_states->destroy_function(all_states, (void*)state_destroy);
+	mutex->destroy(mutex);
+}
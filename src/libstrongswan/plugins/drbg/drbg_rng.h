@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2013 strongSwan Project
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/**
+ * @defgroup drbg_rng drbg_rng
+ * @{ @ingroup drbg_p
+ */
+
+#ifndef DRBG_RNG_H_
+#define DRBG_RNG_H_
+
+#include <crypto/rngs/rng.h>
+
+typedef struct drbg_rng_t drbg_rng_t;
+
+/**
+ * RNG implemented as HMAC_DRBG with SHA-256 as specified in NIST SP 800-90A.
+ *
+ * Each thread uses its own DRBG state, instantiated on first use and reseeded
+ * from the kernel after a configurable number of requests. Generating random
+ * bytes therefore requires neither locking nor a system call.
+ */
+struct drbg_rng_t {
+
+	/**
+	 * Implements rng_t interface.
+	 */
+	rng_t rng;
+};
+
+/**
+ * Create a drbg_rng instance.
+ *
+ * @param quality		RNG quality, RNG_WEAK or RNG_STRONG
+ * @return				RNG instance, NULL if quality not supported
+ */
+drbg_rng_t *drbg_rng_create(rng_quality_t quality);
+
+/**
+ * Set up the per-thread DRBG states, called when loading the plugin.
+ *
+ * @param fd			file descriptor to read seed material from
+ * @param reseed		number of requests after which a state gets reseeded
+ */
+void drbg_rng_init(int fd, u_int reseed);
+
+/**
+ * Destroy all per-thread DRBG states, called when unloading the plugin.
+ */
+void drbg_rng_deinit();
+
+#endif /** DRBG_RNG_H_ @}*/
@@ -53,97 +53,206 @@ struct private_gcm_aead_t {
 	 * GHASH subkey H
 	 */
 	char h[BLOCK_SIZE];
+
+	/**
+	 * Precomputed multiples of H, high 64 bits
+	 */
+	u_int64_t hh[16];
+
+	/**
+	 * Precomputed multiples of H, low 64 bits
+	 */
+	u_int64_t hl[16];
+
+	/**
+	 * Multiplication by H in GF128, table driven or using PCLMULQDQ
+	 */
+	void (*mult)(private_gcm_aead_t *this, char *x);
 };
 
 /**
- * Find a suiteable word size and network order conversion functions
+ * Reduction values for 4-bit multiplication, as in the Shoup method
  */
-#if ULONG_MAX == 18446744073709551615UL && defined(htobe64)
-#	define htobeword htobe64
-#	define bewordtoh be64toh
-#	define SHIFT_WORD_TYPE u_int64_t
-#else
-#	define htobeword htonl
-#	define bewordtoh ntohl
-#	define SHIFT_WORD_TYPE u_int32_t
-#endif
+static const u_int64_t last4[16] = {
+	0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+	0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0,
+};
 
 /**
- * Bitshift a block right by one bit
+ * Precompute the multiples of H for 4-bit table driven multiplication
  */
-static void sr_block(char *block)
+static void create_table(private_gcm_aead_t *this)
 {
-	int i;
-	SHIFT_WORD_TYPE *word = (SHIFT_WORD_TYPE*)block;
+	u_int64_t vh, vl, t;
+	int i, j;
+
+	vh = untoh64(this->h);
+	vl = untoh64(this->h + 8);
 
-	for (i = 0; i < BLOCK_SIZE / sizeof(*word); i++)
+	this->hh[0] = this->hl[0] = 0;
+	this->hh[8] = vh;
+	this->hl[8] = vl;
+	for (i = 4; i > 0; i >>= 1)
 	{
-		word[i] = bewordtoh(word[i]);
+		t = (vl & 1) * 0xe1000000;
+		vl = (vh << 63) | (vl >> 1);
+		vh = (vh >> 1) ^ (t << 32);
+		this->hh[i] = vh;
+		this->hl[i] = vl;
 	}
-	for (i = BLOCK_SIZE / sizeof(*word) - 1; i >= 0; i--)
+	for (i = 2; i <= 8; i *= 2)
 	{
-		word[i] >>= 1;
-		if (i != 0)
+		for (j = 1; j < i; j++)
 		{
-			word[i] |= word[i - 1] << (sizeof(*word) * 8 - 1);
+			this->hh[i + j] = this->hh[i] ^ this->hh[j];
+			this->hl[i + j] = this->hl[i] ^ this->hl[j];
 		}
 	}
-	for (i = 0; i < BLOCK_SIZE / sizeof(*word); i++)
-	{
-		word[i] = htobeword(word[i]);
-	}
 }
 
 /**
- * Naive implementation of block multiplication in GF128, no tables
+ * Multiply a block by H in GF128, using the precomputed 4-bit table
  */
-static void mult_block(char *x, char *y, char *res)
+static void mult_block_table(private_gcm_aead_t *this, char *x)
 {
-	char z[BLOCK_SIZE], v[BLOCK_SIZE], r;
-	int bit, byte;
+	u_int64_t zh, zl;
+	u_char *y = x, lo, hi, rem;
+	int i;
 
-	r = 0xE1;
-	memset(z, 0, BLOCK_SIZE);
-	memcpy(v, y, BLOCK_SIZE);
+	lo = y[15] & 0x0f;
+	zh = this->hh[lo];
+	zl = this->hl[lo];
 
-	for (byte = 0; byte < BLOCK_SIZE; byte++)
+	for (i = 15; i >= 0; i--)
 	{
-		for (bit = 7; bit >= 0; bit--)
+		lo = y[i] & 0x0f;
+		hi = (y[i] >> 4) & 0x0f;
+
+		if (i != 15)
 		{
-			if (x[byte] & (1 << bit))
-			{
-				memxor(z, v, BLOCK_SIZE);
-			}
-			if (v[BLOCK_SIZE - 1] & 0x01)
-			{
-				sr_block(v);
-				v[0] ^= r;
-			}
-			else
-			{
-				sr_block(v);
-			}
+			rem = zl & 0x0f;
+			zl = (zh << 60) | (zl >> 4);
+			zh = (zh >> 4) ^ (last4[rem] << 48);
+			zh ^= this->hh[lo];
+			zl ^= this->hl[lo];
 		}
+		rem = zl & 0x0f;
+		zl = (zh << 60) | (zl >> 4);
+		zh = (zh >> 4) ^ (last4[rem] << 48);
+		zh ^= this->hh[hi];
+		zl ^= this->hl[hi];
 	}
-	memcpy(res, z, BLOCK_SIZE);
+	htoun64(x, zh);
+	htoun64(x + 8, zl);
 }
 
+#ifdef HAVE_PCLMUL_INTRINSICS
+
+#include <wmmintrin.h>
+#include <tmmintrin.h>
+#include <cpuid.h>
+
 /**
- * GHASH function
+ * Check if the CPU supports PCLMULQDQ and SSSE3
  */
-static void ghash(private_gcm_aead_t *this, chunk_t x, char *res)
+static bool have_pclmul()
 {
-	char y[BLOCK_SIZE];
+	unsigned int eax, ebx, ecx, edx;
 
-	memset(y, 0, BLOCK_SIZE);
+	if (__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+	{
+		return (ecx & bit_PCLMUL) && (ecx & bit_SSSE3);
+	}
+	return FALSE;
+}
 
-	while (x.len)
+/**
+ * Swap the byte order of a 128-bit value
+ */
+__attribute__((target("pclmul,ssse3")))
+static inline __m128i swap128(__m128i x)
+{
+	return _mm_shuffle_epi8(x, _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7,
+											8, 9, 10, 11, 12, 13, 14, 15));
+}
+
+/**
+ * Multiply a block by H in GF128 using carry-less multiplication, as
+ * described in Intel's "Carry-Less Multiplication Instruction and its Usage
+ * for Computing the GCM Mode" white paper.
+ */
+__attribute__((target("pclmul,ssse3")))
+static void mult_block_pclmul(private_gcm_aead_t *this, char *x)
+{
+	__m128i a, b, t2, t3, t4, t5, t6, t7, t8, t9;
+
+	a = swap128(_mm_loadu_si128((__m128i*)x));
+	b = swap128(_mm_loadu_si128((__m128i*)this->h));
+
+	t3 = _mm_clmulepi64_si128(a, b, 0x00);
+	t4 = _mm_clmulepi64_si128(a, b, 0x10);
+	t5 = _mm_clmulepi64_si128(a, b, 0x01);
+	t6 = _mm_clmulepi64_si128(a, b, 0x11);
+
+	t4 = _mm_xor_si128(t4, t5);
+	t5 = _mm_slli_si128(t4, 8);
+	t4 = _mm_srli_si128(t4, 8);
+	t3 = _mm_xor_si128(t3, t5);
+	t6 = _mm_xor_si128(t6, t4);
+
+	/* shift the 256-bit result left by one bit, as operands are reflected */
+	t7 = _mm_srli_epi32(t3, 31);
+	t8 = _mm_srli_epi32(t6, 31);
+	t3 = _mm_slli_epi32(t3, 1);
+	t6 = _mm_slli_epi32(t6, 1);
+	t9 = _mm_srli_si128(t7, 12);
+	t8 = _mm_slli_si128(t8, 4);
+	t7 = _mm_slli_si128(t7, 4);
+	t3 = _mm_or_si128(t3, t7);
+	t6 = _mm_or_si128(t6, t8);
+	t6 = _mm_or_si128(t6, t9);
+
+	/* reduce modulo x^128 + x^7 + x^2 + x + 1 */
+	t7 = _mm_slli_epi32(t3, 31);
+	t8 = _mm_slli_epi32(t3, 30);
+	t9 = _mm_slli_epi32(t3, 25);
+	t7 = _mm_xor_si128(t7, t8);
+	t7 = _mm_xor_si128(t7, t9);
+	t8 = _mm_srli_si128(t7, 4);
+	t7 = _mm_slli_si128(t7, 12);
+	t3 = _mm_xor_si128(t3, t7);
+
+	t2 = _mm_srli_epi32(t3, 1);
+	t4 = _mm_srli_epi32(t3, 2);
+	t5 = _mm_srli_epi32(t3, 7);
+	t2 = _mm_xor_si128(t2, t4);
+	t2 = _mm_xor_si128(t2, t5);
+	t2 = _mm_xor_si128(t2, t8);
+	t3 = _mm_xor_si128(t3, t2);
+	t6 = _mm_xor_si128(t6, t3);
+
+	_mm_storeu_si128((__m128i*)x, swap128(t6));
+}
+
+#endif /* HAVE_PCLMUL_INTRINSICS */
+
+/**
+ * GHASH function, processes data incrementally on the intermediate value y.
+ * A partial last block is padded with zeros.
+ */
+static void ghash(private_gcm_aead_t *this, chunk_t x, char *y)
+{
+	while (x.len >= BLOCK_SIZE)
 	{
 		memxor(y, x.ptr, BLOCK_SIZE);
-		mult_block(y, this->h, y);
+		this->mult(this, y);
 		x = chunk_skip(x, BLOCK_SIZE);
 	}
-	memcpy(res, y, BLOCK_SIZE);
+	if (x.len)
+	{
+		memxor(y, x.ptr, x.len);
+		this->mult(this, y);
+	}
 }
 
 /**
@@ -219,40 +328,17 @@ static bool crypt(private_gcm_aead_t *this, char *j, chunk_t in, chunk_t out)
 static bool create_icv(private_gcm_aead_t *this, chunk_t assoc, chunk_t crypt,
 					   char *j, char *icv)
 {
-	size_t assoc_pad, crypt_pad;
-	chunk_t chunk;
-	char s[BLOCK_SIZE], *pos;
-
-	assoc_pad = (BLOCK_SIZE - (assoc.len % BLOCK_SIZE)) % BLOCK_SIZE;
-	crypt_pad = (BLOCK_SIZE - (crypt.len % BLOCK_SIZE)) % BLOCK_SIZE;
-
-	/* concatenate data to a new chunk */
-	chunk = chunk_alloc(assoc.len + assoc_pad +
-						crypt.len + crypt_pad + BLOCK_SIZE);
-	pos = chunk.ptr;
-	/* add associated data */
-	memcpy(pos, assoc.ptr, assoc.len);
-	pos += assoc.len;
-	memset(pos, 0, assoc_pad);
-	pos += assoc_pad;
-	/* add encrypted data */
-	memcpy(pos, crypt.ptr, crypt.len);
-	pos += crypt.len;
-	memset(pos, 0, crypt_pad);
-	pos += crypt_pad;
-	/* write associated len */
-	memset(pos, 0, 4);
-	pos += 4;
-	htoun32(pos, assoc.len * 8);
-	pos += 4;
-	/* write encrypted length */
-	memset(pos, 0, 4);
-	pos += 4;
-	htoun32(pos, crypt.len * 8);
-	pos += 4;
-
-	ghash(this, chunk, s);
-	free(chunk.ptr);
+	char s[BLOCK_SIZE], len[BLOCK_SIZE];
+
+	/* GHASH over the zero padded associated and encrypted data, followed by
+	 * their lengths in bits */
+	memset(s, 0, BLOCK_SIZE);
+	ghash(this, assoc, s);
+	ghash(this, crypt, s);
+	htoun64(len, (u_int64_t)assoc.len * 8);
+	htoun64(len + 8, (u_int64_t)crypt.len * 8);
+	ghash(this, chunk_from_thing(len), s);
+
 	if (!gctr(this, j, chunk_from_thing(s)))
 	{
 		return FALSE;
@@ -348,8 +434,13 @@ METHOD(aead_t, set_key, bool,
 {
 	memcpy(this->salt, key.ptr + key.len - SALT_SIZE, SALT_SIZE);
 	key.len -= SALT_SIZE;
-	return this->crypter->set_key(this->crypter, key) &&
-		   create_h(this, this->h);
+	if (!this->crypter->set_key(this->crypter, key) ||
+		!create_h(this, this->h))
+	{
+		return FALSE;
+	}
+	create_table(this);
+	return TRUE;
 }
 
 METHOD(aead_t, destroy, void,
@@ -412,8 +503,16 @@ gcm_aead_t *gcm_aead_create(encryption_algorithm_t algo, size_t key_size)
 		},
 		.crypter = lib->crypto->create_crypter(lib->crypto, algo, key_size),
 		.icv_size = icv_size,
+		.mult = mult_block_table,
 	);
 
+#ifdef HAVE_PCLMUL_INTRINSICS
+	if (have_pclmul())
+	{
+		this->mult = mult_block_pclmul;
+	}
+#endif
+
 	if (!this->crypter)
 	{
 		free(this);
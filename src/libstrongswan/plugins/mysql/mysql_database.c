@@ -24,6 +24,7 @@
 #include <threading/thread_value.h>
 #include <threading/mutex.h>
 #include <collections/linked_list.h>
+#include <collections/hashtable.h>
 
 /* Older mysql.h headers do not define it, but we need it. It is not returned
  * in in MySQL 4 by default, but by MySQL 5. To avoid this problem, we catch
@@ -78,6 +79,11 @@ struct private_mysql_database_t {
 	 * tcp port
 	 */
 	int port;
+
+	/**
+	 * connection a thread is running a transaction on, as conn_t
+	 */
+	thread_value_t *transaction;
 };
 
 typedef struct conn_t conn_t;
@@ -96,14 +102,65 @@ struct conn_t {
 	 * connection in use?
 	 */
 	bool in_use;
+
+	/**
+	 * connection used for a transaction, kept until finished?
+	 */
+	bool transaction;
+
+	/**
+	 * prepared statements for reuse, SQL string => stmt_cache_t
+	 */
+	hashtable_t *stmts;
 };
 
+/**
+ * Prepared statement cached in a connection
+ */
+typedef struct {
+
+	/**
+	 * SQL string the statement has been prepared for, key in hashtable
+	 */
+	char *sql;
+
+	/**
+	 * prepared MySQL statement
+	 */
+	MYSQL_STMT *stmt;
+
+	/**
+	 * statement currently executed, e.g. by an open query enumerator
+	 */
+	bool in_use;
+
+} stmt_cache_t;
+
+/**
+ * Hashtable hash function
+ */
+static u_int stmt_hash(char *key)
+{
+	return chunk_hash(chunk_create(key, strlen(key)));
+}
+
+/**
+ * Hashtable equals function
+ */
+static bool stmt_equals(char *a, char *b)
+{
+	return streq(a, b);
+}
+
 /**
  * Release a mysql connection
  */
 static void conn_release(conn_t *conn)
 {
-	conn->in_use = FALSE;
+	if (!conn->transaction)
+	{
+		conn->in_use = FALSE;
+	}
 }
 
 /**
@@ -151,6 +208,18 @@ void mysql_database_deinit()
  */
 static void conn_destroy(conn_t *this)
 {
+	enumerator_t *enumerator;
+	stmt_cache_t *cache;
+
+	enumerator = this->stmts->create_enumerator(this->stmts);
+	while (enumerator->enumerate(enumerator, NULL, &cache))
+	{
+		mysql_stmt_close(cache->stmt);
+		free(cache->sql);
+		free(cache);
+	}
+	enumerator->destroy(enumerator);
+	this->stmts->destroy(this->stmts);
 	mysql_close(this->mysql);
 	free(this);
 }
@@ -165,6 +234,12 @@ static conn_t *conn_get(private_mysql_database_t *this)
 
 	thread_initialize();
 
+	found = this->transaction->get(this->transaction);
+	if (found)
+	{	/* queries during a transaction must use its connection */
+		return found;
+	}
+
 	while (TRUE)
 	{
 		this->mutex->lock(this->mutex);
@@ -197,9 +272,12 @@ static conn_t *conn_get(private_mysql_database_t *this)
 	}
 	if (found == NULL)
 	{
-		found = malloc_thing(conn_t);
-		found->in_use = TRUE;
-		found->mysql = mysql_init(NULL);
+		INIT(found,
+			.in_use = TRUE,
+			.mysql = mysql_init(NULL),
+			.stmts = hashtable_create((hashtable_hash_t)stmt_hash,
+									  (hashtable_equals_t)stmt_equals, 8),
+		);
 		if (!mysql_real_connect(found->mysql, this->host, this->username,
 								this->password, this->database, this->port,
 								NULL, 0))
@@ -223,18 +301,26 @@ static conn_t *conn_get(private_mysql_database_t *this)
 }
 
 /**
- * Create and run a MySQL stmt using a sql string and args
+ * Get the cached prepared statement for a SQL string, or prepare one.
+ *
+ * If the cached statement is in use, e.g. by a nested query during a
+ * transaction, an uncached statement gets prepared and cache is set to NULL.
  */
-static MYSQL_STMT* run(MYSQL *mysql, char *sql, va_list *args)
+static MYSQL_STMT* prepare(conn_t *conn, char *sql, stmt_cache_t **cache)
 {
 	MYSQL_STMT *stmt;
-	int params;
 
-	stmt = mysql_stmt_init(mysql);
+	*cache = conn->stmts->get(conn->stmts, sql);
+	if (*cache && !(*cache)->in_use)
+	{
+		(*cache)->in_use = TRUE;
+		return (*cache)->stmt;
+	}
+	stmt = mysql_stmt_init(conn->mysql);
 	if (stmt == NULL)
 	{
 		DBG1(DBG_LIB, "creating MySQL statement failed: %s",
-			 mysql_error(mysql));
+			 mysql_error(conn->mysql));
 		return NULL;
 	}
 	if (mysql_stmt_prepare(stmt, sql, strlen(sql)))
@@ -242,6 +328,65 @@ static MYSQL_STMT* run(MYSQL *mysql, char *sql, va_list *args)
 		DBG1(DBG_LIB, "preparing MySQL statement failed: %s",
 			 mysql_stmt_error(stmt));
 		mysql_stmt_close(stmt);
+		*cache = NULL;
+		return NULL;
+	}
+	if (*cache)
+	{	/* cached statement busy, use this one once */
+		*cache = NULL;
+		return stmt;
+	}
+	INIT(*cache,
+		.sql = strdup(sql),
+		.stmt = stmt,
+		.in_use = TRUE,
+	);
+	conn->stmts->put(conn->stmts, (*cache)->sql, *cache);
+	return stmt;
+}
+
+/**
+ * Return a statement to the cache, or close it if not cached
+ */
+static void release(MYSQL_STMT *stmt, stmt_cache_t *cache)
+{
+	if (cache)
+	{
+		mysql_stmt_free_result(stmt);
+		cache->in_use = FALSE;
+	}
+	else
+	{
+		mysql_stmt_close(stmt);
+	}
+}
+
+/**
+ * Remove a failed statement from the cache and close it
+ */
+static void discard(conn_t *conn, MYSQL_STMT *stmt, stmt_cache_t *cache)
+{
+	if (cache)
+	{
+		conn->stmts->remove(conn->stmts, cache->sql);
+		free(cache->sql);
+		free(cache);
+	}
+	mysql_stmt_close(stmt);
+}
+
+/**
+ * Create and run a MySQL stmt using a sql string and args
+ */
+static MYSQL_STMT* run(conn_t *conn, char *sql, va_list *args,
+						stmt_cache_t **cache)
+{
+	MYSQL_STMT *stmt;
+	int params;
+
+	stmt = prepare(conn, sql, cache);
+	if (stmt == NULL)
+	{
 		return NULL;
 	}
 	params = mysql_stmt_param_count(stmt);
@@ -307,7 +452,7 @@ static MYSQL_STMT* run(MYSQL *mysql, char *sql, va_list *args)
 				}
 				default:
 					DBG1(DBG_LIB, "invalid data type supplied");
-					mysql_stmt_close(stmt);
+					discard(conn, stmt, *cache);
 					return NULL;
 			}
 		}
@@ -315,7 +460,7 @@ static MYSQL_STMT* run(MYSQL *mysql, char *sql, va_list *args)
 		{
 			DBG1(DBG_LIB, "binding MySQL param failed: %s",
 				 mysql_stmt_error(stmt));
-			mysql_stmt_close(stmt);
+			discard(conn, stmt, *cache);
 			return NULL;
 		}
 	}
@@ -323,7 +468,7 @@ static MYSQL_STMT* run(MYSQL *mysql, char *sql, va_list *args)
 	{
 		DBG1(DBG_LIB, "executing MySQL statement failed: %s",
 			 mysql_stmt_error(stmt));
-		mysql_stmt_close(stmt);
+		discard(conn, stmt, *cache);
 		return NULL;
 	}
 	return stmt;
@@ -334,6 +479,8 @@ typedef struct {
 	enumerator_t public;
 	/** associated MySQL statement */
 	MYSQL_STMT *stmt;
+	/** statement cache entry the statement belongs to, if any */
+	stmt_cache_t *cache;
 	/** result bindings */
 	MYSQL_BIND *bind;
 	/** pooled connection handle */
@@ -372,7 +519,7 @@ static void mysql_enumerator_destroy(mysql_enumerator_t *this)
 				break;
 		}
 	}
-	mysql_stmt_close(this->stmt);
+	release(this->stmt, this->cache);
 	conn_release(this->conn);
 	free(this->bind);
 	free(this->val.p_void);
@@ -480,6 +627,7 @@ METHOD(database_t, query, enumerator_t*,
 	private_mysql_database_t *this, char *sql, ...)
 {
 	MYSQL_STMT *stmt;
+	stmt_cache_t *cache;
 	va_list args;
 	mysql_enumerator_t *enumerator = NULL;
 	conn_t *conn;
@@ -491,7 +639,7 @@ METHOD(database_t, query, enumerator_t*,
 	}
 
 	va_start(args, sql);
-	stmt = run(conn->mysql, sql, &args);
+	stmt = run(conn, sql, &args, &cache);
 	if (stmt)
 	{
 		int columns, i;
@@ -500,6 +648,7 @@ METHOD(database_t, query, enumerator_t*,
 		enumerator->public.enumerate = (void*)mysql_enumerator_enumerate;
 		enumerator->public.destroy = (void*)mysql_enumerator_destroy;
 		enumerator->stmt = stmt;
+		enumerator->cache = cache;
 		enumerator->conn = conn;
 		columns = mysql_stmt_field_count(stmt);
 		enumerator->bind = calloc(columns, sizeof(MYSQL_BIND));
@@ -554,6 +703,14 @@ METHOD(database_t, query, enumerator_t*,
 			mysql_enumerator_destroy(enumerator);
 			enumerator = NULL;
 		}
+		else if (conn->transaction && mysql_stmt_store_result(stmt))
+		{	/* the connection of a transaction is used for all statements of
+			 * the thread, buffer the result to allow nested statements */
+			DBG1(DBG_LIB, "storing MySQL result failed: %s",
+				 mysql_stmt_error(stmt));
+			mysql_enumerator_destroy(enumerator);
+			enumerator = NULL;
+		}
 	}
 	else
 	{
@@ -567,6 +724,7 @@ METHOD(database_t, execute, int,
 	private_mysql_database_t *this, int *rowid, char *sql, ...)
 {
 	MYSQL_STMT *stmt;
+	stmt_cache_t *cache;
 	va_list args;
 	conn_t *conn;
 	int affected = -1;
@@ -577,7 +735,7 @@ METHOD(database_t, execute, int,
 		return -1;
 	}
 	va_start(args, sql);
-	stmt = run(conn->mysql, sql, &args);
+	stmt = run(conn, sql, &args, &cache);
 	if (stmt)
 	{
 		if (rowid)
@@ -585,13 +743,85 @@ METHOD(database_t, execute, int,
 			*rowid = mysql_stmt_insert_id(stmt);
 		}
 		affected = mysql_stmt_affected_rows(stmt);
-		mysql_stmt_close(stmt);
+		release(stmt, cache);
 	}
 	va_end(args);
 	conn_release(conn);
 	return affected;
 }
 
+METHOD(database_t, transaction, bool,
+	private_mysql_database_t *this)
+{
+	conn_t *conn;
+
+	if (this->transaction->get(this->transaction))
+	{
+		DBG1(DBG_LIB, "nested MySQL transactions are not supported");
+		return FALSE;
+	}
+	conn = conn_get(this);
+	if (!conn)
+	{
+		return FALSE;
+	}
+	if (mysql_query(conn->mysql, "START TRANSACTION"))
+	{
+		DBG1(DBG_LIB, "starting MySQL transaction failed: %s",
+			 mysql_error(conn->mysql));
+		conn_release(conn);
+		return FALSE;
+	}
+	conn->transaction = TRUE;
+	this->transaction->set(this->transaction, conn);
+	return TRUE;
+}
+
+/**
+ * Finish the transaction of the calling thread, release its connection
+ */
+static bool finalize_transaction(private_mysql_database_t *this, bool commit)
+{
+	conn_t *conn;
+	bool success;
+
+	conn = this->transaction->get(this->transaction);
+	if (!conn)
+	{
+		DBG1(DBG_LIB, "no MySQL transaction to finish");
+		return FALSE;
+	}
+	if (commit)
+	{
+		success = mysql_commit(conn->mysql) == 0;
+	}
+	else
+	{
+		success = mysql_rollback(conn->mysql) == 0;
+	}
+	if (!success)
+	{
+		DBG1(DBG_LIB, "%s MySQL transaction failed: %s",
+			 commit ? "committing" : "rolling back", mysql_error(conn->mysql));
+	}
+	this->transaction->set(this->transaction, NULL);
+	conn->transaction = FALSE;
+	conn_release(conn);
+	return success;
+}
+
+METHOD(database_t, commit, bool,
+	private_mysql_database_t *this)
+{
+	return finalize_transaction(this, TRUE);
+}
+
+METHOD(database_t, rollback, bool,
+	private_mysql_database_t *this)
+{
+	return finalize_transaction(this, FALSE);
+}
+
 METHOD(database_t, get_driver,db_driver_t,
 	private_mysql_database_t *this)
 {
@@ -601,6 +831,7 @@ METHOD(database_t, get_driver,db_driver_t,
 METHOD(database_t, destroy, void,
 	private_mysql_database_t *this)
 {
+	this->transaction->destroy(this->transaction);
 	this->pool->destroy_function(this->pool, (void*)conn_destroy);
 	this->mutex->destroy(this->mutex);
 	free(this->host);
@@ -676,6 +907,9 @@ mysql_database_t *mysql_database_create(char *uri)
 			.db = {
 				.query = _query,
 				.execute = _execute,
+				.transaction = _transaction,
+				.commit = _commit,
+				.rollback = _rollback,
 				.get_driver = _get_driver,
 				.destroy = _destroy,
 			},
@@ -689,6 +923,7 @@ mysql_database_t *mysql_database_create(char *uri)
 	}
 	this->mutex = mutex_create(MUTEX_TYPE_DEFAULT);
 	this->pool = linked_list_create();
+	this->transaction = thread_value_create(NULL);
 
 	/* check connectivity */
 	conn = conn_get(this);
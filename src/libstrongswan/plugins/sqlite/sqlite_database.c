@@ -20,6 +20,8 @@
 #include <library.h>
 #include <utils/debug.h>
 #include <threading/mutex.h>
+#include <collections/hashtable.h>
+#include <collections/linked_list.h>
 
 typedef struct private_sqlite_database_t private_sqlite_database_t;
 
@@ -39,25 +41,137 @@ struct private_sqlite_database_t {
 	sqlite3 *db;
 
 	/**
-	 * mutex used to lock execute()
+	 * mutex used to lock execute(), held during transactions
 	 */
 	mutex_t *mutex;
+
+	/**
+	 * prepared statements for reuse, SQL string => stmt_cache_t
+	 */
+	hashtable_t *stmts;
+
+	/**
+	 * mutex to lock the statement cache
+	 */
+	mutex_t *stmt_mutex;
 };
 
 /**
- * Create and run a sqlite stmt using a sql string and args
+ * Prepared statements of a specific SQL string
  */
-static sqlite3_stmt* run(private_sqlite_database_t *this, char *sql,
-						 va_list *args)
+typedef struct {
+
+	/**
+	 * SQL string the statements have been prepared for, key in hashtable
+	 */
+	char *sql;
+
+	/**
+	 * idle prepared statements, as sqlite3_stmt
+	 */
+	linked_list_t *idle;
+
+} stmt_cache_t;
+
+/**
+ * Destroy a statement cache entry, finalizing all idle statements
+ */
+static void stmt_cache_destroy(stmt_cache_t *this)
+{
+	this->idle->destroy_function(this->idle, (void*)sqlite3_finalize);
+	free(this->sql);
+	free(this);
+}
+
+/**
+ * Hashtable hash function
+ */
+static u_int stmt_hash(char *key)
+{
+	return chunk_hash(chunk_create(key, strlen(key)));
+}
+
+/**
+ * Hashtable equals function
+ */
+static bool stmt_equals(char *a, char *b)
+{
+	return streq(a, b);
+}
+
+/**
+ * Get an idle prepared statement for the given SQL string, or prepare one.
+ *
+ * Statements are cached only if sqlite3_prepare_v2() is available, as these
+ * get transparently recompiled if the schema changes.
+ */
+static sqlite3_stmt* prepare(private_sqlite_database_t *this, char *sql,
+							 stmt_cache_t **cache)
 {
 	sqlite3_stmt *stmt = NULL;
-	int params, i, res = SQLITE_OK;
 
 #ifdef HAVE_SQLITE3_PREPARE_V2
+	this->stmt_mutex->lock(this->stmt_mutex);
+	*cache = this->stmts->get(this->stmts, sql);
+	if (!*cache)
+	{
+		INIT(*cache,
+			.sql = strdup(sql),
+			.idle = linked_list_create(),
+		);
+		this->stmts->put(this->stmts, (*cache)->sql, *cache);
+	}
+	if ((*cache)->idle->remove_first((*cache)->idle, (void**)&stmt) == SUCCESS)
+	{
+		this->stmt_mutex->unlock(this->stmt_mutex);
+		return stmt;
+	}
+	this->stmt_mutex->unlock(this->stmt_mutex);
 	if (sqlite3_prepare_v2(this->db, sql, -1, &stmt, NULL) == SQLITE_OK)
 #else
+	*cache = NULL;
 	if (sqlite3_prepare(this->db, sql, -1, &stmt, NULL) == SQLITE_OK)
 #endif
+	{
+		return stmt;
+	}
+	DBG1(DBG_LIB, "preparing sqlite statement failed: %s",
+		 sqlite3_errmsg(this->db));
+	sqlite3_finalize(stmt);
+	return NULL;
+}
+
+/**
+ * Return a statement to the cache, or finalize it if not cacheable
+ */
+static void release(private_sqlite_database_t *this, sqlite3_stmt *stmt,
+					stmt_cache_t *cache)
+{
+	if (cache)
+	{
+		sqlite3_reset(stmt);
+		sqlite3_clear_bindings(stmt);
+		this->stmt_mutex->lock(this->stmt_mutex);
+		cache->idle->insert_last(cache->idle, stmt);
+		this->stmt_mutex->unlock(this->stmt_mutex);
+	}
+	else
+	{
+		sqlite3_finalize(stmt);
+	}
+}
+
+/**
+ * Create and run a sqlite stmt using a sql string and args
+ */
+static sqlite3_stmt* run(private_sqlite_database_t *this, char *sql,
+						 va_list *args, stmt_cache_t **cache)
+{
+	sqlite3_stmt *stmt;
+	int params, i, res = SQLITE_OK;
+
+	stmt = prepare(this, sql, cache);
+	if (stmt)
 	{
 		params = sqlite3_bind_parameter_count(stmt);
 		for (i = 1; i <= params; i++)
@@ -108,11 +222,6 @@ static sqlite3_stmt* run(private_sqlite_database_t *this, char *sql,
 			}
 		}
 	}
-	else
-	{
-		DBG1(DBG_LIB, "preparing sqlite statement failed: %s",
-			 sqlite3_errmsg(this->db));
-	}
 	if (res != SQLITE_OK)
 	{
 		DBG1(DBG_LIB, "binding sqlite statement failed: %s",
@@ -128,6 +237,8 @@ typedef struct {
 	enumerator_t public;
 	/** associated sqlite statement */
 	sqlite3_stmt *stmt;
+	/** statement cache entry the statement belongs to, if any */
+	stmt_cache_t *cache;
 	/** number of result columns */
 	int count;
 	/** column types */
@@ -141,7 +252,7 @@ typedef struct {
  */
 static void sqlite_enumerator_destroy(sqlite_enumerator_t *this)
 {
-	sqlite3_finalize(this->stmt);
+	release(this->database, this->stmt, this->cache);
 #if SQLITE_VERSION_NUMBER < 3005000
 	this->database->mutex->unlock(this->database->mutex);
 #endif
@@ -218,6 +329,7 @@ METHOD(database_t, query, enumerator_t*,
 	private_sqlite_database_t *this, char *sql, ...)
 {
 	sqlite3_stmt *stmt;
+	stmt_cache_t *cache;
 	va_list args;
 	sqlite_enumerator_t *enumerator = NULL;
 	int i;
@@ -228,13 +340,14 @@ METHOD(database_t, query, enumerator_t*,
 #endif
 
 	va_start(args, sql);
-	stmt = run(this, sql, &args);
+	stmt = run(this, sql, &args, &cache);
 	if (stmt)
 	{
 		enumerator = malloc_thing(sqlite_enumerator_t);
 		enumerator->public.enumerate = (void*)sqlite_enumerator_enumerate;
 		enumerator->public.destroy = (void*)sqlite_enumerator_destroy;
 		enumerator->stmt = stmt;
+		enumerator->cache = cache;
 		enumerator->count = sqlite3_column_count(stmt);
 		enumerator->columns = malloc(sizeof(db_type_t) * enumerator->count);
 		enumerator->database = this;
@@ -251,13 +364,14 @@ METHOD(database_t, execute, int,
 	private_sqlite_database_t *this, int *rowid, char *sql, ...)
 {
 	sqlite3_stmt *stmt;
+	stmt_cache_t *cache;
 	int affected = -1;
 	va_list args;
 
 	/* we need a lock to get our rowid/changes correctly */
 	this->mutex->lock(this->mutex);
 	va_start(args, sql);
-	stmt = run(this, sql, &args);
+	stmt = run(this, sql, &args, &cache);
 	va_end(args);
 	if (stmt)
 	{
@@ -274,12 +388,55 @@ METHOD(database_t, execute, int,
 			DBG1(DBG_LIB, "sqlite execute failed: %s",
 				 sqlite3_errmsg(this->db));
 		}
-		sqlite3_finalize(stmt);
+		release(this, stmt, cache);
 	}
 	this->mutex->unlock(this->mutex);
 	return affected;
 }
 
+METHOD(database_t, transaction, bool,
+	private_sqlite_database_t *this)
+{
+	/* keep other threads from executing statements on our connection, as
+	 * these would be part of the transaction */
+	this->mutex->lock(this->mutex);
+	if (execute(this, NULL, "BEGIN TRANSACTION") == -1)
+	{
+		this->mutex->unlock(this->mutex);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+ * Finish the transaction of the calling thread
+ */
+static bool finalize_transaction(private_sqlite_database_t *this, char *sql)
+{
+	bool success;
+
+	success = execute(this, NULL, sql) != -1;
+	if (!success && !sqlite3_get_autocommit(this->db))
+	{	/* a failed COMMIT (e.g. SQLITE_BUSY) leaves the transaction open,
+		 * which would make later statements of other threads part of it */
+		execute(this, NULL, "ROLLBACK TRANSACTION");
+	}
+	this->mutex->unlock(this->mutex);
+	return success;
+}
+
+METHOD(database_t, commit, bool,
+	private_sqlite_database_t *this)
+{
+	return finalize_transaction(this, "COMMIT TRANSACTION");
+}
+
+METHOD(database_t, rollback, bool,
+	private_sqlite_database_t *this)
+{
+	return finalize_transaction(this, "ROLLBACK TRANSACTION");
+}
+
 METHOD(database_t, get_driver, db_driver_t,
 	private_sqlite_database_t *this)
 {
@@ -300,6 +457,17 @@ static int busy_handler(private_sqlite_database_t *this, int count)
 METHOD(database_t, destroy, void,
 	private_sqlite_database_t *this)
 {
+	enumerator_t *enumerator;
+	stmt_cache_t *cache;
+
+	enumerator = this->stmts->create_enumerator(this->stmts);
+	while (enumerator->enumerate(enumerator, NULL, &cache))
+	{
+		stmt_cache_destroy(cache);
+	}
+	enumerator->destroy(enumerator);
+	this->stmts->destroy(this->stmts);
+	this->stmt_mutex->destroy(this->stmt_mutex);
 	if (sqlite3_close(this->db) == SQLITE_BUSY)
 	{
 		DBG1(DBG_LIB, "sqlite close failed because database is busy");
@@ -330,11 +498,17 @@ sqlite_database_t *sqlite_database_create(char *uri)
 			.db = {
 				.query = _query,
 				.execute = _execute,
+				.transaction = _transaction,
+				.commit = _commit,
+				.rollback = _rollback,
 				.get_driver = _get_driver,
 				.destroy = _destroy,
 			},
 		},
 		.mutex = mutex_create(MUTEX_TYPE_RECURSIVE),
+		.stmts = hashtable_create((hashtable_hash_t)stmt_hash,
+								  (hashtable_equals_t)stmt_equals, 8),
+		.stmt_mutex = mutex_create(MUTEX_TYPE_DEFAULT),
 	);
 
 	if (sqlite3_open(file, &this->db) != SQLITE_OK)
@@ -29,8 +29,55 @@
 #include <threading/thread_value.h>
 #include <collections/linked_list.h>
 
+/* initial size of a job ring */
+#define JOB_RING_SIZE 16
+
 typedef struct private_processor_t private_processor_t;
 
+/**
+ * Ring buffer of queued jobs of a single priority
+ */
+typedef struct {
+
+	/**
+	 * Queued jobs
+	 */
+	job_t **jobs;
+
+	/**
+	 * Size of the ring
+	 */
+	u_int size;
+
+	/**
+	 * Position of the oldest job
+	 */
+	u_int head;
+
+	/**
+	 * Number of queued jobs
+	 */
+	u_int count;
+
+} job_ring_t;
+
+/**
+ * A queue of jobs, shared by the worker threads and producers mapped to it
+ */
+typedef struct {
+
+	/**
+	 * A ring of queued jobs for each priority
+	 */
+	job_ring_t rings[JOB_PRIO_MAX];
+
+	/**
+	 * Access to the rings is locked through this mutex
+	 */
+	mutex_t *mutex;
+
+} job_queue_t;
+
 /**
  * Private data of processor_t class.
  */
@@ -54,7 +101,12 @@ struct private_processor_t {
 	/**
 	 * Number of threads currently working, for each priority
 	 */
-	u_int working_threads[JOB_PRIO_MAX];
+	refcount_t working_threads[JOB_PRIO_MAX];
+
+	/**
+	 * Number of threads waiting for job_added
+	 */
+	u_int sleeping_threads;
 
 	/**
 	 * All threads managed in the pool (including threads that have been
@@ -63,9 +115,14 @@ struct private_processor_t {
 	linked_list_t *threads;
 
 	/**
-	 * A list of queued jobs for each priority
+	 * Job queues, threads use the queue with their thread ID as index
 	 */
-	linked_list_t *jobs[JOB_PRIO_MAX];
+	job_queue_t *queues;
+
+	/**
+	 * Number of job queues
+	 */
+	u_int queue_count;
 
 	/**
 	 * Threads reserved for each priority
@@ -73,7 +130,13 @@ struct private_processor_t {
 	int prio_threads[JOB_PRIO_MAX];
 
 	/**
-	 * access to job lists is locked through this mutex
+	 * TRUE if threads are reserved for any priority
+	 */
+	bool reserved;
+
+	/**
+	 * Thread management is locked through this mutex, job selection too if
+	 * threads are reserved
 	 */
 	mutex_t *mutex;
 
@@ -113,43 +176,109 @@ typedef struct {
 	 */
 	job_priority_t priority;
 
+	/**
+	 * Index of the queue this worker prefers
+	 */
+	u_int queue;
+
+	/**
+	 * Locks access to the current job, as cancel() may use it
+	 */
+	mutex_t *mutex;
+
 } worker_thread_t;
 
 static void process_jobs(worker_thread_t *worker);
 
+/**
+ * Add a job to a ring, growing it if necessary
+ */
+static void ring_push(job_ring_t *ring, job_t *job)
+{
+	u_int tail, size;
+
+	if (ring->count == ring->size)
+	{
+		size = ring->size;
+		ring->size = max(size * 2, JOB_RING_SIZE);
+		ring->jobs = realloc(ring->jobs, ring->size * sizeof(job_t*));
+		if (ring->head)
+		{	/* move the wrapped part behind the old end of the ring */
+			memcpy(ring->jobs + size, ring->jobs, ring->head * sizeof(job_t*));
+		}
+	}
+	tail = (ring->head + ring->count) % ring->size;
+	ring->jobs[tail] = job;
+	ring->count++;
+}
+
+/**
+ * Remove the oldest job from a ring
+ */
+static job_t *ring_pop(job_ring_t *ring)
+{
+	job_t *job;
+
+	if (!ring->count)
+	{
+		return NULL;
+	}
+	job = ring->jobs[ring->head];
+	ring->head = (ring->head + 1) % ring->size;
+	ring->count--;
+	return job;
+}
+
+/**
+ * Create a worker thread, returns NULL on failure
+ */
+static worker_thread_t *worker_create(private_processor_t *this)
+{
+	worker_thread_t *worker;
+
+	INIT(worker,
+		.processor = this,
+		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
+	);
+	worker->thread = thread_create((thread_main_t)process_jobs, worker);
+	if (!worker->thread)
+	{
+		worker->mutex->destroy(worker->mutex);
+		free(worker);
+		return NULL;
+	}
+	return worker;
+}
+
 /**
  * restart a terminated thread
  */
 static void restart(worker_thread_t *worker)
 {
 	private_processor_t *this = worker->processor;
+	worker_thread_t *new_worker;
 
 	DBG2(DBG_JOB, "terminated worker thread %.2u", thread_current_id());
 
-	this->mutex->lock(this->mutex);
 	/* cleanup worker thread  */
-	this->working_threads[worker->priority]--;
+	ignore_result(ref_put(&this->working_threads[worker->priority]));
+	worker->mutex->lock(worker->mutex);
 	worker->job->status = JOB_STATUS_CANCELED;
 	worker->job->destroy(worker->job);
 	worker->job = NULL;
+	worker->mutex->unlock(worker->mutex);
 
+	this->mutex->lock(this->mutex);
 	/* respawn thread if required */
 	if (this->desired_threads >= this->total_threads)
 	{
-		worker_thread_t *new_worker;
-
-		INIT(new_worker,
-			.processor = this,
-		);
-		new_worker->thread = thread_create((thread_main_t)process_jobs,
-										   new_worker);
-		if (new_worker->thread)
+		new_worker = worker_create(this);
+		if (new_worker)
 		{
 			this->threads->insert_last(this->threads, new_worker);
 			this->mutex->unlock(this->mutex);
 			return;
 		}
-		free(new_worker);
 	}
 	this->total_threads--;
 	this->thread_terminated->signal(this->thread_terminated);
@@ -172,116 +301,266 @@ static u_int get_idle_threads_nolock(private_processor_t *this)
 }
 
 /**
- * Process queued jobs, called by the worker threads
+ * Wake up a sleeping worker thread after queueing a job
  */
-static void process_jobs(worker_thread_t *worker)
+static void wakeup_worker(private_processor_t *this)
 {
-	private_processor_t *this = worker->processor;
+	/* pairs with the barrier in wait_for_job(), so either we see the sleeping
+	 * thread or it sees our job */
+	memory_barrier();
+	if (this->sleeping_threads)
+	{
+		this->mutex->lock(this->mutex);
+		this->job_added->signal(this->job_added);
+		this->mutex->unlock(this->mutex);
+	}
+}
 
-	/* worker threads are not cancelable by default */
-	thread_cancelability(FALSE);
+/**
+ * Queue a job to the queue of the current thread
+ */
+static void enqueue(private_processor_t *this, job_t *job, job_priority_t prio)
+{
+	job_queue_t *queue;
 
-	DBG2(DBG_JOB, "started worker thread %.2u", thread_current_id());
+	queue = &this->queues[thread_current_id() % this->queue_count];
+	queue->mutex->lock(queue->mutex);
+	ring_push(&queue->rings[prio], job);
+	queue->mutex->unlock(queue->mutex);
+	wakeup_worker(this);
+}
 
-	this->mutex->lock(this->mutex);
-	while (this->desired_threads >= this->total_threads)
-	{
-		int i, reserved = 0, idle;
+/**
+ * Get the next job the worker may process, highest priority first. Jobs of
+ * the same priority are taken from the worker's own queue first, then stolen
+ * from the other queues. Locks the processor if threads are reserved, unless
+ * the caller already did.
+ */
+static bool get_job(private_processor_t *this, worker_thread_t *worker,
+					bool locked)
+{
+	job_queue_t *queue;
+	int i, reserved = 0, idle;
+	u_int q;
 
-		idle = get_idle_threads_nolock(this);
+	if (this->reserved && !locked)
+	{
+		this->mutex->lock(this->mutex);
+	}
+	idle = get_idle_threads_nolock(this);
 
-		for (i = 0; i < JOB_PRIO_MAX; i++)
+	for (i = 0; i < JOB_PRIO_MAX && !worker->job; i++)
+	{
+		if (reserved && reserved >= idle)
 		{
-			if (reserved && reserved >= idle)
-			{
-				DBG2(DBG_JOB, "delaying %N priority jobs: %d threads idle, "
-					 "but %d reserved for higher priorities",
-					 job_priority_names, i, idle, reserved);
-				break;
+			DBG2(DBG_JOB, "delaying %N priority jobs: %d threads idle, "
+				 "but %d reserved for higher priorities",
+				 job_priority_names, i, idle, reserved);
+			break;
+		}
+		if (this->working_threads[i] < this->prio_threads[i])
+		{
+			reserved += this->prio_threads[i] - this->working_threads[i];
+		}
+		for (q = 0; q < this->queue_count; q++)
+		{
+			queue = &this->queues[(worker->queue + q) % this->queue_count];
+			if (!queue->rings[i].count)
+			{	/* skip empty rings without locking them */
+				continue;
 			}
-			if (this->working_threads[i] < this->prio_threads[i])
+			queue->mutex->lock(queue->mutex);
+			worker->job = ring_pop(&queue->rings[i]);
+			queue->mutex->unlock(queue->mutex);
+			if (worker->job)
 			{
-				reserved += this->prio_threads[i] - this->working_threads[i];
+				ref_get(&this->working_threads[i]);
+				worker->priority = i;
+				break;
 			}
-			if (this->jobs[i]->remove_first(this->jobs[i],
-											(void**)&worker->job) == SUCCESS)
-			{
-				job_requeue_t requeue;
+		}
+	}
+	if (this->reserved && !locked)
+	{
+		this->mutex->unlock(this->mutex);
+	}
+	return worker->job != NULL;
+}
 
-				this->working_threads[i]++;
-				worker->job->status = JOB_STATUS_EXECUTING;
-				worker->priority = i;
-				this->mutex->unlock(this->mutex);
-				/* canceled threads are restarted to get a constant pool */
-				thread_cleanup_push((thread_cleanup_t)restart, worker);
-				while (TRUE)
-				{
-					requeue = worker->job->execute(worker->job);
-					if (requeue.type != JOB_REQUEUE_TYPE_DIRECT)
-					{
-						break;
-					}
-					else if (!worker->job->cancel)
-					{	/* only allow cancelable jobs to requeue directly */
-						requeue.type = JOB_REQUEUE_TYPE_FAIR;
-						break;
-					}
-				}
-				thread_cleanup_pop(FALSE);
-				this->mutex->lock(this->mutex);
-				this->working_threads[i]--;
-				if (worker->job->status == JOB_STATUS_CANCELED)
-				{	/* job was canceled via a custom cancel() method or did not
-					 * use JOB_REQUEUE_TYPE_DIRECT */
-					worker->job->destroy(worker->job);
+/**
+ * Unregister the calling thread if there are too many, processor is locked
+ */
+static bool terminate_nolock(private_processor_t *this)
+{
+	if (this->desired_threads < this->total_threads)
+	{
+		this->total_threads--;
+		this->thread_terminated->signal(this->thread_terminated);
+		return TRUE;
+	}
+	return FALSE;
+}
+
+/**
+ * Unregister the calling thread if there are too many
+ */
+static bool terminate(private_processor_t *this)
+{
+	bool terminated;
+
+	this->mutex->lock(this->mutex);
+	terminated = terminate_nolock(this);
+	this->mutex->unlock(this->mutex);
+	return terminated;
+}
+
+/**
+ * Wait for a job if there is none, returns FALSE if the thread terminates
+ */
+static bool wait_for_job(private_processor_t *this, worker_thread_t *worker)
+{
+	this->mutex->lock(this->mutex);
+	if (terminate_nolock(this))
+	{
+		this->mutex->unlock(this->mutex);
+		return FALSE;
+	}
+	this->sleeping_threads++;
+	/* pairs with the barrier in wakeup_worker() */
+	memory_barrier();
+	if (!get_job(this, worker, TRUE))
+	{
+		this->job_added->wait(this->job_added, this->mutex);
+	}
+	this->sleeping_threads--;
+	this->mutex->unlock(this->mutex);
+	return TRUE;
+}
+
+/**
+ * Execute the current job of a worker thread
+ */
+static void execute_job(private_processor_t *this, worker_thread_t *worker)
+{
+	job_priority_t i = worker->priority;
+	job_requeue_t requeue;
+	job_t *job;
+
+	/* canceled threads are restarted to get a constant pool */
+	thread_cleanup_push((thread_cleanup_t)restart, worker);
+	while (TRUE)
+	{
+		requeue = worker->job->execute(worker->job);
+		if (requeue.type != JOB_REQUEUE_TYPE_DIRECT)
+		{
+			break;
+		}
+		else if (!worker->job->cancel)
+		{	/* only allow cancelable jobs to requeue directly */
+			requeue.type = JOB_REQUEUE_TYPE_FAIR;
+			break;
+		}
+	}
+	thread_cleanup_pop(FALSE);
+
+	if (this->reserved)
+	{
+		this->mutex->lock(this->mutex);
+		ignore_result(ref_put(&this->working_threads[i]));
+		this->mutex->unlock(this->mutex);
+	}
+	else
+	{
+		ignore_result(ref_put(&this->working_threads[i]));
+	}
+
+	worker->mutex->lock(worker->mutex);
+	job = worker->job;
+	worker->job = NULL;
+	if (job->status == JOB_STATUS_CANCELED)
+	{	/* job was canceled via a custom cancel() method or did not
+		 * use JOB_REQUEUE_TYPE_DIRECT */
+		worker->mutex->unlock(worker->mutex);
+		job->destroy(job);
+		return;
+	}
+	worker->mutex->unlock(worker->mutex);
+
+	switch (requeue.type)
+	{
+		case JOB_REQUEUE_TYPE_NONE:
+			job->status = JOB_STATUS_DONE;
+			job->destroy(job);
+			break;
+		case JOB_REQUEUE_TYPE_FAIR:
+			job->status = JOB_STATUS_QUEUED;
+			enqueue(this, job, i);
+			break;
+		case JOB_REQUEUE_TYPE_SCHEDULE:
+			switch (requeue.schedule)
+			{
+				case JOB_SCHEDULE:
+					lib->scheduler->schedule_job(lib->scheduler, job,
+												 requeue.time.rel);
+					break;
+				case JOB_SCHEDULE_MS:
+					lib->scheduler->schedule_job_ms(lib->scheduler, job,
+													requeue.time.rel);
+					break;
+				case JOB_SCHEDULE_TV:
+					lib->scheduler->schedule_job_tv(lib->scheduler, job,
+													requeue.time.abs);
 					break;
-				}
-				switch (requeue.type)
-				{
-					case JOB_REQUEUE_TYPE_NONE:
-						worker->job->status = JOB_STATUS_DONE;
-						worker->job->destroy(worker->job);
-						break;
-					case JOB_REQUEUE_TYPE_FAIR:
-						worker->job->status = JOB_STATUS_QUEUED;
-						this->jobs[i]->insert_last(this->jobs[i],
-												   worker->job);
-						this->job_added->signal(this->job_added);
-						break;
-					case JOB_REQUEUE_TYPE_SCHEDULE:
-						/* scheduler_t does not hold its lock when queeuing jobs
-						 * so this should be safe without unlocking our mutex */
-						switch (requeue.schedule)
-						{
-							case JOB_SCHEDULE:
-								lib->scheduler->schedule_job(lib->scheduler,
-											worker->job, requeue.time.rel);
-								break;
-							case JOB_SCHEDULE_MS:
-								lib->scheduler->schedule_job_ms(lib->scheduler,
-											worker->job, requeue.time.rel);
-								break;
-							case JOB_SCHEDULE_TV:
-								lib->scheduler->schedule_job_tv(lib->scheduler,
-											worker->job, requeue.time.abs);
-								break;
-						}
-						break;
-					default:
-						break;
-				}
-				break;
 			}
+			break;
+		default:
+			break;
+	}
+}
+
+/**
+ * Process queued jobs, called by the worker threads
+ */
+static void process_jobs(worker_thread_t *worker)
+{
+	private_processor_t *this = worker->processor;
+	job_t *job;
+
+	/* worker threads are not cancelable by default */
+	thread_cancelability(FALSE);
+
+	DBG2(DBG_JOB, "started worker thread %.2u", thread_current_id());
+
+	worker->queue = thread_current_id() % this->queue_count;
+	while (TRUE)
+	{
+		if (this->desired_threads < this->total_threads && terminate(this))
+		{
+			break;
+		}
+		if (!get_job(this, worker, FALSE) && !wait_for_job(this, worker))
+		{
+			break;
 		}
 		if (!worker->job)
 		{
-			this->job_added->wait(this->job_added, this->mutex);
+			continue;
 		}
-		worker->job = NULL;
+		worker->mutex->lock(worker->mutex);
+		if (this->desired_threads < this->total_threads)
+		{	/* thread count got reduced while we picked the job, requeue it
+			 * as cancel() might already have checked this worker */
+			job = worker->job;
+			worker->job = NULL;
+			worker->mutex->unlock(worker->mutex);
+			ignore_result(ref_put(&this->working_threads[worker->priority]));
+			enqueue(this, job, worker->priority);
+			continue;
+		}
+		worker->job->status = JOB_STATUS_EXECUTING;
+		worker->mutex->unlock(worker->mutex);
+		execute_job(this, worker);
 	}
-	this->total_threads--;
-	this->thread_terminated->signal(this->thread_terminated);
-	this->mutex->unlock(this->mutex);
 }
 
 METHOD(processor_t, get_total_threads, u_int,
@@ -332,12 +611,17 @@ METHOD(processor_t, get_working_threads, u_int,
 METHOD(processor_t, get_job_load, u_int,
 	private_processor_t *this, job_priority_t prio)
 {
-	u_int load;
+	job_queue_t *queue;
+	u_int load = 0, q;
 
 	prio = sane_prio(prio);
-	this->mutex->lock(this->mutex);
-	load = this->jobs[prio]->get_count(this->jobs[prio]);
-	this->mutex->unlock(this->mutex);
+	for (q = 0; q < this->queue_count; q++)
+	{
+		queue = &this->queues[q];
+		queue->mutex->lock(queue->mutex);
+		load += queue->rings[prio].count;
+		queue->mutex->unlock(queue->mutex);
+	}
 	return load;
 }
 
@@ -349,10 +633,7 @@ METHOD(processor_t, queue_job, void,
 	prio = sane_prio(job->get_priority(job));
 	job->status = JOB_STATUS_QUEUED;
 
-	this->mutex->lock(this->mutex);
-	this->jobs[prio]->insert_last(this->jobs[prio], job);
-	this->job_added->signal(this->job_added);
-	this->mutex->unlock(this->mutex);
+	enqueue(this, job, prio);
 }
 
 METHOD(processor_t, set_threads, void,
@@ -368,19 +649,12 @@ METHOD(processor_t, set_threads, void,
 		DBG1(DBG_JOB, "spawning %d worker threads", count - this->total_threads);
 		for (i = this->total_threads; i < count; i++)
 		{
-			INIT(worker,
-				.processor = this,
-			);
-			worker->thread = thread_create((thread_main_t)process_jobs, worker);
-			if (worker->thread)
+			worker = worker_create(this);
+			if (worker)
 			{
 				this->threads->insert_last(this->threads, worker);
 				this->total_threads++;
 			}
-			else
-			{
-				free(worker);
-			}
 		}
 	}
 	else if (count < this->total_threads)
@@ -403,6 +677,7 @@ METHOD(processor_t, cancel, void,
 	enumerator = this->threads->create_enumerator(this->threads);
 	while (enumerator->enumerate(enumerator, (void**)&worker))
 	{
+		worker->mutex->lock(worker->mutex);
 		if (worker->job && worker->job->cancel)
 		{
 			worker->job->status = JOB_STATUS_CANCELED;
@@ -412,6 +687,7 @@ METHOD(processor_t, cancel, void,
 				worker->thread->cancel(worker->thread);
 			}
 		}
+		worker->mutex->unlock(worker->mutex);
 	}
 	enumerator->destroy(enumerator);
 	while (this->total_threads > 0)
@@ -423,6 +699,7 @@ METHOD(processor_t, cancel, void,
 									  (void**)&worker) == SUCCESS)
 	{
 		worker->thread->join(worker->thread);
+		worker->mutex->destroy(worker->mutex);
 		free(worker);
 	}
 	this->mutex->unlock(this->mutex);
@@ -431,16 +708,28 @@ METHOD(processor_t, cancel, void,
 METHOD(processor_t, destroy, void,
 	private_processor_t *this)
 {
-	int i;
+	job_queue_t *queue;
+	job_t *job;
+	u_int q, i;
 
 	cancel(this);
 	this->thread_terminated->destroy(this->thread_terminated);
 	this->job_added->destroy(this->job_added);
 	this->mutex->destroy(this->mutex);
-	for (i = 0; i < JOB_PRIO_MAX; i++)
+	for (q = 0; q < this->queue_count; q++)
 	{
-		this->jobs[i]->destroy_offset(this->jobs[i], offsetof(job_t, destroy));
+		queue = &this->queues[q];
+		for (i = 0; i < JOB_PRIO_MAX; i++)
+		{
+			while ((job = ring_pop(&queue->rings[i])) != NULL)
+			{
+				job->destroy(job);
+			}
+			free(queue->rings[i].jobs);
+		}
+		queue->mutex->destroy(queue->mutex);
 	}
+	free(this->queues);
 	this->threads->destroy(this->threads);
 	free(this);
 }
@@ -451,6 +740,7 @@ METHOD(processor_t, destroy, void,
 processor_t *processor_create()
 {
 	private_processor_t *this;
+	u_int q;
 	int i;
 
 	INIT(this,
@@ -468,13 +758,23 @@ processor_t *processor_create()
 		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
 		.job_added = condvar_create(CONDVAR_TYPE_DEFAULT),
 		.thread_terminated = condvar_create(CONDVAR_TYPE_DEFAULT),
+		.queue_count = max(1, lib->settings->get_int(lib->settings,
+						"libstrongswan.processor.queues", 1)),
 	);
+	this->queues = calloc(this->queue_count, sizeof(job_queue_t));
+	for (q = 0; q < this->queue_count; q++)
+	{
+		this->queues[q].mutex = mutex_create(MUTEX_TYPE_DEFAULT);
+	}
 	for (i = 0; i < JOB_PRIO_MAX; i++)
 	{
-		this->jobs[i] = linked_list_create();
 		this->prio_threads[i] = lib->settings->get_int(lib->settings,
 						"libstrongswan.processor.priority_threads.%N", 0,
 						job_priority_names, i);
+		if (this->prio_threads[i] > 0)
+		{
+			this->reserved = TRUE;
+		}
 	}
 
 	return &this->public;
@@ -32,6 +32,11 @@ typedef struct processor_t processor_t;
 
 /**
  * The processor uses threads to process queued jobs.
+ *
+ * Jobs are stored in one or more queues, see libstrongswan.processor.queues.
+ * Each thread queues to and processes the queue selected by its thread ID,
+ * idle worker threads steal jobs from other queues. Jobs are always processed
+ * by priority, honoring the threads reserved for each priority class.
  */
 struct processor_t {
 
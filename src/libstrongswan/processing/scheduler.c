@@ -25,9 +25,28 @@
 #include <threading/thread.h>
 #include <threading/condvar.h>
 #include <threading/mutex.h>
+#include <collections/hashtable.h>
 
-/* the initial size of the heap */
-#define HEAP_SIZE_DEFAULT 64
+/* number of bits used per level of the timing wheel */
+#define WHEEL_BITS 6
+
+/* number of slots per level */
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+
+/* mask to get the slot of a tick */
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+
+/* number of levels, six levels with a tick of 1 ms cover ~795 days */
+#define WHEEL_LEVELS 6
+
+/* maximum distance of an event to the current tick, in ticks */
+#define WHEEL_MAX_DELTA ((1ULL << (WHEEL_LEVELS * WHEEL_BITS)) - 1)
+
+/* the initial size of the handle table */
+#define HANDLE_TABLE_SIZE 64
+
+/* tick used if there is nothing to wait for */
+#define NO_WAKEUP (~0ULL)
 
 typedef struct event_t event_t;
 
@@ -36,14 +55,34 @@ typedef struct event_t event_t;
  */
 struct event_t {
 	/**
-	 * Time to fire the event.
+	 * Tick at which to fire the event, in ms since the scheduler base.
 	 */
-	timeval_t time;
+	u_int64_t tick;
+
+	/**
+	 * Handle to cancel the event.
+	 */
+	scheduler_handle_t handle;
 
 	/**
 	 * Every event has its assigned job.
 	 */
 	job_t *job;
+
+	/**
+	 * Next event in the same slot.
+	 */
+	event_t *next;
+
+	/**
+	 * Pointer to the pointer referencing this event in the slot.
+	 */
+	event_t **pprev;
+
+	/**
+	 * Level of the wheel the event currently is in.
+	 */
+	u_int level;
 };
 
 /**
@@ -68,14 +107,39 @@ struct private_scheduler_t {
 	 scheduler_t public;
 
 	/**
-	 * The heap in which the events are stored.
+	 * The slots of the timing wheels, each a list of event_t.
+	 */
+	event_t *wheel[WHEEL_LEVELS][WHEEL_SIZE];
+
+	/**
+	 * Number of events per level.
+	 */
+	u_int level_count[WHEEL_LEVELS];
+
+	/**
+	 * Next tick to process.
+	 */
+	u_int64_t tick;
+
+	/**
+	 * Tick the scheduler thread waits for, NO_WAKEUP if there is none.
+	 */
+	u_int64_t wakeup;
+
+	/**
+	 * Monotonic time of tick 0.
 	 */
-	event_t **heap;
+	timeval_t base;
 
 	/**
-	 * The size of the heap.
+	 * Last handle assigned to an event.
 	 */
-	u_int heap_size;
+	scheduler_handle_t handle;
+
+	/**
+	 * Scheduled events, scheduler_handle_t => event_t.
+	 */
+	hashtable_t *handles;
 
 	/**
 	 * The number of scheduled events.
@@ -94,84 +158,200 @@ struct private_scheduler_t {
 };
 
 /**
- * Comparse two timevals, return >0 if a > b, <0 if a < b and =0 if equal
+ * Hash function for handles
+ */
+static u_int hash(scheduler_handle_t *key)
+{
+	return chunk_hash(chunk_from_thing(*key));
+}
+
+/**
+ * Comparison function for handles
  */
-static int timeval_cmp(timeval_t *a, timeval_t *b)
+static bool equals(scheduler_handle_t *key, scheduler_handle_t *other_key)
 {
-	if (a->tv_sec > b->tv_sec)
+	return *key == *other_key;
+}
+
+/**
+ * Convert a monotonic time to a tick, rounded up for events to never fire early
+ */
+static u_int64_t time2tick(private_scheduler_t *this, timeval_t *tv, bool up)
+{
+	int64_t diff;
+
+	diff = (int64_t)(tv->tv_sec - this->base.tv_sec) * 1000000 +
+		   (tv->tv_usec - this->base.tv_usec);
+	if (diff <= 0)
 	{
-		return 1;
+		return 0;
+	}
+	return (diff + (up ? 999 : 0)) / 1000;
+}
+
+/**
+ * Convert a tick back to a monotonic time
+ */
+static void tick2time(private_scheduler_t *this, u_int64_t tick, timeval_t *tv)
+{
+	timeval_t add = {
+		.tv_sec = tick / 1000,
+		.tv_usec = (tick % 1000) * 1000,
+	};
+
+	timeradd(&this->base, &add, tv);
+}
+
+/**
+ * Put an event into the slot of the lowest level able to hold it
+ */
+static void link_event(private_scheduler_t *this, event_t *event)
+{
+	u_int64_t tick, delta;
+	event_t **slot;
+	u_int level = 0;
+
+	/* events that have already expired fire with the next processed tick */
+	tick = max(event->tick, this->tick);
+	delta = tick - this->tick;
+	if (delta > WHEEL_MAX_DELTA)
+	{	/* too far in the future, it gets cascaded down again later */
+		delta = WHEEL_MAX_DELTA;
+		tick = this->tick + delta;
 	}
-	if (a->tv_sec < b->tv_sec)
+	while (delta >= WHEEL_SIZE)
 	{
-		return -1;
+		delta >>= WHEEL_BITS;
+		level++;
 	}
-	if (a->tv_usec > b->tv_usec)
+	slot = &this->wheel[level][(tick >> (level * WHEEL_BITS)) & WHEEL_MASK];
+
+	event->level = level;
+	event->next = *slot;
+	if (event->next)
 	{
-		return 1;
+		event->next->pprev = &event->next;
 	}
-	if (a->tv_usec < b->tv_usec)
+	event->pprev = slot;
+	*slot = event;
+	this->level_count[level]++;
+}
+
+/**
+ * Remove an event from its slot
+ */
+static void unlink_event(private_scheduler_t *this, event_t *event)
+{
+	*event->pprev = event->next;
+	if (event->next)
 	{
-		return -1;
+		event->next->pprev = event->pprev;
 	}
-	return 0;
+	this->level_count[event->level]--;
 }
 
 /**
- * Returns the top event without removing it. Returns NULL if the heap is empty.
+ * Move all events in a slot down to the lower levels
  */
-static event_t *peek_event(private_scheduler_t *this)
+static void cascade(private_scheduler_t *this, u_int level, u_int index)
 {
-	return this->event_count > 0 ? this->heap[1] : NULL;
+	event_t *event, *next;
+
+	event = this->wheel[level][index];
+	this->wheel[level][index] = NULL;
+	while (event)
+	{
+		next = event->next;
+		this->level_count[level]--;
+		link_event(this, event);
+		event = next;
+	}
 }
 
 /**
- * Removes the top event from the heap and returns it. Returns NULL if the heap
- * is empty.
+ * Get the tick following the one just processed, skipping empty levels
  */
-static event_t *remove_event(private_scheduler_t *this)
+static u_int64_t next_tick(private_scheduler_t *this, u_int64_t now)
 {
-	event_t *event, *top;
-	if (!this->event_count)
+	u_int level, shift;
+
+	for (level = 0; level < WHEEL_LEVELS; level++)
 	{
-		return NULL;
+		if (this->level_count[level])
+		{	/* jump to the next cascade of the lowest non-empty level */
+			shift = level * WHEEL_BITS;
+			return min(((this->tick >> shift) + 1) << shift, now + 1);
+		}
 	}
+	return now + 1;
+}
 
-	/* store the value to return */
-	event = this->heap[1];
-	/* move the bottom event to the top */
-	top = this->heap[1] = this->heap[this->event_count];
+/**
+ * Process all ticks up to now, returns a list of expired events
+ */
+static event_t *expire_events(private_scheduler_t *this, u_int64_t now)
+{
+	event_t *expired = NULL, *event;
+	u_int level, index;
 
-	if (--this->event_count > 1)
+	while (this->tick <= now)
 	{
-		/* seep down the top event */
-		u_int position = 1;
-		while ((position << 1) <= this->event_count)
+		if ((this->tick & WHEEL_MASK) == 0)
 		{
-			u_int child = position << 1;
-
-			if ((child + 1) <= this->event_count &&
-				timeval_cmp(&this->heap[child + 1]->time,
-							&this->heap[child]->time) < 0)
+			for (level = 1; level < WHEEL_LEVELS; level++)
 			{
-				/* the "right" child is smaller */
-				child++;
+				index = (this->tick >> (level * WHEEL_BITS)) & WHEEL_MASK;
+				cascade(this, level, index);
+				if (index)
+				{
+					break;
+				}
 			}
+		}
+		while ((event = this->wheel[0][this->tick & WHEEL_MASK]) != NULL)
+		{
+			unlink_event(this, event);
+			this->handles->remove(this->handles, &event->handle);
+			this->event_count--;
+			event->next = expired;
+			expired = event;
+		}
+		this->tick = next_tick(this, now);
+	}
+	return expired;
+}
+
+/**
+ * Get the tick at which the wheels have to be processed next
+ */
+static u_int64_t next_wakeup(private_scheduler_t *this)
+{
+	u_int64_t wakeup = NO_WAKEUP, tick;
+	u_int level, shift, i;
 
-			if (timeval_cmp(&top->time, &this->heap[child]->time) <= 0)
+	if (this->level_count[0])
+	{
+		for (i = 0; i < WHEEL_SIZE; i++)
+		{
+			tick = this->tick + i;
+			if (this->wheel[0][tick & WHEEL_MASK])
 			{
-				/* the top event fires before the smaller of the two children,
-				 * stop */
+				wakeup = tick;
 				break;
 			}
-
-			/* swap with the smaller child */
-			this->heap[position] = this->heap[child];
-			position = child;
 		}
-		this->heap[position] = top;
 	}
-	return event;
+	for (level = 1; level < WHEEL_LEVELS; level++)
+	{
+		if (this->level_count[level])
+		{	/* the next cascade of this level, including the current tick */
+			shift = level * WHEEL_BITS;
+			tick = ((this->tick + (1ULL << shift) - 1) >> shift) << shift;
+			wakeup = min(wakeup, tick);
+			break;
+		}
+	}
+	return wakeup;
 }
 
 /**
@@ -179,26 +359,40 @@ static event_t *remove_event(private_scheduler_t *this)
  */
 static job_requeue_t schedule(private_scheduler_t * this)
 {
-	timeval_t now;
-	event_t *event;
-	bool timed = FALSE, oldstate;
+	timeval_t now, next;
+	event_t *event, *expired;
+	bool oldstate;
 
 	this->mutex->lock(this->mutex);
 
 	time_monotonic(&now);
-
-	if ((event = peek_event(this)) != NULL)
+	expired = expire_events(this, time2tick(this, &now, FALSE));
+	if (expired)
 	{
-		if (timeval_cmp(&now, &event->time) >= 0)
+		this->mutex->unlock(this->mutex);
+		while (expired)
 		{
-			remove_event(this);
-			this->mutex->unlock(this->mutex);
+			event = expired;
+			expired = event->next;
 			DBG2(DBG_JOB, "got event, queuing job for execution");
 			lib->processor->queue_job(lib->processor, event->job);
 			free(event);
-			return JOB_REQUEUE_DIRECT;
 		}
-		timersub(&event->time, &now, &now);
+		return JOB_REQUEUE_DIRECT;
+	}
+
+	this->wakeup = next_wakeup(this);
+	if (this->wakeup != NO_WAKEUP)
+	{
+		tick2time(this, this->wakeup, &next);
+		if (timercmp(&next, &now, >))
+		{
+			timersub(&next, &now, &now);
+		}
+		else
+		{
+			timerclear(&now);
+		}
 		if (now.tv_sec)
 		{
 			DBG2(DBG_JOB, "next event in %ds %dms, waiting",
@@ -208,14 +402,13 @@ static job_requeue_t schedule(private_scheduler_t * this)
 		{
 			DBG2(DBG_JOB, "next event in %dms, waiting", now.tv_usec/1000);
 		}
-		timed = TRUE;
 	}
 	thread_cleanup_push((thread_cleanup_t)this->mutex->unlock, this->mutex);
 	oldstate = thread_cancelability(TRUE);
 
-	if (timed)
+	if (this->wakeup != NO_WAKEUP)
 	{
-		this->condvar->timed_wait_abs(this->condvar, this->mutex, event->time);
+		this->condvar->timed_wait_abs(this->condvar, this->mutex, next);
 	}
 	else
 	{
@@ -237,45 +430,63 @@ METHOD(scheduler_t, get_job_load, u_int,
 	return count;
 }
 
-METHOD(scheduler_t, schedule_job_tv, void,
+METHOD(scheduler_t, schedule_job_tv, scheduler_handle_t,
 	private_scheduler_t *this, job_t *job, timeval_t tv)
 {
+	scheduler_handle_t handle;
 	event_t *event;
-	u_int position;
 
-	event = malloc_thing(event_t);
-	event->job = job;
+	INIT(event,
+		.job = job,
+		.tick = time2tick(this, &tv, TRUE),
+	);
 	event->job->status = JOB_STATUS_QUEUED;
-	event->time = tv;
 
 	this->mutex->lock(this->mutex);
 
+	handle = event->handle = ++this->handle;
+	this->handles->put(this->handles, &event->handle, event);
+	link_event(this, event);
 	this->event_count++;
-	if (this->event_count > this->heap_size)
-	{
-		/* double the size of the heap */
-		this->heap_size <<= 1;
-		this->heap = (event_t**)realloc(this->heap,
-									(this->heap_size + 1) * sizeof(event_t*));
+
+	if (event->tick < this->wakeup)
+	{	/* fires before the scheduler thread would wake up */
+		this->wakeup = event->tick;
+		this->condvar->signal(this->condvar);
 	}
-	/* "put" the event to the bottom */
-	position = this->event_count;
+	this->mutex->unlock(this->mutex);
+
+	return handle;
+}
+
+METHOD(scheduler_t, cancel, bool,
+	private_scheduler_t *this, scheduler_handle_t handle)
+{
+	event_t *event;
 
-	/* then bubble it up */
-	while (position > 1 && timeval_cmp(&this->heap[position >> 1]->time,
-									   &event->time) > 0)
+	if (!handle)
 	{
-		/* parent has to be fired after the new event, move up */
-		this->heap[position] = this->heap[position >> 1];
-		position >>= 1;
+		return FALSE;
+	}
+	this->mutex->lock(this->mutex);
+	event = this->handles->remove(this->handles, &handle);
+	if (event)
+	{
+		unlink_event(this, event);
+		this->event_count--;
 	}
-	this->heap[position] = event;
-
-	this->condvar->signal(this->condvar);
 	this->mutex->unlock(this->mutex);
+
+	if (event)
+	{
+		DBG2(DBG_JOB, "cancelled scheduled job");
+		event_destroy(event);
+		return TRUE;
+	}
+	return FALSE;
 }
 
-METHOD(scheduler_t, schedule_job, void,
+METHOD(scheduler_t, schedule_job, scheduler_handle_t,
 	private_scheduler_t *this, job_t *job, u_int32_t s)
 {
 	timeval_t tv;
@@ -283,10 +494,10 @@ METHOD(scheduler_t, schedule_job, void,
 	time_monotonic(&tv);
 	tv.tv_sec += s;
 
-	schedule_job_tv(this, job, tv);
+	return schedule_job_tv(this, job, tv);
 }
 
-METHOD(scheduler_t, schedule_job_ms, void,
+METHOD(scheduler_t, schedule_job_ms, scheduler_handle_t,
 	private_scheduler_t *this, job_t *job, u_int32_t ms)
 {
 	timeval_t tv, add;
@@ -297,20 +508,29 @@ METHOD(scheduler_t, schedule_job_ms, void,
 
 	timeradd(&tv, &add, &tv);
 
-	schedule_job_tv(this, job, tv);
+	return schedule_job_tv(this, job, tv);
 }
 
 METHOD(scheduler_t, destroy, void,
 	private_scheduler_t *this)
 {
 	event_t *event;
+	u_int level, index;
+
 	this->condvar->destroy(this->condvar);
 	this->mutex->destroy(this->mutex);
-	while ((event = remove_event(this)) != NULL)
+	for (level = 0; level < WHEEL_LEVELS; level++)
 	{
-		event_destroy(event);
+		for (index = 0; index < WHEEL_SIZE; index++)
+		{
+			while ((event = this->wheel[level][index]) != NULL)
+			{
+				this->wheel[level][index] = event->next;
+				event_destroy(event);
+			}
+		}
 	}
-	free(this->heap);
+	this->handles->destroy(this->handles);
 	free(this);
 }
 
@@ -328,14 +548,17 @@ scheduler_t * scheduler_create()
 			.schedule_job = _schedule_job,
 			.schedule_job_ms = _schedule_job_ms,
 			.schedule_job_tv = _schedule_job_tv,
+			.cancel = _cancel,
 			.destroy = _destroy,
 		},
-		.heap_size = HEAP_SIZE_DEFAULT,
+		.handles = hashtable_create((hashtable_hash_t)hash,
+									(hashtable_equals_t)equals,
+									HANDLE_TABLE_SIZE),
 		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
 		.condvar = condvar_create(CONDVAR_TYPE_DEFAULT),
 	);
 
-	this->heap = (event_t**)calloc(this->heap_size + 1, sizeof(event_t*));
+	time_monotonic(&this->base);
 
 	job = callback_job_create_with_prio((callback_job_cb_t)schedule, this,
 										NULL, return_false, JOB_PRIO_CRITICAL);
@@ -29,54 +29,44 @@ typedef struct scheduler_t scheduler_t;
 #include <processing/jobs/job.h>
 
 /**
- * The scheduler queues timed events which are then passed to the processor.
- *
- * The scheduler is implemented as a heap. A heap is a special kind of tree-
- * based data structure that satisfies the following property: if B is a child
- * node of A, then key(A) >= (or <=) key(B). So either the element with the
- * greatest (max-heap) or the smallest (min-heap) key is the root of the heap.
- * We use a min-heap with the key being the absolute unix time at which an
- * event is scheduled. So the root is always the event that will fire next.
+ * Handle to a scheduled job, allows to cancel it before it fires.
  *
- * An earlier implementation of the scheduler used a sorted linked list to store
- * the events. That had the advantage that removing the next event was extremely
- * fast, also, adding an event scheduled before or after all other events was
- * equally fast (all in O(1)). The problem was, though, that adding an event
- * in-between got slower, as the number of events grew larger (O(n)).
- * For each connection there could be several events: IKE-rekey, NAT-keepalive,
- * retransmissions, expire (half-open), and others. So a gateway that probably
- * has to handle thousands of concurrent connnections has to be able to queue a
- * large number of events as fast as possible. Locking makes this even worse, to
- * provide thread-safety, no events can be processed, while an event is queued,
- * so making the insertion fast is even more important.
+ * Handles are never reused, a handle of 0 is never returned.
+ */
+typedef u_int64_t scheduler_handle_t;
+
+/**
+ * The scheduler queues timed events which are then passed to the processor.
  *
- * That's the advantage of the heap. Adding an element to the heap can be
- * achieved in O(log n) - on the other hand, removing the root node also
- * requires O(log n) operations. Consider 10000 queued events. Inserting a new
- * event in the list implementation required up to 10000 comparisons. In the
- * heap implementation, the worst case is about 13.3 comparisons. That's a
- * drastic improvement.
+ * The scheduler is implemented as a hierarchical timing wheel. A timing wheel
+ * is a circular array of slots, each slot containing a list of the events
+ * that fire at a specific tick. The scheduler uses a tick of one millisecond
+ * and the slot of an event is simply its tick modulo the size of the wheel.
+ * Adding an event is therefore a matter of appending it to a list, which
+ * works in O(1), regardless of the number of queued events.
  *
- * The implementation itself uses a binary tree mapped to a one-based array to
- * store the elements. This reduces storage overhead and simplifies navigation:
- * the children of the node at position n are at position 2n and 2n+1 (likewise
- * the parent node of the node at position n is at position [n/2]). Thus,
- * navigating up and down the tree is reduced to simple index computations.
+ * A single wheel covering the lifetime of an IKE_SA would be huge, so several
+ * wheels are stacked. Each wheel has 64 slots, the first one with a
+ * resolution of one tick, each following one with a resolution of 64 times
+ * the previous one. Six levels cover more than two years, events scheduled
+ * even further in the future are put into the last slot of the highest level.
+ * An event is placed into the lowest level that can hold it. Whenever a wheel
+ * completes a revolution, the next slot of the level above is "cascaded": its
+ * events are moved down to the lower levels. Each event moves at most once
+ * per level, so the amortized cost stays constant.
  *
- * Adding an element to the heap works as follows: The heap is always filled
- * from left to right, until a row is full, then the next row is filled. Mapped
- * to an array this gets as simple as putting the new element to the first free
- * position. In a one-based array that position equals the number of elements
- * currently stored in the heap. Then the heap property has to be restored, i.e.
- * the new element has to be "bubbled up" the tree until the parent node's key
- * is smaller or the element got the new root of the tree.
+ * An earlier implementation used a binary heap with O(log n) insertion and
+ * removal. Each connection has several events queued: IKE rekeying,
+ * reauthentication, NAT keepalives, DPD, retransmissions and inactivity
+ * checks. As there was no way to remove an event before it fired, a gateway
+ * with thousands of connections accumulated large numbers of obsolete events.
+ * Each job now gets a handle, which allows the owner to cancel it in O(1)
+ * when it gets superseded or the associated IKE_SA goes away.
  *
- * Removing the next event from the heap works similarly. The event itself is
- * the root node and stored at position 1 of the array. After removing it, the
- * root has to be replaced and the heap property has to be restored. This is
- * done by moving the bottom element (last row, rightmost element) to the root
- * and then "seep it down" by swapping it with child nodes until none of the
- * children has a smaller key or it is again a leaf node.
+ * The scheduler thread sleeps until the next non-empty slot of the lowest
+ * level, or until the next cascade of a non-empty level above. It only gets
+ * woken up by newly queued events if they fire before that time. Empty
+ * stretches of the wheels are skipped when catching up after sleeping.
  */
 struct scheduler_t {
 
@@ -85,16 +75,20 @@ struct scheduler_t {
 	 *
 	 * @param job			job to schedule
 	 * @param time			relative time to schedule job, in s
+	 * @return				handle to cancel the job
 	 */
-	void (*schedule_job) (scheduler_t *this, job_t *job, u_int32_t s);
+	scheduler_handle_t (*schedule_job) (scheduler_t *this, job_t *job,
+										u_int32_t s);
 
 	/**
 	 * Adds a event to the queue, using a relative time offset in ms.
 	 *
 	 * @param job			job to schedule
 	 * @param time			relative time to schedule job, in ms
+	 * @return				handle to cancel the job
 	 */
-	void (*schedule_job_ms) (scheduler_t *this, job_t *job, u_int32_t ms);
+	scheduler_handle_t (*schedule_job_ms) (scheduler_t *this, job_t *job,
+										   u_int32_t ms);
 
 	/**
 	 * Adds a event to the queue, using an absolut time.
@@ -104,8 +98,22 @@ struct scheduler_t {
 	 *
 	 * @param job			job to schedule
 	 * @param time			absolut time to schedule job
+	 * @return				handle to cancel the job
+	 */
+	scheduler_handle_t (*schedule_job_tv) (scheduler_t *this, job_t *job,
+										   timeval_t tv);
+
+	/**
+	 * Cancel a scheduled job before it fires.
+	 *
+	 * A cancelled job gets destroyed. Cancelling a job that has already been
+	 * passed to the processor has no effect, so it is safe to pass handles of
+	 * jobs that might have fired in the mean time.
+	 *
+	 * @param handle		handle returned when scheduling the job, or 0
+	 * @return				TRUE if job cancelled, FALSE if not found
 	 */
-	void (*schedule_job_tv) (scheduler_t *this, job_t *job, timeval_t tv);
+	bool (*cancel) (scheduler_t *this, scheduler_handle_t handle);
 
 	/**
 	 * Returns number of jobs scheduled.
@@ -226,6 +226,17 @@ struct identification_t {
 	 */
 	bool (*equals) (identification_t *this, identification_t *other);
 
+	/**
+	 * Hash this identification, consistent with equals().
+	 *
+	 * IDs considered equal by equals() return the same hash, even if their
+	 * encoding differs in case or string types.
+	 *
+	 * @param inc		hash to include, 0 for none
+	 * @return			hash value
+	 */
+	u_int (*hash) (identification_t *this, u_int inc);
+
 	/**
 	 * Check if an ID matches a wildcard ID.
 	 *
@@ -515,6 +515,20 @@ bool cas_##name(type *ptr, type oldval, type newval) \
 _cas_impl(bool, bool)
 _cas_impl(ptr, void*)
 
+/**
+ * Mutex used to enforce memory barriers.
+ */
+static pthread_mutex_t barrier_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Full memory barrier, acquiring and releasing a mutex implies one
+ */
+void memory_barrier()
+{
+	pthread_mutex_lock(&barrier_mutex);
+	pthread_mutex_unlock(&barrier_mutex);
+}
+
 #endif /* HAVE_GCC_ATOMIC_OPERATIONS */
 
 /**
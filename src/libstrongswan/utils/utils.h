@@ -674,6 +674,8 @@ typedef volatile u_int refcount_t;
 #define cas_ptr(ptr, oldval, newval) \
 					(__sync_bool_compare_and_swap(ptr, oldval, newval))
 
+#define memory_barrier() { __sync_synchronize(); }
+
 #else /* !HAVE_GCC_ATOMIC_OPERATIONS */
 
 /**
@@ -716,6 +718,13 @@ bool cas_bool(bool *ptr, bool oldval, bool newval);
  */
 bool cas_ptr(void **ptr, void *oldval, void *newval);
 
+/**
+ * Issue a full memory barrier.
+ *
+ * Neither the compiler nor the CPU reorder loads and stores across it.
+ */
+void memory_barrier();
+
 #endif /* HAVE_GCC_ATOMIC_OPERATIONS */
 
 /**